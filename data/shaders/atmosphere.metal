@@ -0,0 +1,225 @@
+#define METAL
+#include <metal_stdlib>
+using namespace metal;
+
+#include "shaderTypes.hpp"
+#include "shaderCommon.hpp"
+#include "atmosphereCommon.hpp"
+#if VOLUMETRIC_LIGHTING
+#include "lightingCommon.hpp"
+#endif
+
+constant uint TransmittanceSteps        = 40;
+constant uint MultiScatteringSteps      = 20;
+constant uint MultiScatteringDirections = 64;   // Must match the threadgroup width used by Atmosphere
+constant uint SkyViewSteps              = 30;
+
+// Zero where the planet hides the sun from this position
+static inline float planetShadow(float3 position, float3 sunDirection, constant AtmosphereParams& params) {
+    return raySphereIntersectNearest(position, sunDirection, params.bottomRadius) >= 0.0f ? 0.0f : 1.0f;
+}
+
+#pragma mark Transmittance LUT
+
+kernel void transmittanceLUTKernel(texture2d<float, access::write>  output  [[texture(TextureIndexTransmittanceLUT)]],
+                          constant AtmosphereParams&                params  [[buffer(BufferIndexAtmosphere)]],
+                                   uint2                            gid     [[thread_position_in_grid]]) {
+    if (gid.x >= output.get_width() || gid.y >= output.get_height()) return;
+
+    float2 uv = (float2(gid) + 0.5f) / float2(output.get_width(), output.get_height());
+    float radius, cosZenith;
+    transmittanceLUTParams(uv, params, radius, cosZenith);
+
+    float3 origin = float3(0.0f, radius, 0.0f);
+    float3 direction = float3(sqrt(max(1.0f - cosZenith * cosZenith, 0.0f)), cosZenith, 0.0f);
+    float distance = raySphereIntersectNearest(origin, direction, params.topRadius);
+
+    float3 opticalDepth = 0.0f;
+    float dt = distance / float(TransmittanceSteps);
+    for (uint i = 0; i < TransmittanceSteps; i++) {
+        float3 position = origin + direction * ((float(i) + 0.5f) * dt);
+        AtmosphereMedium medium = sampleAtmosphereMedium(length(position) - params.bottomRadius, params);
+        opticalDepth += medium.extinction * dt;
+    }
+
+    output.write(float4(exp(-opticalDepth), 1.0f), gid);
+}
+
+#pragma mark Multiple scattering LUT
+
+// One threadgroup per texel, every thread integrates second order scattering along one
+// direction of the sphere and the results are combined as the geometric series L2 / (1 - f_ms)
+kernel void multiScatteringLUTKernel(texture2d<float>                   transmittanceLUT    [[texture(TextureIndexTransmittanceLUT)]],
+                                     texture2d<float, access::write>    output              [[texture(TextureIndexMultiScatteringLUT)]],
+                            constant AtmosphereParams&                  params              [[buffer(BufferIndexAtmosphere)]],
+                                     uint2                              groupId             [[threadgroup_position_in_grid]],
+                                     uint                               threadIndex         [[thread_index_in_threadgroup]]) {
+    threadgroup float3 luminanceShared[MultiScatteringDirections];
+    threadgroup float3 transferShared[MultiScatteringDirections];
+
+    float2 uv = (float2(groupId) + 0.5f) / float2(output.get_width(), output.get_height());
+    float cosSunZenith = uv.x * 2.0f - 1.0f;
+    float radius = mix(params.bottomRadius + 0.01f, params.topRadius - 0.01f, uv.y);
+
+    float3 origin = float3(0.0f, radius, 0.0f);
+    float3 sunDirection = float3(sqrt(saturate(1.0f - cosSunZenith * cosSunZenith)), cosSunZenith, 0.0f);
+
+    // Uniform 8x8 grid over the sphere
+    float cosTheta = 1.0f - 2.0f * (float(threadIndex / 8) + 0.5f) / 8.0f;
+    float sinTheta = sqrt(saturate(1.0f - cosTheta * cosTheta));
+    float phi = 2.0f * AtmospherePI * (float(threadIndex % 8) + 0.5f) / 8.0f;
+    float3 direction = float3(sinTheta * cos(phi), cosTheta, sinTheta * sin(phi));
+
+    float groundDistance = raySphereIntersectNearest(origin, direction, params.bottomRadius);
+    float distance = groundDistance >= 0.0f ? groundDistance : raySphereIntersectNearest(origin, direction, params.topRadius);
+    float dt = max(distance, 0.0f) / float(MultiScatteringSteps);
+
+    const float isotropicPhase = 1.0f / (4.0f * AtmospherePI);
+    float3 luminance = 0.0f;
+    float3 transfer = 0.0f;
+    float3 throughput = 1.0f;
+
+    for (uint i = 0; i < MultiScatteringSteps; i++) {
+        float3 position = origin + direction * ((float(i) + 0.5f) * dt);
+        float height = length(position);
+        AtmosphereMedium medium = sampleAtmosphereMedium(height - params.bottomRadius, params);
+        float3 extinction = max(medium.extinction, 1e-6f);
+        float3 sampleTransmittance = exp(-extinction * dt);
+
+        float3 sunTransmittance = sampleTransmittanceLUT(transmittanceLUT, height, dot(sunDirection, position / height), params);
+        float3 inScattering = medium.scattering * isotropicPhase * sunTransmittance * planetShadow(position, sunDirection, params);
+
+        // Analytic integration over the step assuming constant medium
+        luminance += throughput * (inScattering - inScattering * sampleTransmittance) / extinction;
+        transfer += throughput * (medium.scattering - medium.scattering * sampleTransmittance) / extinction;
+        throughput *= sampleTransmittance;
+    }
+
+    if (groundDistance >= 0.0f) {
+        float3 position = origin + direction * groundDistance;
+        float3 normal = normalize(position);
+        float3 sunTransmittance = sampleTransmittanceLUT(transmittanceLUT, params.bottomRadius, dot(sunDirection, normal), params);
+        luminance += throughput * sunTransmittance * saturate(dot(normal, sunDirection)) * params.groundAlbedo.rgb / AtmospherePI;
+    }
+
+    luminanceShared[threadIndex] = luminance;
+    transferShared[threadIndex] = transfer;
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    for (uint stride = MultiScatteringDirections / 2; stride > 0; stride /= 2) {
+        if (threadIndex < stride) {
+            luminanceShared[threadIndex] += luminanceShared[threadIndex + stride];
+            transferShared[threadIndex] += transferShared[threadIndex + stride];
+        }
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+    }
+
+    if (threadIndex == 0) {
+        // Uniform sphere sampling with an isotropic phase function reduces to the mean
+        float3 secondOrder = luminanceShared[0] / float(MultiScatteringDirections);
+        float3 transferFactor = transferShared[0] / float(MultiScatteringDirections);
+        output.write(float4(secondOrder / max(1.0f - transferFactor, 1e-4f), 1.0f), groupId);
+    }
+}
+
+#pragma mark Sky view LUT
+
+kernel void skyViewLUTKernel(texture2d<float>                   transmittanceLUT    [[texture(TextureIndexTransmittanceLUT)]],
+                             texture2d<float>                   multiScatteringLUT  [[texture(TextureIndexMultiScatteringLUT)]],
+                             texture2d<float, access::write>    output              [[texture(TextureIndexSkyViewLUT)]],
+                    constant AtmosphereParams&                  params              [[buffer(BufferIndexAtmosphere)]],
+                             uint2                              gid                 [[thread_position_in_grid]]) {
+    if (gid.x >= output.get_width() || gid.y >= output.get_height()) return;
+
+    float2 uv = (float2(gid) + 0.5f) / float2(output.get_width(), output.get_height());
+    float radius = params.cameraRadius;
+    float cosViewZenith, cosLightView;
+    skyViewLUTParams(uv, radius, params, cosViewZenith, cosLightView);
+
+    // Local frame: up is y, the sun lies in the xy plane
+    float3 sunDirection = normalize(params.sunDirection.xyz);
+    float cosSunZenith = sunDirection.y;
+    float3 localSun = float3(sqrt(saturate(1.0f - cosSunZenith * cosSunZenith)), cosSunZenith, 0.0f);
+
+    float sinViewZenith = sqrt(saturate(1.0f - cosViewZenith * cosViewZenith));
+    float3 direction = float3(sinViewZenith * cosLightView,
+                              cosViewZenith,
+                              sinViewZenith * sqrt(saturate(1.0f - cosLightView * cosLightView)));
+    float3 origin = float3(0.0f, radius, 0.0f);
+
+    float groundDistance = raySphereIntersectNearest(origin, direction, params.bottomRadius);
+    float distance = groundDistance >= 0.0f ? groundDistance : raySphereIntersectNearest(origin, direction, params.topRadius);
+    float dt = max(distance, 0.0f) / float(SkyViewSteps);
+
+    float cosTheta = dot(direction, localSun);
+    float phaseRayleigh = rayleighPhase(cosTheta);
+    float phaseMie = miePhase(cosTheta, params.miePhaseG);
+
+    float3 luminance = 0.0f;
+    float3 throughput = 1.0f;
+    for (uint i = 0; i < SkyViewSteps; i++) {
+        float3 position = origin + direction * ((float(i) + 0.5f) * dt);
+        float height = length(position);
+        AtmosphereMedium medium = sampleAtmosphereMedium(height - params.bottomRadius, params);
+        float3 extinction = max(medium.extinction, 1e-6f);
+        float3 sampleTransmittance = exp(-extinction * dt);
+
+        float cosSun = dot(localSun, position / height);
+        float3 sunTransmittance = sampleTransmittanceLUT(transmittanceLUT, height, cosSun, params);
+        float3 multiScattering = sampleMultiScatteringLUT(multiScatteringLUT, height, cosSun, params);
+
+        float3 singleScattering = (medium.rayleighScattering * phaseRayleigh + medium.mieScattering * phaseMie)
+                                * sunTransmittance * planetShadow(position, localSun, params);
+        float3 inScattering = singleScattering + multiScattering * medium.scattering;
+
+        luminance += throughput * (inScattering - inScattering * sampleTransmittance) / extinction;
+        throughput *= sampleTransmittance;
+    }
+
+    output.write(float4(luminance * params.sunIlluminance.rgb, 1.0f), gid);
+}
+
+#pragma mark Sky
+
+struct SkyVertexOut {
+    float4 position [[position]];
+    float3 viewDirection;
+};
+
+// Full-screen triangle on the far plane, the depth test keeps it behind the scene
+vertex SkyVertexOut atmosphere_sky_vertex(uint                  vertexID    [[vertex_id]],
+                                 constant ViewConstants&        view        [[buffer(BufferIndexViewConstants)]]) {
+    SkyVertexOut out;
+
+    float2 position = float2((vertexID << 1) & 2, vertexID & 2);
+    out.position = float4(position * 2.0f - 1.0f, 1.0f, 1.0f);
+
+    float4 eyeDirection = view.projection_matrix_inverse * float4(out.position.xy, 1.0f, 1.0f);
+    float3x3 viewRotation = float3x3(view.view_matrix[0].xyz, view.view_matrix[1].xyz, view.view_matrix[2].xyz);
+    out.viewDirection = transpose(viewRotation) * (eyeDirection.xyz / eyeDirection.w);
+
+    return out;
+}
+
+fragment AccumLightBuffer atmosphere_sky_fragment(SkyVertexOut                in                  [[stage_in]],
+                                                  texture2d<float>            transmittanceLUT    [[texture(TextureIndexTransmittanceLUT)]],
+                                                  texture2d<float>            skyViewLUT          [[texture(TextureIndexSkyViewLUT)]],
+                                         constant AtmosphereParams&           params              [[buffer(BufferIndexAtmosphere)]],
+                                         constant FrameConstants&             frame               [[buffer(BufferIndexFrameConstants)]]
+#if VOLUMETRIC_LIGHTING
+                                       , constant PassConstants&              pass                [[buffer(BufferIndexPassConstants)]]
+                                       , texture3d<half>                      froxelVolume        [[texture(TextureIndexFroxelVolume)]]
+#endif
+                                                  ) {
+    float3 sunDirection = normalize(-frame.sun_eye_direction.xyz);
+    float3 luminance = atmosphereSkyLuminance(normalize(in.viewDirection), sunDirection, transmittanceLUT, skyViewLUT, params);
+
+    AccumLightBuffer output;
+    output.lighting = half4(half3(luminance), 1.0h);
+#if VOLUMETRIC_LIGHTING
+    // The sky is behind the whole volume
+    float2 screenUV = in.position.xy / float2(pass.framebuffer_width, pass.framebuffer_height);
+    output.lighting.rgb = applyVolumetricLighting(output.lighting.rgb, froxelVolume, screenUV, frame.volumetric_far, frame);
+#endif
+    return output;
+}
@@ -0,0 +1,155 @@
+#include <simd/simd.h>
+
+// Helpers shared by the atmosphere LUT kernels, the sky and the lighting pass.
+// LUT parameterisations follow Bruneton (transmittance) and Hillaire (multiple
+// scattering and sky view). Positions are relative to the planet centre, in km.
+
+constant float AtmospherePI = 3.14159265f;
+
+struct AtmosphereMedium {
+    float3 scattering;
+    float3 extinction;
+    float3 rayleighScattering;
+    float3 mieScattering;
+};
+
+static inline AtmosphereMedium sampleAtmosphereMedium(float height, constant AtmosphereParams& params) {
+    float rayleighDensity = exp(-height / params.rayleighScaleHeight);
+    float mieDensity = exp(-height / params.mieScaleHeight);
+    float ozoneDensity = max(0.0f, 1.0f - abs(height - params.ozoneCenterHeight) / params.ozoneHalfWidth);
+
+    AtmosphereMedium medium;
+    medium.rayleighScattering = params.rayleighScattering.xyz * rayleighDensity;
+    medium.mieScattering = params.mieScattering.xyz * mieDensity;
+    medium.scattering = medium.rayleighScattering + medium.mieScattering;
+    medium.extinction = medium.rayleighScattering
+                      + params.mieExtinction.xyz * mieDensity
+                      + params.ozoneAbsorption.xyz * ozoneDensity;
+    return medium;
+}
+
+// Distance to the nearest intersection in front of the origin, or -1
+static inline float raySphereIntersectNearest(float3 origin, float3 direction, float radius) {
+    float b = dot(origin, direction);
+    float c = dot(origin, origin) - radius * radius;
+    float discriminant = b * b - c;
+    if (discriminant < 0.0f) return -1.0f;
+
+    float root = sqrt(discriminant);
+    float t0 = -b - root;
+    float t1 = -b + root;
+    if (t0 >= 0.0f) return t0;
+    if (t1 >= 0.0f) return t1;
+    return -1.0f;
+}
+
+static inline float rayleighPhase(float cosTheta) {
+    return 3.0f / (16.0f * AtmospherePI) * (1.0f + cosTheta * cosTheta);
+}
+
+// Cornette-Shanks
+static inline float miePhase(float cosTheta, float g) {
+    float g2 = g * g;
+    float k = 3.0f / (8.0f * AtmospherePI) * (1.0f - g2) / (2.0f + g2);
+    return k * (1.0f + cosTheta * cosTheta) / pow(max(1.0f + g2 - 2.0f * g * cosTheta, 1e-4f), 1.5f);
+}
+
+static inline float2 transmittanceLUTUV(float radius, float cosZenith, constant AtmosphereParams& params) {
+    float H = sqrt(params.topRadius * params.topRadius - params.bottomRadius * params.bottomRadius);
+    float rho = sqrt(max(radius * radius - params.bottomRadius * params.bottomRadius, 0.0f));
+
+    float discriminant = radius * radius * (cosZenith * cosZenith - 1.0f) + params.topRadius * params.topRadius;
+    float d = max(-radius * cosZenith + sqrt(max(discriminant, 0.0f)), 0.0f);
+    float dMin = params.topRadius - radius;
+    float dMax = rho + H;
+    return float2((d - dMin) / (dMax - dMin), rho / H);
+}
+
+static inline void transmittanceLUTParams(float2 uv, constant AtmosphereParams& params,
+                                          thread float& radius, thread float& cosZenith) {
+    float H = sqrt(params.topRadius * params.topRadius - params.bottomRadius * params.bottomRadius);
+    float rho = H * uv.y;
+    radius = sqrt(rho * rho + params.bottomRadius * params.bottomRadius);
+
+    float dMin = params.topRadius - radius;
+    float dMax = rho + H;
+    float d = dMin + uv.x * (dMax - dMin);
+    cosZenith = d == 0.0f ? 1.0f : (H * H - rho * rho - d * d) / (2.0f * radius * d);
+    cosZenith = clamp(cosZenith, -1.0f, 1.0f);
+}
+
+static inline float3 sampleTransmittanceLUT(texture2d<float> lut, float radius, float cosZenith, constant AtmosphereParams& params) {
+    constexpr sampler linearClamp(mag_filter::linear, min_filter::linear, address::clamp_to_edge);
+    return lut.sample(linearClamp, transmittanceLUTUV(radius, cosZenith, params)).rgb;
+}
+
+static inline float3 sampleMultiScatteringLUT(texture2d<float> lut, float radius, float cosSunZenith, constant AtmosphereParams& params) {
+    constexpr sampler linearClamp(mag_filter::linear, min_filter::linear, address::clamp_to_edge);
+    float2 uv = float2(cosSunZenith * 0.5f + 0.5f,
+                       (radius - params.bottomRadius) / (params.topRadius - params.bottomRadius));
+    return lut.sample(linearClamp, uv).rgb;
+}
+
+// Non-linear latitude mapping that spends half the table on a narrow band around the horizon
+static inline float2 skyViewLUTUV(float radius, float cosViewZenith, float cosLightView, bool intersectsGround,
+                                  constant AtmosphereParams& params) {
+    float horizonDistance = sqrt(max(radius * radius - params.bottomRadius * params.bottomRadius, 0.0f));
+    float beta = acos(clamp(horizonDistance / radius, -1.0f, 1.0f));
+    float zenithHorizonAngle = AtmospherePI - beta;
+    float viewZenith = acos(clamp(cosViewZenith, -1.0f, 1.0f));
+
+    float v;
+    if (!intersectsGround) {
+        float coord = 1.0f - saturate(viewZenith / zenithHorizonAngle);
+        v = (1.0f - sqrt(coord)) * 0.5f;
+    } else {
+        float coord = saturate((viewZenith - zenithHorizonAngle) / beta);
+        v = sqrt(coord) * 0.5f + 0.5f;
+    }
+    float u = sqrt(saturate(-cosLightView * 0.5f + 0.5f));
+    return float2(u, v);
+}
+
+static inline void skyViewLUTParams(float2 uv, float radius, constant AtmosphereParams& params,
+                                    thread float& cosViewZenith, thread float& cosLightView) {
+    float horizonDistance = sqrt(max(radius * radius - params.bottomRadius * params.bottomRadius, 0.0f));
+    float beta = acos(clamp(horizonDistance / radius, -1.0f, 1.0f));
+    float zenithHorizonAngle = AtmospherePI - beta;
+
+    if (uv.y < 0.5f) {
+        float coord = 1.0f - 2.0f * uv.y;
+        coord = 1.0f - coord * coord;
+        cosViewZenith = cos(zenithHorizonAngle * coord);
+    } else {
+        float coord = uv.y * 2.0f - 1.0f;
+        cosViewZenith = cos(zenithHorizonAngle + beta * coord * coord);
+    }
+    cosLightView = -(uv.x * uv.x * 2.0f - 1.0f);
+}
+
+// Sky seen along a world space direction from the camera, including the sun disc
+static inline float3 atmosphereSkyLuminance(float3 direction, float3 sunDirection,
+                                            texture2d<float> transmittanceLUT, texture2d<float> skyViewLUT,
+                                            constant AtmosphereParams& params) {
+    constexpr sampler skySampler(mag_filter::linear, min_filter::linear, address::clamp_to_edge);
+
+    float radius = params.cameraRadius;
+    float3 origin = float3(0.0f, radius, 0.0f);
+
+    // Azimuth relative to the sun, measured in the horizontal plane
+    float2 horizontalView = direction.xz;
+    float2 horizontalSun = sunDirection.xz;
+    float cosLightView = 1.0f;
+    if (length_squared(horizontalView) > 1e-8f && length_squared(horizontalSun) > 1e-8f) {
+        cosLightView = dot(normalize(horizontalView), normalize(horizontalSun));
+    }
+
+    bool intersectsGround = raySphereIntersectNearest(origin, direction, params.bottomRadius) >= 0.0f;
+    float3 luminance = skyViewLUT.sample(skySampler, skyViewLUTUV(radius, direction.y, cosLightView, intersectsGround, params)).rgb;
+
+    // Sun disc, roughly half a degree across
+    if (!intersectsGround && dot(direction, sunDirection) > cos(0.5f * 0.00935f)) {
+        luminance += sampleTransmittanceLUT(transmittanceLUT, radius, direction.y, params) * params.sunIlluminance.rgb * 20.0f;
+    }
+    return min(luminance, 60000.0f);
+}
@@ -14,4 +14,153 @@
 // necessary.
 #define LIGHT_STENCIL_CULLING      1
 
+// When enabled, the G-buffer pass writes the instance and primitive ID of
+// every covered pixel into an extra render target. The editor copies a small
+// region around the cursor back to the CPU to resolve object selection.
+#define OBJECT_PICKING             1
 
+// When enabled, the deferred lighting pass adds diffuse ambient light from the
+// environment, stored as nine L2 spherical harmonics coefficients in FrameConstants.
+// Evaluation is a handful of multiply-adds per pixel regardless of the
+// environment map resolution.
+#define SH_AMBIENT_LIGHTING        1
+
+// When enabled, the sky is rendered from precomputed atmospheric scattering
+// lookup tables (transmittance, multiple scattering and sky view) and the sun
+// light is attenuated by the transmittance towards the sun. The sky view table
+// is only rebuilt when the sun has moved past a small angular threshold.
+#define ATMOSPHERIC_SCATTERING     1
+
+// When enabled, the G-buffer is rendered with 4x MSAA and lit in compute. A
+// classification pass marks pixels whose samples differ in depth, normal or
+// albedo; simple pixels are shaded once and edge pixels once per sample, each
+// set dispatched indirectly from its own compacted tile list. When disabled,
+// lighting runs in the single sample G-buffer render pass.
+#define MSAA_DEFERRED              0
+
+// When enabled, a tile shading stage runs between the G-buffer draws and the
+// lighting pass of the single sample path. It reduces the depth bounds of each
+// 16x16 tile from imageblock memory and culls the point lights into a list kept
+// in threadgroup memory, which the lighting fragment of the same tile reads
+// without touching another render target. Requires USE_EYE_DEPTH. Point lights
+// are not shaded by the MSAA_DEFERRED path.
+#define TILE_LIGHT_CULLING         1
+
+#if TILE_LIGHT_CULLING && !USE_EYE_DEPTH
+#error "TILE_LIGHT_CULLING reconstructs positions from eye depth"
+#endif
+
+// CPU only. When enabled, startup scatters 256 randomly coloured point lights
+// through the scene bounds to give TILE_LIGHT_CULLING something to cull. Off by
+// default, the scene has no point lights of its own. REFERENCE_CHECKS scatters them
+// too, to have lights to check the culling with.
+#define TEST_POINT_LIGHTS          0
+
+// When enabled, a compute pass after the G-buffer classifies 16x16 screen tiles
+// from the stored eye depth into empty, simple, complex and edge tiles and appends
+// them to one list per class. Ray tracing then runs one indirect dispatch per
+// class instead of covering the whole screen: complex tiles trace every pixel,
+// simple tiles one ray per 2x2 block, edge tiles only their geometry pixels, and
+// sky only tiles are cleared.
+#define TILE_CLASSIFICATION        1
+
+// CPU only. When enabled, global operator new is replaced with a counting version
+// and the engine checks that steady state frames make no C++ heap allocations on
+// the thread that draws them: after a warmup period, any frame that allocates is
+// reported and asserts. Frames that rebuild the editor overlay are skipped, ImGui
+// allocates while building.
+#define COUNT_FRAME_ALLOCATIONS    0
+
+// CPU only. When enabled, startup bakes (or reads from the cache) sparse signed
+// distance volumes of every scene mesh into Engine::distanceFields. Off by default,
+// nothing reads them yet.
+#define MESH_DISTANCE_FIELDS       0
+
+// CPU only. When enabled, startup bakes the signed distance volumes of every scene
+// mesh with 1, 2, 4 ... threads up to the hardware thread count and prints the bake
+// time and throughput of each run, before the cooked cache is consulted.
+#define SDF_BAKE_BENCHMARK         0
+
+// When enabled, startup bakes octahedral impostors of the SMG model (cooked to the
+// cache like the distance fields) and scatters instances of it over the scene.
+// Instances beyond Impostors::distanceThreshold are drawn as camera facing quads
+// into the G-buffer, nearer ones as the full mesh.
+#define IMPOSTORS                  0
+
+// CPU only. When enabled, startup builds (or reads from the cache) potentially
+// visible sets over the walkable space of the static scene. The set of the cell the
+// camera is in limits the main view's frustum culling to the instances that can be
+// seen from that cell. Off by default, the sets are sampled and thin objects seen
+// through small gaps can be missed.
+#define POTENTIALLY_VISIBLE_SETS   0
+
+// When enabled, ray tracing writes one ambient occlusion ray per primary hit into a
+// queue, bins the queue by origin Morton code and quantised direction and traces it
+// in bin order, scattering the results back to their pixels. Replaces the tile
+// classified and full screen ray tracing dispatches.
+#define SECONDARY_RAY_QUEUE        0
+
+// CPU only. When enabled, startup traces the secondary rays of a headless camera
+// over the software BVH of every scene mesh, once in pixel order and once in
+// sorted order, and prints the traversal cost and SIMD coherence of each.
+#define SECONDARY_RAY_BENCHMARK    0
+
+// When enabled, import rasterises the UV footprint of every alpha masked triangle
+// against its texture's alpha and classifies micro triangles of it as opaque,
+// transparent or unknown. Transparent triangles are left out of the acceleration
+// structure, opaque ones are traced as opaque geometry, and only unknown micro
+// triangles run the alpha test in the masked geometry's intersection function.
+#define OPACITY_MICROMAPS          1
+
+// When enabled together with SECONDARY_RAY_QUEUE, startup simplifies the opaque scene
+// geometry with a bounded error (cooked to the cache) and builds a second, smaller
+// acceleration structure from it and the exact alpha masked triangles. Secondary rays
+// trace the proxy, primary rays keep the full detail structure.
+#define PROXY_GEOMETRY             1
+
+// CPU only. When enabled, ray tracing and the min max depth pyramid are submitted to a
+// second command queue and overlap the raster work of the frame, ordered against it
+// with a shared event. When disabled they run on the graphics queue in the same order.
+#define ASYNC_COMPUTE              1
+
+// CPU only. When enabled, startup clears the normals of the first scene mesh,
+// regenerates them with one thread and with every thread, and prints the throughput
+// of both and the mean angle to the authored normals.
+#define SMOOTH_NORMALS_BENCHMARK   0
+
+// CPU only. When enabled, the main thread only polls input and simulates, writing each
+// frame into a render snapshot, while a render thread encodes and submits the
+// previous one. When disabled the same snapshots are rendered on the main thread
+// right after they are written.
+#define RENDER_THREAD              1
+
+// CPU only. When 1, startup measures every imported mesh and material (vertex bloat,
+// ACMR, degenerate and sliver triangles, texel density against on-screen need, texture
+// array padding, GPU memory), checks them against data/asset_budgets.json and writes
+// the ranked report to the cache as asset_report.json and to the console. When 2, the
+// application quits after startup with a non zero exit status if any budget is exceeded,
+// so a build can run it as a check.
+#define ASSET_REPORT               0
+
+// When enabled, the engine renders a few frames, then copies one frame's GPU results
+// back and compares them with their CPU references, within the tolerances given at
+// each check: the post chain with PostProcessReference, the MSAA_DEFERRED edge mask and
+// tile lists with MSAAClassifierReference, otherwise the TILE_LIGHT_CULLING lists of the
+// test point lights with TileLightCullingReference, and the TILE_CLASSIFICATION tile
+// lists with TileClassifierReference. The application quits after that frame, with a
+// non zero exit status if a check failed, so a build can run it as a check like
+// ASSET_REPORT 2.
+#define REFERENCE_CHECKS           0
+
+// When enabled, a low resolution froxel volume aligned with the camera is injected every
+// frame with height fog and sun in-scattering, shadowed by a ray against the scene
+// acceleration structure from a jittered position inside each froxel, and blended with
+// the previous frame's volume reprojected into this one. A second pass integrates each
+// froxel column front to back once, so the single sample lighting pass and the sky
+// apply the fog with one 3D texture fetch. Runs on the compute queue ahead of the
+// G-buffer. Requires USE_EYE_DEPTH, not applied by the MSAA_DEFERRED path.
+#define VOLUMETRIC_LIGHTING        1
+
+#if VOLUMETRIC_LIGHTING && !USE_EYE_DEPTH
+#error "VOLUMETRIC_LIGHTING reads linear depth from the G-buffer"
+#endif
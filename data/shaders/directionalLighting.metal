@@ -4,6 +4,10 @@ using namespace metal;
 
 #include "shaderTypes.hpp"
 #include "shaderCommon.hpp"
+#if ATMOSPHERIC_SCATTERING
+#include "atmosphereCommon.hpp"
+#endif
+#include "lightingCommon.hpp"
 
 struct VertexOut {
     float4 position [[position]];
@@ -14,7 +18,7 @@ struct VertexOut {
 };
 
 vertex VertexOut deferred_directional_lighting_vertex(uint 				vertexID	[[vertex_id]],
-										   constant FrameData& 			frameData 	[[buffer(BufferIndexFrameData)]]) {
+										   constant ViewConstants& 		view 		[[buffer(BufferIndexViewConstants)]]) {
     VertexOut out;
 
     // Generate full-screen triangle
@@ -23,7 +27,7 @@ vertex VertexOut deferred_directional_lighting_vertex(uint 				vertexID	[[vertex
     out.texCoords = position;
 
 #if USE_EYE_DEPTH
-    float4 unprojected_eye_coord = frameData.projection_matrix_inverse * out.position;
+    float4 unprojected_eye_coord = view.projection_matrix_inverse * out.position;
     out.eye_position = unprojected_eye_coord.xyz / unprojected_eye_coord.w;
 #endif
 
@@ -31,7 +35,20 @@ vertex VertexOut deferred_directional_lighting_vertex(uint 				vertexID	[[vertex
 }
 
 fragment AccumLightBuffer deferred_directional_lighting_fragment(VertexOut 				in 			[[stage_in]],
-														constant FrameData& 			frameData 	[[buffer(BufferIndexFrameData)]],
+														constant FrameConstants& 		frame 		[[buffer(BufferIndexFrameConstants)]],
+														constant ViewConstants& 		view 		[[buffer(BufferIndexViewConstants)]],
+#if ATMOSPHERIC_SCATTERING
+														constant AtmosphereParams& 		atmosphere 	[[buffer(BufferIndexAtmosphere)]],
+																 texture2d<float> 		transmittanceLUT [[texture(TextureIndexTransmittanceLUT)]],
+#endif
+#if VOLUMETRIC_LIGHTING
+														constant PassConstants& 		pass 		[[buffer(BufferIndexPassConstants)]],
+																 texture3d<half> 		froxelVolume [[texture(TextureIndexFroxelVolume)]],
+#endif
+#if TILE_LIGHT_CULLING
+														constant PointLight* 			lights 		[[buffer(BufferIndexPointLights)]],
+													 threadgroup TileLightList& 		tileLights 	[[threadgroup(ThreadgroupIndexTileLights)]],
+#endif
 																 GBufferData 			GBuffer) {
     // Extract albedo and normals from the GBuffer
     half4 albedo_specular = GBuffer.albedo_specular;
@@ -40,12 +57,24 @@ fragment AccumLightBuffer deferred_directional_lighting_fragment(VertexOut 				i
     half3 albedo = albedo_specular.rgb;
     half3 normal = normalize(normal_map.xyz); // Use the normal from the GBuffer
 
-    // Simulate a directional light
-    float3 lightDir = normalize(-frameData.sun_eye_direction.xyz); // Directional light from the sun
-    half NdotL = max(dot(normal, half3(lightDir)), 0.0h);
+#if ATMOSPHERIC_SCATTERING
+    half3 finalColor = shadeDirectionalLight(albedo, normal, frame, atmosphere, transmittanceLUT);
+#else
+    half3 finalColor = shadeDirectionalLight(albedo, normal, frame);
+#endif
+
+#if TILE_LIGHT_CULLING
+    // Lights culled for this tile by cullLightsTileKernel, shaded in eye space
+    float3 eyePosition = in.eye_position * (GBuffer.depth / in.eye_position.z);
+    float3 eyeNormal = (view.view_matrix * float4(float3(normal), 0.0f)).xyz;
+    finalColor += shadePointLights(albedo, eyeNormal, eyePosition, lights, tileLights);
+#endif
 
-    // Combine albedo and the diffuse term
-    half3 finalColor = albedo * NdotL;
+#if VOLUMETRIC_LIGHTING
+    // Eye depth is negative in front of the camera
+    float2 screenUV = in.position.xy / float2(pass.framebuffer_width, pass.framebuffer_height);
+    finalColor = applyVolumetricLighting(finalColor, froxelVolume, screenUV, -GBuffer.depth, frame);
+#endif
 
     // Output the final color
     AccumLightBuffer output;
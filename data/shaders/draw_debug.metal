@@ -19,9 +19,9 @@ struct IndirectCommand {
 
 vertex DebugLineVertex forwardVertex(uint                vertexID        [[vertex_id]],
                          constant    DebugLineVertex*    lineVertices    [[buffer(0)]],
-                         constant    FrameData&          frameData       [[buffer(BufferIndexFrameData)]]) {
+                         constant    ViewConstants&      view            [[buffer(BufferIndexViewConstants)]]) {
     DebugLineVertex outVertex = lineVertices[vertexID];
-    outVertex.position = frameData.projection_matrix * frameData.view_matrix * outVertex.position;
+    outVertex.position = view.projection_matrix * view.view_matrix * outVertex.position;
 
     return outVertex;
 }
@@ -0,0 +1,26 @@
+#define METAL
+#include <metal_stdlib>
+using namespace metal;
+
+#include "shaderTypes.hpp"
+
+struct CompositeVertexOut {
+    float4 position [[position]];
+};
+
+vertex CompositeVertexOut editorCompositeVertex(uint vertexID [[vertex_id]]) {
+    CompositeVertexOut out;
+
+    // Generate full-screen triangle
+    float2 position = float2((vertexID << 1) & 2, vertexID & 2);
+    out.position = float4(position * 2.0f - 1.0f, 0.0f, 1.0f);
+
+    return out;
+}
+
+// The overlay is rendered by ImGui into a cleared target, so its colour is already
+// premultiplied and is blended with (One, OneMinusSourceAlpha)
+fragment half4 editorCompositeFragment(CompositeVertexOut   in      [[stage_in]],
+                                       texture2d<half>      overlay [[texture(TextureIndexEditorOverlay)]]) {
+    return overlay.read(uint2(in.position.xy));
+}
@@ -5,6 +5,7 @@ using namespace metal;
 #include "vertexData.hpp"
 #include "shaderTypes.hpp"
 #include "shaderCommon.hpp"
+#include "vertexPulling.hpp"
 
 struct ColorInOut
 {
@@ -18,49 +19,49 @@ struct ColorInOut
 	int    normalTextureIndex;
 };
 
-struct DescriptorDefinedVertex
-{
-	float4  position    [[attribute(VertexAttributePosition)]];
-	float2  tex_coord   [[attribute(VertexAttributeTexcoord)]];
-	half4   normal      [[attribute(VertexAttributeNormal)]];
-	half4   tangent     [[attribute(VertexAttributeTangent)]];
-	half4   bitangent   [[attribute(VertexAttributeBitangent)]];
-};
-
-vertex ColorInOut gbuffer_vertex(DescriptorDefinedVertex  	in        	[[stage_in]],
-								 uint 						vertexID  	[[vertex_id]],
-                     constant    Vertex* 			        vertexData  [[buffer(BufferIndexVertexData)]],
-                     constant    FrameData&		            frameData 	[[buffer(BufferIndexFrameData)]]) {
+vertex ColorInOut gbuffer_vertex(uint 						vertexID  		[[vertex_id]],
+                     const device uchar* 			        positions  		[[buffer(BufferIndexPositionStream)]],
+                     const device uchar* 			        tangentFrames  	[[buffer(BufferIndexTangentFrameStream)]],
+                     const device uchar* 			        texcoords  		[[buffer(BufferIndexTexcoordStream)]],
+                     const device short2* 			        textureIndices  [[buffer(BufferIndexTextureIndexStream)]],
+                     constant    VertexStreamLayout&        layout  		[[buffer(BufferIndexVertexStreamLayout)]],
+                     constant    ViewConstants&		        view 			[[buffer(BufferIndexViewConstants)]],
+                     constant    InstanceConstants&	        instance 		[[buffer(BufferIndexInstanceConstants)]]) {
 	
 	ColorInOut out;
 
+	// Every attribute is pulled from its own stream
+	float4 model_position = fetchPosition(positions, vertexID, layout.positionFormat);
+	TangentFrame tangentFrame = fetchTangentFrame(tangentFrames, vertexID, layout.tangentFrameFormat);
+
 	// Convert model position to eye space and project to clip space
-	float4 model_position = in.position;
-	float4 eye_position = frameData.scene_modelview_matrix * model_position;
-	out.position = frameData.projection_matrix * eye_position;
-	out.tex_coord = in.tex_coord;
+	float4 eye_position = view.view_matrix * (instance.model_matrix * model_position);
+	out.position = view.projection_matrix * eye_position;
+	out.tex_coord = fetchTexcoord(texcoords, vertexID);
 
 	#if USE_EYE_DEPTH
 	out.eye_position = eye_position.xyz;
 	#endif
 
 	// Rotate tangents, bitangents, and normals by the normal matrix
-	half3x3 normalMatrix = half3x3(frameData.scene_normal_matrix);
+	half3x3 normalMatrix = half3x3(instance.normal_matrix);
 
 	// Transform normal, tangent, and bitangent to eye space
-	out.tangent = normalize(normalMatrix * in.tangent.xyz);
-	out.bitangent = -normalize(normalMatrix * in.bitangent.xyz); // Note the inversion if required
-	out.normal = normalize(normalMatrix * in.normal.xyz);
+	out.tangent = normalize(normalMatrix * tangentFrame.tangent);
+	out.bitangent = -normalize(normalMatrix * tangentFrame.bitangent); // Note the inversion if required
+	out.normal = normalize(normalMatrix * tangentFrame.normal);
 	
-	out.diffuseTextureIndex = vertexData[vertexID].diffuseTextureIndex;
-	out.normalTextureIndex = vertexData[vertexID].normalTextureIndex;
+	short2 vertexTextureIndices = textureIndices[vertexID];
+	out.diffuseTextureIndex = vertexTextureIndices.x;
+	out.normalTextureIndex = vertexTextureIndices.y;
 
 	return out;
 }
 
 
 fragment GBufferData gbuffer_fragment(ColorInOut            in                  [[stage_in]],
-                          constant    FrameData&            frameData           [[buffer(BufferIndexFrameData)]],
+									  uint                  primitiveID         [[primitive_id]],
+                          constant    uint2&                objectInfo          [[buffer(BufferIndexObjectId)]],
 									  texture2d_array<half> baseColorMap        [[texture(TextureIndexBaseColor)]],
 									  texture2d_array<half> normalMap           [[texture(TextureIndexNormal)]],
                           constant    TextureInfo*          diffuseTextureInfos [[buffer(BufferIndexDiffuseInfo)]],
@@ -112,6 +113,12 @@ fragment GBufferData gbuffer_fragment(ColorInOut            in
 	gBuffer.depth = in.position.z;
 	#endif
 
+	#if OBJECT_PICKING
+	// Zero is reserved for "nothing hit", so instance IDs are stored offset by one.
+	// Submeshes are drawn separately, y holds the first triangle of the draw.
+	gBuffer.object_id = uint2(objectInfo.x + 1, objectInfo.y + primitiveID);
+	#endif
+
 	return gBuffer;
 }
 
@@ -0,0 +1,184 @@
+#define METAL
+#include <metal_stdlib>
+using namespace metal;
+
+#include "shaderTypes.hpp"
+#include "shaderCommon.hpp"
+
+// Octahedral frame layout, must match Impostors::frameDirection on the CPU. Y is up,
+// the full octahedron folds the lower hemisphere into the corners.
+static inline float2 octahedralEncode(float3 direction, bool hemisphere) {
+    direction /= abs(direction.x) + abs(direction.y) + abs(direction.z);
+    if (hemisphere) {
+        return float2(direction.x + direction.z, direction.x - direction.z);
+    }
+    float2 uv = direction.xz;
+    if (direction.y < 0.0f) {
+        uv = (1.0f - abs(uv.yx)) * select(float2(-1.0f), float2(1.0f), uv >= 0.0f);
+    }
+    return uv;
+}
+
+static inline float3 octahedralDecode(float2 uv, bool hemisphere) {
+    float3 direction;
+    if (hemisphere) {
+        float2 xz = float2(uv.x + uv.y, uv.x - uv.y) * 0.5f;
+        direction = float3(xz.x, 1.0f - abs(xz.x) - abs(xz.y), xz.y);
+    } else {
+        direction = float3(uv.x, 1.0f - abs(uv.x) - abs(uv.y), uv.y);
+        if (direction.y < 0.0f) {
+            direction.xz = (1.0f - abs(direction.zx)) * select(float2(-1.0f), float2(1.0f), direction.xz >= 0.0f);
+        }
+    }
+    return normalize(direction);
+}
+
+static inline float3 frameDirection(uint2 frame, constant ImpostorParams& params) {
+    float2 uv = float2(frame) / float(params.framesPerSide - 1) * 2.0f - 1.0f;
+    return octahedralDecode(uv, params.hemisphere != 0);
+}
+
+struct ImpostorFrameSample {
+    half4 albedo;
+    half3 normal;
+    float depth;
+};
+
+// Projects the point onto the frame plane through the centre, parallax between
+// frames is not corrected
+static inline ImpostorFrameSample sampleFrame(uint2 frame, float3 objectOffset,
+                                              constant ImpostorParams& params,
+                                              texture2d<half> albedoAtlas,
+                                              texture2d<half> normalAtlas,
+                                              texture2d<float> depthAtlas) {
+    constexpr sampler atlasSampler(mag_filter::linear, min_filter::linear, address::clamp_to_edge);
+
+    float3 direction = frameDirection(frame, params);
+    float3 up = abs(direction.y) > 0.999f ? float3(0.0f, 0.0f, 1.0f) : float3(0.0f, 1.0f, 0.0f);
+    float3 right = normalize(cross(up, direction));
+    up = cross(direction, right);
+
+    float radius = params.center_radius.w;
+    float2 local = float2(dot(objectOffset, right), -dot(objectOffset, up)) / radius * 0.5f + 0.5f;
+
+    // Half a texel inset keeps the filter inside the frame
+    float frameTexels = float(albedoAtlas.get_width()) / float(params.framesPerSide);
+    local = clamp(local, 0.5f / frameTexels, 1.0f - 0.5f / frameTexels);
+    float2 uv = (float2(frame) + local) / float(params.framesPerSide);
+
+    ImpostorFrameSample result;
+    result.albedo = albedoAtlas.sample(atlasSampler, uv);
+    result.normal = normalAtlas.sample(atlasSampler, uv).xyz;
+    result.depth = depthAtlas.sample(atlasSampler, uv).x;
+    return result;
+}
+
+struct ImpostorInOut {
+    float4 position [[position]];
+    float3 world_position;
+    float3 instance_center;
+    float  scale;
+};
+
+vertex ImpostorInOut impostor_vertex(uint                                vertexID    [[vertex_id]],
+                                     uint                                instanceID  [[instance_id]],
+                                     const device ImpostorInstance*      instances   [[buffer(BufferIndexImpostorInstances)]],
+                                     constant    ImpostorParams&         params      [[buffer(BufferIndexImpostorParams)]],
+                                     constant    ViewConstants&          view        [[buffer(BufferIndexViewConstants)]]) {
+    ImpostorInstance instance = instances[instanceID];
+    float scale = instance.position_scale.w;
+    float3 center = instance.position_scale.xyz + params.center_radius.xyz * scale;
+
+    // Triangle strip corners, the quad faces the camera and covers the bounding sphere
+    float2 corner = float2(vertexID & 1, vertexID >> 1) * 2.0f - 1.0f;
+    float radius = params.center_radius.w * scale;
+    float3 worldPosition = center + (view.cameraRight.xyz * corner.x + view.cameraUp.xyz * corner.y) * radius;
+
+    ImpostorInOut out;
+    out.position = view.projection_matrix * view.view_matrix * float4(worldPosition, 1.0f);
+    out.world_position = worldPosition;
+    out.instance_center = center;
+    out.scale = scale;
+    return out;
+}
+
+struct ImpostorGBufferData {
+    half4 albedo_specular [[color(RenderTargetAlbedo),   raster_order_group(GBufferROG)]];
+    half4 normal_map      [[color(RenderTargetNormal),   raster_order_group(GBufferROG)]];
+    float depth           [[color(RenderTargetDepth),    raster_order_group(GBufferROG)]];
+#if OBJECT_PICKING
+    uint2 object_id       [[color(RenderTargetObjectId), raster_order_group(GBufferROG)]];
+#endif
+    float fragment_depth  [[depth(any)]];
+};
+
+// Blends the three frames around the view direction, weighted by their barycentric
+// position in the frame grid cell, and writes the result into the G-buffer so the
+// impostor is lit like the mesh
+fragment ImpostorGBufferData impostor_fragment(ImpostorInOut              in          [[stage_in]],
+                                               constant ImpostorParams&   params      [[buffer(BufferIndexImpostorParams)]],
+                                               constant ViewConstants&    view        [[buffer(BufferIndexViewConstants)]],
+                                               texture2d<half>            albedoAtlas [[texture(TextureIndexImpostorAlbedo)]],
+                                               texture2d<half>            normalAtlas [[texture(TextureIndexImpostorNormal)]],
+                                               texture2d<float>           depthAtlas  [[texture(TextureIndexImpostorDepth)]]) {
+    float3 toCamera = normalize(view.cameraPosition.xyz - in.instance_center);
+    bool hemisphere = params.hemisphere != 0;
+    if (hemisphere) {
+        toCamera.y = max(toCamera.y, 0.0f);
+        toCamera = normalize(toCamera + float3(0.0f, 1e-4f, 0.0f));
+    }
+
+    float2 grid = (octahedralEncode(toCamera, hemisphere) * 0.5f + 0.5f) * float(params.framesPerSide - 1);
+    uint2 base = uint2(clamp(floor(grid), 0.0f, float(params.framesPerSide - 2)));
+    float2 fraction = saturate(grid - float2(base));
+
+    uint2 frames[3];
+    float3 weights;
+    frames[0] = base;
+    frames[2] = base + uint2(1, 1);
+    if (fraction.x > fraction.y) {
+        frames[1] = base + uint2(1, 0);
+        weights = float3(1.0f - fraction.x, fraction.x - fraction.y, fraction.y);
+    } else {
+        frames[1] = base + uint2(0, 1);
+        weights = float3(1.0f - fraction.y, fraction.y - fraction.x, fraction.x);
+    }
+
+    float3 objectOffset = (in.world_position - in.instance_center) / in.scale;
+    half4 albedo = 0.0h;
+    float3 normal = 0.0f;
+    float depth = 0.0f;
+    float coverage = 0.0f;
+    for (uint i = 0; i < 3; i++) {
+        ImpostorFrameSample frameSample = sampleFrame(frames[i], objectOffset, params, albedoAtlas, normalAtlas, depthAtlas);
+        float weight = weights[i] * frameSample.albedo.a;
+        albedo += frameSample.albedo * half(weights[i]);
+        normal += float3(frameSample.normal) * weight;
+        depth += frameSample.depth * weight;
+        coverage += weight;
+    }
+    if (albedo.a < 0.5h || coverage <= 0.0f)
+        discard_fragment();
+
+    // Baked eye depth is relative to a camera 2 * radius out, turn it into an offset
+    // towards the viewer from the quad plane
+    float offset = (depth / coverage + 2.0f * params.center_radius.w) * in.scale;
+    float3 worldPosition = in.world_position + toCamera * offset;
+    float4 eyePosition = view.view_matrix * float4(worldPosition, 1.0f);
+    float4 clipPosition = view.projection_matrix * eyePosition;
+
+    ImpostorGBufferData out;
+    out.albedo_specular = half4(albedo.rgb / albedo.a, 1.0h);
+    out.normal_map = half4(half3(normalize(normal)), 1.0h);
+#if USE_EYE_DEPTH
+    out.depth = eyePosition.z;
+#else
+    out.depth = clipPosition.z / clipPosition.w;
+#endif
+#if OBJECT_PICKING
+    // Impostors are not pickable, zero reads as "nothing hit"
+    out.object_id = uint2(0, 0);
+#endif
+    out.fragment_depth = clipPosition.z / clipPosition.w;
+    return out;
+}
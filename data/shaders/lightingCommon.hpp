@@ -0,0 +1,119 @@
+#include <simd/simd.h>
+
+// Sun and ambient shading of one G-buffer sample, shared by the single sample
+// lighting fragment and the MSAA lighting kernels. Include after
+// atmosphereCommon.hpp when ATMOSPHERIC_SCATTERING is enabled.
+static inline half3 shadeDirectionalLight(half3                     albedo,
+                                          half3                     normal,
+                                          constant FrameConstants&  frame
+#if ATMOSPHERIC_SCATTERING
+                                        , constant AtmosphereParams& atmosphere
+                                        , texture2d<float>          transmittanceLUT
+#endif
+                                          ) {
+    // Simulate a directional light
+    float3 lightDir = normalize(-frame.sun_eye_direction.xyz); // Directional light from the sun
+    half NdotL = max(dot(normal, half3(lightDir)), 0.0h);
+
+    // Combine albedo and the diffuse term
+    half3 finalColor = albedo * NdotL;
+
+#if ATMOSPHERIC_SCATTERING
+    // Sunlight reaching the camera altitude through the atmosphere
+    finalColor *= half3(sampleTransmittanceLUT(transmittanceLUT, atmosphere.cameraRadius, lightDir.y, atmosphere));
+#endif
+
+#if SH_AMBIENT_LIGHTING
+    // Diffuse ambient from the environment
+    half3 ambient = half3(evaluateSHIrradiance(float3(normal), frame.sh_irradiance) * frame.ambient_intensity);
+    finalColor += albedo * ambient;
+#endif
+
+    return finalColor;
+}
+
+#if VOLUMETRIC_LIGHTING
+// Attenuates a colour seen at linear depth behind the fog and adds the light the fog
+// scatters towards the camera, one fetch from the integrated froxel volume. uv is the
+// screen position with rows growing downwards.
+static inline half3 applyVolumetricLighting(half3                       color,
+                                            texture3d<half>             froxelVolume,
+                                            float2                      uv,
+                                            float                       linearDepth,
+                                            constant FrameConstants&    frame) {
+    constexpr sampler linearClamp(filter::linear, address::clamp_to_edge);
+    float slice = log(max(linearDepth, frame.volumetric_near) / frame.volumetric_near) /
+                  log(frame.volumetric_far / frame.volumetric_near);
+    // Froxel z holds the integral to the far side of its slice
+    half4 fog = froxelVolume.sample(linearClamp, float3(uv, slice - 0.5f / float(FroxelGridDepth)));
+    return color * fog.a + fog.rgb;
+}
+#endif
+
+#if TILE_LIGHT_CULLING
+// Side planes of a screen tile in eye space, facing inwards. pixelMin and pixelMax
+// are clamped to the framebuffer. Mirrored by TileLightCullingReference.
+static inline void tileFrustumPlanes(float2                 pixelMin,
+                                     float2                 pixelMax,
+                                     constant ViewConstants& view,
+                                     constant PassConstants& pass,
+                                     thread float3*         planes) {
+    float2 framebufferSize = float2(pass.framebuffer_width, pass.framebuffer_height);
+    float2 ndcMin = pixelMin / framebufferSize * 2.0f - 1.0f;
+    float2 ndcMax = pixelMax / framebufferSize * 2.0f - 1.0f;
+
+    // Pixel rows grow downwards, NDC y upwards
+    float2 cornersNDC[4] = {
+        float2(ndcMin.x, -ndcMin.y), float2(ndcMax.x, -ndcMin.y),
+        float2(ndcMax.x, -ndcMax.y), float2(ndcMin.x, -ndcMax.y)
+    };
+    float3 corners[4];
+    for (uint i = 0; i < 4; i++) {
+        float4 corner = view.projection_matrix_inverse * float4(cornersNDC[i], 1.0f, 1.0f);
+        corners[i] = corner.xyz / corner.w;
+    }
+    float3 centre = corners[0] + corners[1] + corners[2] + corners[3];
+
+    for (uint i = 0; i < 4; i++) {
+        float3 normal = normalize(cross(corners[i], corners[(i + 1) % 4]));
+        planes[i] = dot(normal, centre) < 0.0f ? -normal : normal;
+    }
+}
+
+// Sphere against the tile side planes and its linear depth range
+static inline bool pointLightInTile(float4 positionRadius, thread const float3* planes, float minDepth, float maxDepth) {
+    for (uint i = 0; i < 4; i++) {
+        if (dot(planes[i], positionRadius.xyz) < -positionRadius.w) return false;
+    }
+    float depth = -positionRadius.z;
+    return depth + positionRadius.w >= minDepth && depth - positionRadius.w <= maxDepth;
+}
+
+// Diffuse contribution of the lights culled into this tile. eyeNormal and
+// eyePosition are in eye space like the light positions.
+static inline half3 shadePointLights(half3                          albedo,
+                                     float3                         eyeNormal,
+                                     float3                         eyePosition,
+                                     constant PointLight*           lights,
+                                     threadgroup TileLightList&     tileLights) {
+    uint count = min(atomic_load_explicit(&tileLights.count, memory_order_relaxed), uint(MaxLightsPerTile));
+
+    float3 result = 0.0f;
+    for (uint i = 0; i < count; i++) {
+        PointLight light = lights[tileLights.indices[i]];
+        float3 toLight = light.position_radius.xyz - eyePosition;
+        float distanceSquared = dot(toLight, toLight);
+        float radius = light.position_radius.w;
+        if (distanceSquared >= radius * radius) continue;
+
+        // Inverse square with a window that reaches zero at the radius
+        float ratio = distanceSquared / (radius * radius);
+        float window = saturate(1.0f - ratio * ratio);
+        float attenuation = window * window / (distanceSquared + 1.0f);
+
+        float NdotL = max(dot(eyeNormal, toLight * rsqrt(max(distanceSquared, 1e-6f))), 0.0f);
+        result += light.color_intensity.rgb * (light.color_intensity.w * attenuation * NdotL);
+    }
+    return albedo * half3(result);
+}
+#endif
@@ -0,0 +1,231 @@
+#define METAL
+#include <metal_stdlib>
+using namespace metal;
+
+#include "shaderTypes.hpp"
+#include "shaderCommon.hpp"
+#if ATMOSPHERIC_SCATTERING
+#include "atmosphereCommon.hpp"
+#endif
+#include "lightingCommon.hpp"
+
+#if MSAA_DEFERRED
+// Must match DeferredMSAA::TileSize and DeferredMSAA::SampleCount
+constant uint MSAATileSize      = 8;
+constant uint MSAASampleCount   = 4;
+
+// Offsets of the threadgroup counts in the indirect dispatch buffer
+constant uint SimpleDispatchOffset  = 0;
+constant uint ComplexDispatchOffset = 3;
+
+#pragma mark Classification
+
+// Compared on raw texel bits: albedo through an RGBA8Uint view, normals through an
+// RGBA8Sint view and |depth| as its float bit pattern. Mirrored by MSAAClassifierReference.
+static bool isComplexPixel(texture2d_ms<uint>               albedo,
+                           texture2d_ms<int>                normal,
+                           texture2d_ms<float>              depth,
+                           uint2                            pixel,
+                           constant MSAAClassifyParams&     params) {
+    uint4 albedo0 = albedo.read(pixel, 0);
+    int4 normal0 = normal.read(pixel, 0);
+    uint depth0 = as_type<uint>(depth.read(pixel, 0).r) & 0x7FFFFFFF;
+
+    for (uint s = 1; s < MSAASampleCount; s++) {
+        uint4 albedoS = albedo.read(pixel, s);
+        uint4 albedoDifference = max(albedoS, albedo0) - min(albedoS, albedo0);
+        if (any(albedoDifference > params.albedoThreshold)) return true;
+
+        int4 normalDifference = abs(normal.read(pixel, s) - normal0);
+        if (uint(normalDifference.x + normalDifference.y + normalDifference.z + normalDifference.w) > params.normalThreshold) return true;
+
+        uint depthS = as_type<uint>(depth.read(pixel, s).r) & 0x7FFFFFFF;
+        if (max(depthS, depth0) - min(depthS, depth0) > params.depthThreshold) return true;
+    }
+    return false;
+}
+
+// One 8x8 threadgroup per screen tile. Writes the edge mask, resolves sample 0 of depth
+// and object ID for the passes that expect single sample targets, and appends the tile
+// to the simple and/or complex list depending on the pixels it contains.
+kernel void msaaClassifyKernel(texture2d_ms<uint>               albedo              [[texture(TextureIndexMSAAAlbedo)]],
+                               texture2d_ms<int>                normal              [[texture(TextureIndexMSAANormal)]],
+                               texture2d_ms<float>              depth               [[texture(TextureIndexMSAADepth)]],
+                               texture2d<uint, access::write>   edgeMask            [[texture(TextureIndexEdgeMask)]],
+                               texture2d<float, access::write>  resolvedDepth       [[texture(TextureIndexResolvedDepth)]],
+#if OBJECT_PICKING
+                               texture2d_ms<uint>               objectId            [[texture(TextureIndexMSAAObjectId)]],
+                               texture2d<uint, access::write>   resolvedObjectId    [[texture(TextureIndexResolvedObjectId)]],
+#endif
+                      constant MSAAClassifyParams&              params              [[buffer(BufferIndexMSAAClassify)]],
+                        device atomic_uint*                     tileDispatch        [[buffer(BufferIndexTileDispatch)]],
+                        device uint*                            simpleTiles         [[buffer(BufferIndexSimpleTiles)]],
+                        device uint*                            complexTiles        [[buffer(BufferIndexComplexTiles)]],
+                               uint2                            gid                 [[thread_position_in_grid]],
+                               uint2                            groupId             [[threadgroup_position_in_grid]],
+                               uint                             threadIndex         [[thread_index_in_threadgroup]]) {
+    threadgroup atomic_uint simpleCount;
+    threadgroup atomic_uint complexCount;
+    if (threadIndex == 0) {
+        atomic_store_explicit(&simpleCount, 0, memory_order_relaxed);
+        atomic_store_explicit(&complexCount, 0, memory_order_relaxed);
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    if (gid.x < edgeMask.get_width() && gid.y < edgeMask.get_height()) {
+        bool complex = isComplexPixel(albedo, normal, depth, gid, params);
+        edgeMask.write(uint4(complex ? 1 : 0), gid);
+        atomic_fetch_add_explicit(complex ? &complexCount : &simpleCount, 1, memory_order_relaxed);
+
+        resolvedDepth.write(depth.read(gid, 0), gid);
+#if OBJECT_PICKING
+        resolvedObjectId.write(objectId.read(gid, 0), gid);
+#endif
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    if (threadIndex == 0) {
+        uint packedTile = groupId.x | (groupId.y << 16);
+        if (atomic_load_explicit(&simpleCount, memory_order_relaxed) > 0) {
+            uint index = atomic_fetch_add_explicit(&tileDispatch[SimpleDispatchOffset], 1, memory_order_relaxed);
+            simpleTiles[index] = packedTile;
+        }
+        if (atomic_load_explicit(&complexCount, memory_order_relaxed) > 0) {
+            uint index = atomic_fetch_add_explicit(&tileDispatch[ComplexDispatchOffset], 1, memory_order_relaxed);
+            complexTiles[index] = packedTile;
+        }
+    }
+}
+
+#if REFERENCE_CHECKS
+// Copies the raw sample bits classification compared into buffers the CPU can read,
+// multisample textures cannot be blitted. Indexed by (y * width + x) * MSAASampleCount + sample.
+kernel void msaaReadbackSamplesKernel(texture2d_ms<uint>    albedo          [[texture(TextureIndexMSAAAlbedo)]],
+                                      texture2d_ms<int>     normal          [[texture(TextureIndexMSAANormal)]],
+                                      texture2d_ms<float>   depth           [[texture(TextureIndexMSAADepth)]],
+                               device uchar4*               albedoSamples   [[buffer(BufferIndexAlbedoSamples)]],
+                               device char4*                normalSamples   [[buffer(BufferIndexNormalSamples)]],
+                               device float*                depthSamples    [[buffer(BufferIndexDepthSamples)]],
+                                      uint2                 gid             [[thread_position_in_grid]]) {
+    if (gid.x >= albedo.get_width() || gid.y >= albedo.get_height()) return;
+
+    uint base = (gid.y * albedo.get_width() + gid.x) * MSAASampleCount;
+    for (uint s = 0; s < MSAASampleCount; s++) {
+        albedoSamples[base + s] = uchar4(albedo.read(gid, s));
+        normalSamples[base + s] = char4(normal.read(gid, s));
+        depthSamples[base + s] = depth.read(gid, s).r;
+    }
+}
+#endif
+
+#pragma mark Shading
+
+static inline uint2 tilePixel(uint packedTile, uint2 lid) {
+    return uint2(packedTile & 0xFFFF, packedTile >> 16) * MSAATileSize + lid;
+}
+
+// Sky or lit surface for one sample. Samples without geometry keep the normal.w of zero
+// the G-buffer was cleared to.
+static half3 shadeMSAASample(texture2d_ms<half>             albedo,
+                             texture2d_ms<half>             normal,
+                             uint2                          pixel,
+                             uint                           sampleIndex,
+                             constant FrameConstants&       frame,
+                             constant ViewConstants&        view,
+                             constant PassConstants&        pass
+#if ATMOSPHERIC_SCATTERING
+                           , constant AtmosphereParams&     atmosphere
+                           , texture2d<float>               transmittanceLUT
+                           , texture2d<float>               skyViewLUT
+#endif
+                             ) {
+    half4 normalSample = normal.read(pixel, sampleIndex);
+    if (normalSample.w < 0.5h) {
+#if ATMOSPHERIC_SCATTERING
+        float2 ndc = (float2(pixel) + 0.5f) / float2(pass.framebuffer_width, pass.framebuffer_height) * 2.0f - 1.0f;
+        float4 eyeDirection = view.projection_matrix_inverse * float4(ndc.x, -ndc.y, 1.0f, 1.0f);
+        float3x3 viewRotation = float3x3(view.view_matrix[0].xyz, view.view_matrix[1].xyz, view.view_matrix[2].xyz);
+        float3 direction = normalize(transpose(viewRotation) * (eyeDirection.xyz / eyeDirection.w));
+        float3 sunDirection = normalize(-frame.sun_eye_direction.xyz);
+        return half3(atmosphereSkyLuminance(direction, sunDirection, transmittanceLUT, skyViewLUT, atmosphere));
+#else
+        // Same as the lighting attachment clear colour of the single sample path
+        return half3(41.0h / 255.0h, 42.0h / 255.0h, 48.0h / 255.0h);
+#endif
+    }
+
+    half3 albedoSample = albedo.read(pixel, sampleIndex).rgb;
+#if ATMOSPHERIC_SCATTERING
+    return shadeDirectionalLight(albedoSample, normalize(normalSample.xyz), frame, atmosphere, transmittanceLUT);
+#else
+    return shadeDirectionalLight(albedoSample, normalize(normalSample.xyz), frame);
+#endif
+}
+
+#if ATMOSPHERIC_SCATTERING
+#define ATMOSPHERE_ARGUMENTS , atmosphere, transmittanceLUT, skyViewLUT
+#else
+#define ATMOSPHERE_ARGUMENTS
+#endif
+
+// One threadgroup per tile of the simple list, shades sample 0 of every non-edge pixel
+kernel void msaaShadeSimpleKernel(texture2d_ms<half>                albedo              [[texture(TextureIndexMSAAAlbedo)]],
+                                  texture2d_ms<half>                normal              [[texture(TextureIndexMSAANormal)]],
+                                  texture2d<uint>                   edgeMask            [[texture(TextureIndexEdgeMask)]],
+                                  texture2d<half, access::write>    output              [[texture(TextureIndexLightingOutput)]],
+#if ATMOSPHERIC_SCATTERING
+                                  texture2d<float>                  transmittanceLUT    [[texture(TextureIndexTransmittanceLUT)]],
+                                  texture2d<float>                  skyViewLUT          [[texture(TextureIndexSkyViewLUT)]],
+                         constant AtmosphereParams&                 atmosphere          [[buffer(BufferIndexAtmosphere)]],
+#endif
+                         constant FrameConstants&                   frame               [[buffer(BufferIndexFrameConstants)]],
+                         constant ViewConstants&                    view                [[buffer(BufferIndexViewConstants)]],
+                         constant PassConstants&                    pass                [[buffer(BufferIndexPassConstants)]],
+                           device const uint*                       simpleTiles         [[buffer(BufferIndexSimpleTiles)]],
+                                  uint                              groupIndex          [[threadgroup_position_in_grid]],
+                                  uint2                             lid                 [[thread_position_in_threadgroup]]) {
+    uint2 pixel = tilePixel(simpleTiles[groupIndex], lid);
+    if (pixel.x >= output.get_width() || pixel.y >= output.get_height()) return;
+    if (edgeMask.read(pixel).r != 0) return;
+
+    half3 color = shadeMSAASample(albedo, normal, pixel, 0, frame, view, pass ATMOSPHERE_ARGUMENTS);
+    output.write(half4(color, 1.0h), pixel);
+}
+
+// One threadgroup per tile of the complex list with one thread per sample (z), so edge
+// pixels spread their extra shading work across the group. Samples are box filtered.
+kernel void msaaShadeComplexKernel(texture2d_ms<half>               albedo              [[texture(TextureIndexMSAAAlbedo)]],
+                                   texture2d_ms<half>               normal              [[texture(TextureIndexMSAANormal)]],
+                                   texture2d<uint>                  edgeMask            [[texture(TextureIndexEdgeMask)]],
+                                   texture2d<half, access::write>   output              [[texture(TextureIndexLightingOutput)]],
+#if ATMOSPHERIC_SCATTERING
+                                   texture2d<float>                 transmittanceLUT    [[texture(TextureIndexTransmittanceLUT)]],
+                                   texture2d<float>                 skyViewLUT          [[texture(TextureIndexSkyViewLUT)]],
+                          constant AtmosphereParams&                atmosphere          [[buffer(BufferIndexAtmosphere)]],
+#endif
+                          constant FrameConstants&                  frame               [[buffer(BufferIndexFrameConstants)]],
+                          constant ViewConstants&                   view                [[buffer(BufferIndexViewConstants)]],
+                          constant PassConstants&                   pass                [[buffer(BufferIndexPassConstants)]],
+                            device const uint*                      complexTiles        [[buffer(BufferIndexComplexTiles)]],
+                                   uint                             groupIndex          [[threadgroup_position_in_grid]],
+                                   uint3                            lid                 [[thread_position_in_threadgroup]]) {
+    threadgroup half3 shaded[MSAASampleCount][MSAATileSize * MSAATileSize];
+
+    uint2 pixel = tilePixel(complexTiles[groupIndex], lid.xy);
+    uint pixelIndex = lid.y * MSAATileSize + lid.x;
+    bool active = pixel.x < output.get_width() && pixel.y < output.get_height() && edgeMask.read(pixel).r != 0;
+
+    if (active) {
+        shaded[lid.z][pixelIndex] = shadeMSAASample(albedo, normal, pixel, lid.z, frame, view, pass ATMOSPHERE_ARGUMENTS);
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    if (active && lid.z == 0) {
+        half3 color = 0.0h;
+        for (uint s = 0; s < MSAASampleCount; s++) {
+            color += shaded[s][pixelIndex];
+        }
+        output.write(half4(color / half(MSAASampleCount), 1.0h), pixel);
+    }
+}
+#endif
@@ -0,0 +1,132 @@
+#define METAL
+#include <metal_stdlib>
+using namespace metal;
+
+#include "shaderTypes.hpp"
+
+// Bloom kernels run 8x8 threadgroups and stage their source footprint in threadgroup
+// memory so every source texel is fetched from the texture once per group
+constant uint BloomGroupSize = 8;
+
+// Quadratic soft knee around the threshold, keeps the bloom from popping in
+static half3 bloomPrefilter(half3 color, constant PostProcessParams& params) {
+    half brightness = max(color.r, max(color.g, color.b));
+    half knee = half(params.bloomThreshold * params.bloomKnee) + 1e-4h;
+    half soft = clamp(brightness - half(params.bloomThreshold) + knee, 0.0h, 2.0h * knee);
+    soft = soft * soft / (4.0h * knee);
+    half contribution = max(soft, brightness - half(params.bloomThreshold)) / max(brightness, 1e-4h);
+    return color * contribution;
+}
+
+kernel void bloomDownsampleKernel(texture2d<half, access::read>     source          [[texture(TextureIndexPostSource)]],
+                                  texture2d<half, access::write>    destination     [[texture(TextureIndexPostDestination)]],
+                         constant PostProcessParams&                params          [[buffer(BufferIndexPostProcess)]],
+                         constant uint&                             applyThreshold  [[buffer(BufferIndexPostProcessStage)]],
+                                  uint2                             gid             [[thread_position_in_grid]],
+                                  uint2                             lid             [[thread_position_in_threadgroup]],
+                                  uint2                             groupId         [[threadgroup_position_in_grid]],
+                                  uint                              threadIndex     [[thread_index_in_threadgroup]]) {
+    // 8x8 destination texels cover a 16x16 source block, plus a one texel border for the filter
+    constexpr uint TileSize = BloomGroupSize * 2 + 2;
+    threadgroup half3 tile[TileSize * TileSize];
+
+    int2 tileOrigin = int2(groupId * BloomGroupSize * 2) - 1;
+    int2 sourceMax = int2(source.get_width(), source.get_height()) - 1;
+    for (uint i = threadIndex; i < TileSize * TileSize; i += BloomGroupSize * BloomGroupSize) {
+        int2 coord = clamp(tileOrigin + int2(i % TileSize, i / TileSize), int2(0), sourceMax);
+        half3 color = source.read(uint2(coord)).rgb;
+        tile[i] = applyThreshold ? bloomPrefilter(color, params) : color;
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    if (gid.x >= destination.get_width() || gid.y >= destination.get_height()) return;
+
+    // Separable 4x4 tent (1 3 3 1) centred on the 2x2 source block of this texel
+    const half weights[4] = {0.125h, 0.375h, 0.375h, 0.125h};
+    uint2 base = lid * 2;
+    half3 sum = 0.0h;
+    for (uint y = 0; y < 4; y++) {
+        half3 row = 0.0h;
+        for (uint x = 0; x < 4; x++) {
+            row += tile[(base.y + y) * TileSize + base.x + x] * weights[x];
+        }
+        sum += row * weights[y];
+    }
+
+    destination.write(half4(sum, 1.0h), gid);
+}
+
+kernel void bloomUpsampleKernel(texture2d<half, access::read>       source          [[texture(TextureIndexPostSource)]],
+                                texture2d<half, access::read_write> destination     [[texture(TextureIndexPostDestination)]],
+                                uint2                               gid             [[thread_position_in_grid]],
+                                uint2                               lid             [[thread_position_in_threadgroup]],
+                                uint2                               groupId         [[threadgroup_position_in_grid]],
+                                uint                                threadIndex     [[thread_index_in_threadgroup]]) {
+    // 8x8 destination texels cover a 4x4 block of the lower mip, plus a one texel border
+    constexpr uint TileSize = BloomGroupSize / 2 + 2;
+    threadgroup half3 tile[TileSize * TileSize];
+
+    int2 tileOrigin = int2(groupId * (BloomGroupSize / 2)) - 1;
+    int2 sourceMax = int2(source.get_width(), source.get_height()) - 1;
+    if (threadIndex < TileSize * TileSize) {
+        int2 coord = clamp(tileOrigin + int2(threadIndex % TileSize, threadIndex / TileSize), int2(0), sourceMax);
+        tile[threadIndex] = source.read(uint2(coord)).rgb;
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    if (gid.x >= destination.get_width() || gid.y >= destination.get_height()) return;
+
+    // Bilinear 2x upsample: every texel sits a quarter texel from its nearest source texel,
+    // towards the neighbour selected by the parity of its coordinate
+    int2 nearest = int2(lid / 2) + 1;
+    int2 neighbour = nearest + select(int2(-1), int2(1), (lid & 1) == 1);
+
+    half3 upsampled = tile[nearest.y * TileSize + nearest.x] * (9.0h / 16.0h)
+                    + tile[nearest.y * TileSize + neighbour.x] * (3.0h / 16.0h)
+                    + tile[neighbour.y * TileSize + nearest.x] * (3.0h / 16.0h)
+                    + tile[neighbour.y * TileSize + neighbour.x] * (1.0h / 16.0h);
+
+    destination.write(half4(destination.read(gid).rgb + upsampled, 1.0h), gid);
+}
+
+// Narkowicz's fit of the ACES filmic curve
+static float3 tonemapACES(float3 x) {
+    const float a = 2.51f, b = 0.03f, c = 2.43f, d = 0.59f, e = 0.14f;
+    return saturate((x * (a * x + b)) / (x * (c * x + d) + e));
+}
+
+static float interleavedGradientNoise(float2 position) {
+    return fract(52.9829189f * fract(dot(position, float2(0.06711056f, 0.00583715f))));
+}
+
+// Exposure, bloom composite, tonemapping, colour grading and dithering in a single pass
+kernel void postCompositeKernel(texture2d<half, access::read>       hdrLighting     [[texture(TextureIndexPostSource)]],
+                                texture2d<half, access::write>      output          [[texture(TextureIndexPostDestination)]],
+                                texture2d<half, access::sample>     bloom           [[texture(TextureIndexPostBloom)]],
+                       constant PostProcessParams&                  params          [[buffer(BufferIndexPostProcess)]],
+                                uint2                               gid             [[thread_position_in_grid]]) {
+    if (gid.x >= output.get_width() || gid.y >= output.get_height()) return;
+
+    constexpr sampler linearClamp(mag_filter::linear, min_filter::linear, address::clamp_to_edge);
+
+    float2 uv = (float2(gid) + 0.5f) / float2(output.get_width(), output.get_height());
+    float3 color = float3(hdrLighting.read(gid).rgb);
+    color += float3(bloom.sample(linearClamp, uv).rgb) * params.bloomIntensity;
+
+    color *= exp2(params.exposure);
+    color = tonemapACES(color);
+
+    // Lift / gamma / gain
+    color = params.gain.rgb * (color + params.lift.rgb * (1.0f - color));
+    color = pow(max(color, 0.0f), 1.0f / params.gamma.rgb);
+
+    float luma = dot(color, float3(0.2126f, 0.7152f, 0.0722f));
+    color = mix(float3(luma), color, params.saturation);
+    color = (color - 0.5f) * params.contrast + 0.5f;
+
+    // Break up banding before quantising to the 8-bit drawable
+    float noise = interleavedGradientNoise(float2(gid) + float(params.frameIndex % 64) * 5.588238f);
+    color += (noise - 0.5f) * params.ditherStrength / 255.0f;
+
+    output.write(half4(half3(saturate(color)), 1.0h), gid);
+}
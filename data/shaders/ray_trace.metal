@@ -11,59 +11,438 @@ struct TriangleResources {
     struct TriangleData {
         float4 normals[3];
         float4 colors[3];
+        float2 texcoords[3];
+        uint   opacityStates;   // 2 bits per micro triangle, see OpacityState
+        uint   alphaMaskLayer;  // Header in the alpha mask buffer
     };
     device TriangleData* triangles;
 };
 
-kernel void raytracingKernel(texture2d<float, access::write>    rayTracingTexture       [[texture(TextureIndexRaytracing)]],
-                    constant FrameData&                         frameData               [[buffer(BufferIndexFrameData)]],
-                             primitive_acceleration_structure   accelerationStructure   [[buffer(BufferIndexAccelerationStructure)]],
-                const device TriangleResources::TriangleData*   resources               [[buffer(BufferIndexResources)]],
-                             uint2                              tid                     [[thread_position_in_grid]]) {
-    
-    if (tid.x >= rayTracingTexture.get_width() || tid.y >= rayTracingTexture.get_height()) {
-        return;
+// Triangle data is stored in the acceleration structure as primitive data, in the
+// order of its geometries
+static inline const device TriangleResources::TriangleData& hitTriangle(const device void* primitiveData) {
+    return *(const device TriangleResources::TriangleData*)primitiveData;
+}
+
+#if OPACITY_MICROMAPS
+// Micro triangle holding the barycentrics, must match OpacityMicromap::microTriangleIndex
+static inline uint opacityMicroTriangle(float2 barycentrics) {
+    constexpr uint perEdge = 1u << OpacitySubdivisionLevel;
+    float2 scaled = saturate(barycentrics) * float(perEdge);
+    uint row = min(uint(scaled.y), perEdge - 1);
+    uint column = min(uint(scaled.x), perEdge - 1 - row);
+    bool inverted = (scaled.x - column) + (scaled.y - row) > 1.0f && column + row + 1 < perEdge;
+    return row * (2 * perEdge - row) + 2 * column + (inverted ? 1 : 0);
+}
+
+// Called for candidate hits on the masked geometry only, opaque triangles never get here.
+// Opaque and transparent micro triangles are answered from the precomputed states, the
+// alpha mask is only read inside unknown ones.
+[[intersection(triangle, triangle_data)]]
+bool alphaTestIntersection(float2                   barycentrics    [[barycentric_coord]],
+                           const device void*       primitiveData   [[primitive_data]],
+                           const device uint*       alphaMasks      [[buffer(IntersectionBufferIndexAlphaMasks)]]) {
+    const device TriangleResources::TriangleData& triangle = hitTriangle(primitiveData);
+    uint state = (triangle.opacityStates >> (2 * opacityMicroTriangle(barycentrics))) & 3;
+    if (state != OpacityStateUnknown) {
+        return state == OpacityStateOpaque;
     }
-    
-    float2 pixel = float2(tid);
-    float2 uv = (pixel + 0.5f) / float2(frameData.framebuffer_width, frameData.framebuffer_height);
+
+    float2 uv = triangle.texcoords[0] * (1.0f - barycentrics.x - barycentrics.y) +
+                triangle.texcoords[1] * barycentrics.x +
+                triangle.texcoords[2] * barycentrics.y;
+    const device AlphaMaskLayer& mask = ((const device AlphaMaskLayer*)alphaMasks)[triangle.alphaMaskLayer];
+    int2 texel = int2(floor(uv * float2(mask.width, mask.height)));
+    uint x = uint((texel.x % int(mask.width) + int(mask.width)) % int(mask.width));
+    uint y = uint((texel.y % int(mask.height) + int(mask.height)) % int(mask.height));
+    return (alphaMasks[mask.wordOffset + y * mask.wordsPerRow + x / 32] >> (x & 31)) & 1;
+}
+#endif
+
+// What the ray kernels trace against. With OPACITY_MICROMAPS the masked geometry runs
+// alphaTestIntersection through the pipeline's function table.
+struct RayScene {
+    primitive_acceleration_structure                accelerationStructure;
+#if OPACITY_MICROMAPS
+    intersection_function_table<triangle_data>      intersectionFunctions;
+#endif
+
+    intersection_result<triangle_data> intersect(ray ray, bool acceptAnyIntersection) const {
+        intersector<triangle_data> intersector;
+        intersector.accept_any_intersection(acceptAnyIntersection);
+#if OPACITY_MICROMAPS
+        return intersector.intersect(ray, accelerationStructure, intersectionFunctions);
+#else
+        return intersector.intersect(ray, accelerationStructure);
+#endif
+    }
+};
+
+struct CameraHit {
+    bool   hit;
+    float3 position;
+    float3 normal;          // Interpolated vertex normal
+};
+
+// Primary ray through a position in pixels, pixel centres sit at + 0.5
+static CameraHit intersectCameraRay(float2                                      pixel,
+                                    constant ViewConstants&                     view,
+                                    constant PassConstants&                     pass,
+                                    RayScene                                    scene) {
+    float2 uv = pixel / float2(pass.framebuffer_width, pass.framebuffer_height);
     float2 ndc = uv * 2.0f - 1.0f;
     ndc.y = -ndc.y;
 
-    float4 viewSpace = frameData.projection_matrix_inverse * float4(ndc, 1.0f, 1.0f);
+    float4 viewSpace = view.projection_matrix_inverse * float4(ndc, 1.0f, 1.0f);
     viewSpace = viewSpace / viewSpace.w;
 
     ray ray;
-    ray.origin = frameData.cameraPosition.xyz;
+    ray.origin = view.cameraPosition.xyz;
     ray.direction = normalize(viewSpace.xyz);
 
-    ray.direction = normalize(ray.direction.x * frameData.cameraRight.xyz +
-                              ray.direction.y * frameData.cameraUp.xyz +
-                             -ray.direction.z * frameData.cameraForward.xyz);
+    ray.direction = normalize(ray.direction.x * view.cameraRight.xyz +
+                              ray.direction.y * view.cameraUp.xyz +
+                             -ray.direction.z * view.cameraForward.xyz);
     
     ray.min_distance = 0.001f;
     ray.max_distance = INFINITY;
     
     // Perform intersection
-    intersector<triangle_data> intersector;
-    intersection_result<triangle_data> result = intersector.intersect(ray, accelerationStructure);
+    intersection_result<triangle_data> result = scene.intersect(ray, false);
     
-    float3 color = 0.0f;
-    if (result.type != intersection_type::none) {
+    CameraHit hit;
+    hit.hit = result.type != intersection_type::none;
+    if (hit.hit) {
         
-        unsigned int primitiveIndex = result.primitive_id;
-
         // Barycentric interpolation for normal
         float2 barycentrics = result.triangle_barycentric_coord;
         
-        const device TriangleResources::TriangleData& triangle = resources[primitiveIndex];
+        const device TriangleResources::TriangleData& triangle = hitTriangle(result.primitive_data);
 
-        float3 normal = normalize(triangle.normals[0].xyz * (1.0 - barycentrics.x - barycentrics.y) +
-                                  triangle.normals[1].xyz * barycentrics.x +
-                                  triangle.normals[2].xyz * barycentrics.y);
+        hit.normal = normalize(triangle.normals[0].xyz * (1.0 - barycentrics.x - barycentrics.y) +
+                               triangle.normals[1].xyz * barycentrics.x +
+                               triangle.normals[2].xyz * barycentrics.y);
+        hit.position = ray.origin + ray.direction * result.distance;
+    }
+    return hit;
+}
+
+// Returns the interpolated normal of the primary hit as a colour
+static float3 traceCameraRay(float2                                      pixel,
+                             constant ViewConstants&                     view,
+                             constant PassConstants&                     pass,
+                             RayScene                                    scene) {
+    CameraHit hit = intersectCameraRay(pixel, view, pass, scene);
+    return hit.hit ? hit.normal * 0.5f + 0.5f : float3(0.0f);
+}
 
-        color = normal*0.5+0.5;
+kernel void raytracingKernel(texture2d<float, access::write>    rayTracingTexture       [[texture(TextureIndexRaytracing)]],
+                    constant ViewConstants&                     view                    [[buffer(BufferIndexViewConstants)]],
+                    constant PassConstants&                     pass                    [[buffer(BufferIndexPassConstants)]],
+                             primitive_acceleration_structure   accelerationStructure   [[buffer(BufferIndexAccelerationStructure)]],
+#if OPACITY_MICROMAPS
+                    intersection_function_table<triangle_data>  intersectionFunctions   [[buffer(BufferIndexIntersectionFunctions)]],
+#endif
+                             uint2                              tid                     [[thread_position_in_grid]]) {
+    
+    if (tid.x >= rayTracingTexture.get_width() || tid.y >= rayTracingTexture.get_height()) {
+        return;
+    }
+
+    RayScene scene;
+    scene.accelerationStructure = accelerationStructure;
+#if OPACITY_MICROMAPS
+    scene.intersectionFunctions = intersectionFunctions;
+#endif
+    float3 color = traceCameraRay(float2(tid) + 0.5f, view, pass, scene);
+    rayTracingTexture.write(float4(color, 1.0), tid);
+}
+
+#if TILE_CLASSIFICATION
+static inline uint2 classifiedTilePixel(uint packedTile, uint2 lid) {
+    return uint2(packedTile & 0xFFFF, packedTile >> 16) * TileClassificationTileSize + lid;
+}
+
+// Indirect variant over one class list of classifyTilesKernel, one threadgroup per tile.
+// Complex tiles hold discontinuities and creases, every pixel traces its own ray.
+kernel void raytracingTilesKernel(texture2d<float, access::write>   rayTracingTexture       [[texture(TextureIndexRaytracing)]],
+                         constant ViewConstants&                    view                    [[buffer(BufferIndexViewConstants)]],
+                         constant PassConstants&                    pass                    [[buffer(BufferIndexPassConstants)]],
+                                  primitive_acceleration_structure  accelerationStructure   [[buffer(BufferIndexAccelerationStructure)]],
+#if OPACITY_MICROMAPS
+                    intersection_function_table<triangle_data>  intersectionFunctions   [[buffer(BufferIndexIntersectionFunctions)]],
+#endif
+                     const device uint*                             tiles                   [[buffer(BufferIndexTileLists)]],
+                                  uint                              groupIndex              [[threadgroup_position_in_grid]],
+                                  uint2                             lid                     [[thread_position_in_threadgroup]]) {
+    uint2 tid = classifiedTilePixel(tiles[groupIndex], lid);
+    if (tid.x >= rayTracingTexture.get_width() || tid.y >= rayTracingTexture.get_height()) {
+        return;
     }
 
+    RayScene scene;
+    scene.accelerationStructure = accelerationStructure;
+#if OPACITY_MICROMAPS
+    scene.intersectionFunctions = intersectionFunctions;
+#endif
+    float3 color = traceCameraRay(float2(tid) + 0.5f, view, pass, scene);
     rayTracingTexture.write(float4(color, 1.0), tid);
 }
+
+// Simple tiles are smooth geometry throughout, one ray through the centre of every 2x2
+// block stands in for its four pixels. One thread per block, half tile threadgroups.
+kernel void raytracingSimpleTilesKernel(texture2d<float, access::write>     rayTracingTexture       [[texture(TextureIndexRaytracing)]],
+                               constant ViewConstants&                      view                    [[buffer(BufferIndexViewConstants)]],
+                               constant PassConstants&                      pass                    [[buffer(BufferIndexPassConstants)]],
+                                        primitive_acceleration_structure    accelerationStructure   [[buffer(BufferIndexAccelerationStructure)]],
+#if OPACITY_MICROMAPS
+                          intersection_function_table<triangle_data>    intersectionFunctions   [[buffer(BufferIndexIntersectionFunctions)]],
+#endif
+                           const device uint*                               tiles                   [[buffer(BufferIndexTileLists)]],
+                                        uint                                groupIndex              [[threadgroup_position_in_grid]],
+                                        uint2                               lid                     [[thread_position_in_threadgroup]]) {
+    uint2 size = uint2(rayTracingTexture.get_width(), rayTracingTexture.get_height());
+    uint2 block = classifiedTilePixel(tiles[groupIndex], lid * 2);
+    if (any(block >= size)) {
+        return;
+    }
+
+    RayScene scene;
+    scene.accelerationStructure = accelerationStructure;
+#if OPACITY_MICROMAPS
+    scene.intersectionFunctions = intersectionFunctions;
+#endif
+    float3 color = traceCameraRay(float2(block) + 1.0f, view, pass, scene);
+    for (uint i = 0; i < 4; i++) {
+        uint2 pixel = block + uint2(i & 1, i >> 1);
+        if (all(pixel < size)) {
+            rayTracingTexture.write(float4(color, 1.0), pixel);
+        }
+    }
+}
+
+// Edge tiles mix sky and geometry. Sky pixels, non-negative in the eye depth target, take
+// the miss colour without tracing, the others trace their own ray.
+kernel void raytracingEdgeTilesKernel(texture2d<float, access::write>   rayTracingTexture       [[texture(TextureIndexRaytracing)]],
+                                      texture2d<float>                  depth                   [[texture(TextureIndexClassifyDepth)]],
+                             constant ViewConstants&                    view                    [[buffer(BufferIndexViewConstants)]],
+                             constant PassConstants&                    pass                    [[buffer(BufferIndexPassConstants)]],
+                                      primitive_acceleration_structure  accelerationStructure   [[buffer(BufferIndexAccelerationStructure)]],
+#if OPACITY_MICROMAPS
+                        intersection_function_table<triangle_data>  intersectionFunctions   [[buffer(BufferIndexIntersectionFunctions)]],
+#endif
+                         const device uint*                             tiles                   [[buffer(BufferIndexTileLists)]],
+                                      uint                              groupIndex              [[threadgroup_position_in_grid]],
+                                      uint2                             lid                     [[thread_position_in_threadgroup]]) {
+    uint2 tid = classifiedTilePixel(tiles[groupIndex], lid);
+    if (tid.x >= rayTracingTexture.get_width() || tid.y >= rayTracingTexture.get_height()) {
+        return;
+    }
+    if (depth.read(tid).r >= 0.0f) {
+        rayTracingTexture.write(float4(0.0f, 0.0f, 0.0f, 1.0f), tid);
+        return;
+    }
+
+    RayScene scene;
+    scene.accelerationStructure = accelerationStructure;
+#if OPACITY_MICROMAPS
+    scene.intersectionFunctions = intersectionFunctions;
+#endif
+    float3 color = traceCameraRay(float2(tid) + 0.5f, view, pass, scene);
+    rayTracingTexture.write(float4(color, 1.0), tid);
+}
+
+// Sky only tiles would miss everything, they are written with the miss colour directly
+kernel void clearRaytracingTilesKernel(texture2d<float, access::write>  rayTracingTexture   [[texture(TextureIndexRaytracing)]],
+                                 const device uint*                     tiles               [[buffer(BufferIndexTileLists)]],
+                                        uint                            groupIndex          [[threadgroup_position_in_grid]],
+                                        uint2                           lid                 [[thread_position_in_threadgroup]]) {
+    uint2 tid = classifiedTilePixel(tiles[groupIndex], lid);
+    if (tid.x >= rayTracingTexture.get_width() || tid.y >= rayTracingTexture.get_height()) {
+        return;
+    }
+    rayTracingTexture.write(float4(0.0f, 0.0f, 0.0f, 1.0f), tid);
+}
+#endif
+
+#if SECONDARY_RAY_QUEUE
+// Bin of a secondary ray, must match SecondaryRayQueue::sortKey on the CPU
+static inline uint secondaryRayKey(float3 origin, float3 direction, constant SecondaryRayParams& params) {
+    uint3 cell = uint3(saturate((origin - params.boundsMin.xyz) * params.boundsInverseExtent.xyz) * 7.999f);
+    uint morton = 0;
+    for (uint bit = 0; bit < 3; bit++) {
+        morton |= ((cell.x >> bit) & 1) << (3 * bit) |
+                  ((cell.y >> bit) & 1) << (3 * bit + 1) |
+                  ((cell.z >> bit) & 1) << (3 * bit + 2);
+    }
+
+    direction /= abs(direction.x) + abs(direction.y) + abs(direction.z);
+    float2 octahedral = direction.xz;
+    if (direction.y < 0.0f) {
+        octahedral = (1.0f - abs(direction.zx)) * select(float2(-1.0f), float2(1.0f), direction.xz >= 0.0f);
+    }
+    uint2 directionCell = uint2(saturate(octahedral * 0.5f + 0.5f) * 7.999f);
+    return (morton << SecondaryRayDirectionBits) | (directionCell.y << 3) | directionCell.x;
+}
+
+static inline uint hashUint(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline uint packColor(float3 color) {
+    uint4 bytes = uint4(saturate(float4(color, 1.0f)) * 255.0f + 0.5f);
+    return bytes.x | (bytes.y << 8) | (bytes.z << 16) | (bytes.w << 24);
+}
+
+// Counts and the ray count start at zero every frame
+kernel void clearSecondaryRayBinsKernel(device uint*    bins    [[buffer(BufferIndexSecondaryRayBins)]],
+                                        uint            tid     [[thread_position_in_grid]]) {
+    if (tid <= SecondaryRayBinCount) {
+        bins[tid] = 0;
+    }
+}
+
+// Primary rays, one per pixel. Misses are written straight away, hits queue one
+// cosine weighted ambient occlusion ray and count it into its bin.
+kernel void queueSecondaryRaysKernel(texture2d<float, access::write>    rayTracingTexture       [[texture(TextureIndexRaytracing)]],
+                            constant ViewConstants&                     view                    [[buffer(BufferIndexViewConstants)]],
+                            constant PassConstants&                     pass                    [[buffer(BufferIndexPassConstants)]],
+                                     primitive_acceleration_structure   accelerationStructure   [[buffer(BufferIndexAccelerationStructure)]],
+#if OPACITY_MICROMAPS
+                    intersection_function_table<triangle_data>  intersectionFunctions   [[buffer(BufferIndexIntersectionFunctions)]],
+#endif
+                            constant SecondaryRayParams&                params                  [[buffer(BufferIndexSecondaryRayParams)]],
+                              device SecondaryRay*                      rays                    [[buffer(BufferIndexSecondaryRays)]],
+                              device atomic_uint*                       bins                    [[buffer(BufferIndexSecondaryRayBins)]],
+                                     uint2                              tid                     [[thread_position_in_grid]]) {
+    if (tid.x >= rayTracingTexture.get_width() || tid.y >= rayTracingTexture.get_height()) {
+        return;
+    }
+
+    RayScene scene;
+    scene.accelerationStructure = accelerationStructure;
+#if OPACITY_MICROMAPS
+    scene.intersectionFunctions = intersectionFunctions;
+#endif
+    CameraHit hit = intersectCameraRay(float2(tid) + 0.5f, view, pass, scene);
+    if (!hit.hit) {
+        rayTracingTexture.write(float4(0.0f, 0.0f, 0.0f, 1.0f), tid);
+        return;
+    }
+
+    uint seed = hashUint(tid.x | (tid.y << 16)) ^ hashUint(params.frameIndex);
+    float2 u = float2(hashUint(seed), hashUint(seed ^ 0x9e3779b9u)) * (1.0f / 4294967296.0f);
+    float3 n = hit.normal;
+    float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+    float a = -1.0f / (sign + n.z);
+    float b = n.x * n.y * a;
+    float3 tangent = float3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    float3 bitangent = float3(b, sign + n.y * n.y * a, -n.y);
+    float radius = sqrt(u.x);
+    float phi = 2.0f * M_PI_F * u.y;
+    float3 direction = normalize(tangent * (radius * cos(phi)) + bitangent * (radius * sin(phi)) + n * sqrt(max(0.0f, 1.0f - u.x)));
+    float3 origin = hit.position + n * (params.maxDistance * 0.01f);
+
+    SecondaryRay queued;
+    queued.origin_maxDistance = float4(origin, params.maxDistance);
+    queued.direction = float4(direction, 0.0f);
+    queued.pixel = tid.x | (tid.y << 16);
+    queued.color = packColor(n * 0.5f + 0.5f);
+    queued.key = secondaryRayKey(origin, direction, params);
+
+    uint index = atomic_fetch_add_explicit(&bins[SecondaryRayBinCount], 1, memory_order_relaxed);
+    rays[index] = queued;
+    atomic_fetch_add_explicit(&bins[queued.key], 1, memory_order_relaxed);
+}
+
+// Exclusive prefix sum of the bin counts in one threadgroup, then the indirect
+// arguments of the sorted passes from the ray count
+kernel void scanSecondaryRayBinsKernel(device uint*     bins    [[buffer(BufferIndexSecondaryRayBins)]],
+                                       uint             lid     [[thread_position_in_threadgroup]]) {
+    constexpr uint binsPerThread = SecondaryRayBinCount / SecondaryRayScanThreads;
+    threadgroup uint sums[SecondaryRayScanThreads];
+
+    uint first = lid * binsPerThread;
+    uint sum = 0;
+    for (uint i = 0; i < binsPerThread; i++) {
+        sum += bins[first + i];
+    }
+    sums[lid] = sum;
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    for (uint offset = 1; offset < SecondaryRayScanThreads; offset <<= 1) {
+        uint value = lid >= offset ? sums[lid - offset] : 0;
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        sums[lid] += value;
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+    }
+
+    uint offset = sums[lid] - sum;
+    for (uint i = 0; i < binsPerThread; i++) {
+        uint count = bins[first + i];
+        bins[first + i] = offset;
+        offset += count;
+    }
+
+    if (lid == 0) {
+        uint rayCount = bins[SecondaryRayBinCount];
+        bins[SecondaryRayBinCount + 1] = (rayCount + SecondaryRayGroupSize - 1) / SecondaryRayGroupSize;
+        bins[SecondaryRayBinCount + 2] = 1;
+        bins[SecondaryRayBinCount + 3] = 1;
+    }
+}
+
+// Copies every ray to its bin's next slot in the sorted half. Order inside a bin is
+// not deterministic, which does not matter for coherence.
+kernel void scatterSecondaryRaysKernel(constant SecondaryRayParams&     params  [[buffer(BufferIndexSecondaryRayParams)]],
+                                         device SecondaryRay*           rays    [[buffer(BufferIndexSecondaryRays)]],
+                                         device atomic_uint*            bins    [[buffer(BufferIndexSecondaryRayBins)]],
+                                                uint                    tid     [[thread_position_in_grid]]) {
+    if (tid >= atomic_load_explicit(&bins[SecondaryRayBinCount], memory_order_relaxed)) {
+        return;
+    }
+    SecondaryRay queued = rays[tid];
+    uint slot = atomic_fetch_add_explicit(&bins[queued.key], 1, memory_order_relaxed);
+    rays[params.capacity + slot] = queued;
+}
+
+// Traces the sorted rays and scatters the shaded result back to their pixels.
+// Occluded samples keep a quarter of the primary colour.
+kernel void traceSecondaryRaysKernel(texture2d<float, access::write>    rayTracingTexture       [[texture(TextureIndexRaytracing)]],
+                                     primitive_acceleration_structure   accelerationStructure   [[buffer(BufferIndexAccelerationStructure)]],
+#if OPACITY_MICROMAPS
+                    intersection_function_table<triangle_data>  intersectionFunctions   [[buffer(BufferIndexIntersectionFunctions)]],
+#endif
+                            constant SecondaryRayParams&                params                  [[buffer(BufferIndexSecondaryRayParams)]],
+                        const device SecondaryRay*                      rays                    [[buffer(BufferIndexSecondaryRays)]],
+                        const device uint*                              bins                    [[buffer(BufferIndexSecondaryRayBins)]],
+                                     uint                               tid                     [[thread_position_in_grid]]) {
+    if (tid >= bins[SecondaryRayBinCount]) {
+        return;
+    }
+    SecondaryRay queued = rays[params.capacity + tid];
+
+    ray ray;
+    ray.origin = queued.origin_maxDistance.xyz;
+    ray.direction = queued.direction.xyz;
+    ray.min_distance = params.minDistance;
+    ray.max_distance = queued.origin_maxDistance.w;
+
+    RayScene scene;
+    scene.accelerationStructure = accelerationStructure;
+#if OPACITY_MICROMAPS
+    scene.intersectionFunctions = intersectionFunctions;
+#endif
+    intersection_result<triangle_data> result = scene.intersect(ray, true);
+    float visibility = result.type == intersection_type::none ? 1.0f : 0.25f;
+
+    float3 color = float3(queued.color & 0xFF, (queued.color >> 8) & 0xFF, (queued.color >> 16) & 0xFF) / 255.0f;
+    uint2 pixel = uint2(queued.pixel & 0xFFFF, queued.pixel >> 16);
+    rayTracingTexture.write(float4(color * visibility, 1.0f), pixel);
+}
+#endif
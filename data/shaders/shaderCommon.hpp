@@ -10,8 +10,25 @@ struct GBufferData
     half4 albedo_specular [[color(RenderTargetAlbedo),   raster_order_group(GBufferROG)]];
     half4 normal_map      [[color(RenderTargetNormal),   raster_order_group(GBufferROG)]];
     float depth           [[color(RenderTargetDepth),    raster_order_group(GBufferROG)]];
+#if OBJECT_PICKING
+    uint2 object_id       [[color(RenderTargetObjectId), raster_order_group(GBufferROG)]];
+#endif
 };
 
+// Irradiance / pi for a world space normal from the coefficients in FrameConstants
+static inline float3 evaluateSHIrradiance(float3 n, constant float4* sh) {
+    float3 result = sh[0].xyz * 0.282095f;
+    result += sh[1].xyz * (0.488603f * n.y);
+    result += sh[2].xyz * (0.488603f * n.z);
+    result += sh[3].xyz * (0.488603f * n.x);
+    result += sh[4].xyz * (1.092548f * n.x * n.y);
+    result += sh[5].xyz * (1.092548f * n.y * n.z);
+    result += sh[6].xyz * (0.315392f * (3.0f * n.z * n.z - 1.0f));
+    result += sh[7].xyz * (1.092548f * n.x * n.z);
+    result += sh[8].xyz * (0.546274f * (n.x * n.x - n.y * n.y));
+    return max(result, 0.0f);
+}
+
 // Final buffer outputs using Raster Order Groups
 struct AccumLightBuffer
 {
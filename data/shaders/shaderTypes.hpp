@@ -1,55 +1,320 @@
+#pragma once
+
 #include <simd/simd.h>
 #include "config.hpp"
 
-struct FrameData {
-	// Per Frame Constants
+// Shader constants are split into blocks by how often they change. Each block has
+// its own binding and its own offset in the per frame constant buffer (see
+// ConstantBlocks), so only blocks that changed are rewritten and extra views only
+// add a ViewConstants block. Layouts are checked below by both compilers.
+
+// Changes at most once per frame
+struct FrameConstants {
+	simd::float4 sun_color;
+	simd::float4 sun_eye_direction;
+	float sun_specular_intensity;
+	float ambient_intensity;
+	float volumetric_near;          // Depth range of the froxel volume, see VolumetricParams
+	float volumetric_far;
+	
+	// Cosine convolved L2 spherical harmonics of the environment, rgb in xyz,
+	// already divided by pi (see EnvironmentLighting::toIrradiance)
+	simd::float4 sh_irradiance[9];
+};
+
+// One per camera drawn in the frame
+struct ViewConstants {
 	simd::float4x4 projection_matrix;
 	simd::float4x4 projection_matrix_inverse;
 	simd::float4x4 view_matrix;
-    
-    // Camera properties
-    simd::float4 cameraUp;
-    simd::float4 cameraRight;
-    simd::float4 cameraForward;
-    simd::float4 cameraPosition;
 	
+	// Camera properties
+	simd::float4 cameraUp;
+	simd::float4 cameraRight;
+	simd::float4 cameraForward;
+	simd::float4 cameraPosition;
+};
+
+// Render target of the pass, changes on resize
+struct PassConstants {
 	uint framebuffer_width;
 	uint framebuffer_height;
-	float sun_specular_intensity;
-	uint _pad1;
+	uint _pad0[2];
+};
+
+// One per mesh, written when the mesh is placed
+struct InstanceConstants {
+	simd::float4x4 model_matrix;
 	
-	// Vector group
-	simd::float4 sun_color;
-	simd::float4 sun_eye_direction;
+	// Note: float3x3 is padded to float4x3 in GPU memory
+	simd::float3x3 normal_matrix;
+};
+
+#define CHECK_CONSTANT_LAYOUT(type, member, offset) \
+	static_assert(__builtin_offsetof(type, member) == offset, #type "::" #member " moved")
+
+CHECK_CONSTANT_LAYOUT(FrameConstants, sun_color, 0);
+CHECK_CONSTANT_LAYOUT(FrameConstants, sun_eye_direction, 16);
+CHECK_CONSTANT_LAYOUT(FrameConstants, sun_specular_intensity, 32);
+CHECK_CONSTANT_LAYOUT(FrameConstants, ambient_intensity, 36);
+CHECK_CONSTANT_LAYOUT(FrameConstants, volumetric_near, 40);
+CHECK_CONSTANT_LAYOUT(FrameConstants, sh_irradiance, 48);
+static_assert(sizeof(FrameConstants) == 192, "FrameConstants size");
+
+CHECK_CONSTANT_LAYOUT(ViewConstants, projection_matrix, 0);
+CHECK_CONSTANT_LAYOUT(ViewConstants, projection_matrix_inverse, 64);
+CHECK_CONSTANT_LAYOUT(ViewConstants, view_matrix, 128);
+CHECK_CONSTANT_LAYOUT(ViewConstants, cameraUp, 192);
+CHECK_CONSTANT_LAYOUT(ViewConstants, cameraRight, 208);
+CHECK_CONSTANT_LAYOUT(ViewConstants, cameraForward, 224);
+CHECK_CONSTANT_LAYOUT(ViewConstants, cameraPosition, 240);
+static_assert(sizeof(ViewConstants) == 256, "ViewConstants size");
+
+CHECK_CONSTANT_LAYOUT(PassConstants, framebuffer_width, 0);
+CHECK_CONSTANT_LAYOUT(PassConstants, framebuffer_height, 4);
+static_assert(sizeof(PassConstants) == 16, "PassConstants size");
+
+CHECK_CONSTANT_LAYOUT(InstanceConstants, model_matrix, 0);
+CHECK_CONSTANT_LAYOUT(InstanceConstants, normal_matrix, 64);
+static_assert(sizeof(InstanceConstants) == 112, "InstanceConstants size");
+
+#undef CHECK_CONSTANT_LAYOUT
+
+// Exposure, bloom and colour grading settings shared by the post-processing
+// kernels and the CPU reference implementation
+struct PostProcessParams {
+	float exposure;             // EV applied before tonemapping
+	float bloomThreshold;
+	float bloomKnee;            // Width of the soft threshold curve
+	float bloomIntensity;
 	
-	// Matrix group
-	simd::float4x4 _pad2;
-	simd::float4x4 _pad3;
-	simd::float4x4 _pad4;
-	simd::float4x4 scene_model_matrix;
-	simd::float4x4 scene_modelview_matrix;
+	simd::float4 lift;          // rgb, w unused
+	simd::float4 gamma;
+	simd::float4 gain;
 	
-	// Note: float3x3 is padded to float4x3 in GPU memory
-	simd::float3x3 scene_normal_matrix;          // 48 bytes
+	float saturation;
+	float contrast;
+	float ditherStrength;       // In 8-bit output steps
+	uint frameIndex;
+};
+
+// Planet and medium description for the atmosphere LUTs, distances in km and
+// coefficients per km. Shared by the LUT kernels, the sky and the lighting pass.
+struct AtmosphereParams {
+	simd::float4 rayleighScattering;
+	simd::float4 mieScattering;
+	simd::float4 mieExtinction;
+	simd::float4 ozoneAbsorption;
+	simd::float4 groundAlbedo;
+	simd::float4 sunIlluminance;    // Radiance scale of the sky and sun disc
+	simd::float4 sunDirection;      // World space, towards the sun, as used for the sky view LUT
+	
+	float bottomRadius;
+	float topRadius;
+	float cameraRadius;             // Distance of the camera from the planet centre
+	float miePhaseG;
+	
+	float rayleighScaleHeight;
+	float mieScaleHeight;
+	float ozoneCenterHeight;
+	float ozoneHalfWidth;
+};
+
+// Thresholds for the MSAA edge classification. All comparisons are on integer
+// texel values so the CPU reference produces bit identical masks.
+struct MSAAClassifyParams {
+	uint depthThreshold;        // Max difference of the |eye depth| float bit patterns (~ relative ulps)
+	uint normalThreshold;       // Max L1 distance between snorm8 normals, in steps of 1/127
+	uint albedoThreshold;       // Max per channel albedo difference, in steps of 1/255
+};
+
+// Point light, position in eye space (xyz) and radius of influence (w). The engine
+// keeps the lights in world space and writes an eye space copy every frame.
+struct PointLight {
+	simd::float4 position_radius;
+	simd::float4 color_intensity;   // rgb colour, w intensity
+};
+
+typedef enum TileLightingLimits {
+	TileLightingTileSize    = 16,   // Pixels per side of a tile shading tile
+	MaxLightsPerTile        = 64
+} TileLightingLimits;
+
+struct TileLightingParams {
+	uint lightCount;
+};
+
+// Threadgroup memory written by the light culling tile kernel and read by the
+// lighting fragment of the same tile. Depth bounds are positive linear eye depth
+// stored as float bits. count is the number of lights that passed the test and
+// may exceed MaxLightsPerTile, only the first MaxLightsPerTile indices are kept.
+struct TileLightList {
+#ifdef METAL
+	atomic_uint minDepthBits;
+	atomic_uint maxDepthBits;
+	atomic_uint count;
+#else
+	uint minDepthBits;
+	uint maxDepthBits;
+	uint count;
+#endif
+	uint _pad;
+	ushort indices[MaxLightsPerTile];
+};
+
+// Screen tile classes written by classifyTilesKernel. Empty tiles only show sky,
+// edge tiles mix sky and geometry, complex tiles contain depth discontinuities or
+// creases and simple tiles are smooth geometry throughout.
+typedef enum TileClass {
+	TileClassEmpty,
+	TileClassSimple,
+	TileClassComplex,
+	TileClassEdge,
+	TileClassCount
+} TileClass;
+
+typedef enum TileClassificationLimits {
+	TileClassificationTileSize = 16
+} TileClassificationLimits;
+
+struct TileClassifyParams {
+	float discontinuityThreshold;   // Relative depth step between neighbours
+	float creaseThreshold;          // Relative second difference of 1 / depth, zero on planes
+	uint  tileListCapacity;         // Tiles per class list, offset of list n is n * capacity
+};
+
+// Octahedral impostor atlas of one mesh. Frames sit on the vertices of a
+// framesPerSide^2 grid over the (hemi-)octahedron, each one an orthographic view
+// towards center covering radius. Depth is the eye depth of the bake camera, which
+// sits 2 * radius from the centre along the frame direction.
+struct ImpostorParams {
+	simd::float4 center_radius;     // Object space bounding sphere
+	uint framesPerSide;
+	uint hemisphere;                // Upper hemisphere only, for objects that are never seen from below
+	uint _pad0[2];
+};
+
+// Far instance drawn as a camera facing quad, translation and uniform scale only
+struct ImpostorInstance {
+	simd::float4 position_scale;
+};
+
+// Secondary ray queue of SECONDARY_RAY_QUEUE. Rays are binned by a key made of the
+// Morton code of their origin, quantised over the scene bounds (high bits), and the
+// cell of their octahedral direction (low bits), then traced in bin order so
+// neighbouring threads walk the same part of the acceleration structure.
+typedef enum SecondaryRayLimits {
+	SecondaryRayOriginBits      = 9,    // 3 per axis
+	SecondaryRayDirectionBits   = 6,    // 3 per octahedral axis
+	SecondaryRayBinCount        = 1 << (SecondaryRayOriginBits + SecondaryRayDirectionBits),
+	SecondaryRayScanThreads     = 1024, // One threadgroup scans all bins
+	SecondaryRayGroupSize       = 64    // Threads per threadgroup of the sorted dispatches
+} SecondaryRayLimits;
+
+struct SecondaryRayParams {
+	simd::float4 boundsMin;             // Scene bounds, origins are quantised inside them
+	simd::float4 boundsInverseExtent;
+	float maxDistance;                  // Ambient occlusion radius
+	uint frameIndex;                    // Seeds the ray directions
+	uint capacity;                      // Rays per half of the ray buffer, one per pixel
+	float minDistance;                  // Proxy error, hits closer than it are the surface itself
+};
+
+// Unsorted rays fill the first half of the ray buffer, the scatter writes the sorted
+// copy to the second half. The bin buffer holds SecondaryRayBinCount counts (turned
+// into write offsets by the scan), the ray count and the indirect dispatch arguments
+// of the sorted passes.
+struct SecondaryRay {
+	simd::float4 origin_maxDistance;
+	simd::float4 direction;
+	uint pixel;                         // x | y << 16
+	uint color;                         // RGBA8 colour of the primary hit
+	uint key;
+	uint _pad0;
+};
+
+// Opacity micromaps of OPACITY_MICROMAPS. Alpha masked triangles are split into
+// OpacityMicroTriangleCount micro triangles, rows of them parallel to the first edge,
+// each classified against the alpha mask of its texture layer. Two bits per micro
+// triangle fit a whole triangle in one uint.
+typedef enum OpacityState {
+	OpacityStateTransparent     = 0,
+	OpacityStateOpaque          = 1,
+	OpacityStateUnknown         = 2     // Straddles the mask edge, the intersection function tests the texel
+} OpacityState;
+
+typedef enum OpacityMicromapLimits {
+	OpacitySubdivisionLevel     = 2,    // Micro triangles per edge is 1 << level
+	OpacityMicroTriangleCount   = 1 << (2 * OpacitySubdivisionLevel)
+} OpacityMicromapLimits;
+
+// Alpha mask of one texture layer, 1 bit per texel with rows padded to whole words.
+// Headers for every layer come first in the mask buffer, followed by the words.
+struct AlphaMaskLayer {
+	uint wordOffset;                    // From the start of the mask buffer, in words
+	uint width;                         // Zero for layers that need no mask
+	uint height;
+	uint wordsPerRow;
+};
+
+// Froxel volume of VOLUMETRIC_LIGHTING, aligned with the camera: x and y follow the
+// screen, slices are spaced exponentially in linear depth between nearDistance and
+// farDistance. Medium settings come first and are edited in the editor, the rest is
+// rewritten every frame.
+typedef enum VolumetricLimits {
+	FroxelGridWidth             = 160,
+	FroxelGridHeight            = 90,
+	FroxelGridDepth             = 64,
+	FroxelJitterPeriod          = 16    // Frames before the sample positions repeat
+} VolumetricLimits;
+
+struct VolumetricParams {
+	simd::float4 scatteringColor;       // rgb ratio of scattering to extinction, w unused
+	float density;                      // Extinction per metre at and below baseHeight
+	float heightFalloff;                // Exponential, per metre above baseHeight
+	float baseHeight;
+	float anisotropy;                   // Henyey-Greenstein g, positive scatters forwards
+	float ambientScale;                 // Of the SH ambient light scattered into the medium
+	float historyWeight;                // Of the new samples when the history is valid
+	float nearDistance;
+	float farDistance;
+	
+	simd::float4x4 inverseViewMatrix;
+	simd::float4x4 previousViewProjection;  // World to the previous frame's clip space
+	simd::float4 jitter;                // Sample offset inside the froxel in froxels, xyz in [0, 1)
+	uint historyValid;
+	uint _pad0[3];
 };
 
+typedef enum IntersectionBufferIndex {
+	IntersectionBufferIndexAlphaMasks   = 0
+} IntersectionBufferIndex;
+
 typedef enum RenderTargetIndex {
 	RenderTargetLighting,
 	RenderTargetAlbedo,
 	RenderTargetNormal,
 	RenderTargetDepth,
+	RenderTargetObjectId,
 	RenderTargetMax
 } RenderTargetIndex;
 
-typedef enum VertexAttributes {
-	VertexAttributePosition  	= 0,
-	VertexAttributeTexcoord  	= 1,
-	VertexAttributeNormal    	= 2,
-	VertexAttributeTangent   	= 3,
-	VertexAttributeBitangent 	= 4,
-	VertexAttributeDiffuseIndex = 5,
-	VertexAttributeNormalIndex 	= 6
-} VertexAttributes;
+// Element formats of the deinterleaved vertex streams. Vertex shaders pull every
+// attribute by index and decode it according to the mesh's VertexStreamLayout, so
+// meshes with different layouts share one pipeline.
+typedef enum VertexStreamFormat {
+	VertexStreamFormatFloat4,       // Position: float4. Tangent frame: normal, tangent, bitangent as float4
+	VertexStreamFormatFloat3,       // Position: packed float3
+	VertexStreamFormatSnorm16,      // Tangent frame: normal, tangent, bitangent as snorm short4
+	VertexStreamFormatFloat2        // Texcoord: float2
+} VertexStreamFormat;
+
+// Texture indices are always a short2 stream (diffuse, normal), -1 for none
+struct VertexStreamLayout {
+	uint positionFormat;
+	uint tangentFrameFormat;
+	uint texcoordFormat;
+};
 
 typedef enum TextureIndex {
 	TextureIndexBaseColor = 0,
@@ -57,17 +322,75 @@ typedef enum TextureIndex {
 	TextureIndexNormal    = 2,
 	TextureIndexAlpha     = 3,
     TextureIndexRaytracing = 4,
+    TextureIndexEditorOverlay = 5,
+    TextureIndexPostSource = 6,
+    TextureIndexPostDestination = 7,
+    TextureIndexPostBloom = 8,
+    TextureIndexTransmittanceLUT = 9,
+    TextureIndexMultiScatteringLUT = 10,
+    TextureIndexSkyViewLUT = 11,
+    TextureIndexMSAAAlbedo = 12,
+    TextureIndexMSAANormal = 13,
+    TextureIndexMSAADepth = 14,
+    TextureIndexMSAAObjectId = 15,
+    TextureIndexEdgeMask = 16,
+    TextureIndexResolvedDepth = 17,
+    TextureIndexResolvedObjectId = 18,
+    TextureIndexLightingOutput = 19,
+    TextureIndexClassifyDepth = 20,
+    TextureIndexImpostorAlbedo = 21,
+    TextureIndexImpostorNormal = 22,
+    TextureIndexImpostorDepth = 23,
+    TextureIndexFroxelHistory = 24,
+    TextureIndexFroxelScattering = 25,
+    TextureIndexFroxelVolume = 26,
 
 	NumMeshTextures = TextureIndexNormal + 1
 
 } TextureIndex;
 
 typedef enum BufferIndex {
-    BufferIndexVertexData               = 0,
-    BufferIndexVertexBytes              = 1,
-    BufferIndexFrameData                = 2,
+    BufferIndexPositionStream           = 0,
+    BufferIndexInstanceConstants        = 1,
+    BufferIndexFrameConstants           = 2,
     BufferIndexResources                = 3,
     BufferIndexAccelerationStructure    = 4,
     BufferIndexDiffuseInfo             = 5,
-    BufferIndexNormalInfo              = 6
+    BufferIndexNormalInfo              = 6,
+    BufferIndexObjectId                = 7,
+    BufferIndexPostProcess             = 8,
+    BufferIndexPostProcessStage        = 9,
+    BufferIndexAtmosphere              = 10,
+    BufferIndexMSAAClassify            = 11,
+    BufferIndexTileDispatch            = 12,
+    BufferIndexSimpleTiles             = 13,
+    BufferIndexComplexTiles            = 14,
+    BufferIndexPointLights             = 15,
+    BufferIndexTileLighting            = 16,
+    BufferIndexTileClassify            = 17,
+    BufferIndexTileClassDispatch       = 18,
+    BufferIndexTileLists               = 19,
+    BufferIndexTangentFrameStream      = 20,
+    BufferIndexTexcoordStream          = 21,
+    BufferIndexTextureIndexStream      = 22,
+    BufferIndexVertexStreamLayout      = 23,
+    BufferIndexViewConstants           = 24,
+    BufferIndexPassConstants           = 25,
+    BufferIndexImpostorParams          = 26,
+    BufferIndexImpostorInstances       = 27,
+    BufferIndexSecondaryRayParams      = 28,
+    BufferIndexSecondaryRays           = 29,
+    BufferIndexSecondaryRayBins        = 30,
+
+    // Metal has 31 buffer slots. Compute only bindings reuse slots of the vertex stage.
+    BufferIndexIntersectionFunctions   = BufferIndexPositionStream,
+    BufferIndexVolumetrics             = BufferIndexTangentFrameStream,
+    BufferIndexAlbedoSamples           = BufferIndexPositionStream,
+    BufferIndexNormalSamples           = BufferIndexTangentFrameStream,
+    BufferIndexDepthSamples            = BufferIndexTexcoordStream,
+    BufferIndexTileLightExport         = BufferIndexPositionStream
 } BufferIndex;
+
+typedef enum ThreadgroupIndex {
+    ThreadgroupIndexTileLights         = 0
+} ThreadgroupIndex;
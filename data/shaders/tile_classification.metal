@@ -0,0 +1,81 @@
+#define METAL
+#include <metal_stdlib>
+using namespace metal;
+
+#include "shaderTypes.hpp"
+
+constant uint TileFlagGeometry  = 1 << 0;
+constant uint TileFlagSky       = 1 << 1;
+constant uint TileFlagComplex   = 1 << 2;
+
+// Linear depth of a pixel, zero for sky (the eye depth target is cleared to a positive value)
+static inline float linearDepth(texture2d<float> depth, int2 pixel) {
+    float eyeDepth = depth.read(uint2(pixel)).r;
+    return eyeDepth < 0.0f ? -eyeDepth : 0.0f;
+}
+
+// True when the pixel sits on a depth discontinuity or a crease. Creases are found from
+// the second difference of 1 / depth, which is zero across any plane. Mirrored by
+// TileClassifierReference.
+static bool isComplexPixel(texture2d<float> depth, int2 pixel, float z, constant TileClassifyParams& params) {
+    int2 size = int2(depth.get_width(), depth.get_height());
+    const int2 axes[2] = {int2(1, 0), int2(0, 1)};
+
+    for (uint i = 0; i < 2; i++) {
+        int2 next = pixel + axes[i];
+        int2 previous = pixel - axes[i];
+        float zNext = all(next < size) ? linearDepth(depth, next) : 0.0f;
+        float zPrevious = all(previous >= 0) ? linearDepth(depth, previous) : 0.0f;
+
+        if (zNext > 0.0f && abs(zNext - z) > params.discontinuityThreshold * min(zNext, z)) return true;
+
+        if (zNext > 0.0f && zPrevious > 0.0f) {
+            float w = 1.0f / z;
+            if (abs(1.0f / zPrevious - 2.0f * w + 1.0f / zNext) > params.creaseThreshold * w) return true;
+        }
+    }
+    return false;
+}
+
+// One threadgroup per tile. Flags are combined per SIMD group before the threadgroup
+// atomic, the first thread appends the tile to the list of its class.
+kernel void classifyTilesKernel(texture2d<float>                depth           [[texture(TextureIndexClassifyDepth)]],
+                       constant TileClassifyParams&             params          [[buffer(BufferIndexTileClassify)]],
+                         device atomic_uint*                    dispatchArgs    [[buffer(BufferIndexTileClassDispatch)]],
+                         device uint*                           tileLists       [[buffer(BufferIndexTileLists)]],
+                                uint2                           gid             [[thread_position_in_grid]],
+                                uint2                           groupId         [[threadgroup_position_in_grid]],
+                                uint                            threadIndex     [[thread_index_in_threadgroup]]) {
+    threadgroup atomic_uint tileFlags;
+    if (threadIndex == 0) {
+        atomic_store_explicit(&tileFlags, 0, memory_order_relaxed);
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    uint flags = 0;
+    if (gid.x < depth.get_width() && gid.y < depth.get_height()) {
+        float z = linearDepth(depth, int2(gid));
+        if (z > 0.0f) {
+            flags = TileFlagGeometry | (isComplexPixel(depth, int2(gid), z, params) ? TileFlagComplex : 0);
+        } else {
+            flags = TileFlagSky;
+        }
+    }
+    flags = simd_or(flags);
+    if (simd_is_first()) {
+        atomic_fetch_or_explicit(&tileFlags, flags, memory_order_relaxed);
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    if (threadIndex == 0) {
+        flags = atomic_load_explicit(&tileFlags, memory_order_relaxed);
+        TileClass tileClass = !(flags & TileFlagGeometry)    ? TileClassEmpty
+                            : (flags & TileFlagSky)          ? TileClassEdge
+                            : (flags & TileFlagComplex)      ? TileClassComplex
+                                                             : TileClassSimple;
+
+        // Threadgroup count x of the class's MTLDispatchThreadgroupsIndirectArguments
+        uint index = atomic_fetch_add_explicit(&dispatchArgs[tileClass * 3], 1, memory_order_relaxed);
+        tileLists[tileClass * params.tileListCapacity + index] = groupId.x | (groupId.y << 16);
+    }
+}
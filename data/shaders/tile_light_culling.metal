@@ -0,0 +1,90 @@
+#define METAL
+#include <metal_stdlib>
+using namespace metal;
+
+#include "shaderTypes.hpp"
+#include "shaderCommon.hpp"
+#include "lightingCommon.hpp"
+
+#if TILE_LIGHT_CULLING
+// Tile shading stage dispatched between the G-buffer draws and the lighting pass with
+// one thread per pixel. Reads eye depth straight from the imageblock, reduces the
+// tile's linear depth bounds and culls the point lights into threadgroup memory that
+// stays resident for the lighting fragments of the tile.
+kernel void cullLightsTileKernel(imageblock<GBufferData, imageblock_layout_implicit>    gBuffer,
+                        constant ViewConstants&                                         view        [[buffer(BufferIndexViewConstants)]],
+                        constant PassConstants&                                         pass        [[buffer(BufferIndexPassConstants)]],
+                        constant PointLight*                                            lights      [[buffer(BufferIndexPointLights)]],
+                        constant TileLightingParams&                                    params      [[buffer(BufferIndexTileLighting)]],
+                     threadgroup TileLightList&                                         tileLights  [[threadgroup(ThreadgroupIndexTileLights)]],
+                                 ushort2                                                lid         [[thread_position_in_threadgroup]],
+                                 ushort2                                                tileSize    [[threads_per_threadgroup]],
+                                 uint2                                                  tileId      [[threadgroup_position_in_grid]],
+                                 ushort                                                 threadIndex [[thread_index_in_threadgroup]]) {
+    if (threadIndex == 0) {
+        atomic_store_explicit(&tileLights.minDepthBits, as_type<uint>(INFINITY), memory_order_relaxed);
+        atomic_store_explicit(&tileLights.maxDepthBits, 0, memory_order_relaxed);
+        atomic_store_explicit(&tileLights.count, 0, memory_order_relaxed);
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    uint2 framebufferSize = uint2(pass.framebuffer_width, pass.framebuffer_height);
+    uint2 pixelMin = tileId * uint2(tileSize);
+    uint2 pixel = pixelMin + uint2(lid);
+
+    // The depth target is cleared to a positive value, geometry is in front of the camera
+    float eyeDepth = gBuffer.read(lid).depth;
+    bool covered = all(pixel < framebufferSize) && eyeDepth < 0.0f;
+
+    // Linear depth is positive so its float bits order like the values. Reduced per
+    // SIMD group first to keep the threadgroup atomics to one per group.
+    float minDepth = simd_min(covered ? -eyeDepth : INFINITY);
+    float maxDepth = simd_max(covered ? -eyeDepth : 0.0f);
+    if (simd_is_first()) {
+        atomic_fetch_min_explicit(&tileLights.minDepthBits, as_type<uint>(minDepth), memory_order_relaxed);
+        atomic_fetch_max_explicit(&tileLights.maxDepthBits, as_type<uint>(maxDepth), memory_order_relaxed);
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    minDepth = as_type<float>(atomic_load_explicit(&tileLights.minDepthBits, memory_order_relaxed));
+    maxDepth = as_type<float>(atomic_load_explicit(&tileLights.maxDepthBits, memory_order_relaxed));
+    // Nothing to light when the tile only contains sky
+    if (minDepth > maxDepth) return;
+
+    float3 planes[4];
+    tileFrustumPlanes(float2(pixelMin), float2(min(pixelMin + uint2(tileSize), framebufferSize)), view, pass, planes);
+
+    uint threadCount = tileSize.x * tileSize.y;
+    for (uint i = threadIndex; i < params.lightCount; i += threadCount) {
+        if (!pointLightInTile(lights[i].position_radius, planes, minDepth, maxDepth)) continue;
+
+        uint slot = atomic_fetch_add_explicit(&tileLights.count, 1, memory_order_relaxed);
+        if (slot < MaxLightsPerTile) {
+            tileLights.indices[slot] = ushort(i);
+        }
+    }
+}
+
+#if REFERENCE_CHECKS
+// Dispatched right after cullLightsTileKernel on the reference check frame. Copies each
+// tile's list out of threadgroup memory, which the CPU cannot read, into a row major
+// buffer for the comparison with TileLightCullingReference.
+kernel void exportTileLightsKernel(constant PassConstants&  pass        [[buffer(BufferIndexPassConstants)]],
+                                   device TileLightList*    exported    [[buffer(BufferIndexTileLightExport)]],
+                              threadgroup TileLightList&    tileLights  [[threadgroup(ThreadgroupIndexTileLights)]],
+                                          ushort2           tileSize    [[threads_per_threadgroup]],
+                                          uint2             tileId      [[threadgroup_position_in_grid]],
+                                          ushort            threadIndex [[thread_index_in_threadgroup]]) {
+    uint tileCountX = (pass.framebuffer_width + tileSize.x - 1) / tileSize.x;
+    device TileLightList& tile = exported[tileId.y * tileCountX + tileId.x];
+    if (threadIndex == 0) {
+        atomic_store_explicit(&tile.minDepthBits, atomic_load_explicit(&tileLights.minDepthBits, memory_order_relaxed), memory_order_relaxed);
+        atomic_store_explicit(&tile.maxDepthBits, atomic_load_explicit(&tileLights.maxDepthBits, memory_order_relaxed), memory_order_relaxed);
+        atomic_store_explicit(&tile.count, atomic_load_explicit(&tileLights.count, memory_order_relaxed), memory_order_relaxed);
+    }
+    if (threadIndex < MaxLightsPerTile) {
+        tile.indices[threadIndex] = tileLights.indices[threadIndex];
+    }
+}
+#endif
+#endif
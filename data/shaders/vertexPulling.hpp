@@ -0,0 +1,38 @@
+#include <simd/simd.h>
+
+// Attribute fetches for the deinterleaved vertex streams, see VertexStreamLayout.
+// The format is uniform across a draw so the branches do not diverge.
+
+static inline float4 fetchPosition(const device uchar* stream, uint index, uint format) {
+    if (format == VertexStreamFormatFloat3) {
+        return float4(float3(((const device packed_float3*)stream)[index]), 1.0f);
+    }
+    return float4(((const device float4*)stream)[index].xyz, 1.0f);
+}
+
+struct TangentFrame {
+    half3 normal;
+    half3 tangent;
+    half3 bitangent;
+};
+
+static inline TangentFrame fetchTangentFrame(const device uchar* stream, uint index, uint format) {
+    TangentFrame frame;
+    if (format == VertexStreamFormatSnorm16) {
+        const device short4* vectors = (const device short4*)stream + index * 3;
+        frame.normal    = half3(float3(vectors[0].xyz) / 32767.0f);
+        frame.tangent   = half3(float3(vectors[1].xyz) / 32767.0f);
+        frame.bitangent = half3(float3(vectors[2].xyz) / 32767.0f);
+    } else {
+        const device float4* vectors = (const device float4*)stream + index * 3;
+        frame.normal    = half3(vectors[0].xyz);
+        frame.tangent   = half3(vectors[1].xyz);
+        frame.bitangent = half3(vectors[2].xyz);
+    }
+    return frame;
+}
+
+// Float2 is the only texcoord format
+static inline float2 fetchTexcoord(const device uchar* stream, uint index) {
+    return ((const device float2*)stream)[index];
+}
@@ -0,0 +1,129 @@
+#define METAL
+#include <metal_stdlib>
+
+using namespace metal;
+using namespace raytracing;
+
+#include "shaderTypes.hpp"
+#include "shaderCommon.hpp"
+#if ATMOSPHERIC_SCATTERING
+#include "atmosphereCommon.hpp"
+#endif
+
+#if VOLUMETRIC_LIGHTING
+// Linear depth of a slice boundary, slice in froxels
+static inline float froxelSliceDepth(float slice, constant VolumetricParams& params) {
+    return params.nearDistance * pow(params.farDistance / params.nearDistance, slice / float(FroxelGridDepth));
+}
+
+// Eye space position of a point in froxel coordinates, pixel rows grow downwards
+static inline float3 froxelEyePosition(float3 froxel, constant ViewConstants& view, constant VolumetricParams& params) {
+    float2 ndc = froxel.xy / float2(FroxelGridWidth, FroxelGridHeight) * 2.0f - 1.0f;
+    float4 eyeDirection = view.projection_matrix_inverse * float4(ndc.x, -ndc.y, 1.0f, 1.0f);
+    float3 direction = eyeDirection.xyz / eyeDirection.w;
+    return direction * (froxelSliceDepth(froxel.z, params) / -direction.z);
+}
+
+static inline float henyeyGreenstein(float cosTheta, float g) {
+    float denominator = 1.0f + g * g - 2.0f * g * cosTheta;
+    return (1.0f - g * g) / (4.0f * M_PI_F * denominator * sqrt(denominator));
+}
+
+// One thread per froxel. Density and sun light are sampled at a jittered position inside
+// the froxel, the froxel centre is reprojected into the previous volume and the new
+// sample is blended with the history found there. Writes scattering rgb, extinction a.
+kernel void injectFroxelsKernel(texture3d<half, access::sample>             history                 [[texture(TextureIndexFroxelHistory)]],
+                                texture3d<half, access::write>              scattering              [[texture(TextureIndexFroxelScattering)]],
+                       constant FrameConstants&                             frame                   [[buffer(BufferIndexFrameConstants)]],
+                       constant ViewConstants&                              view                    [[buffer(BufferIndexViewConstants)]],
+                       constant VolumetricParams&                           params                  [[buffer(BufferIndexVolumetrics)]],
+                                primitive_acceleration_structure            accelerationStructure   [[buffer(BufferIndexAccelerationStructure)]],
+#if OPACITY_MICROMAPS
+                                intersection_function_table<triangle_data>  intersectionFunctions   [[buffer(BufferIndexIntersectionFunctions)]],
+#endif
+#if ATMOSPHERIC_SCATTERING
+                       constant AtmosphereParams&                           atmosphere              [[buffer(BufferIndexAtmosphere)]],
+                                texture2d<float>                            transmittanceLUT        [[texture(TextureIndexTransmittanceLUT)]],
+#endif
+                                uint3                                       tid                     [[thread_position_in_grid]]) {
+    if (tid.x >= FroxelGridWidth || tid.y >= FroxelGridHeight || tid.z >= FroxelGridDepth) return;
+
+    float3 position = (params.inverseViewMatrix * float4(froxelEyePosition(float3(tid) + params.jitter.xyz, view, params), 1.0f)).xyz;
+    float extinction = params.density * exp(-params.heightFalloff * max(position.y - params.baseHeight, 0.0f));
+
+    // Sun visibility from the sample, any hit shadows it
+    float3 toSun = normalize(-frame.sun_eye_direction.xyz);
+    ray shadowRay;
+    shadowRay.origin = position;
+    shadowRay.direction = toSun;
+    shadowRay.min_distance = 0.001f;
+    shadowRay.max_distance = INFINITY;
+    intersector<triangle_data> intersector;
+    intersector.accept_any_intersection(true);
+#if OPACITY_MICROMAPS
+    bool sunVisible = intersector.intersect(shadowRay, accelerationStructure, intersectionFunctions).type == intersection_type::none;
+#else
+    bool sunVisible = intersector.intersect(shadowRay, accelerationStructure).type == intersection_type::none;
+#endif
+
+    float3 light = evaluateSHIrradiance(float3(0.0f, 1.0f, 0.0f), frame.sh_irradiance) * frame.ambient_intensity * params.ambientScale;
+    if (sunVisible) {
+        float3 sun = frame.sun_color.rgb;
+#if ATMOSPHERIC_SCATTERING
+        sun *= sampleTransmittanceLUT(transmittanceLUT, atmosphere.cameraRadius, toSun.y, atmosphere);
+#endif
+        float3 viewDirection = normalize(position - view.cameraPosition.xyz);
+        light += sun * henyeyGreenstein(dot(viewDirection, toSun), params.anisotropy);
+    }
+    float4 current = float4(params.scatteringColor.rgb * extinction * light, extinction);
+
+    if (params.historyValid) {
+        float3 centre = (params.inverseViewMatrix * float4(froxelEyePosition(float3(tid) + 0.5f, view, params), 1.0f)).xyz;
+        float4 clip = params.previousViewProjection * float4(centre, 1.0f);
+        if (clip.w > 0.0f) {
+            // Clip w is the previous linear depth, slices are exponential in it
+            float3 uvw = float3(clip.xy / clip.w * float2(0.5f, -0.5f) + 0.5f,
+                                log(clip.w / params.nearDistance) / log(params.farDistance / params.nearDistance));
+            if (all(uvw >= 0.0f) && all(uvw <= 1.0f)) {
+                constexpr sampler linearClamp(filter::linear, address::clamp_to_edge);
+                current = mix(float4(history.sample(linearClamp, uvw)), current, params.historyWeight);
+            }
+        }
+    }
+    scattering.write(half4(current), tid);
+}
+
+// One thread per froxel column, front to back. Each froxel receives the light scattered
+// towards the camera up to the far side of its slice and the transmittance to there.
+kernel void integrateFroxelsKernel(texture3d<half, access::read>    scattering  [[texture(TextureIndexFroxelScattering)]],
+                                   texture3d<half, access::write>   volume      [[texture(TextureIndexFroxelVolume)]],
+                          constant ViewConstants&                   view        [[buffer(BufferIndexViewConstants)]],
+                          constant VolumetricParams&                params      [[buffer(BufferIndexVolumetrics)]],
+                                   uint2                            tid         [[thread_position_in_grid]]) {
+    if (tid.x >= FroxelGridWidth || tid.y >= FroxelGridHeight) return;
+
+    // Distance along the view ray per unit of linear depth
+    float3 direction = froxelEyePosition(float3(float2(tid) + 0.5f, 0.0f), view, params);
+    float stretch = length(direction) / -direction.z;
+
+    float3 inScattered = 0.0f;
+    float transmittance = 1.0f;
+    float sliceStart = 0.0f;
+    for (uint slice = 0; slice < FroxelGridDepth; slice++) {
+        float sliceEnd = froxelSliceDepth(float(slice + 1), params);
+        float thickness = (sliceEnd - sliceStart) * stretch;
+        sliceStart = sliceEnd;
+
+        float4 froxel = float4(scattering.read(uint3(tid, slice)));
+        float extinction = max(froxel.a, 1e-6f);
+        float sliceTransmittance = exp(-extinction * thickness);
+        // Scattering integrated over the slice against its own extinction, stays energy
+        // conserving for thick slices (Hillaire, "Physically Based and Unified Volumetric
+        // Rendering in Frostbite")
+        inScattered += transmittance * (froxel.rgb - froxel.rgb * sliceTransmittance) / extinction;
+        transmittance *= sliceTransmittance;
+
+        volume.write(half4(half3(inScattered), half(transmittance)), uint3(tid, slice));
+    }
+}
+#endif
@@ -1,4 +1,5 @@
 #include "gltfLoader.hpp"
+#include "../managers/smoothNormals.hpp"
 
 GLTFLoader::GLTFLoader(MTL::Device* device) : _device(device) {}
 
@@ -189,6 +190,11 @@ GLTFLoader::ProcessedMeshData GLTFLoader::processMesh(const tinygltf::Model& mod
 		}
 	}
 	
+	// Primitives without a NORMAL attribute get smooth normals split at hard edges
+	if (!normals && !result.indices.empty()) {
+		SmoothNormals::generate(result.vertices, result.indices, SmoothNormals::Settings{});
+	}
+	
 	return result;
 }
 
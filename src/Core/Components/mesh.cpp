@@ -4,33 +4,37 @@
 //
 
 #include "mesh.hpp"
+#include "../managers/smoothNormals.hpp"
 #include "../../data/shaders/shaderTypes.hpp"
 
 #include <iostream>
 #include <unordered_map>
 #include <string>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 // For tinyobjloader
-Mesh::Mesh(std::string filePath, MTL::Device* metalDevice, MTL::VertexDescriptor* vertexDescriptor, bool useTextures) {
+Mesh::Mesh(std::string filePath, MTL::Device* metalDevice, bool useTextures) {
     device = metalDevice;
     hasTextures = useTextures;
+    sourcePath = filePath;
     loadObj(filePath);
-    createBuffers(vertexDescriptor);
+    createBuffers();
 }
 
 // For tinyGLTF
 Mesh::Mesh(MTL::Device* device, const Vertex* vertexData, size_t vertexCount, const uint32_t* indexData, size_t indexCount, bool useTextures)
 : device(device), hasTextures(useTextures) {
-    // Create vertex buffer with proper alignment
-    size_t vertexBufferSize = vertexCount * sizeof(Vertex);
-    
-    vertexBuffer = device->newBuffer(vertexData, vertexBufferSize, MTL::ResourceStorageModeShared);
-    vertexBuffer->setLabel(NS::String::string("Mesh Vertex Buffer", NS::ASCIIStringEncoding));
+    createStreams(vertexData, vertexCount, FullStreamLayout);
 
     // Create index buffer
     this->indexCount = indexCount;
     indexBuffer = device->newBuffer(indexData, indexCount * sizeof(uint32_t), MTL::ResourceStorageModeShared);
     indexBuffer->setLabel(NS::String::string("Mesh Index Buffer", NS::ASCIIStringEncoding));
+
+    addSubmesh(vertexData, indexData, 0, indexCount);
 }
 
 Mesh::~Mesh() {
@@ -40,7 +44,10 @@ Mesh::~Mesh() {
         diffuseTextures->release();
         diffuseTextureInfos->release();
     }
-    vertexBuffer->release();
+    positionStream->release();
+    tangentFrameStream->release();
+    texcoordStream->release();
+    textureIndexStream->release();
     indexBuffer->release();
 }
 
@@ -108,8 +115,11 @@ void Mesh::loadObj(std::string filePath) {
     vertexIndices.clear();
     vertexMap.clear();
     
+    submeshes.clear();
+    
     for (const auto& shape : shapes) {
         size_t index_offset = 0;
+        size_t shapeFirstIndex = vertexIndices.size();
         
         for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++) {
             int material_id = -1;
@@ -199,13 +209,39 @@ void Mesh::loadObj(std::string filePath) {
             index_offset += fv;
             triangleCount++;
         }
+        
+        if (vertexIndices.size() > shapeFirstIndex) {
+            addSubmesh(vertices.data(), vertexIndices.data(), shapeFirstIndex, vertexIndices.size() - shapeFirstIndex);
+        }
     }
     
+    // Faces without normal indices, tangents are built from the generated normals
+    SmoothNormals::Stats normalStats;
+    if (SmoothNormals::generate(vertices, vertexIndices, SmoothNormals::Settings{}, &normalStats)) {
+        printf("Generated smooth normals: %u triangles, %u split vertices, %.2f ms\n",
+               normalStats.triangles, normalStats.splitVertices, normalStats.milliseconds);
+    }
+
     if (hasTextures) {
         calculateTangentSpace(vertices, vertexIndices);
     }
 }
 
+void Mesh::addSubmesh(const Vertex* vertexData, const uint32_t* indexData, size_t indexOffset, size_t indexCount) {
+    Submesh submesh{
+        .indexOffset = static_cast<uint32_t>(indexOffset),
+        .indexCount = static_cast<uint32_t>(indexCount),
+        .boundsMin = simd::float3(std::numeric_limits<float>::max()),
+        .boundsMax = simd::float3(-std::numeric_limits<float>::max())
+    };
+    for (size_t i = indexOffset; i < indexOffset + indexCount; i++) {
+        simd::float3 position = vertexData[indexData[i]].position.xyz;
+        submesh.boundsMin = simd::min(submesh.boundsMin, position);
+        submesh.boundsMax = simd::max(submesh.boundsMax, position);
+    }
+    submeshes.push_back(submesh);
+}
+
 void Mesh::calculateTangentSpace(std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
     for (size_t i = 0; i < indices.size(); i += 3) {
         Vertex& v0 = vertices[indices[i]];
@@ -248,14 +284,69 @@ void Mesh::calculateTangentSpace(std::vector<Vertex>& vertices, const std::vecto
     }
 }
 
-void Mesh::createBuffers(MTL::VertexDescriptor* vertexDescriptor) {
-    // Create Vertex Buffers
-    unsigned long vertexCount = vertices.size();
-//    std::cout << "Mesh Vertex Count: " << vertexCount << std::endl;
-    unsigned long vertexBufferSize = sizeof(Vertex) * vertices.size();
-//    std::cout << "Mesh Vertex Buffer Size: " << vertexBufferSize << std::endl;
-    vertexBuffer = device->newBuffer(vertices.data(), vertexBufferSize, MTL::ResourceStorageModeShared);
-    vertexBuffer->setLabel(NS::String::string("Mesh Vertex Buffer", NS::ASCIIStringEncoding));
+void Mesh::createStreams(const Vertex* vertexData, size_t vertexCount, const VertexStreamLayout& layout) {
+    streamLayout = layout;
+
+    auto newStream = [&](const void* data, size_t size, const char* label) {
+        MTL::Buffer* buffer = device->newBuffer(data, std::max<size_t>(size, 16), MTL::ResourceStorageModeShared);
+        buffer->setLabel(NS::String::string(label, NS::ASCIIStringEncoding));
+        return buffer;
+    };
+
+    // Positions
+    if (layout.positionFormat == VertexStreamFormatFloat3) {
+        std::vector<float> positions(vertexCount * 3);
+        for (size_t i = 0; i < vertexCount; i++) {
+            std::memcpy(&positions[i * 3], &vertexData[i].position, sizeof(float) * 3);
+        }
+        positionStream = newStream(positions.data(), positions.size() * sizeof(float), "Mesh Position Stream");
+    } else {
+        std::vector<simd::float4> positions(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++) {
+            positions[i] = vertexData[i].position;
+        }
+        positionStream = newStream(positions.data(), positions.size() * sizeof(simd::float4), "Mesh Position Stream");
+    }
+
+    // Normal, tangent and bitangent of each vertex, in that order
+    if (layout.tangentFrameFormat == VertexStreamFormatSnorm16) {
+        auto toSnorm16 = [](float value) {
+            return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+        };
+        std::vector<int16_t> frames(vertexCount * 12);
+        for (size_t i = 0; i < vertexCount; i++) {
+            const simd::float4 vectors[3] = {vertexData[i].normal, vertexData[i].tangent, vertexData[i].bitangent};
+            for (int v = 0; v < 3; v++) {
+                for (int c = 0; c < 4; c++) {
+                    frames[i * 12 + v * 4 + c] = toSnorm16(vectors[v][c]);
+                }
+            }
+        }
+        tangentFrameStream = newStream(frames.data(), frames.size() * sizeof(int16_t), "Mesh Tangent Frame Stream");
+    } else {
+        std::vector<simd::float4> frames(vertexCount * 3);
+        for (size_t i = 0; i < vertexCount; i++) {
+            frames[i * 3 + 0] = vertexData[i].normal;
+            frames[i * 3 + 1] = vertexData[i].tangent;
+            frames[i * 3 + 2] = vertexData[i].bitangent;
+        }
+        tangentFrameStream = newStream(frames.data(), frames.size() * sizeof(simd::float4), "Mesh Tangent Frame Stream");
+    }
+
+    std::vector<simd::float2> texcoords(vertexCount);
+    std::vector<int16_t> textureIndices(vertexCount * 2);
+    for (size_t i = 0; i < vertexCount; i++) {
+        texcoords[i] = vertexData[i].textureCoordinate;
+        textureIndices[i * 2 + 0] = static_cast<int16_t>(hasTextures ? vertexData[i].diffuseTextureIndex : -1);
+        textureIndices[i * 2 + 1] = static_cast<int16_t>(hasTextures ? vertexData[i].normalTextureIndex : -1);
+    }
+    texcoordStream = newStream(texcoords.data(), texcoords.size() * sizeof(simd::float2), "Mesh Texcoord Stream");
+    textureIndexStream = newStream(textureIndices.data(), textureIndices.size() * sizeof(int16_t), "Mesh Texture Index Stream");
+}
+
+void Mesh::createBuffers() {
+    createStreams(vertices.data(), vertices.size(), CompactStreamLayout);
+
     // Create Index Buffer
     indexCount = vertexIndices.size();
     unsigned long indexBufferSize = sizeof(uint32_t) * vertexIndices.size();
@@ -282,44 +373,4 @@ void Mesh::createBuffers(MTL::VertexDescriptor* vertexDescriptor) {
         normalTextureInfos = device->newBuffer(normalTexturesArray->normalTextureInfos.data(), normalBufferSize, MTL::ResourceStorageModeShared);
         normalTextureInfos->setLabel(NS::String::string("Normal Texture Info Array", NS::ASCIIStringEncoding));
     }
-    
-    if (vertexDescriptor) {
-        // Position
-        vertexDescriptor->attributes()->object(VertexAttributePosition)->setFormat(MTL::VertexFormatFloat4);
-        vertexDescriptor->attributes()->object(VertexAttributePosition)->setOffset(offsetof(Vertex, position));
-        vertexDescriptor->attributes()->object(VertexAttributePosition)->setBufferIndex(0);
-
-        // Normal
-        vertexDescriptor->attributes()->object(VertexAttributeNormal)->setFormat(MTL::VertexFormatFloat4);
-        vertexDescriptor->attributes()->object(VertexAttributeNormal)->setOffset(offsetof(Vertex, normal));
-        vertexDescriptor->attributes()->object(VertexAttributeNormal)->setBufferIndex(0);
-
-        // Tangent
-        vertexDescriptor->attributes()->object(VertexAttributeTangent)->setFormat(MTL::VertexFormatFloat4);
-        vertexDescriptor->attributes()->object(VertexAttributeTangent)->setOffset(offsetof(Vertex, tangent));
-        vertexDescriptor->attributes()->object(VertexAttributeTangent)->setBufferIndex(0);
-
-        // Bitangent
-        vertexDescriptor->attributes()->object(VertexAttributeBitangent)->setFormat(MTL::VertexFormatFloat4);
-        vertexDescriptor->attributes()->object(VertexAttributeBitangent)->setOffset(offsetof(Vertex, bitangent));
-        vertexDescriptor->attributes()->object(VertexAttributeBitangent)->setBufferIndex(0);
-
-        // TextureCoordinate
-        vertexDescriptor->attributes()->object(VertexAttributeTexcoord)->setFormat(MTL::VertexFormatFloat2);
-        vertexDescriptor->attributes()->object(VertexAttributeTexcoord)->setOffset(offsetof(Vertex, textureCoordinate));
-        vertexDescriptor->attributes()->object(VertexAttributeTexcoord)->setBufferIndex(0);
-        
-        // DiffuseTextureIndex
-        vertexDescriptor->attributes()->object(VertexAttributeDiffuseIndex)->setFormat(MTL::VertexFormatInt);
-        vertexDescriptor->attributes()->object(VertexAttributeDiffuseIndex)->setOffset(offsetof(Vertex, diffuseTextureIndex));
-        vertexDescriptor->attributes()->object(VertexAttributeDiffuseIndex)->setBufferIndex(0);
-        
-        // NormalTextureIndex
-        vertexDescriptor->attributes()->object(VertexAttributeNormalIndex)->setFormat(MTL::VertexFormatInt);
-        vertexDescriptor->attributes()->object(VertexAttributeNormalIndex)->setOffset(offsetof(Vertex, normalTextureIndex));
-        vertexDescriptor->attributes()->object(VertexAttributeNormalIndex)->setBufferIndex(0);
-
-        // Set layout
-        vertexDescriptor->layouts()->object(0)->setStride(sizeof(Vertex));
-    }
 }
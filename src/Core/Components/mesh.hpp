@@ -14,6 +14,7 @@ using namespace simd;
 #include <tinyobjloader/tiny_obj_loader.h>
 #include "vertexData.hpp"
 #include "textureArray.hpp"
+#include "../../../data/shaders/shaderTypes.hpp"
 
 inline bool operator==(const Vertex& lhs, const Vertex& rhs) {
     return lhs.position.x == rhs.position.x &&
@@ -57,27 +58,48 @@ namespace std {
     };
 }
 
+// Contiguous index range drawn with one call, with its object space bounds for culling
+struct Submesh {
+    uint32_t        indexOffset;
+    uint32_t        indexCount;
+    simd::float3    boundsMin;
+    simd::float3    boundsMax;
+};
+
 struct Mesh {
 //    Mesh(std::string filePath, MTL::Device* metalDevice);
-    Mesh(std::string filePath, MTL::Device* metalDevice, MTL::VertexDescriptor* vertexDescriptor, bool useTextures = false);
+    Mesh(std::string filePath, MTL::Device* metalDevice, bool useTextures = false);
     Mesh(MTL::Device* device, const Vertex* vertexData, size_t vertexCount, const uint32_t* indexData, size_t indexCount, bool useTextures = false);
 
+    // Compact streams for OBJ meshes; glTF meshes keep full precision. Both draw with the same pipeline.
+    static constexpr VertexStreamLayout CompactStreamLayout = {VertexStreamFormatFloat3, VertexStreamFormatSnorm16, VertexStreamFormatFloat2};
+    static constexpr VertexStreamLayout FullStreamLayout    = {VertexStreamFormatFloat4, VertexStreamFormatFloat4, VertexStreamFormatFloat2};
+
     ~Mesh();
 
 public:
     void loadObj(std::string filePath);
     void calculateTangentSpace(std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
-    void createBuffers(MTL::VertexDescriptor* vertexDescriptor);
+    void createBuffers();
+    void createStreams(const Vertex* vertexData, size_t vertexCount, const VertexStreamLayout& layout);
+    void addSubmesh(const Vertex* vertexData, const uint32_t* indexData, size_t indexOffset, size_t indexCount);
     
     std::vector<Vertex>                     vertices;
     std::vector<uint32_t>                   vertexIndices;
     TextureArray*                           diffuseTexturesArray;
     TextureArray*                           normalTexturesArray;
     std::unordered_map<Vertex, uint32_t>    vertexMap;
+    std::vector<Submesh>                    submeshes;      // One per OBJ shape
+    std::string                             sourcePath;     // Empty for meshes built from memory
     
 public:
     MTL::Device*    device;
-    MTL::Buffer*    vertexBuffer;
+    // Deinterleaved vertex streams, pulled by index in gbuffer_vertex
+    MTL::Buffer*        positionStream;
+    MTL::Buffer*        tangentFrameStream;
+    MTL::Buffer*        texcoordStream;
+    MTL::Buffer*        textureIndexStream;
+    VertexStreamLayout  streamLayout;
     MTL::Buffer*    indexBuffer;
     unsigned long   indexCount;
     unsigned long   triangleCount;
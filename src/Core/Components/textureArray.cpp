@@ -10,6 +10,7 @@
 TextureArray::TextureArray(std::vector<std::string>& FilePaths,
                            MTL::Device* metalDevice, TextureType type) {
     device = metalDevice;
+    filePaths = FilePaths;
     
     if (!FilePaths.empty())
 		loadTextures(FilePaths, type);
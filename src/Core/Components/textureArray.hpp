@@ -7,6 +7,7 @@
 #include <Metal/Metal.hpp>
 #include <stb/stb_image.h>
 #include <vector>
+#include <string>
 
 #include "vertexData.hpp"
 
@@ -31,6 +32,8 @@ public:
 	MTL::Texture* normalTextureArray;
 	std::vector<TextureInfo> normalTextureInfos;
 
+    std::vector<std::string> filePaths;    // Layer order
+
 private:
     MTL::Device* device;
 };
@@ -24,6 +24,33 @@
 #include "../../data/shaders/shaderTypes.hpp"
 #include "../../data/shaders/config.hpp"
 #include "managers/renderPipeline.hpp"
+#include "managers/objectPicker.hpp"
+#include "managers/gpuProfiler.hpp"
+#include "managers/gpuScheduler.hpp"
+#include "managers/postProcess.hpp"
+#include "managers/environmentLighting.hpp"
+#include "managers/atmosphere.hpp"
+#include "managers/volumetrics.hpp"
+#include "managers/deferredMSAA.hpp"
+#include "managers/tileClassifier.hpp"
+#include "managers/secondaryRayQueue.hpp"
+#include "managers/opacityMicromap.hpp"
+#include "managers/proxyMesh.hpp"
+#include "managers/smoothNormals.hpp"
+#include "managers/assetReport.hpp"
+#include "managers/frustumCuller.hpp"
+#include "managers/constantBlocks.hpp"
+#include "managers/resourceRegistry.hpp"
+#include "managers/frameArena.hpp"
+#include "managers/allocationCounter.hpp"
+#include "managers/startupGraph.hpp"
+#include "managers/meshSDF.hpp"
+#include "managers/impostors.hpp"
+#include "managers/pvs.hpp"
+#include "managers/renderSnapshot.hpp"
+#if REFERENCE_CHECKS
+#include "managers/gpuReadback.hpp"
+#endif
 #include "../editor/editor.hpp"
 #include "../debug/debug.hpp"
 
@@ -31,6 +58,9 @@
 
 #include <simd/simd.h>
 #include <filesystem>
+#include <mutex>
+#include <thread>
+#include <Block.h>
 
 constexpr uint8_t MaxFramesInFlight = 3;
 
@@ -38,6 +68,9 @@ class Engine {
     struct TriangleData {
         simd::float4 normals[3];
         simd::float4 colors[3];
+        simd::float2 texcoords[3];
+        uint32_t     opacityStates;     // See OpacityMicromap
+        uint32_t     alphaMaskLayer;
     };
 public:
     void init();
@@ -46,6 +79,11 @@ public:
 
 	Engine();
 
+    // Instance, triangle and depth under the cursor from the last resolved pick
+    std::optional<PickResult> getPickResult() const { return objectPicker->getResult(); }
+    // Non zero when a check failed, see ASSET_REPORT and REFERENCE_CHECKS
+    int getExitCode() const { return exitCode; }
+
 private:
     void initDevice();
     void initWindow();
@@ -53,15 +91,26 @@ private:
     void loadScene();
     void createBuffers();
 	
-	MTL::CommandBuffer* beginFrame(bool isPaused);
+	MTL::CommandBuffer* beginFrame(const RenderSnapshot& snapshot);
 	MTL::CommandBuffer* beginDrawableCommands();
 	void endFrame(MTL::CommandBuffer* commandBuffer, MTL::Drawable* currentDrawable);
-    void updateWorldState(bool isPaused);
+    void updateWorldState(const RenderSnapshot& snapshot);
+
+    // Main thread: input and animation into the next snapshot. Render side: one snapshot
+    // encoded and submitted, false once the queue is closed. See RENDER_THREAD.
+    void simulate(RenderSnapshot& snapshot, bool isPaused);
+    bool renderFrame();
+    SnapshotQueue       snapshots;
+    std::thread         renderThread;
+    std::mutex          editorMutex;    // ImGui state, between event polling and the overlay build
+    uint64_t            simulationFrame = 0;
 	
-	void draw();
+	void draw(const RenderSnapshot& snapshot);
 	void drawMeshes(MTL::RenderCommandEncoder* renderCommandEncoder);
 	void drawGBuffer(MTL::RenderCommandEncoder* renderCommandEncoder);
 	void drawDirectionalLight(MTL::RenderCommandEncoder* renderCommandEncoder);
+	void drawSky(MTL::RenderCommandEncoder* renderCommandEncoder);
+	void drawTileLightCulling(MTL::RenderCommandEncoder* renderCommandEncoder);
 
     void createDepthTexture();
 	void createViewRenderPassDescriptor();
@@ -71,6 +120,7 @@ private:
 
     void createDefaultLibrary();
     void createCommandQueue();
+    void selectRenderTargetFormats();
     void createRenderPipelines();
     void createLightSourceRenderPipeline();
 
@@ -84,9 +134,22 @@ private:
 	dispatch_semaphore_t                                inFlightSemaphore;
     std::array<dispatch_semaphore_t, MaxFramesInFlight> frameSemaphores;
     uint8_t                                             currentFrameIndex;
+
+    // Completion handlers signalling frameSemaphores, one per frame in flight
+    std::array<MTL::CommandBufferHandler, MaxFramesInFlight> frameCompletedHandlers{};
+
+    // CPU temporaries of the current frame, reset in beginFrame
+    FrameArena                                          frameArena;
+
+    // Frames allowed to allocate after startup or a resize, see COUNT_FRAME_ALLOCATIONS
+    static constexpr uint32_t                           AllocationWarmupFrames = 8;
+    uint32_t                                            allocationWarmupFrames = AllocationWarmupFrames;
 	
-	// Buffers used to store dynamically changing per-frame data
-	MTL::Buffer* 		frameDataBuffers[MaxFramesInFlight];
+	// Frame, view, pass and instance constants, one buffer per frame in flight
+	std::unique_ptr<ConstantBlocks> constants;
+
+	// Owns meshes and defers releases until the frames using them have completed
+	std::unique_ptr<ResourceRegistry> resources;
 
     MTL::Device*        metalDevice;
     GLFWwindow*         glfwWindow;
@@ -99,6 +162,7 @@ private:
     std::unique_ptr<Editor>       editor;
     
     bool                windowResizeFlag = false;
+    // Framebuffer size last reported by the window, main thread
     int                 newWidth;
     int                 newHeight;
 
@@ -115,19 +179,83 @@ private:
 	MTL::PixelFormat 			albedoSpecularGBufferFormat;
 	MTL::PixelFormat 			normalMapGBufferFormat;
 	MTL::PixelFormat 			depthGBufferFormat;
-	MTL::Texture* 				albedoSpecularGBuffer;
-	MTL::Texture* 				normalMapGBuffer;
+	MTL::PixelFormat 			objectIdGBufferFormat;
+	MTL::PixelFormat 			hdrLightingFormat;
+	MTL::PixelFormat 			drawablePixelFormat;
+	MTL::Texture* 				albedoSpecularGBuffer = nullptr;  // Null with MSAA_DEFERRED
+	MTL::Texture* 				normalMapGBuffer = nullptr;
 	MTL::Texture* 				depthGBuffer;
+	MTL::Texture* 				objectIdGBuffer = nullptr;
+	MTL::Texture* 				hdrLightingTexture = nullptr;
 
 	MTL::StorageMode 			GBufferStorageMode;
 
 	MTL::Texture* 				depthStencilTexture;
 
-	MTL::VertexDescriptor*		defaultVertexDescriptor;
     MTL::Library*               metalDefaultLibrary;
     MTL::CommandQueue*          metalCommandQueue;
 	
-    std::vector<Mesh*>          meshes;
+    // Scene order, indexed by CullInstance::meshIndex and the picking mesh ID
+    std::vector<MeshHandle>     meshes;
+
+    // Visibility of every submesh for all views at once. Shadow cascades, probes and
+    // extra viewports append their views after CullViewMain.
+    enum CullView : uint32_t {
+        CullViewMain = 0
+    };
+    struct CullInstance {
+        uint32_t meshIndex;
+        uint32_t submeshIndex;
+    };
+    void createCullingInstances();
+    FrustumCuller                       culler;
+    std::vector<CullInstance>           cullInstances;      // Indexed by culler instance
+    std::vector<FrustumCuller::View>    cullViews;
+
+    // Potentially visible sets of the static scene over the culler's instances, see POTENTIALLY_VISIBLE_SETS
+    void createVisibilitySets();
+    PVS::Data                           visibilitySets;
+    std::vector<uint64_t>               cellCandidates;     // Decompressed set of cameraCell
+    uint32_t                            cameraCell = PVS::NoCell;
+
+    // Signed distance volumes of every mesh, submesh order, read from the cooked cache when current.
+    // See MESH_DISTANCE_FIELDS, the task also runs the SDF_BAKE_BENCHMARK.
+    void createDistanceFields();
+#if MESH_DISTANCE_FIELDS
+    std::vector<std::vector<MeshSDF::Volume>>   distanceFields;     // Indexed like meshes
+#endif
+
+    // Cost report of the imported content against the budgets, see ASSET_REPORT
+    void createAssetReport();
+    int                         exitCode = 0;
+
+#if REFERENCE_CHECKS
+    // Frame whose GPU results are compared with the CPU references, after which the
+    // application quits. Waits for the frame to complete.
+    static constexpr uint32_t   ReferenceCheckFrame = 16;
+    uint32_t                    referenceCheckFrames = ReferenceCheckFrame;
+    void runReferenceChecks(MTL::CommandBuffer* commandBuffer);
+#if TILE_LIGHT_CULLING
+    // Called in the G-buffer pass after drawTileLightCulling, copies the culled lists out
+    // of the tile stage together with the eye space lights and projection they used
+    void exportTileLights(MTL::RenderCommandEncoder* renderCommandEncoder);
+    // Compares the copied lists with TileLightCullingReference on the copied depth
+    bool checkTileLightCulling();
+    GPUReadback                 tileLightsReadback;
+    GPUReadback                 tileDepthReadback;
+    std::vector<PointLight>     checkLights;        // Eye space
+    simd::float4x4              checkProjectionInverse;
+#endif
+#endif
+
+    // Distant copies of one model drawn as octahedral impostors, see IMPOSTORS
+    void createImpostors();
+    void drawImpostors(MTL::RenderCommandEncoder* renderCommandEncoder);
+    std::unique_ptr<Impostors>  impostors;
+
+    // Scene bounds of the secondary ray queue and its CPU benchmark, see SECONDARY_RAY_QUEUE
+    void createSecondaryRays();
+    MeshHandle                  impostorMesh{};     // Not in meshes, never culled or picked
 
     MTL::SamplerState*          samplerState;
 
@@ -136,12 +264,25 @@ private:
     
     // Ray tracing
     std::vector<MTL::AccelerationStructure*>    primitiveAccelerationStructures;
-    MTL::Buffer*                                resourceBuffer;
-    size_t                                      totalTriangles;
+    MTL::Buffer*                                resourceBuffer;         // Primitive data of the acceleration structure, in its order
+    size_t                                      totalTriangles;         // Ray traced, transparent triangles are left out
+    std::vector<uint32_t>                       rayTracedIndices;       // Opaque triangles, then alpha masked ones
+    size_t                                      maskedTriangleStart = 0;
     MTL::Texture*                               rayTracingTexture;
+
+    // Micro triangle states of every triangle and the alpha masks behind them, see OPACITY_MICROMAPS
+    void createOpacityMicromaps();
+    std::vector<std::vector<uint32_t>>          opacityStates;          // Indexed like meshes
+    std::vector<uint32_t>                       alphaMaskLayerBases;    // First mask header of each mesh
+    MTL::Buffer*                                alphaMaskBuffer = nullptr;
     
     void setupTriangleResources();
+    MTL::AccelerationStructure* buildAccelerationStructure(const std::vector<MTL::AccelerationStructureTriangleGeometryDescriptor*>& geometries);
     void createAccelerationStructureWithDescriptors();
+
+    // Simplified opaque geometry plus the exact alpha masked triangles, traced by secondary rays, see PROXY_GEOMETRY
+    void createProxyAccelerationStructure();
+    MTL::AccelerationStructure*                 proxyAccelerationStructure = nullptr;
     void dispatchRaytracing(MTL::CommandBuffer* commandBuffer);
     
     // Forward Debug
@@ -155,5 +296,51 @@ private:
 
     // Min Max Depth Buffer
     void dispatchMinMaxDepthMipmaps(MTL::CommandBuffer* commandBuffer);
-    MTL::Texture* minMaxDepthTexture;
+    void releaseMinMaxDepthTexture();
+    MTL::Texture* minMaxDepthTexture = nullptr;
+    std::vector<MTL::Texture*>  minMaxDepthMipViews;    // One RG32Float view per mip
+    std::vector<NS::String*>    minMaxDepthMipLabels;
+
+    // HDR post-processing
+    std::unique_ptr<GPUProfiler>    gpuProfiler;
+    std::unique_ptr<GPUScheduler>   gpuScheduler;
+    // Event value of the last compute queue work, the next G-buffer pass overwrites what it read
+    uint64_t                        computeDoneValue = 0;
+    std::unique_ptr<PostProcess>    postProcess;
+
+    // Environment lighting
+    void createEnvironmentLighting();
+    std::array<simd::float4, EnvironmentLighting::CoefficientCount> environmentIrradiance{};
+    float ambientIntensity = 1.0f;
+
+    // Atmosphere
+    std::unique_ptr<Atmosphere> atmosphere;
+    simd::float3                sunDirection = {0.0f, 1.0f, 0.0f};     // Towards the sun, world space
+
+    // Froxel fog and sun shafts, see VOLUMETRIC_LIGHTING
+    std::unique_ptr<Volumetrics> volumetrics;
+
+    // Point lights, culled per tile by the tile shading stage (TILE_LIGHT_CULLING), see
+    // TEST_POINT_LIGHTS and REFERENCE_CHECKS
+    void createPointLights();
+    std::vector<PointLight>     pointLights;                            // World space
+    MTL::Buffer*                pointLightBuffers[MaxFramesInFlight];   // Eye space copy per frame
+
+    // MSAA G-buffer with compute lighting, see MSAA_DEFERRED
+    std::unique_ptr<DeferredMSAA> deferredMSAA;
+
+    // Screen tile lists for indirect dispatches, see TILE_CLASSIFICATION
+    std::unique_ptr<TileClassifier> tileClassifier;
+
+    // Binned secondary rays of the ray tracing pass, see SECONDARY_RAY_QUEUE
+    std::unique_ptr<SecondaryRayQueue> secondaryRays;
+
+    // Object picking
+    std::unique_ptr<ObjectPicker> objectPicker;
+
+    // Pick at the cursor, handed to the renderer with the next snapshot
+    void requestPickAtCursor();
+    bool                pickRequested = false;
+    uint32_t            pickX = 0;
+    uint32_t            pickY = 0;
 };
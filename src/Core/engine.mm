@@ -1,4 +1,7 @@
 #include "engine.hpp"
+#if REFERENCE_CHECKS && TILE_LIGHT_CULLING
+#include "managers/tileLightCullingReference.hpp"
+#endif
 
 Engine::Engine()
 : camera(simd::float3{7.0f, 5.0f, 0.0f}, 0.1f, 1000.0f)
@@ -10,6 +13,14 @@ Engine::Engine()
 
     for (int i = 0; i < MaxFramesInFlight; i++) {
         frameSemaphores[i] = dispatch_semaphore_create(1);
+
+        // Heap blocks made once, Metal only retains them when they are added to a command buffer.
+        // Each captures its own semaphore, currentFrameIndex has moved on by the time it runs.
+        dispatch_semaphore_t semaphore = frameSemaphores[i];
+        frameCompletedHandlers[i] = Block_copy(^(MTL::CommandBuffer*) {
+            // Signal the semaphore for this frame when GPU work is complete
+            dispatch_semaphore_signal(semaphore);
+        });
     }
 
 }
@@ -20,53 +31,230 @@ void Engine::init() {
 
     editor = std::make_unique<Editor>(glfwWindow, metalDevice);
     debug = std::make_unique<Debug>(metalDevice);
+    objectPicker = std::make_unique<ObjectPicker>(metalDevice);
+    gpuProfiler = std::make_unique<GPUProfiler>(metalDevice);
+    constants = std::make_unique<ConstantBlocks>(metalDevice, MaxFramesInFlight);
+    resources = std::make_unique<ResourceRegistry>(metalDevice);
+    postProcess = std::make_unique<PostProcess>(metalDevice, renderPipelines, *gpuProfiler);
+    editor->postProcessParams = &postProcess->params;
+    editor->gpuProfiler = gpuProfiler.get();
+    // frameIndex is rewritten every frame, only the user facing fields are watched
+    editor->watchValue(&postProcess->params, offsetof(PostProcessParams, frameIndex));
+    atmosphere = std::make_unique<Atmosphere>(metalDevice, renderPipelines);
+#if VOLUMETRIC_LIGHTING
+    volumetrics = std::make_unique<Volumetrics>(metalDevice, renderPipelines);
+    editor->volumetricParams = &volumetrics->params;
+    // Only the medium settings, the rest is rewritten every frame
+    editor->watchValue(&volumetrics->params, offsetof(VolumetricParams, inverseViewMatrix));
+#endif
+#if TILE_CLASSIFICATION
+    tileClassifier = std::make_unique<TileClassifier>(metalDevice, renderPipelines, *gpuProfiler);
+#endif
+#if SECONDARY_RAY_QUEUE
+    secondaryRays = std::make_unique<SecondaryRayQueue>(metalDevice, renderPipelines);
+#endif
 
     createCommandQueue();
-	loadScene();
-    createDefaultLibrary();
-    renderPipelines.initialize(metalDevice, metalDefaultLibrary);
-    createRenderPipelines();
-	createViewRenderPassDescriptor();
-    createAccelerationStructureWithDescriptors();
-    setupTriangleResources();
-    // Debug
-    createSphereGrid();
-    createDebugLines();
+    gpuScheduler = std::make_unique<GPUScheduler>(metalDevice, metalCommandQueue, ASYNC_COMPUTE);
+    editor->gpuScheduler = gpuScheduler.get();
+    selectRenderTargetFormats();
+#if MSAA_DEFERRED
+    deferredMSAA = std::make_unique<DeferredMSAA>(metalDevice, renderPipelines, *gpuProfiler, DeferredMSAA::Formats{
+        .albedo = albedoSpecularGBufferFormat,
+        .normal = normalMapGBufferFormat,
+        .depth = depthGBufferFormat,
+        .objectId = objectIdGBufferFormat
+    });
+#endif
+
+    // The window is already up. Everything that touches the layer stays on the main thread,
+    // which pumps events while the library, pipelines, scene and AS are built on workers.
+    StartupGraph startup;
+    StartupGraph::TaskId library = startup.addTask("Shader Library", [this] {
+        createDefaultLibrary();
+        renderPipelines.initialize(metalDevice, metalDefaultLibrary);
+    });
+    StartupGraph::TaskId pipelines = startup.addTask("Pipelines", [this] { createRenderPipelines(); }, {library});
+    StartupGraph::TaskId scene = startup.addTask("Scene Import", [this] { loadScene(); });
+    startup.addTask("Environment Lighting", [this] { createEnvironmentLighting(); });
+    StartupGraph::TaskId cullingInstances = startup.addTask("Culling Instances", [this] { createCullingInstances(); }, {scene});
+#if POTENTIALLY_VISIBLE_SETS
+    startup.addTask("Visibility Sets", [this] { createVisibilitySets(); }, {cullingInstances});
+#endif
+    startup.addTask("Point Lights", [this] { createPointLights(); }, {scene});
+#if MESH_DISTANCE_FIELDS || SDF_BAKE_BENCHMARK
+    startup.addTask("Mesh SDF", [this] { createDistanceFields(); }, {scene});
+#endif
+#if ASSET_REPORT
+    startup.addTask("Asset Report", [this] { createAssetReport(); }, {scene});
+#endif
+#if SMOOTH_NORMALS_BENCHMARK
+    startup.addTask("Smooth Normals Benchmark", [this] {
+        SmoothNormals::benchmark(*resources->get(meshes[0]), SmoothNormals::Settings{});
+    }, {scene});
+#endif
+#if IMPOSTORS
+    // The GPU bake draws with the G-buffer shaders
+    startup.addTask("Impostors", [this] { createImpostors(); }, {pipelines, scene});
+#endif
+#if SECONDARY_RAY_QUEUE || SECONDARY_RAY_BENCHMARK
+    StartupGraph::TaskId secondaryRayQueue = startup.addTask("Secondary Rays", [this] { createSecondaryRays(); }, {scene});
+#endif
+#if OPACITY_MICROMAPS
+    StartupGraph::TaskId opacityMicromaps = startup.addTask("Opacity Micromaps", [this] { createOpacityMicromaps(); }, {scene});
+    // Every ray tracing pipeline has its own intersection function table
+    startup.addTask("Alpha Mask Binding", [this] {
+        renderPipelines.setIntersectionFunctionBuffer(alphaMaskBuffer, IntersectionBufferIndexAlphaMasks);
+    }, {pipelines, opacityMicromaps});
+    StartupGraph::TaskId triangleResources = startup.addTask("Triangle Resources", [this] { setupTriangleResources(); }, {scene, opacityMicromaps});
+#else
+    StartupGraph::TaskId triangleResources = startup.addTask("Triangle Resources", [this] { setupTriangleResources(); }, {scene});
+#endif
+    // Triangle resources are the primitive data of the acceleration structure, in its triangle order
+    StartupGraph::TaskId accelerationStructure = startup.addTask("Acceleration Structure", [this] {
+        createAccelerationStructureWithDescriptors();
+    }, {triangleResources});
+#if SECONDARY_RAY_QUEUE && PROXY_GEOMETRY
+    // Reads the triangle order of the full structure and hands the proxy to the queue
+    startup.addTask("Proxy Acceleration Structure", [this] { createProxyAccelerationStructure(); }, {accelerationStructure, secondaryRayQueue});
+#endif
+    // Debug line buffers are appended to, spheres and normals share one task
+    startup.addTask("Debug Geometry", [this] {
+        createSphereGrid();
+        createDebugLines();
+    }, {scene});
+    // Runs before the first event poll, a resize callback always finds the targets
+    startup.addTask("Render Targets", [this] { createViewRenderPassDescriptor(); }, {}, true);
+
+    startup.run([] { glfwPollEvents(); });
+    startup.printReport();
+#if ASSET_REPORT == 2
+    // Check only, run() returns before the first frame
+    glfwSetWindowShouldClose(glfwWindow, GLFW_TRUE);
+#endif
 }
 
 void Engine::run() {
+    // The first overlay may be built before the loop below has polled anything
+    editor->pollPlatform();
+#if RENDER_THREAD
+    renderThread = std::thread([this] {
+        while (renderFrame()) {}
+    });
+#endif
     while (!glfwWindowShouldClose(glfwWindow)) {
         float currentFrame = glfwGetTime();
         float deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
         
         camera.processKeyboardInput(glfwWindow, deltaTime);
-        
-        @autoreleasepool {
-            metalDrawable = (__bridge CA::MetalDrawable*)[metalLayer nextDrawable];
-            draw();
-        }
-        
+
+        // Waits while the renderer is a whole snapshot behind
+        RenderSnapshot& snapshot = snapshots.beginWrite();
+        simulate(snapshot, false);
+        snapshots.publish();
+#if !RENDER_THREAD
+        renderFrame();
+#endif
+
+        // ImGui's input callbacks run in here, never while the overlay is built
+        std::lock_guard<std::mutex> lock(editorMutex);
         glfwPollEvents();
+        editor->pollPlatform();
     }
+#if RENDER_THREAD
+    snapshots.close();
+    renderThread.join();
+#endif
+}
+
+bool Engine::renderFrame() {
+    const RenderSnapshot* snapshot = snapshots.acquire();
+    if (!snapshot)
+        return false;
+
+    @autoreleasepool {
+        // A minimised window reports a zero size, the old targets are kept
+        if (snapshot->framebufferWidth > 0 && snapshot->framebufferHeight > 0 &&
+            (snapshot->framebufferWidth != (uint32_t)metalLayer.drawableSize.width ||
+             snapshot->framebufferHeight != (uint32_t)metalLayer.drawableSize.height)) {
+            resizeFrameBuffer(snapshot->framebufferWidth, snapshot->framebufferHeight);
+        }
+        if (snapshot->pickRequested) {
+            objectPicker->requestPick(snapshot->pickX, snapshot->pickY);
+        }
+
+        metalDrawable = (__bridge CA::MetalDrawable*)[metalLayer nextDrawable];
+        draw(*snapshot);
+    }
+    snapshots.release();
+    return true;
+}
+
+void Engine::simulate(RenderSnapshot& snapshot, bool isPaused) {
+    if (!isPaused) {
+        simulationFrame++;
+    }
+    snapshot.frameNumber = simulationFrame;
+
+    camera.setProjectionMatrix(45, (float)newWidth / std::max(newHeight, 1), 0.1f, 1000.0f);
+    snapshot.viewMatrix = camera.getViewMatrix();
+    snapshot.projectionMatrix = camera.getProjectionMatrix();
+    snapshot.cameraPosition = camera.position;
+    snapshot.cameraUp = camera.up;
+    snapshot.cameraRight = camera.right;
+    snapshot.cameraFront = camera.front;
+
+    // Calculate the sun's Z position oscillating over time
+    float oscillationSpeed = 0.01f;
+    float oscillationAmplitude = 12.0f;
+    snapshot.sunPosition = {0.0f, 10.0f, sinf(simulationFrame * oscillationSpeed) * oscillationAmplitude};
+
+    snapshot.framebufferWidth = (uint32_t)newWidth;
+    snapshot.framebufferHeight = (uint32_t)newHeight;
+    snapshot.pickRequested = pickRequested;
+    snapshot.pickX = pickX;
+    snapshot.pickY = pickY;
+    pickRequested = false;
 }
 
 void Engine::cleanup() {
     glfwTerminate();
-    for (auto& mesh : meshes)
-            delete mesh;
+    // Nothing below is released while the GPU may still use it
+    resources->waitIdle();
 	
 	for(uint8_t i = 0; i < MaxFramesInFlight; i++) {
-		frameDataBuffers[i]->release();
+		pointLightBuffers[i]->release();
+		Block_release(frameCompletedHandlers[i]);
     }
 	
+    objectPicker.reset();
+    constants.reset();
+    postProcess.reset();
+    atmosphere.reset();
+    volumetrics.reset();
+    deferredMSAA.reset();
+    tileClassifier.reset();
+    secondaryRays.reset();
+    impostors.reset();
+    if (objectIdGBuffer) {
+        objectIdGBuffer->release();
+    }
+    hdrLightingTexture->release();
     forwardDepthStencilTexture->release();
     rayTracingTexture->release();
-    minMaxDepthTexture->release();
+    releaseMinMaxDepthTexture();
     resourceBuffer->release();
-	defaultVertexDescriptor->release();
+    if (alphaMaskBuffer) {
+        alphaMaskBuffer->release();
+    }
+    if (proxyAccelerationStructure) {
+        proxyAccelerationStructure->release();
+    }
 	viewRenderPassDescriptor->release();
     forwardDescriptor->release();
+    // Frees the meshes and everything retired above
+    resources.reset();
     metalDevice->release();
 }
 
@@ -76,12 +264,18 @@ void Engine::initDevice() {
 
 void Engine::frameBufferSizeCallback(GLFWwindow *window, int width, int height) {
     Engine* engine = (Engine*)glfwGetWindowUserPointer(window);
-    engine->resizeFrameBuffer(width, height);
+    // Render targets belong to the renderer, which resizes them when the next snapshot arrives
+    engine->newWidth = width;
+    engine->newHeight = height;
 }
 
 void Engine::mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
     Engine* engine = (Engine*)glfwGetWindowUserPointer(window);
     engine->camera.processMouseButton(window, button, action);
+
+    if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS && !ImGui::GetIO().WantCaptureMouse) {
+        engine->requestPickAtCursor();
+    }
 }
 
 void Engine::cursorPosCallback(GLFWwindow* window, double xpos, double ypos) {
@@ -89,32 +283,31 @@ void Engine::cursorPosCallback(GLFWwindow* window, double xpos, double ypos) {
     engine->camera.processMouseMovement(xpos, ypos);
 }
 
+void Engine::requestPickAtCursor() {
+    double cursorX, cursorY;
+    int windowWidth, windowHeight;
+    glfwGetCursorPos(glfwWindow, &cursorX, &cursorY);
+    glfwGetWindowSize(glfwWindow, &windowWidth, &windowHeight);
+    if (windowWidth <= 0 || windowHeight <= 0 || cursorX < 0.0 || cursorY < 0.0)
+        return;
+
+    // Cursor is in window points, the ID target is in drawable pixels. Handed over with the next snapshot.
+    double scaleX = (double)newWidth / windowWidth;
+    double scaleY = (double)newHeight / windowHeight;
+    pickRequested = true;
+    pickX = (uint32_t)(cursorX * scaleX);
+    pickY = (uint32_t)(cursorY * scaleY);
+}
+
 void Engine::resizeFrameBuffer(int width, int height) {
     metalLayer.drawableSize = CGSizeMake(width, height);
-    // Deallocate the textures if they have been created
-	if (albedoSpecularGBuffer) {
-		albedoSpecularGBuffer->release();
-		albedoSpecularGBuffer = nullptr;
-	}
-	if (normalMapGBuffer) {
-		normalMapGBuffer->release();
-		normalMapGBuffer = nullptr;
-	}
-	if (depthGBuffer) {
-		depthGBuffer->release();
-		depthGBuffer = nullptr;
-	}
-	if (depthStencilTexture) {
-		depthStencilTexture->release();
-		depthStencilTexture = nullptr;
-	}
-    if (rayTracingTexture) {
-        rayTracingTexture->release();
-        rayTracingTexture = nullptr;
-    }
-    if (forwardDepthStencilTexture) {
-        forwardDepthStencilTexture->release();
-        forwardDepthStencilTexture = nullptr;
+    allocationWarmupFrames = AllocationWarmupFrames;
+    // Frames in flight may still use the old targets, they are released once the GPU is done with them
+    MTL::Texture** targets[] = {&albedoSpecularGBuffer, &normalMapGBuffer, &depthGBuffer, &objectIdGBuffer,
+                                &hdrLightingTexture, &depthStencilTexture, &rayTracingTexture, &forwardDepthStencilTexture};
+    for (MTL::Texture** target : targets) {
+        resources->retire(*target);
+        *target = nullptr;
     }
     
 	// Recreate G-buffer textures and descriptors
@@ -136,11 +329,15 @@ void Engine::initWindow() {
 
     int width, height;
     glfwGetFramebufferSize(glfwWindow, &width, &height);
+    newWidth = width;
+    newHeight = height;
 
     metalWindow = glfwGetCocoaWindow(glfwWindow);
     metalLayer = [CAMetalLayer layer];
     metalLayer.device = (__bridge id<MTLDevice>)metalDevice;
     metalLayer.pixelFormat = MTLPixelFormatBGRA8Unorm;
+    // The post-processing composite writes the drawable from a compute kernel
+    metalLayer.framebufferOnly = NO;
     metalLayer.drawableSize = CGSizeMake(width, height);
     metalWindow.contentView.layer = metalLayer;
     metalWindow.contentView.wantsLayer = YES;
@@ -154,15 +351,30 @@ void Engine::initWindow() {
     metalDrawable = (__bridge CA::MetalDrawable*)[metalLayer nextDrawable];
 }
 
-MTL::CommandBuffer* Engine::beginFrame(bool isPaused) {
+MTL::CommandBuffer* Engine::beginFrame(const RenderSnapshot& snapshot) {
 	
     // Wait on the semaphore for the current frame
     dispatch_semaphore_wait(frameSemaphores[currentFrameIndex], DISPATCH_TIME_FOREVER);
 
+    frameArena.reset();
+    resources->beginFrame();
+
     // Create a new command buffer for each render pass to the current drawable
-    MTL::CommandBuffer* commandBuffer = metalCommandQueue->commandBuffer();
+    MTL::CommandBuffer* commandBuffer = gpuScheduler->commandBuffer(GPUScheduler::Queue::Graphics, MTLSTR("Frame Setup Commands"));
+
+    // Pick readbacks from earlier frames are resolved without waiting on the GPU
+    objectPicker->resolve();
+    if (objectPicker->takeResolvedPick()) {
+        auto pick = objectPicker->getResult();
+        editor->selection.valid = pick.has_value();
+        if (pick) {
+            editor->selection.instanceId = pick->instanceId;
+            editor->selection.triangleId = pick->triangleId;
+            editor->selection.depth = pick->depth;
+        }
+    }
 
-    updateWorldState(isPaused);
+    updateWorldState(snapshot);
 	
 	return commandBuffer;
 }
@@ -172,13 +384,8 @@ MTL::CommandBuffer* Engine::beginFrame(bool isPaused) {
 /// can begin executing encoded commands for the frame (commands from the previous command buffer)
 /// before a drawable for this frame becomes available.
 MTL::CommandBuffer* Engine::beginDrawableCommands() {
-	MTL::CommandBuffer* commandBuffer = metalCommandQueue->commandBuffer();
-	
-	MTL::CommandBufferHandler handler = [this](MTL::CommandBuffer*) {
-		// Signal the semaphore for this frame when GPU work is complete
-		dispatch_semaphore_signal(frameSemaphores[currentFrameIndex]);
-	};
-	commandBuffer->addCompletedHandler(handler);
+	MTL::CommandBuffer* commandBuffer = gpuScheduler->commandBuffer(GPUScheduler::Queue::Graphics, MTLSTR("Deferred Rendering Commands"));
+	commandBuffer->addCompletedHandler(frameCompletedHandlers[currentFrameIndex]);
 	
 	return commandBuffer;
 }
@@ -186,6 +393,7 @@ MTL::CommandBuffer* Engine::beginDrawableCommands() {
 void Engine::endFrame(MTL::CommandBuffer* commandBuffer, MTL::Drawable* currentDrawable) {
     if(commandBuffer) {
         commandBuffer->presentDrawable(metalDrawable);
+        resources->signalFrameEnd(commandBuffer);
         commandBuffer->commit();
         
         // Move to next frame
@@ -194,10 +402,21 @@ void Engine::endFrame(MTL::CommandBuffer* commandBuffer, MTL::Drawable* currentD
 }
 
 void Engine::loadScene() {
-	defaultVertexDescriptor = MTL::VertexDescriptor::alloc()->init();
-	
     std::string objPath = std::string(SCENES_PATH) + "/sponza/sponza.obj";
-    meshes.push_back(new Mesh(objPath.c_str(), metalDevice, defaultVertexDescriptor, true));
+    meshes.push_back(resources->addMesh(new Mesh(objPath.c_str(), metalDevice, true)));
+
+    // Sponza at origin. Instance blocks are only rewritten when a mesh moves.
+    matrix_float4x4 modelMatrix = matrix4x4_translation(0.0f, 0.0f, 0.0f);
+    constants->setInstance(0, InstanceConstants{
+        .model_matrix = modelMatrix,
+        .normal_matrix = matrix3x3_upper_left(modelMatrix)
+    });
+	
+#if IMPOSTORS
+    // Kept out of meshes, it is only drawn through the impostor instances
+    std::string impostorPath = std::string(MODELS_PATH) + "/SMG/smg.obj";
+    impostorMesh = resources->addMesh(new Mesh(impostorPath.c_str(), metalDevice, true));
+#endif
 	
 //	GLTFLoader gltfLoader(metalDevice);
 //	std::string modelPath = std::string(SCENES_PATH) + "/DamagedHelmet/DamagedHelmet.gltf";
@@ -211,6 +430,311 @@ void Engine::loadScene() {
 //				  gltfModel.indices.size());
 }
 
+void Engine::createCullingInstances() {
+    culler.clearInstances();
+    cullInstances.clear();
+
+    // Sponza sits at the origin, object space bounds are world space
+    for (uint32_t meshIndex = 0; meshIndex < meshes.size(); meshIndex++) {
+        const auto& submeshes = resources->get(meshes[meshIndex])->submeshes;
+        for (uint32_t submeshIndex = 0; submeshIndex < submeshes.size(); submeshIndex++) {
+            culler.addInstance(submeshes[submeshIndex].boundsMin, submeshes[submeshIndex].boundsMax);
+            cullInstances.push_back({meshIndex, submeshIndex});
+        }
+    }
+}
+
+void Engine::createVisibilitySets() {
+    // One vertex array for the whole scene, objects are the culler's instances. Sponza sits
+    // at the origin, object space is world space.
+    std::vector<simd::float3> positions;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> triangleObjects;
+    std::vector<simd::float3> boundsMin, boundsMax;
+    std::vector<uint32_t> baseVertices;
+    for (MeshHandle handle : meshes) {
+        const Mesh* mesh = resources->get(handle);
+        baseVertices.push_back((uint32_t)positions.size());
+        for (const Vertex& vertex : mesh->vertices) {
+            positions.push_back(vertex.position.xyz);
+        }
+    }
+    for (uint32_t object = 0; object < cullInstances.size(); object++) {
+        const Mesh* mesh = resources->get(meshes[cullInstances[object].meshIndex]);
+        const Submesh& submesh = mesh->submeshes[cullInstances[object].submeshIndex];
+        for (uint32_t i = submesh.indexOffset; i < submesh.indexOffset + submesh.indexCount; i++) {
+            indices.push_back(baseVertices[cullInstances[object].meshIndex] + mesh->vertexIndices[i]);
+        }
+        triangleObjects.insert(triangleObjects.end(), submesh.indexCount / 3, object);
+        boundsMin.push_back(submesh.boundsMin);
+        boundsMax.push_back(submesh.boundsMax);
+    }
+
+    PVS::Scene scene{
+        .positions = positions,
+        .indices = indices,
+        .triangleObjects = triangleObjects,
+        .objectBoundsMin = boundsMin,
+        .objectBoundsMax = boundsMax
+    };
+    visibilitySets = PVS::loadOrBuild(scene, CACHE_PATH, PVS::BuildSettings{});
+    cellCandidates.resize(visibilitySets.getWordCount());
+}
+
+void Engine::createDistanceFields() {
+    MeshSDF::BakeSettings settings;
+#if MESH_DISTANCE_FIELDS
+    distanceFields.clear();
+#endif
+    for (MeshHandle handle : meshes) {
+        const Mesh* mesh = resources->get(handle);
+#if SDF_BAKE_BENCHMARK
+        MeshSDF::benchmark(*mesh, settings);
+#endif
+#if MESH_DISTANCE_FIELDS
+        distanceFields.push_back(MeshSDF::loadOrBake(*mesh, CACHE_PATH, settings));
+#endif
+    }
+}
+
+void Engine::createAssetReport() {
+    AssetReport::Report report;
+    std::string budgetsPath = std::string(DATA_PATH) + "/asset_budgets.json";
+    if (!AssetReport::loadBudgets(budgetsPath, report.settings.budgets)) {
+        printf("Asset report: no budgets at %s, using the defaults\n", budgetsPath.c_str());
+    }
+
+    std::vector<MeshHandle> analysed = meshes;
+#if IMPOSTORS
+    analysed.push_back(impostorMesh);
+#endif
+    for (MeshHandle handle : analysed) {
+        const Mesh* mesh = resources->get(handle);
+        std::string name = std::filesystem::path(mesh->sourcePath).lexically_relative(DATA_PATH).string();
+        report.meshes.push_back(AssetReport::analyse(*mesh, name, report.settings));
+    }
+    AssetReport::finish(report);
+    AssetReport::print(report);
+
+    std::string reportPath = std::string(CACHE_PATH) + "/asset_report.json";
+    if (!AssetReport::writeJSON(reportPath, report)) {
+        printf("Asset report: could not write %s\n", reportPath.c_str());
+    }
+#if ASSET_REPORT == 2
+    exitCode = report.violations > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+#endif
+}
+
+#if REFERENCE_CHECKS
+void Engine::runReferenceChecks(MTL::CommandBuffer* commandBuffer) {
+    commandBuffer->waitUntilCompleted();
+
+    bool passed = postProcess->checkReference();
+#if MSAA_DEFERRED
+    passed = deferredMSAA->checkReference() && passed;
+#elif TILE_LIGHT_CULLING
+    passed = checkTileLightCulling() && passed;
+#endif
+#if TILE_CLASSIFICATION
+    passed = tileClassifier->checkReference() && passed;
+#endif
+
+    printf("Reference checks %s\n", passed ? "passed" : "FAILED");
+    if (!passed) {
+        exitCode = EXIT_FAILURE;
+    }
+    // Check only, like ASSET_REPORT 2
+    glfwSetWindowShouldClose(glfwWindow, GLFW_TRUE);
+}
+
+#if TILE_LIGHT_CULLING
+void Engine::exportTileLights(MTL::RenderCommandEncoder* renderCommandEncoder) {
+    const PointLight* eyeLights = (const PointLight*)pointLightBuffers[currentFrameIndex]->contents();
+    checkLights.assign(eyeLights, eyeLights + pointLights.size());
+    checkProjectionInverse = constants->getView(ConstantBlocks::MainView).projection_matrix_inverse;
+
+    uint32_t tileCountX = ((uint32_t)depthGBuffer->width() + TileLightingTileSize - 1) / TileLightingTileSize;
+    uint32_t tileCountY = ((uint32_t)depthGBuffer->height() + TileLightingTileSize - 1) / TileLightingTileSize;
+
+    // Bindings and threadgroup memory are still those of the culling dispatch
+    renderCommandEncoder->pushDebugGroup(MTLSTR("Tile Light Export"));
+    renderCommandEncoder->setRenderPipelineState(renderPipelines.getRenderPipeline(RenderPipelineType::TileLightExport));
+    renderCommandEncoder->setTileBuffer(tileLightsReadback.target(metalDevice, tileCountX, tileCountY, sizeof(TileLightList)), 0, BufferIndexTileLightExport);
+    renderCommandEncoder->dispatchThreadsPerTile(MTL::Size(TileLightingTileSize, TileLightingTileSize, 1));
+    renderCommandEncoder->popDebugGroup();
+}
+
+// The depth bounds are reduced from the same floats and must match bit for bit. The
+// light tests run in fast math on the GPU, so lights are only required within 0.1% of
+// their radius: the tile must hold every light that passes with the radius shrunk by
+// that much and nothing that fails with it grown. When more than MaxLightsPerTile lights
+// passed, which ones were kept is arbitrary and only the count is bounded.
+bool Engine::checkTileLightCulling() {
+    uint32_t width = tileDepthReadback.getWidth();
+    uint32_t height = tileDepthReadback.getHeight();
+    const float* depth = tileDepthReadback.data<float>();
+    std::vector<float> eyeDepth(depth, depth + (size_t)width * height);
+
+    auto scaledLights = [&](float scale) {
+        std::vector<PointLight> lights = checkLights;
+        for (PointLight& light : lights) {
+            light.position_radius.w *= scale;
+        }
+        return lights;
+    };
+    auto inner = TileLightCullingReference::cull(eyeDepth, width, height, scaledLights(0.999f), checkProjectionInverse);
+    auto outer = TileLightCullingReference::cull(eyeDepth, width, height, scaledLights(1.001f), checkProjectionInverse);
+    auto exact = TileLightCullingReference::cull(eyeDepth, width, height, checkLights, checkProjectionInverse);
+
+    const TileLightList* gpuTiles = tileLightsReadback.data<TileLightList>();
+    uint32_t depthMismatches = 0;
+    uint32_t listMismatches = 0;
+    size_t gpuLights = 0;
+    size_t referenceLights = 0;
+    for (size_t i = 0; i < exact.tiles.size(); i++) {
+        const TileLightList& gpu = gpuTiles[i];
+        uint32_t minDepthBits, maxDepthBits;
+        std::memcpy(&minDepthBits, &exact.tiles[i].minDepth, sizeof(uint32_t));
+        std::memcpy(&maxDepthBits, &exact.tiles[i].maxDepth, sizeof(uint32_t));
+        if (gpu.minDepthBits != minDepthBits || gpu.maxDepthBits != maxDepthBits) {
+            depthMismatches++;
+            continue;
+        }
+
+        const std::vector<uint16_t>& required = inner.tiles[i].lights;
+        const std::vector<uint16_t>& allowed = outer.tiles[i].lights;
+        uint32_t kept = std::min<uint32_t>(gpu.count, MaxLightsPerTile);
+        std::vector<uint16_t> indices(gpu.indices, gpu.indices + kept);
+        std::sort(indices.begin(), indices.end());
+        gpuLights += gpu.count;
+        referenceLights += exact.tiles[i].lights.size();
+
+        bool inRange = gpu.count >= required.size() && gpu.count <= allowed.size();
+        bool valid = std::includes(allowed.begin(), allowed.end(), indices.begin(), indices.end()) &&
+                     std::adjacent_find(indices.begin(), indices.end()) == indices.end();
+        if (gpu.count <= MaxLightsPerTile) {
+            valid = valid && std::includes(indices.begin(), indices.end(), required.begin(), required.end());
+        }
+        if (!inRange || !valid)
+            listMismatches++;
+    }
+
+    printf("Tile light culling reference: %zu lights in %zu tiles, %u tiles with other depth bounds, %u with other lights (%zu lights culled, %zu expected)\n",
+           checkLights.size(), exact.tiles.size(), depthMismatches, listMismatches, gpuLights, referenceLights);
+    return depthMismatches == 0 && listMismatches == 0;
+}
+#endif
+#endif
+
+void Engine::createSecondaryRays() {
+    simd::float3 boundsMin = simd::float3(std::numeric_limits<float>::max());
+    simd::float3 boundsMax = simd::float3(-std::numeric_limits<float>::max());
+    for (MeshHandle handle : meshes) {
+        const Mesh* mesh = resources->get(handle);
+#if SECONDARY_RAY_BENCHMARK
+        SecondaryRayQueue::benchmark(*mesh, 640, 360);
+#endif
+        for (const Vertex& vertex : mesh->vertices) {
+            boundsMin = simd::min(boundsMin, vertex.position.xyz);
+            boundsMax = simd::max(boundsMax, vertex.position.xyz);
+        }
+    }
+#if SECONDARY_RAY_QUEUE
+    secondaryRays->setSceneBounds(boundsMin, boundsMax);
+#endif
+}
+
+void Engine::createImpostors() {
+#if IMPOSTORS
+    impostors = std::make_unique<Impostors>(metalDevice, renderPipelines, MaxFramesInFlight);
+    const Mesh* mesh = resources->get(impostorMesh);
+    Impostors::BakeSettings settings;
+    uint32_t atlas = impostors->addMesh(*mesh, CACHE_PATH, metalCommandQueue, settings);
+
+    simd::float3 boundsMin = simd::float3(std::numeric_limits<float>::max());
+    simd::float3 boundsMax = simd::float3(-std::numeric_limits<float>::max());
+    for (MeshHandle handle : meshes) {
+        for (const Vertex& vertex : resources->get(handle)->vertices) {
+            boundsMin = simd::min(boundsMin, vertex.position.xyz);
+            boundsMax = simd::max(boundsMax, vertex.position.xyz);
+        }
+    }
+    float sceneSize = simd::length(boundsMax - boundsMin);
+    impostors->distanceThreshold = sceneSize * 0.15f;
+
+    // A grid on the floor of the scene, every copy about 3% of the scene across
+    const uint32_t gridSize = 32;
+    float scale = sceneSize * 0.015f / Impostors::fitParams(*mesh, settings).center_radius.w;
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> jitter(-0.5f, 0.5f);
+    for (uint32_t z = 0; z < gridSize; z++) {
+        for (uint32_t x = 0; x < gridSize; x++) {
+            simd::float3 t = {(x + 0.5f + jitter(random) * 0.5f) / gridSize, 0.0f, (z + 0.5f + jitter(random) * 0.5f) / gridSize};
+            impostors->addInstance({.atlas = atlas, .position = boundsMin + (boundsMax - boundsMin) * t, .scale = scale});
+        }
+    }
+#endif
+}
+
+void Engine::createPointLights() {
+#if TEST_POINT_LIGHTS || (REFERENCE_CHECKS && TILE_LIGHT_CULLING)
+    // Scatter the lights through the scene bounds
+    simd::float3 boundsMin = simd::float3(std::numeric_limits<float>::max());
+    simd::float3 boundsMax = simd::float3(-std::numeric_limits<float>::max());
+    for (MeshHandle handle : meshes) {
+        const Mesh* mesh = resources->get(handle);
+        for (const Vertex& vertex : mesh->vertices) {
+            boundsMin = simd::min(boundsMin, vertex.position.xyz);
+            boundsMax = simd::max(boundsMax, vertex.position.xyz);
+        }
+    }
+    float sceneSize = simd::length(boundsMax - boundsMin);
+
+    const uint32_t lightCount = 256;
+    std::mt19937 random(1337);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    pointLights.resize(lightCount);
+    for (PointLight& light : pointLights) {
+        simd::float3 t = {unit(random), unit(random) * 0.5f, unit(random)};
+        simd::float3 position = boundsMin + (boundsMax - boundsMin) * t;
+        float radius = sceneSize * (0.02f + 0.03f * unit(random));
+
+        simd::float3 color = simd::float3{unit(random), unit(random), unit(random)};
+        color /= std::max({color.x, color.y, color.z, 1e-3f});
+
+        light.position_radius = simd_make_float4(position, radius);
+        light.color_intensity = simd_make_float4(color, 4.0f);
+    }
+#endif
+
+    // Never empty, the tile stage binds the buffer whatever the light count
+    size_t bufferLength = sizeof(PointLight) * std::max<size_t>(pointLights.size(), 1);
+    for (uint8_t i = 0; i < MaxFramesInFlight; i++) {
+        pointLightBuffers[i] = metalDevice->newBuffer(bufferLength, MTL::ResourceStorageModeShared);
+        pointLightBuffers[i]->setLabel(NS::String::string("Point Lights", NS::ASCIIStringEncoding));
+    }
+}
+
+void Engine::createEnvironmentLighting() {
+    EnvironmentLighting::SphericalHarmonicsL2 radiance;
+    std::string environmentPath = std::string(SCENES_PATH) + "/environment.hdr";
+
+    // Fall back to a procedural sky when the scene ships without an environment map
+    if (!std::ifstream(environmentPath).good() || !EnvironmentLighting::loadEquirectangular(environmentPath, radiance)) {
+        auto sky = EnvironmentLighting::proceduralSky(64,
+                                                      simd::float3{0.0f, 1.0f, 0.3f},
+                                                      simd::float3{0.25f, 0.40f, 0.70f},
+                                                      simd::float3{0.60f, 0.65f, 0.70f},
+                                                      simd::float3{0.18f, 0.16f, 0.14f},
+                                                      simd::float3{4.0f, 3.8f, 3.5f});
+        radiance = EnvironmentLighting::projectCubeMap(sky);
+        ambientIntensity = 0.3f;
+    }
+
+    EnvironmentLighting::toIrradiance(radiance, environmentIrradiance.data());
+}
+
 void Engine::createDefaultLibrary() {
     // Create an NSString from the metallib path
     NS::String* libraryPath = NS::String::string(
@@ -222,11 +746,6 @@ void Engine::createDefaultLibrary() {
 
     printf("Selected Device: %s\n", metalDevice->name()->utf8String());
 
-    for(uint8_t i = 0; i < MaxFramesInFlight; i++) {
-        frameDataBuffers[i] = metalDevice->newBuffer(sizeof(FrameData), MTL::ResourceStorageModeShared);
-        frameDataBuffers[i]->setLabel(NS::String::string("FrameData", NS::ASCIIStringEncoding));
-    }
-    
     metalDefaultLibrary = metalDevice->newLibrary(libraryPath, &error);
     
     if (!metalDefaultLibrary) {
@@ -238,53 +757,79 @@ void Engine::createDefaultLibrary() {
     }
 }
 
-void Engine::updateWorldState(bool isPaused) {
-	if (!isPaused) {
-		frameNumber++;
-	}
-
-	FrameData *frameData = (FrameData *)(frameDataBuffers[currentFrameIndex]->contents());
+void Engine::updateWorldState(const RenderSnapshot& snapshot) {
+	frameNumber = snapshot.frameNumber;
 
-	float aspectRatio = metalDrawable->layer()->drawableSize().width / metalDrawable->layer()->drawableSize().height;
-	
-	camera.setProjectionMatrix(45, aspectRatio, 0.1f, 1000.0f);
-	frameData->projection_matrix = camera.getProjectionMatrix();
-	frameData->projection_matrix_inverse = matrix_invert(frameData->projection_matrix);
-	frameData->view_matrix = camera.getViewMatrix();
+	// Only blocks whose contents change are written to the constant buffer
+	ViewConstants view = constants->getView(ConstantBlocks::MainView);
+	matrix_float4x4 projection = snapshot.projectionMatrix;
+	if (memcmp(&projection, &view.projection_matrix, sizeof(projection)) != 0) {
+		view.projection_matrix = projection;
+		view.projection_matrix_inverse = matrix_invert(projection);
+	}
+	view.view_matrix = snapshot.viewMatrix;
     
-    frameData->cameraUp         = float4{camera.up.x,       camera.up.y,        camera.up.z, 1.0f};
-    frameData->cameraRight      = float4{camera.right.x,    camera.right.y,     camera.right.z, 1.0f};
-    frameData->cameraForward    = float4{camera.front.x,    camera.front.y,     camera.front.z, 1.0f};
-    frameData->cameraPosition   = float4{camera.position.x, camera.position.y,  camera.position.z, 1.0f};
+    view.cameraUp         = simd_make_float4(snapshot.cameraUp, 1.0f);
+    view.cameraRight      = simd_make_float4(snapshot.cameraRight, 1.0f);
+    view.cameraForward    = simd_make_float4(snapshot.cameraFront, 1.0f);
+    view.cameraPosition   = simd_make_float4(snapshot.cameraPosition, 1.0f);
+	constants->setView(ConstantBlocks::MainView, view);
 
 	// Set screen dimensions
-	frameData->framebuffer_width = (uint)metalLayer.drawableSize.width;
-	frameData->framebuffer_height = (uint)metalLayer.drawableSize.height;
+	constants->setPass(PassConstants{
+		.framebuffer_width = (uint)metalLayer.drawableSize.width,
+		.framebuffer_height = (uint)metalLayer.drawableSize.height
+	});
 
+	FrameConstants frame{};
 	// Define the sun color
-	frameData->sun_color = simd_make_float4(1.0, 1.0, 1.0, 1.0);
-	frameData->sun_specular_intensity = 1.0;
-
-	// Calculate the sun's X position oscillating over time
-	float oscillationSpeed = 0.01f;
-	float oscillationAmplitude = 12.0f;
-	float sunZ = sin(frameNumber * oscillationSpeed) * oscillationAmplitude;
+	frame.sun_color = simd_make_float4(1.0, 1.0, 1.0, 1.0);
+	frame.sun_specular_intensity = 1.0;
 
-	float sunY = 10.0f;
-	float sunX = 0.0f;
+	// Ambient environment lighting
+	frame.ambient_intensity = ambientIntensity;
+#if VOLUMETRIC_LIGHTING
+	frame.volumetric_near = volumetrics->params.nearDistance;
+	frame.volumetric_far = volumetrics->params.farDistance;
+#endif
+	std::copy(environmentIrradiance.begin(), environmentIrradiance.end(), frame.sh_irradiance);
 
 	// Sun world position
-	float4 sunWorldPosition = {sunX, sunY, sunZ, 1.0};
+	float4 sunWorldPosition = simd_make_float4(snapshot.sunPosition, 1.0f);
 	float4 sunWorldDirection = -sunWorldPosition;
 
 	// Update the sun direction in view space
-	frameData->sun_eye_direction = sunWorldDirection;
+	frame.sun_eye_direction = sunWorldDirection;
+	sunDirection = simd::normalize(sunWorldPosition.xyz);
+	constants->setFrame(frame);
+
+	// One culling pass for every view of the frame
+	cullViews.clear();
+	cullViews.push_back({.viewProjection = view.projection_matrix * view.view_matrix});
+#if POTENTIALLY_VISIBLE_SETS
+	// The candidate set only changes when the camera crosses into another cell
+	uint32_t cell = PVS::findCell(visibilitySets, snapshot.cameraPosition);
+	if (cell != cameraCell) {
+		cameraCell = cell;
+		bool hasSet = PVS::decompress(visibilitySets, cell, cellCandidates);
+		culler.setCandidates(hasSet ? std::span<const uint64_t>(cellCandidates) : std::span<const uint64_t>());
+	}
+	cullViews.back().flags |= FrustumCuller::ViewFlagCandidatesOnly;
+#endif
+	culler.cull(cullViews, frameArena);
+#if IMPOSTORS
+	impostors->update(currentFrameIndex, snapshot.cameraPosition);
+#endif
+
+	// Point lights are culled and shaded in eye space
+	PointLight* eyeLights = (PointLight*)pointLightBuffers[currentFrameIndex]->contents();
+	for (size_t i = 0; i < pointLights.size(); i++) {
+		float4 eyePosition = view.view_matrix * simd_make_float4(pointLights[i].position_radius.xyz, 1.0f);
+		eyeLights[i].position_radius = simd_make_float4(eyePosition.xyz, pointLights[i].position_radius.w);
+		eyeLights[i].color_intensity = pointLights[i].color_intensity;
+	}
 
-	float4 directionalLightUpVector = {0.0, 1.0, 0.0, 0.0};
-	// Update scene matrices
-	frameData->scene_model_matrix = matrix4x4_translation(0.0f, 0.0f, 0.0f); // Sponza at origin
-	frameData->scene_modelview_matrix = frameData->view_matrix * frameData->scene_model_matrix;
-	frameData->scene_normal_matrix = matrix3x3_upper_left(frameData->scene_model_matrix);
+	constants->upload(currentFrameIndex);
 }
 
 
@@ -292,12 +837,25 @@ void Engine::createCommandQueue() {
     metalCommandQueue = metalDevice->newCommandQueue();
 }
 
-void Engine::createRenderPipelines() {
-    NS::Error* error;
-	
+void Engine::selectRenderTargetFormats() {
 	albedoSpecularGBufferFormat = MTL::PixelFormatRGBA8Unorm_sRGB;
 	normalMapGBufferFormat 	    = MTL::PixelFormatRGBA8Snorm;
 	depthGBufferFormat			= MTL::PixelFormatR32Float;
+	objectIdGBufferFormat		= MTL::PixelFormatRG32Uint;
+	hdrLightingFormat			= MTL::PixelFormatRGBA16Float;
+	// Read once here, pipelines are built off the main thread while the drawable is swapped on resize
+	drawablePixelFormat			= (MTL::PixelFormat)metalLayer.pixelFormat;
+}
+
+void Engine::createRenderPipelines() {
+    NS::Error* error;
+
+    // Every pipeline that traces rays links the alpha test of the masked geometry
+#if OPACITY_MICROMAPS
+    const std::vector<std::string> rayIntersectionFunctions = {"alphaTestIntersection"};
+#else
+    const std::vector<std::string> rayIntersectionFunctions;
+#endif
 
     #pragma mark Deferred render pipeline setup
     {
@@ -306,15 +864,49 @@ void Engine::createRenderPipelines() {
                 .label = "G-buffer Creation",
                 .vertexFunctionName = "gbuffer_vertex",
                 .fragmentFunctionName = "gbuffer_fragment",
-                .vertexDescriptor = defaultVertexDescriptor
+                .colorPixelFormat = hdrLightingFormat
             };
             gbufferConfig.colorAttachments = {
-                {RenderTargetLighting, MTL::PixelFormatBGRA8Unorm},
+                {RenderTargetLighting, hdrLightingFormat},
                 {RenderTargetAlbedo, albedoSpecularGBufferFormat},
                 {RenderTargetNormal, normalMapGBufferFormat},
                 {RenderTargetDepth, depthGBufferFormat}
             };
+        #if OBJECT_PICKING
+            gbufferConfig.colorAttachments[RenderTargetObjectId] = objectIdGBufferFormat;
+        #endif
+        #if MSAA_DEFERRED
+            // Lighting happens in compute afterwards, the pass has no lighting attachment
+            gbufferConfig.colorPixelFormat = MTL::PixelFormatInvalid;
+            gbufferConfig.colorAttachments.erase(RenderTargetLighting);
+            gbufferConfig.sampleCount = DeferredMSAA::SampleCount;
+        #endif
             renderPipelines.createRenderPipeline(RenderPipelineType::GBuffer, gbufferConfig);
+
+		#if IMPOSTORS
+            // Impostor quads are drawn inside the G-buffer pass
+            RenderPipelineConfig impostorConfig = gbufferConfig;
+            impostorConfig.label = "Impostors";
+            impostorConfig.vertexFunctionName = "impostor_vertex";
+            impostorConfig.fragmentFunctionName = "impostor_fragment";
+            renderPipelines.createRenderPipeline(RenderPipelineType::Impostor, impostorConfig);
+
+            // The bake reuses the G-buffer shaders with only the atlas targets attached
+            RenderPipelineConfig impostorBakeConfig{
+                .label = "Impostor Bake",
+                .vertexFunctionName = "gbuffer_vertex",
+                .fragmentFunctionName = "gbuffer_fragment",
+                .colorPixelFormat = MTL::PixelFormatInvalid,
+                .depthPixelFormat = MTL::PixelFormatDepth32Float,
+                .stencilPixelFormat = MTL::PixelFormatInvalid
+            };
+            impostorBakeConfig.colorAttachments = {
+                {RenderTargetAlbedo, MTL::PixelFormatRGBA8Unorm_sRGB},
+                {RenderTargetNormal, MTL::PixelFormatRGBA8Snorm},
+                {RenderTargetDepth, MTL::PixelFormatR16Float}
+            };
+            renderPipelines.createRenderPipeline(RenderPipelineType::ImpostorBake, impostorBakeConfig);
+		#endif
 		}
 		
 		#pragma mark GBuffer depth state setup
@@ -339,6 +931,15 @@ void Engine::createRenderPipelines() {
                 .backStencil = gbufferStencil
             };
             renderPipelines.createDepthStencilState(DepthStencilType::GBuffer, gbufferDepthConfig);
+
+		#if IMPOSTORS
+			DepthStencilConfig impostorBakeDepthConfig{
+                .label = "Impostor Bake",
+                .depthCompareFunction = MTL::CompareFunctionLess,
+                .depthWriteEnabled = true
+            };
+            renderPipelines.createDepthStencilState(DepthStencilType::ImpostorBake, impostorBakeDepthConfig);
+		#endif
 		}
 		
 		// Setup render state to apply directional light in final pass
@@ -349,19 +950,21 @@ void Engine::createRenderPipelines() {
                     .label = "Deferred Directional Lighting",
                     .vertexFunctionName = "deferred_directional_lighting_vertex",
                     .fragmentFunctionName = "deferred_directional_lighting_fragment",
-                    .colorPixelFormat = MTL::PixelFormatBGRA8Unorm,
+                    .colorPixelFormat = hdrLightingFormat,
                     .depthPixelFormat = MTL::PixelFormatDepth32Float_Stencil8,
-                    .stencilPixelFormat = MTL::PixelFormatDepth32Float_Stencil8,
-                    .vertexDescriptor = nullptr
+                    .stencilPixelFormat = MTL::PixelFormatDepth32Float_Stencil8
                 };
 
                 // Add additional color attachments for GBuffer
                 directionalConfig.colorAttachments = {
-                    {RenderTargetLighting, MTL::PixelFormatBGRA8Unorm},
+                    {RenderTargetLighting, hdrLightingFormat},
                     {RenderTargetAlbedo, albedoSpecularGBufferFormat},
                     {RenderTargetNormal, normalMapGBufferFormat},
                     {RenderTargetDepth, depthGBufferFormat}
                 };
+            #if OBJECT_PICKING
+                directionalConfig.colorAttachments[RenderTargetObjectId] = objectIdGBufferFormat;
+            #endif
                 renderPipelines.createRenderPipeline(RenderPipelineType::DirectionalLight, directionalConfig);
             }
 
@@ -388,13 +991,73 @@ void Engine::createRenderPipelines() {
                 renderPipelines.createDepthStencilState(DepthStencilType::DirectionalLight, directionalDepthConfig);
 			}
 		}
+
+	#if TILE_LIGHT_CULLING
+		#pragma mark Tile light culling pipeline setup
+		{
+			TilePipelineConfig tileCullingConfig{
+                .label = "Tile Light Culling",
+                .tileFunctionName = "cullLightsTileKernel"
+            };
+            tileCullingConfig.colorAttachments = {
+                {RenderTargetLighting, hdrLightingFormat},
+                {RenderTargetAlbedo, albedoSpecularGBufferFormat},
+                {RenderTargetNormal, normalMapGBufferFormat},
+                {RenderTargetDepth, depthGBufferFormat}
+            };
+        #if OBJECT_PICKING
+            tileCullingConfig.colorAttachments[RenderTargetObjectId] = objectIdGBufferFormat;
+        #endif
+            renderPipelines.createTilePipeline(RenderPipelineType::TileLightCulling, tileCullingConfig);
+
+        #if REFERENCE_CHECKS
+            TilePipelineConfig tileExportConfig = tileCullingConfig;
+            tileExportConfig.label = "Tile Light Export";
+            tileExportConfig.tileFunctionName = "exportTileLightsKernel";
+            renderPipelines.createTilePipeline(RenderPipelineType::TileLightExport, tileExportConfig);
+        #endif
+		}
+	#endif
+
+	#if ATMOSPHERIC_SCATTERING
+		#pragma mark Sky render pipeline setup
+		{
+			RenderPipelineConfig skyConfig{
+                .label = "Atmosphere Sky",
+                .vertexFunctionName = "atmosphere_sky_vertex",
+                .fragmentFunctionName = "atmosphere_sky_fragment",
+                .colorPixelFormat = hdrLightingFormat,
+                .depthPixelFormat = MTL::PixelFormatDepth32Float_Stencil8,
+                .stencilPixelFormat = MTL::PixelFormatDepth32Float_Stencil8
+            };
+            skyConfig.colorAttachments = {
+                {RenderTargetLighting, hdrLightingFormat},
+                {RenderTargetAlbedo, albedoSpecularGBufferFormat},
+                {RenderTargetNormal, normalMapGBufferFormat},
+                {RenderTargetDepth, depthGBufferFormat}
+            };
+        #if OBJECT_PICKING
+            skyConfig.colorAttachments[RenderTargetObjectId] = objectIdGBufferFormat;
+        #endif
+            renderPipelines.createRenderPipeline(RenderPipelineType::Sky, skyConfig);
+
+            // Drawn on the far plane, only where no geometry was written
+            DepthStencilConfig skyDepthConfig{
+                .label = "Atmosphere Sky",
+                .depthCompareFunction = MTL::CompareFunctionLessEqual,
+                .depthWriteEnabled = false
+            };
+            renderPipelines.createDepthStencilState(DepthStencilType::Sky, skyDepthConfig);
+		}
+	#endif
     }
     
     #pragma mark Ray tracing pipeline state
     {
         ComputePipelineConfig raytracingConfig{
             .label = "Raytracing Pipeline",
-            .computeFunctionName = "raytracingKernel"
+            .computeFunctionName = "raytracingKernel",
+            .intersectionFunctionNames = rayIntersectionFunctions
         };
         renderPipelines.createComputePipeline(ComputePipelineType::Raytracing, raytracingConfig);
     }
@@ -405,10 +1068,22 @@ void Engine::createRenderPipelines() {
             .label = "Forward Debug Pipeline",
             .vertexFunctionName = "forwardVertex",
             .fragmentFunctionName = "forwardFragment",
-            .colorPixelFormat = metalDrawable->texture()->pixelFormat()
+            .colorPixelFormat = drawablePixelFormat
         };
         renderPipelines.createRenderPipeline(RenderPipelineType::ForwardDebug, debugConfig);
     }
+
+    #pragma mark Editor overlay composite pipeline state
+    {
+        RenderPipelineConfig compositeConfig{
+            .label = "Editor Overlay Composite",
+            .vertexFunctionName = "editorCompositeVertex",
+            .fragmentFunctionName = "editorCompositeFragment",
+            .colorPixelFormat = drawablePixelFormat,
+            .blend = BlendConfig{}
+        };
+        renderPipelines.createRenderPipeline(RenderPipelineType::EditorComposite, compositeConfig);
+    }
     
     #pragma mark Min Max Depth Buffer
     {
@@ -430,51 +1105,201 @@ void Engine::createRenderPipelines() {
             renderPipelines.createComputePipeline(ComputePipelineType::MinMaxDepth, minMaxDepthConfig);
         }
     }
-}
 
-void Engine::createAccelerationStructureWithDescriptors() {
-    // Create a separate command queue for acceleration structure building
-    MTL::CommandQueue* commandQueue = metalDevice->newCommandQueue();
-    MTL::CommandBuffer* commandBuffer = commandQueue->commandBuffer();
+    #pragma mark Post-processing pipeline states
+    {
+        ComputePipelineConfig bloomDownsampleConfig{
+            .label = "Bloom Downsample",
+            .computeFunctionName = "bloomDownsampleKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::BloomDownsample, bloomDownsampleConfig);
 
-    std::vector<Vertex> mergedVertices;
-    std::vector<uint32_t> mergedIndices;
+        ComputePipelineConfig bloomUpsampleConfig{
+            .label = "Bloom Upsample",
+            .computeFunctionName = "bloomUpsampleKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::BloomUpsample, bloomUpsampleConfig);
 
-    size_t vertexOffset = 0;
-        
-    for (const auto& mesh : meshes) {
-        mergedVertices.insert(mergedVertices.end(), mesh->vertices.begin(), mesh->vertices.end());
+        ComputePipelineConfig compositeConfig{
+            .label = "Post Composite",
+            .computeFunctionName = "postCompositeKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::PostComposite, compositeConfig);
+    }
 
-        for (size_t index : mesh->vertexIndices) {
-            mergedIndices.push_back(static_cast<uint32_t>(index + vertexOffset));
-        }
+    #pragma mark Atmosphere LUT pipeline states
+    {
+        ComputePipelineConfig transmittanceConfig{
+            .label = "Transmittance LUT",
+            .computeFunctionName = "transmittanceLUTKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::TransmittanceLUT, transmittanceConfig);
+
+        ComputePipelineConfig multiScatteringConfig{
+            .label = "Multiple Scattering LUT",
+            .computeFunctionName = "multiScatteringLUTKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::MultiScatteringLUT, multiScatteringConfig);
 
-        vertexOffset += mesh->vertices.size();
-        totalTriangles += mesh->triangleCount;
+        ComputePipelineConfig skyViewConfig{
+            .label = "Sky View LUT",
+            .computeFunctionName = "skyViewLUTKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::SkyViewLUT, skyViewConfig);
     }
 
-    size_t vertexBufferSize             = mergedVertices.size() * sizeof(Vertex);
-    MTL::Buffer* mergedVertexBuffer     = metalDevice->newBuffer(vertexBufferSize, MTL::ResourceStorageModeShared);
-    mergedVertexBuffer->setLabel(NS::String::string("mergedVertexBuffer", NS::ASCIIStringEncoding));
-    memcpy(mergedVertexBuffer->contents(), mergedVertices.data(), vertexBufferSize);
+#if TILE_CLASSIFICATION
+    #pragma mark Tile classification pipeline states
+    {
+        ComputePipelineConfig classifyConfig{
+            .label = "Tile Classification",
+            .computeFunctionName = "classifyTilesKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::TileClassify, classifyConfig);
 
-    size_t indexBufferSize          = mergedIndices.size() * sizeof(uint32_t);
-    MTL::Buffer* mergedIndexBuffer  = metalDevice->newBuffer(indexBufferSize, MTL::ResourceStorageModeShared);
-    mergedIndexBuffer->setLabel(NS::String::string("mergedIndexBuffer", NS::ASCIIStringEncoding));
+        ComputePipelineConfig raytracingTilesConfig{
+            .label = "Raytracing Tiles",
+            .computeFunctionName = "raytracingTilesKernel",
+            .intersectionFunctionNames = rayIntersectionFunctions
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::RaytracingTiles, raytracingTilesConfig);
 
-    memcpy(mergedIndexBuffer->contents(), mergedIndices.data(), indexBufferSize);
+        ComputePipelineConfig raytracingSimpleTilesConfig{
+            .label = "Raytracing Simple Tiles",
+            .computeFunctionName = "raytracingSimpleTilesKernel",
+            .intersectionFunctionNames = rayIntersectionFunctions
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::RaytracingSimpleTiles, raytracingSimpleTilesConfig);
+
+        ComputePipelineConfig raytracingEdgeTilesConfig{
+            .label = "Raytracing Edge Tiles",
+            .computeFunctionName = "raytracingEdgeTilesKernel",
+            .intersectionFunctionNames = rayIntersectionFunctions
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::RaytracingEdgeTiles, raytracingEdgeTilesConfig);
+
+        ComputePipelineConfig clearTilesConfig{
+            .label = "Raytracing Clear Tiles",
+            .computeFunctionName = "clearRaytracingTilesKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::RaytracingClearTiles, clearTilesConfig);
+    }
+#endif
 
+#if SECONDARY_RAY_QUEUE
+    #pragma mark Secondary ray queue pipeline states
+    {
+        ComputePipelineConfig clearConfig{
+            .label = "Secondary Ray Clear",
+            .computeFunctionName = "clearSecondaryRayBinsKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::SecondaryRayClear, clearConfig);
+
+        ComputePipelineConfig queueConfig{
+            .label = "Secondary Ray Queue",
+            .computeFunctionName = "queueSecondaryRaysKernel",
+            .intersectionFunctionNames = rayIntersectionFunctions
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::SecondaryRayQueue, queueConfig);
+
+        ComputePipelineConfig scanConfig{
+            .label = "Secondary Ray Scan",
+            .computeFunctionName = "scanSecondaryRayBinsKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::SecondaryRayScan, scanConfig);
+
+        ComputePipelineConfig scatterConfig{
+            .label = "Secondary Ray Scatter",
+            .computeFunctionName = "scatterSecondaryRaysKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::SecondaryRayScatter, scatterConfig);
+
+        ComputePipelineConfig traceConfig{
+            .label = "Secondary Ray Trace",
+            .computeFunctionName = "traceSecondaryRaysKernel",
+            .intersectionFunctionNames = rayIntersectionFunctions
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::SecondaryRayTrace, traceConfig);
+    }
+#endif
+
+#if VOLUMETRIC_LIGHTING
+    #pragma mark Volumetric lighting pipeline states
+    {
+        ComputePipelineConfig injectConfig{
+            .label = "Froxel Injection",
+            .computeFunctionName = "injectFroxelsKernel",
+            .intersectionFunctionNames = rayIntersectionFunctions
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::InjectFroxels, injectConfig);
+
+        ComputePipelineConfig integrateConfig{
+            .label = "Froxel Integration",
+            .computeFunctionName = "integrateFroxelsKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::IntegrateFroxels, integrateConfig);
+    }
+#endif
+
+#if MSAA_DEFERRED
+    #pragma mark MSAA deferred lighting pipeline states
+    {
+        ComputePipelineConfig classifyConfig{
+            .label = "MSAA Classify",
+            .computeFunctionName = "msaaClassifyKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::MSAAClassify, classifyConfig);
+
+        ComputePipelineConfig shadeSimpleConfig{
+            .label = "MSAA Shade Simple",
+            .computeFunctionName = "msaaShadeSimpleKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::MSAAShadeSimple, shadeSimpleConfig);
+
+        ComputePipelineConfig shadeComplexConfig{
+            .label = "MSAA Shade Complex",
+            .computeFunctionName = "msaaShadeComplexKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::MSAAShadeComplex, shadeComplexConfig);
+
+#if REFERENCE_CHECKS
+        ComputePipelineConfig readbackSamplesConfig{
+            .label = "MSAA Readback Samples",
+            .computeFunctionName = "msaaReadbackSamplesKernel"
+        };
+        renderPipelines.createComputePipeline(ComputePipelineType::MSAAReadbackSamples, readbackSamplesConfig);
+#endif
+    }
+#endif
+}
+
+// Opaque geometry never calls an intersection function, non-opaque geometry runs the
+// alpha test at offset 0 of the function table
+static MTL::AccelerationStructureTriangleGeometryDescriptor* createTriangleGeometry(MTL::Buffer* vertexBuffer, NS::UInteger vertexStride,
+                                                                                   MTL::Buffer* indexBuffer, size_t firstTriangle,
+                                                                                   size_t triangleCount, bool opaque) {
     MTL::AccelerationStructureTriangleGeometryDescriptor* geometryDescriptor = MTL::AccelerationStructureTriangleGeometryDescriptor::alloc()->init();
 
-    geometryDescriptor->setVertexBuffer(mergedVertexBuffer);
-    geometryDescriptor->setVertexStride(sizeof(Vertex));
+    geometryDescriptor->setVertexBuffer(vertexBuffer);
+    geometryDescriptor->setVertexStride(vertexStride);
     geometryDescriptor->setVertexFormat(MTL::AttributeFormatFloat3);
 
-    geometryDescriptor->setIndexBuffer(mergedIndexBuffer);
+    geometryDescriptor->setIndexBuffer(indexBuffer);
+    geometryDescriptor->setIndexBufferOffset(firstTriangle * 3 * sizeof(uint32_t));
     geometryDescriptor->setIndexType(MTL::IndexTypeUInt32);
-    geometryDescriptor->setTriangleCount(static_cast<uint32_t>(totalTriangles));
+    geometryDescriptor->setTriangleCount(triangleCount);
+
+    geometryDescriptor->setOpaque(opaque);
+    geometryDescriptor->setIntersectionFunctionTableOffset(0);
+    return geometryDescriptor;
+}
+
+MTL::AccelerationStructure* Engine::buildAccelerationStructure(const std::vector<MTL::AccelerationStructureTriangleGeometryDescriptor*>& geometries) {
+    // Create a separate command queue for acceleration structure building
+    MTL::CommandQueue* commandQueue = metalDevice->newCommandQueue();
+    MTL::CommandBuffer* commandBuffer = commandQueue->commandBuffer();
 
-    NS::Array* geometryDescriptors = NS::Array::array(geometryDescriptor);
+    NS::Array* geometryDescriptors = NS::Array::array((const NS::Object* const*)geometries.data(), geometries.size());
 
     // Set the triangle geometry descriptors in the acceleration structure descriptor
     MTL::PrimitiveAccelerationStructureDescriptor* accelerationStructureDescriptor = MTL::PrimitiveAccelerationStructureDescriptor::alloc()->init();
@@ -500,38 +1325,197 @@ void Engine::createAccelerationStructureWithDescriptors() {
     commandBuffer->commit();
     commandBuffer->waitUntilCompleted();
 
-    // Store the acceleration structure for later use
-    primitiveAccelerationStructures.push_back(accelerationStructure);
-
-    geometryDescriptor->release();
-    geometryDescriptors->release();
+    for (auto* geometryDescriptor : geometries) {
+        geometryDescriptor->release();
+    }
     accelerationStructureDescriptor->release();
     scratchBuffer->release();
     commandBuffer->release();
     commandQueue->release();
+    return accelerationStructure;
 }
 
-void Engine::setupTriangleResources() {
-    size_t resourceStride = sizeof(TriangleData);
-    size_t bufferLength = resourceStride * totalTriangles;
+void Engine::createAccelerationStructureWithDescriptors() {
+    std::vector<Vertex> mergedVertices;
+    for (MeshHandle handle : meshes) {
+        const Mesh* mesh = resources->get(handle);
+        mergedVertices.insert(mergedVertices.end(), mesh->vertices.begin(), mesh->vertices.end());
+    }
 
-    resourceBuffer = metalDevice->newBuffer(bufferLength, MTL::ResourceStorageModeShared);
-    resourceBuffer->setLabel(NS::String::string("Resource Buffer", NS::ASCIIStringEncoding));
+    size_t vertexBufferSize             = mergedVertices.size() * sizeof(Vertex);
+    MTL::Buffer* mergedVertexBuffer     = metalDevice->newBuffer(vertexBufferSize, MTL::ResourceStorageModeShared);
+    mergedVertexBuffer->setLabel(NS::String::string("mergedVertexBuffer", NS::ASCIIStringEncoding));
+    memcpy(mergedVertexBuffer->contents(), mergedVertices.data(), vertexBufferSize);
 
-    TriangleData* resourceBufferContents = (TriangleData*)((uint8_t*)(resourceBuffer->contents()));
-    size_t triangleIndex = 0;
+    size_t indexBufferSize          = rayTracedIndices.size() * sizeof(uint32_t);
+    MTL::Buffer* mergedIndexBuffer  = metalDevice->newBuffer(std::max<size_t>(indexBufferSize, sizeof(uint32_t)), MTL::ResourceStorageModeShared);
+    mergedIndexBuffer->setLabel(NS::String::string("mergedIndexBuffer", NS::ASCIIStringEncoding));
 
-    for (const auto& mesh : meshes) {
-        for (size_t i = 0; i < mesh->vertexIndices.size(); i += 3) {
-            TriangleData& triangle = resourceBufferContents[triangleIndex++];
+    memcpy(mergedIndexBuffer->contents(), rayTracedIndices.data(), indexBufferSize);
+
+    // Each triangle carries its TriangleData as primitive data
+    auto createGeometry = [&](size_t firstTriangle, size_t triangleCount, bool opaque) {
+        auto* geometryDescriptor = createTriangleGeometry(mergedVertexBuffer, sizeof(Vertex), mergedIndexBuffer, firstTriangle, triangleCount, opaque);
+        geometryDescriptor->setPrimitiveDataBuffer(resourceBuffer);
+        geometryDescriptor->setPrimitiveDataBufferOffset(firstTriangle * sizeof(TriangleData));
+        geometryDescriptor->setPrimitiveDataStride(sizeof(TriangleData));
+        geometryDescriptor->setPrimitiveDataElementSize(sizeof(TriangleData));
+        return geometryDescriptor;
+    };
+
+    std::vector<MTL::AccelerationStructureTriangleGeometryDescriptor*> geometries;
+    if (maskedTriangleStart > 0) {
+        geometries.push_back(createGeometry(0, maskedTriangleStart, true));
+    }
+    if (totalTriangles > maskedTriangleStart) {
+        geometries.push_back(createGeometry(maskedTriangleStart, totalTriangles - maskedTriangleStart, false));
+    }
+
+    // Store the acceleration structure for later use
+    primitiveAccelerationStructures.push_back(buildAccelerationStructure(geometries));
+
+    mergedVertexBuffer->release();
+    mergedIndexBuffer->release();
+#if !(SECONDARY_RAY_QUEUE && PROXY_GEOMETRY)
+    rayTracedIndices = {};
+#endif
+}
+
+void Engine::createProxyAccelerationStructure() {
+#if SECONDARY_RAY_QUEUE && PROXY_GEOMETRY
+    std::vector<simd::float3> positions;
+    for (MeshHandle handle : meshes) {
+        for (const Vertex& vertex : resources->get(handle)->vertices) {
+            positions.push_back(vertex.position.xyz);
+        }
+    }
+
+    // Only opaque triangles are simplified, alpha masked ones keep their exact shape
+    // and primitive data so the alpha test still applies
+    std::span<const uint32_t> opaqueIndices(rayTracedIndices.data(), maskedTriangleStart * 3);
+    ProxyMesh::Settings settings;
+    ProxyMesh::Proxy proxy = ProxyMesh::loadOrSimplify(positions, opaqueIndices, CACHE_PATH, settings);
+
+    std::vector<simd::float3> proxyPositions = proxy.positions;
+    std::vector<uint32_t> proxyIndices = proxy.indices;
+    std::unordered_map<uint32_t, uint32_t> maskedVertices;
+    for (size_t i = maskedTriangleStart * 3; i < rayTracedIndices.size(); i++) {
+        auto [it, inserted] = maskedVertices.try_emplace(rayTracedIndices[i], (uint32_t)proxyPositions.size());
+        if (inserted)
+            proxyPositions.push_back(positions[rayTracedIndices[i]]);
+        proxyIndices.push_back(it->second);
+    }
+
+    MTL::Buffer* vertexBuffer = metalDevice->newBuffer(std::max<size_t>(proxyPositions.size(), 1) * sizeof(simd::float3), MTL::ResourceStorageModeShared);
+    vertexBuffer->setLabel(NS::String::string("Proxy Vertices", NS::ASCIIStringEncoding));
+    memcpy(vertexBuffer->contents(), proxyPositions.data(), proxyPositions.size() * sizeof(simd::float3));
+    MTL::Buffer* indexBuffer = metalDevice->newBuffer(std::max<size_t>(proxyIndices.size(), 1) * sizeof(uint32_t), MTL::ResourceStorageModeShared);
+    indexBuffer->setLabel(NS::String::string("Proxy Indices", NS::ASCIIStringEncoding));
+    memcpy(indexBuffer->contents(), proxyIndices.data(), proxyIndices.size() * sizeof(uint32_t));
+
+    std::vector<MTL::AccelerationStructureTriangleGeometryDescriptor*> geometries;
+    const size_t proxyTriangles = proxy.getTriangleCount();
+    const size_t maskedTriangles = totalTriangles - maskedTriangleStart;
+    if (proxyTriangles > 0) {
+        geometries.push_back(createTriangleGeometry(vertexBuffer, sizeof(simd::float3), indexBuffer, 0, proxyTriangles, true));
+    }
+    if (maskedTriangles > 0) {
+        auto* geometryDescriptor = createTriangleGeometry(vertexBuffer, sizeof(simd::float3), indexBuffer, proxyTriangles, maskedTriangles, false);
+        geometryDescriptor->setPrimitiveDataBuffer(resourceBuffer);
+        geometryDescriptor->setPrimitiveDataBufferOffset(maskedTriangleStart * sizeof(TriangleData));
+        geometryDescriptor->setPrimitiveDataStride(sizeof(TriangleData));
+        geometryDescriptor->setPrimitiveDataElementSize(sizeof(TriangleData));
+        geometries.push_back(geometryDescriptor);
+    }
+    proxyAccelerationStructure = buildAccelerationStructure(geometries);
+    secondaryRays->setProxy(proxyAccelerationStructure, proxy.maxError);
+
+    printf("Proxy acceleration structure: %zu of %zu triangles, %.1f MB (full %.1f MB), max error %.4f\n",
+           proxyTriangles + maskedTriangles, totalTriangles, proxyAccelerationStructure->size() / 1048576.0,
+           primitiveAccelerationStructures[0]->size() / 1048576.0, proxy.maxError);
+
+    vertexBuffer->release();
+    indexBuffer->release();
+    rayTracedIndices = {};
+#endif
+}
+
+void Engine::createOpacityMicromaps() {
+#if OPACITY_MICROMAPS
+    OpacityMicromap::Settings settings;
+    std::vector<OpacityMicromap::AlphaMasks> masks;
+    opacityStates.clear();
+    for (MeshHandle handle : meshes) {
+        const Mesh* mesh = resources->get(handle);
+        masks.push_back(OpacityMicromap::buildAlphaMasks(ImpostorRasterizer::readDiffuseTextures(*mesh), settings));
+
+        OpacityMicromap::Stats stats;
+        opacityStates.push_back(OpacityMicromap::classify(*mesh, masks.back(), settings, &stats));
+        printf("Opacity micromaps: %u triangles, %u opaque, %u transparent, %u masked (%u of %u micro triangles unknown), %.1f ms\n",
+               stats.triangles, stats.opaqueTriangles, stats.transparentTriangles, stats.maskedTriangles,
+               stats.unknownMicroTriangles, stats.maskedTriangles * (uint32_t)OpacityMicroTriangleCount, stats.milliseconds);
+    }
+
+    std::vector<uint32_t> packed = OpacityMicromap::pack(masks, alphaMaskLayerBases);
+    size_t bufferSize = std::max<size_t>(packed.size() * sizeof(uint32_t), sizeof(uint32_t));
+    alphaMaskBuffer = metalDevice->newBuffer(bufferSize, MTL::ResourceStorageModeShared);
+    alphaMaskBuffer->setLabel(NS::String::string("Alpha Masks", NS::ASCIIStringEncoding));
+    memcpy(alphaMaskBuffer->contents(), packed.data(), packed.size() * sizeof(uint32_t));
+#endif
+}
 
+void Engine::setupTriangleResources() {
+    // Opaque triangles first, then alpha masked ones; transparent triangles are not traced
+    std::vector<TriangleData> opaqueTriangles, maskedTriangles;
+    std::vector<uint32_t> opaqueIndices, maskedIndices;
+    uint32_t vertexOffset = 0;
+
+    for (size_t meshIndex = 0; meshIndex < meshes.size(); meshIndex++) {
+        const Mesh* mesh = resources->get(meshes[meshIndex]);
+        for (size_t i = 0; i < mesh->vertexIndices.size(); i += 3) {
+            uint32_t states = OpacityMicromap::AllOpaque;
+#if OPACITY_MICROMAPS
+            states = opacityStates[meshIndex][i / 3];
+#endif
+            OpacityState state = OpacityMicromap::triangleState(states);
+            if (state == OpacityStateTransparent)
+                continue;
+
+            TriangleData triangle{};
             for (size_t j = 0; j < 3; ++j) {
                 size_t vertexIndex = mesh->vertexIndices[i + j];
                 triangle.normals[j] = mesh->vertices[vertexIndex].normal;
                 triangle.colors[j] = simd::float4{0.1, 0.2, 0.3, 0.4};
+                triangle.texcoords[j] = mesh->vertices[vertexIndex].textureCoordinate;
+            }
+            triangle.opacityStates = states;
+#if OPACITY_MICROMAPS
+            triangle.alphaMaskLayer = alphaMaskLayerBases[meshIndex] + std::max(mesh->vertices[mesh->vertexIndices[i]].diffuseTextureIndex, 0);
+#endif
+
+            bool opaque = state == OpacityStateOpaque;
+            (opaque ? opaqueTriangles : maskedTriangles).push_back(triangle);
+            for (size_t j = 0; j < 3; ++j) {
+                (opaque ? opaqueIndices : maskedIndices).push_back(mesh->vertexIndices[i + j] + vertexOffset);
             }
         }
+        vertexOffset += (uint32_t)mesh->vertices.size();
     }
+
+    maskedTriangleStart = opaqueTriangles.size();
+    totalTriangles = opaqueTriangles.size() + maskedTriangles.size();
+    rayTracedIndices = std::move(opaqueIndices);
+    rayTracedIndices.insert(rayTracedIndices.end(), maskedIndices.begin(), maskedIndices.end());
+
+    size_t resourceStride = sizeof(TriangleData);
+    size_t bufferLength = resourceStride * std::max<size_t>(totalTriangles, 1);
+
+    resourceBuffer = metalDevice->newBuffer(bufferLength, MTL::ResourceStorageModeShared);
+    resourceBuffer->setLabel(NS::String::string("Resource Buffer", NS::ASCIIStringEncoding));
+
+    TriangleData* resourceBufferContents = (TriangleData*)((uint8_t*)(resourceBuffer->contents()));
+    std::copy(opaqueTriangles.begin(), opaqueTriangles.end(), resourceBufferContents);
+    std::copy(maskedTriangles.begin(), maskedTriangles.end(), resourceBufferContents + maskedTriangleStart);
 }
 
 void Engine::createSphereGrid() {
@@ -554,7 +1538,8 @@ void Engine::createDebugLines() {
     std::vector<simd::float3> startPoints;
     std::vector<simd::float3> endPoints;
 
-    for (const auto& mesh : meshes) {
+    for (MeshHandle handle : meshes) {
+        const Mesh* mesh = resources->get(handle);
         for (size_t i = 0; i < mesh->vertexIndices.size(); i += 3) {
             for (size_t j = 0; j < 3; ++j) {
                 size_t vertexIndex = mesh->vertexIndices[i + j];
@@ -576,25 +1561,31 @@ void Engine::drawDebug(MTL::RenderCommandEncoder* commandEncoder, MTL::CommandBu
     commandEncoder->setRenderPipelineState(renderPipelines.getRenderPipeline(RenderPipelineType::ForwardDebug));
 
     commandEncoder->setVertexBuffer(debug->lineBuffer, 0, 0);
-    commandEncoder->setVertexBuffer(frameDataBuffers[currentFrameIndex], 0, BufferIndexFrameData);
+    constants->bindVertex(commandEncoder);
 
     uint32_t* lineCount = reinterpret_cast<uint32_t*>(debug->lineCountBuffer->contents());
 
     if (*lineCount > 0 && editor->debug.enableDebugFeature) {
          commandEncoder->drawPrimitives(MTL::PrimitiveTypeLine, 0, *lineCount * 2, 1);
     }
-    editor->endFrame(commandBuffer, commandEncoder);
+
+    // Composite the cached editor overlay, this is all the UI costs on idle frames
+    commandEncoder->setRenderPipelineState(renderPipelines.getRenderPipeline(RenderPipelineType::EditorComposite));
+    commandEncoder->setFragmentTexture(editor->getOverlayTexture(), TextureIndexEditorOverlay);
+    commandEncoder->drawPrimitives(MTL::PrimitiveTypeTriangle, (NS::UInteger)0, (NS::UInteger)3);
 }
 
 void Engine::dispatchRaytracing(MTL::CommandBuffer* commandBuffer) {
     MTL::ComputeCommandEncoder* computeEncoder = commandBuffer->computeCommandEncoder();
+    computeEncoder->pushDebugGroup(MTLSTR("Raytracing"));
     
     computeEncoder->setComputePipelineState(renderPipelines.getComputePipeline(ComputePipelineType::Raytracing));
     computeEncoder->setTexture(rayTracingTexture, TextureIndexRaytracing);
-    computeEncoder->setBuffer(frameDataBuffers[currentFrameIndex], 0, BufferIndexFrameData);
-    computeEncoder->setBuffer(resourceBuffer, 0, BufferIndexResources);
-    
-    computeEncoder->useResource(resourceBuffer, MTL::ResourceUsageRead);
+    constants->bind(computeEncoder);
+#if OPACITY_MICROMAPS
+    // Read by the intersection functions through their tables
+    computeEncoder->useResource(alphaMaskBuffer, MTL::ResourceUsageRead);
+#endif
     
     // Set acceleration structures
     for (uint i = 0; i < primitiveAccelerationStructures.size(); i++) {
@@ -603,11 +1594,37 @@ void Engine::dispatchRaytracing(MTL::CommandBuffer* commandBuffer) {
 
     }
 
+#if SECONDARY_RAY_QUEUE
+    // Primary rays queue their occlusion rays, which are binned and traced in bin order
+    secondaryRays->encode(computeEncoder, rayTracingTexture, (uint32_t)frameNumber);
+#elif TILE_CLASSIFICATION
+    // Each class traces only what it needs: complex tiles a ray per pixel, simple tiles a ray
+    // per 2x2 block, edge tiles a ray per geometry pixel. Sky only tiles are cleared.
+    auto traceClass = [&](ComputePipelineType type, TileClass tileClass, uint32_t groupSize) {
+        computeEncoder->setComputePipelineState(renderPipelines.getComputePipeline(type));
+#if OPACITY_MICROMAPS
+        computeEncoder->setIntersectionFunctionTable(renderPipelines.getIntersectionFunctionTable(type), BufferIndexIntersectionFunctions);
+#endif
+        tileClassifier->dispatch(computeEncoder, tileClass, BufferIndexTileLists, groupSize);
+    };
+    computeEncoder->setTexture(depthGBuffer, TextureIndexClassifyDepth);
+    traceClass(ComputePipelineType::RaytracingTiles, TileClassComplex, TileClassifier::TileSize);
+    traceClass(ComputePipelineType::RaytracingSimpleTiles, TileClassSimple, TileClassifier::TileSize / 2);
+    traceClass(ComputePipelineType::RaytracingEdgeTiles, TileClassEdge, TileClassifier::TileSize);
+
+    computeEncoder->setComputePipelineState(renderPipelines.getComputePipeline(ComputePipelineType::RaytracingClearTiles));
+    tileClassifier->dispatch(computeEncoder, TileClassEmpty, BufferIndexTileLists);
+#else
+#if OPACITY_MICROMAPS
+    computeEncoder->setIntersectionFunctionTable(renderPipelines.getIntersectionFunctionTable(ComputePipelineType::Raytracing),
+                                                 BufferIndexIntersectionFunctions);
+#endif
     MTL::Size threadGroupSize = MTL::Size(16, 16, 1);
     MTL::Size gridSize = MTL::Size((rayTracingTexture->width() + threadGroupSize.width - 1) / threadGroupSize.width,
                                    (rayTracingTexture->height() + threadGroupSize.height - 1) / threadGroupSize.height, 1);
 
     computeEncoder->dispatchThreadgroups(gridSize, threadGroupSize);
+#endif
     computeEncoder->popDebugGroup();
     computeEncoder->endEncoding();
 }
@@ -622,12 +1639,22 @@ void Engine::createViewRenderPassDescriptor() {
 	gbufferTextureDesc->setTextureType(MTL::TextureType2D);
 
 	// StorageModeMemoryLess
+#if MSAA_DEFERRED
+	// Depth, object ID and lighting are written by the MSAA compute passes
+	gbufferTextureDesc->setUsage(MTL::TextureUsageRenderTarget | MTL::TextureUsageShaderRead | MTL::TextureUsageShaderWrite);
+#else
 	gbufferTextureDesc->setUsage(MTL::TextureUsageRenderTarget | MTL::TextureUsageShaderRead);
+#endif
+#if !MSAA_DEFERRED
+	// The MSAA path rasterises albedo and normals into its own multisampled targets
 	gbufferTextureDesc->setStorageMode(MTL::StorageModeMemoryless);
 	gbufferTextureDesc->setPixelFormat(albedoSpecularGBufferFormat);
 	albedoSpecularGBuffer = metalDevice->newTexture(gbufferTextureDesc);
 	gbufferTextureDesc->setPixelFormat(normalMapGBufferFormat);
 	normalMapGBuffer = metalDevice->newTexture(gbufferTextureDesc);
+	albedoSpecularGBuffer->setLabel(NS::String::string("Albedo GBuffer", NS::ASCIIStringEncoding));
+	normalMapGBuffer->setLabel(NS::String::string("Normal + Specular GBuffer", NS::ASCIIStringEncoding));
+#endif
 	gbufferTextureDesc->setPixelFormat(depthGBufferFormat);
     gbufferTextureDesc->setStorageMode(MTL::StorageModeShared); // shared for min max depth buffer
 	depthGBuffer = metalDevice->newTexture(gbufferTextureDesc);
@@ -635,17 +1662,41 @@ void Engine::createViewRenderPassDescriptor() {
     // Create depth/stencil texture
 	gbufferTextureDesc->setPixelFormat(MTL::PixelFormatDepth32Float_Stencil8);
 	depthStencilTexture = metalDevice->newTexture(gbufferTextureDesc);
+
+#if OBJECT_PICKING
+	// Private rather than memoryless so the pick region can be blitted out after the pass
+	gbufferTextureDesc->setPixelFormat(objectIdGBufferFormat);
+	gbufferTextureDesc->setStorageMode(MTL::StorageModePrivate);
+	objectIdGBuffer = metalDevice->newTexture(gbufferTextureDesc);
+	objectIdGBuffer->setLabel(NS::String::string("Object ID GBuffer", NS::ASCIIStringEncoding));
+#endif
 	
-	albedoSpecularGBuffer->setLabel(NS::String::string("Albedo GBuffer", NS::ASCIIStringEncoding));
-	normalMapGBuffer->setLabel(NS::String::string("Normal + Specular GBuffer", NS::ASCIIStringEncoding));
 	depthGBuffer->setLabel(NS::String::string("Depth GBuffer", NS::ASCIIStringEncoding));
 	depthStencilTexture->setLabel(NS::String::string("Depth-Stencil Texture", NS::ASCIIStringEncoding));
 
+	// HDR lighting is accumulated here and resolved to the drawable by the post chain
+	gbufferTextureDesc->setPixelFormat(hdrLightingFormat);
+	gbufferTextureDesc->setStorageMode(MTL::StorageModePrivate);
+	hdrLightingTexture = metalDevice->newTexture(gbufferTextureDesc);
+	hdrLightingTexture->setLabel(NS::String::string("HDR Lighting", NS::ASCIIStringEncoding));
+
 	gbufferTextureDesc->release();
+
+	postProcess->resize((uint32_t)metalLayer.drawableSize.width, (uint32_t)metalLayer.drawableSize.height, *resources);
+#if MSAA_DEFERRED
+	deferredMSAA->resize((uint32_t)metalLayer.drawableSize.width, (uint32_t)metalLayer.drawableSize.height, *resources);
+#endif
+#if TILE_CLASSIFICATION
+	tileClassifier->resize((uint32_t)metalLayer.drawableSize.width, (uint32_t)metalLayer.drawableSize.height, *resources);
+#endif
+#if SECONDARY_RAY_QUEUE
+	secondaryRays->resize((uint32_t)metalLayer.drawableSize.width, (uint32_t)metalLayer.drawableSize.height, *resources);
+#endif
 	
 	viewRenderPassDescriptor = MTL::RenderPassDescriptor::alloc()->init();
 
 	// Set up render pass descriptor attachments
+	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetLighting)->setTexture(hdrLightingTexture);
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetAlbedo)->setTexture(albedoSpecularGBuffer);
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetNormal)->setTexture(normalMapGBuffer);
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetDepth)->setTexture(depthGBuffer);
@@ -653,6 +1704,10 @@ void Engine::createViewRenderPassDescriptor() {
 	viewRenderPassDescriptor->stencilAttachment()->setTexture(depthStencilTexture);
 	
 	// Configure load/store actions
+	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetLighting)->setLoadAction(MTL::LoadActionClear);
+	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetLighting)->setStoreAction(MTL::StoreActionStore);
+	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetLighting)->setClearColor(MTL::ClearColor(41.0f / 255.0f, 42.0f / 255.0f, 48.0f / 255.0f, 1.0));
+
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetAlbedo)->setLoadAction(MTL::LoadActionDontCare);
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetAlbedo)->setStoreAction(MTL::StoreActionDontCare);
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetAlbedo)->setClearColor(MTL::ClearColor(0.0, 0.0, 0.0, 1.0));
@@ -661,10 +1716,24 @@ void Engine::createViewRenderPassDescriptor() {
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetNormal)->setStoreAction(MTL::StoreActionDontCare);
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetNormal)->setClearColor(MTL::ClearColor(0.0, 0.0, 0.0, 1.0));
 	
+#if TILE_LIGHT_CULLING || TILE_CLASSIFICATION
+	// Cleared so tile culling and classification can tell sky pixels (positive eye depth) from geometry
+	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetDepth)->setLoadAction(MTL::LoadActionClear);
+#else
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetDepth)->setLoadAction(MTL::LoadActionDontCare);
-	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetDepth)->setStoreAction(MTL::StoreActionDontCare);
+#endif
+	// Stored because the min/max depth pyramid and object picking read it after the pass
+	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetDepth)->setStoreAction(MTL::StoreActionStore);
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetDepth)->setClearColor(MTL::ClearColor(1.0, 1.0, 1.0, 1.0));
 	
+#if OBJECT_PICKING
+	// Cleared to zero, which the picker treats as "nothing hit"
+	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetObjectId)->setTexture(objectIdGBuffer);
+	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetObjectId)->setLoadAction(MTL::LoadActionClear);
+	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetObjectId)->setStoreAction(MTL::StoreActionStore);
+	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetObjectId)->setClearColor(MTL::ClearColor(0.0, 0.0, 0.0, 0.0));
+#endif
+	
 	viewRenderPassDescriptor->depthAttachment()->setLoadAction(MTL::LoadActionDontCare);
 	viewRenderPassDescriptor->depthAttachment()->setStoreAction(MTL::StoreActionDontCare);
 	viewRenderPassDescriptor->depthAttachment()->setClearDepth(1.0);
@@ -672,6 +1741,13 @@ void Engine::createViewRenderPassDescriptor() {
 	viewRenderPassDescriptor->stencilAttachment()->setLoadAction(MTL::LoadActionDontCare);
 	viewRenderPassDescriptor->stencilAttachment()->setStoreAction(MTL::StoreActionDontCare);
 	viewRenderPassDescriptor->stencilAttachment()->setClearStencil(0);
+
+#if TILE_LIGHT_CULLING
+	// One light list per tile, kept in threadgroup memory from culling to lighting
+	viewRenderPassDescriptor->setTileWidth(TileLightingTileSize);
+	viewRenderPassDescriptor->setTileHeight(TileLightingTileSize);
+	viewRenderPassDescriptor->setThreadgroupMemoryLength(sizeof(TileLightList));
+#endif
     
     // Ray tracing texture
     MTL::TextureDescriptor* raytracingTextureDescriptor = MTL::TextureDescriptor::alloc()->init();
@@ -711,15 +1787,43 @@ void Engine::createViewRenderPassDescriptor() {
     // Enable mipmaps so we can generate hierarchical depth manually
     descriptor->setMipmapLevelCount(log2(std::max(metalLayer.drawableSize.width, metalLayer.drawableSize.height)));
 
+    releaseMinMaxDepthTexture();
     minMaxDepthTexture = metalDevice->newTexture(descriptor);
     descriptor->release();
+
+    // Single mip views and labels for the reduction, created once per size instead of every frame
+    for (NS::UInteger level = 0; level < minMaxDepthTexture->mipmapLevelCount(); level++) {
+        MTL::Texture* view = minMaxDepthTexture->newTextureView(MTL::PixelFormatRG32Float, MTL::TextureType2D,
+                                                               NS::Range(level, 1), NS::Range(0, 1));
+        std::string label = "MipLevel: " + std::to_string(level);
+        minMaxDepthMipLabels.push_back(NS::String::alloc()->init(label.c_str(), NS::ASCIIStringEncoding));
+        view->setLabel(minMaxDepthMipLabels.back());
+        minMaxDepthMipViews.push_back(view);
+    }
+}
+
+void Engine::releaseMinMaxDepthTexture() {
+    for (MTL::Texture* view : minMaxDepthMipViews) {
+        resources->retire(view);
+    }
+    for (NS::String* label : minMaxDepthMipLabels) {
+        label->release();
+    }
+    minMaxDepthMipViews.clear();
+    minMaxDepthMipLabels.clear();
+    resources->retire(minMaxDepthTexture);
+    minMaxDepthTexture = nullptr;
 }
 
 void Engine::updateRenderPassDescriptor() {
 	// Update all render pass descriptor attachments with resized textures
+	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetLighting)->setTexture(hdrLightingTexture);
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetAlbedo)->setTexture(albedoSpecularGBuffer);
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetNormal)->setTexture(normalMapGBuffer);
 	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetDepth)->setTexture(depthGBuffer);
+#if OBJECT_PICKING
+	viewRenderPassDescriptor->colorAttachments()->object(RenderTargetObjectId)->setTexture(objectIdGBuffer);
+#endif
 
 	// Update depth/stencil attachment
 	viewRenderPassDescriptor->depthAttachment()->setTexture(depthStencilTexture);
@@ -729,39 +1833,95 @@ void Engine::updateRenderPassDescriptor() {
 void Engine::drawMeshes(MTL::RenderCommandEncoder* renderCommandEncoder) {
 	renderCommandEncoder->setFrontFacingWinding(MTL::WindingCounterClockwise);
 	renderCommandEncoder->setCullMode(MTL::CullModeBack);
-    
-    for (int i = 0; i < meshes.size(); i++) {
-        //	renderCommandEncoder->setTriangleFillMode(MTL::TriangleFillModeLines);
-        renderCommandEncoder->setVertexBuffer(meshes[i]->vertexBuffer, 0, BufferIndexVertexData);
-        
-        matrix_float4x4 modelMatrix = matrix4x4_translation(0.0f, 0.0f, 0.0f);
-        renderCommandEncoder->setVertexBytes(&modelMatrix, sizeof(modelMatrix), BufferIndexVertexBytes);
-        
-        // Set any textures read/sampled from the render pipeline
-        renderCommandEncoder->setFragmentTexture(meshes[i]->diffuseTextures, TextureIndexBaseColor);
-        renderCommandEncoder->setFragmentTexture(meshes[i]->normalTextures, TextureIndexNormal);
-        renderCommandEncoder->setFragmentBuffer(meshes[i]->diffuseTextureInfos, 0, BufferIndexDiffuseInfo);
-        renderCommandEncoder->setFragmentBuffer(meshes[i]->normalTextureInfos, 0, BufferIndexNormalInfo);
+
+
+    // Visible submeshes are in instance order, mesh state is only bound when the mesh changes
+    uint32_t boundMesh = UINT32_MAX;
+    for (uint32_t instance : culler.getVisibleInstances(CullViewMain)) {
+        const CullInstance& cullInstance = cullInstances[instance];
+        Mesh* mesh = resources->get(meshes[cullInstance.meshIndex]);
+
+        if (cullInstance.meshIndex != boundMesh) {
+            boundMesh = cullInstance.meshIndex;
+            //	renderCommandEncoder->setTriangleFillMode(MTL::TriangleFillModeLines);
+            renderCommandEncoder->setVertexBuffer(mesh->positionStream, 0, BufferIndexPositionStream);
+            renderCommandEncoder->setVertexBuffer(mesh->tangentFrameStream, 0, BufferIndexTangentFrameStream);
+            renderCommandEncoder->setVertexBuffer(mesh->texcoordStream, 0, BufferIndexTexcoordStream);
+            renderCommandEncoder->setVertexBuffer(mesh->textureIndexStream, 0, BufferIndexTextureIndexStream);
+            renderCommandEncoder->setVertexBytes(&mesh->streamLayout, sizeof(VertexStreamLayout), BufferIndexVertexStreamLayout);
+            constants->bindInstance(renderCommandEncoder, cullInstance.meshIndex);
+
+            // Set any textures read/sampled from the render pipeline
+            renderCommandEncoder->setFragmentTexture(mesh->diffuseTextures, TextureIndexBaseColor);
+            renderCommandEncoder->setFragmentTexture(mesh->normalTextures, TextureIndexNormal);
+            renderCommandEncoder->setFragmentBuffer(mesh->diffuseTextureInfos, 0, BufferIndexDiffuseInfo);
+            renderCommandEncoder->setFragmentBuffer(mesh->normalTextureInfos, 0, BufferIndexNormalInfo);
+        }
+
+        const Submesh& submesh = mesh->submeshes[cullInstance.submeshIndex];
+
+        // Mesh index and the first triangle of the draw, so picking reports mesh wide triangle IDs
+        simd::uint2 objectInfo = {cullInstance.meshIndex, submesh.indexOffset / 3};
+        renderCommandEncoder->setFragmentBytes(&objectInfo, sizeof(objectInfo), BufferIndexObjectId);
         
         MTL::PrimitiveType typeTriangle = MTL::PrimitiveTypeTriangle;
-        renderCommandEncoder->drawIndexedPrimitives(typeTriangle, meshes[i]->indexCount, MTL::IndexTypeUInt32, meshes[i]->indexBuffer, 0);
+        renderCommandEncoder->drawIndexedPrimitives(typeTriangle, submesh.indexCount, MTL::IndexTypeUInt32, mesh->indexBuffer,
+                                                    submesh.indexOffset * sizeof(uint32_t));
     }
 }
 
 void Engine::drawGBuffer(MTL::RenderCommandEncoder* renderCommandEncoder)
 {
-	renderCommandEncoder->pushDebugGroup(NS::String::string("Draw G-Buffer", NS::ASCIIStringEncoding));
+	renderCommandEncoder->pushDebugGroup(MTLSTR("Draw G-Buffer"));
 	renderCommandEncoder->setCullMode(MTL::CullModeBack);
 	renderCommandEncoder->setRenderPipelineState(renderPipelines.getRenderPipeline(RenderPipelineType::GBuffer));
 	renderCommandEncoder->setDepthStencilState(renderPipelines.getDepthStencilState(DepthStencilType::GBuffer));
 	renderCommandEncoder->setStencilReferenceValue(128);
-    renderCommandEncoder->setVertexBuffer(frameDataBuffers[currentFrameIndex], 0, BufferIndexFrameData);
-	renderCommandEncoder->setFragmentBuffer(frameDataBuffers[currentFrameIndex], 0, BufferIndexFrameData);
+    constants->bindVertex(renderCommandEncoder);
+	constants->bindFragment(renderCommandEncoder);
 
 	drawMeshes(renderCommandEncoder);
+	drawImpostors(renderCommandEncoder);
 	renderCommandEncoder->popDebugGroup();
 }
 
+/// Near impostor instances as full meshes, the rest as quads from the baked atlas
+void Engine::drawImpostors(MTL::RenderCommandEncoder* renderCommandEncoder)
+{
+#if IMPOSTORS
+	std::span<const uint32_t> nearInstances = impostors->getNearInstances();
+	if (!nearInstances.empty()) {
+		Mesh* mesh = resources->get(impostorMesh);
+		renderCommandEncoder->setVertexBuffer(mesh->positionStream, 0, BufferIndexPositionStream);
+		renderCommandEncoder->setVertexBuffer(mesh->tangentFrameStream, 0, BufferIndexTangentFrameStream);
+		renderCommandEncoder->setVertexBuffer(mesh->texcoordStream, 0, BufferIndexTexcoordStream);
+		renderCommandEncoder->setVertexBuffer(mesh->textureIndexStream, 0, BufferIndexTextureIndexStream);
+		renderCommandEncoder->setVertexBytes(&mesh->streamLayout, sizeof(VertexStreamLayout), BufferIndexVertexStreamLayout);
+		renderCommandEncoder->setFragmentTexture(mesh->diffuseTextures, TextureIndexBaseColor);
+		renderCommandEncoder->setFragmentTexture(mesh->normalTextures, TextureIndexNormal);
+		renderCommandEncoder->setFragmentBuffer(mesh->diffuseTextureInfos, 0, BufferIndexDiffuseInfo);
+		renderCommandEncoder->setFragmentBuffer(mesh->normalTextureInfos, 0, BufferIndexNormalInfo);
+
+		// Offset by one in the shader, this reads back as "nothing hit"
+		simd::uint2 objectInfo = {UINT32_MAX, 0};
+		renderCommandEncoder->setFragmentBytes(&objectInfo, sizeof(objectInfo), BufferIndexObjectId);
+
+		for (uint32_t index : nearInstances) {
+			const Impostors::Instance& instance = impostors->getInstance(index);
+			matrix_float4x4 modelMatrix = matrix4x4_scale_translation(simd::float3(instance.scale), instance.position);
+			InstanceConstants instanceConstants{
+				.model_matrix = modelMatrix,
+				.normal_matrix = matrix3x3_upper_left(modelMatrix)
+			};
+			renderCommandEncoder->setVertexBytes(&instanceConstants, sizeof(instanceConstants), BufferIndexInstanceConstants);
+			renderCommandEncoder->drawIndexedPrimitives(MTL::PrimitiveTypeTriangle, mesh->indexCount, MTL::IndexTypeUInt32, mesh->indexBuffer, 0);
+		}
+	}
+
+	impostors->draw(renderCommandEncoder);
+#endif
+}
+
 /// Draw the directional ("sun") light in deferred pass.  Use stencil buffer to limit execution
 /// of the shader to only those pixels that should be lit
 void Engine::drawDirectionalLight(MTL::RenderCommandEncoder* renderCommandEncoder)
@@ -771,13 +1931,66 @@ void Engine::drawDirectionalLight(MTL::RenderCommandEncoder* renderCommandEncode
 
 	renderCommandEncoder->setRenderPipelineState(renderPipelines.getRenderPipeline(RenderPipelineType::DirectionalLight));
 	renderCommandEncoder->setDepthStencilState(renderPipelines.getDepthStencilState(DepthStencilType::DirectionalLight));
-	renderCommandEncoder->setVertexBuffer(frameDataBuffers[currentFrameIndex], 0, BufferIndexFrameData);
-	renderCommandEncoder->setFragmentBuffer(frameDataBuffers[currentFrameIndex], 0, BufferIndexFrameData);
+	constants->bindVertex(renderCommandEncoder);
+	constants->bindFragment(renderCommandEncoder);
+#if ATMOSPHERIC_SCATTERING
+	renderCommandEncoder->setFragmentBytes(&atmosphere->params, sizeof(AtmosphereParams), BufferIndexAtmosphere);
+	renderCommandEncoder->setFragmentTexture(atmosphere->getTransmittanceLUT(), TextureIndexTransmittanceLUT);
+#endif
+#if VOLUMETRIC_LIGHTING
+	renderCommandEncoder->setFragmentTexture(volumetrics->getVolume(), TextureIndexFroxelVolume);
+#endif
+#if TILE_LIGHT_CULLING
+	renderCommandEncoder->setFragmentBuffer(pointLightBuffers[currentFrameIndex], 0, BufferIndexPointLights);
+#endif
 
 	// Draw full screen triangle
 	renderCommandEncoder->drawPrimitives(MTL::PrimitiveTypeTriangle, (NS::UInteger)0, (NS::UInteger)3);
 }
 
+/// Fill the background from the sky view LUT. The triangle sits on the far plane so the depth
+/// test rejects every pixel covered by the G-buffer.
+void Engine::drawSky(MTL::RenderCommandEncoder* renderCommandEncoder)
+{
+#if ATMOSPHERIC_SCATTERING
+	renderCommandEncoder->pushDebugGroup(MTLSTR("Draw Sky"));
+	renderCommandEncoder->setCullMode(MTL::CullModeNone);
+	renderCommandEncoder->setRenderPipelineState(renderPipelines.getRenderPipeline(RenderPipelineType::Sky));
+	renderCommandEncoder->setDepthStencilState(renderPipelines.getDepthStencilState(DepthStencilType::Sky));
+	constants->bindVertex(renderCommandEncoder);
+	constants->bindFragment(renderCommandEncoder);
+	renderCommandEncoder->setFragmentBytes(&atmosphere->params, sizeof(AtmosphereParams), BufferIndexAtmosphere);
+	renderCommandEncoder->setFragmentTexture(atmosphere->getTransmittanceLUT(), TextureIndexTransmittanceLUT);
+	renderCommandEncoder->setFragmentTexture(atmosphere->getSkyViewLUT(), TextureIndexSkyViewLUT);
+#if VOLUMETRIC_LIGHTING
+	renderCommandEncoder->setFragmentTexture(volumetrics->getVolume(), TextureIndexFroxelVolume);
+#endif
+
+	renderCommandEncoder->drawPrimitives(MTL::PrimitiveTypeTriangle, (NS::UInteger)0, (NS::UInteger)3);
+	renderCommandEncoder->popDebugGroup();
+#endif
+}
+
+/// Cull the point lights per tile between the G-buffer draws and lighting. The tile dispatch
+/// waits for the draws before it, and the list it leaves in threadgroup memory is read by the
+/// lighting fragments of the same tile.
+void Engine::drawTileLightCulling(MTL::RenderCommandEncoder* renderCommandEncoder)
+{
+#if TILE_LIGHT_CULLING
+	renderCommandEncoder->pushDebugGroup(MTLSTR("Tile Light Culling"));
+	renderCommandEncoder->setRenderPipelineState(renderPipelines.getRenderPipeline(RenderPipelineType::TileLightCulling));
+	constants->bindTile(renderCommandEncoder);
+	renderCommandEncoder->setTileBuffer(pointLightBuffers[currentFrameIndex], 0, BufferIndexPointLights);
+
+	TileLightingParams params{.lightCount = (uint)pointLights.size()};
+	renderCommandEncoder->setTileBytes(&params, sizeof(params), BufferIndexTileLighting);
+	renderCommandEncoder->setThreadgroupMemoryLength(sizeof(TileLightList), 0, ThreadgroupIndexTileLights);
+
+	renderCommandEncoder->dispatchThreadsPerTile(MTL::Size(TileLightingTileSize, TileLightingTileSize, 1));
+	renderCommandEncoder->popDebugGroup();
+#endif
+}
+
 void Engine::dispatchMinMaxDepthMipmaps(MTL::CommandBuffer* commandBuffer) {
     {
         MTL::ComputeCommandEncoder* initEncoder = commandBuffer->computeCommandEncoder();
@@ -799,33 +2012,10 @@ void Engine::dispatchMinMaxDepthMipmaps(MTL::CommandBuffer* commandBuffer) {
     unsigned long mipLevels = minMaxDepthTexture->mipmapLevelCount();
 
     for (uint32_t level = 1; level < mipLevels; ++level) {
-        std::string labelStr = "MipLevel: " + std::to_string(level);
-        NS::String* label = NS::String::string(labelStr.c_str(), NS::ASCIIStringEncoding);
-        
-        encoder->pushDebugGroup(label);
-                   
-        NS::Range levelRangeSrc(level - 1, 1);
-        NS::Range levelRangeDst(level, 1);
-        NS::Range sliceRange(0, 1);
-
-        MTL::Texture* srcMip = minMaxDepthTexture->newTextureView(
-            MTL::PixelFormatRG32Float,
-            MTL::TextureType2D,
-            levelRangeSrc,
-            sliceRange
-        );
-
-        MTL::Texture* dstMip = minMaxDepthTexture->newTextureView(
-            MTL::PixelFormatRG32Float,
-            MTL::TextureType2D,
-            levelRangeDst,
-            sliceRange
-        );
-        
-        srcMip->setLabel(label);
-        dstMip->setLabel(label);
+        encoder->pushDebugGroup(minMaxDepthMipLabels[level]);
 
-        encoder->setTexture(srcMip, 0);
+        MTL::Texture* dstMip = minMaxDepthMipViews[level];
+        encoder->setTexture(minMaxDepthMipViews[level - 1], 0);
         encoder->setTexture(dstMip, 1);
 
         MTL::Size threadsPerGroup(8, 8, 1);
@@ -833,30 +2023,66 @@ void Engine::dispatchMinMaxDepthMipmaps(MTL::CommandBuffer* commandBuffer) {
 
         encoder->dispatchThreadgroups(threadgroups, threadsPerGroup);
 
-        srcMip->release();
-        dstMip->release();
-        
         encoder->popDebugGroup();
     }
 
     encoder->endEncoding();
 }
 
-void Engine::draw() {
-    // First command buffer for raytracing pass
-    MTL::CommandBuffer* raytracingCommandBuffer = beginFrame(false);
-    raytracingCommandBuffer->setLabel(NS::String::string("Raytracing Commands", NS::ASCIIStringEncoding));
+void Engine::draw(const RenderSnapshot& snapshot) {
+    uint64_t allocationsAtStart = AllocationCounter::count();
+#if REFERENCE_CHECKS
+    bool referenceFrame = referenceCheckFrames > 0 && --referenceCheckFrames == 0;
+#endif
+    gpuProfiler->beginFrame();
+    gpuScheduler->beginFrame();
+
+    // First command buffer for the lookup tables the lighting reads
+    MTL::CommandBuffer* setupCommandBuffer = beginFrame(snapshot);
+    // Nonzero when the lookup tables were rewritten, compute work reading them waits for it
+    uint64_t setupDoneValue = 0;
+#if ATMOSPHERIC_SCATTERING
+    // Scene units are treated as metres
+    if (atmosphere->update(setupCommandBuffer, sunDirection, snapshot.cameraPosition.y * 0.001f)) {
+        setupDoneValue = gpuScheduler->signal(setupCommandBuffer);
+    }
+#endif
+    setupCommandBuffer->commit();
+
+#if !TILE_CLASSIFICATION
+    // Camera rays need nothing from this frame's raster work and overlap all of it.
+    // With tile classification rays are traced after the G-buffer, over its classified tiles.
+    MTL::CommandBuffer* raytracingCommandBuffer = gpuScheduler->commandBuffer(GPUScheduler::Queue::Compute, MTLSTR("Raytracing Commands"));
     dispatchRaytracing(raytracingCommandBuffer);
+    uint64_t raytracingDoneValue = gpuScheduler->signal(raytracingCommandBuffer);
     raytracingCommandBuffer->commit();
+#endif
+
+#if VOLUMETRIC_LIGHTING
+    // The froxels need nothing from this frame's raster work and overlap the previous
+    // frame's post process. That frame's lighting read the integrated volume before its
+    // depth pyramid started, which runs ahead of this on the same queue. The sun's
+    // transmittance is read from the atmosphere LUT, rewritten on the graphics queue above.
+    MTL::CommandBuffer* volumetricCommandBuffer = gpuScheduler->commandBuffer(GPUScheduler::Queue::Compute, MTLSTR("Volumetric Commands"));
+    gpuScheduler->wait(volumetricCommandBuffer, setupDoneValue);
+    Volumetrics::Scene volumetricScene{.accelerationStructure = primitiveAccelerationStructures[0]};
+#if OPACITY_MICROMAPS
+    volumetricScene.intersectionFunctions = renderPipelines.getIntersectionFunctionTable(ComputePipelineType::InjectFroxels);
+    volumetricScene.alphaMasks = alphaMaskBuffer;
+#endif
+    volumetrics->encode(volumetricCommandBuffer, *constants, volumetricScene, atmosphere.get(), frameNumber);
+    uint64_t volumetricDoneValue = gpuScheduler->signal(volumetricCommandBuffer);
+    volumetricCommandBuffer->commit();
+#endif
 
     MTL::CommandBuffer* commandBuffer = beginDrawableCommands();
-    commandBuffer->setLabel(NS::String::string("Deferred Rendering Commands", NS::ASCIIStringEncoding));
+    // The previous frame's compute work still reads the depth and tile lists written below
+    gpuScheduler->wait(commandBuffer, computeDoneValue);
+#if VOLUMETRIC_LIGHTING
+    gpuScheduler->wait(commandBuffer, volumetricDoneValue);
+#endif
     
     // G-Buffer render pass descriptor setup
-    viewRenderPassDescriptor->colorAttachments()->object(RenderTargetLighting)->setTexture(metalDrawable->texture());
-    viewRenderPassDescriptor->colorAttachments()->object(RenderTargetLighting)->setLoadAction(MTL::LoadActionClear);
-    viewRenderPassDescriptor->colorAttachments()->object(RenderTargetLighting)->setClearColor(MTL::ClearColor(41.0f / 255.0f, 42.0f / 255.0f, 48.0f / 255.0f, 1.0));
-
     viewRenderPassDescriptor->depthAttachment()->setTexture(depthStencilTexture);
     viewRenderPassDescriptor->depthAttachment()->setLoadAction(MTL::LoadActionClear);
     viewRenderPassDescriptor->depthAttachment()->setClearDepth(1.0); // Clear depth to farthest
@@ -864,16 +2090,80 @@ void Engine::draw() {
     viewRenderPassDescriptor->stencilAttachment()->setLoadAction(MTL::LoadActionClear);
     viewRenderPassDescriptor->stencilAttachment()->setClearStencil(0); // Clear stencil
 
+#if MSAA_DEFERRED
+    // MSAA G-buffer pass, lit in compute from the classified tile lists
+    MTL::RenderPassDescriptor* msaaGBufferDescriptor = deferredMSAA->getGBufferPassDescriptor();
+    gpuProfiler->attachRenderPass(msaaGBufferDescriptor, "G-Buffer (MSAA)");
+    MTL::RenderCommandEncoder* gBufferEncoder = commandBuffer->renderCommandEncoder(msaaGBufferDescriptor);
+    if (gBufferEncoder) {
+        drawGBuffer(gBufferEncoder);
+
+        gBufferEncoder->endEncoding();
+    }
+    deferredMSAA->encodeLighting(commandBuffer, *constants, atmosphere.get(),
+                                 hdrLightingTexture, depthGBuffer, objectIdGBuffer);
+#if REFERENCE_CHECKS
+    if (referenceFrame) {
+        deferredMSAA->encodeReferenceReadback(commandBuffer);
+    }
+#endif
+#else
     // G-Buffer pass
+    gpuProfiler->attachRenderPass(viewRenderPassDescriptor, "G-Buffer + Lighting");
     MTL::RenderCommandEncoder* gBufferEncoder = commandBuffer->renderCommandEncoder(viewRenderPassDescriptor);
     if (gBufferEncoder) {
         drawGBuffer(gBufferEncoder);
+        drawTileLightCulling(gBufferEncoder);
+    #if TILE_LIGHT_CULLING && REFERENCE_CHECKS
+        if (referenceFrame) {
+            exportTileLights(gBufferEncoder);
+        }
+    #endif
         drawDirectionalLight(gBufferEncoder);
+        drawSky(gBufferEncoder);
 
         gBufferEncoder->endEncoding();
     }
-
-    dispatchMinMaxDepthMipmaps(commandBuffer);
+#if TILE_LIGHT_CULLING && REFERENCE_CHECKS
+    if (referenceFrame) {
+        tileDepthReadback.copyTexture(commandBuffer, depthGBuffer, sizeof(float));
+    }
+#endif
+#endif
+
+#if TILE_CLASSIFICATION
+    tileClassifier->encode(commandBuffer, depthGBuffer);
+#if REFERENCE_CHECKS
+    if (referenceFrame) {
+        tileClassifier->encodeReferenceReadback(commandBuffer, depthGBuffer);
+    }
+#endif
+#endif
+    uint64_t gBufferDoneValue = gpuScheduler->signal(commandBuffer);
+
+    // The depth pyramid, and the classified tiles' rays, overlap the post process and overlay
+    MTL::CommandBuffer* computeCommandBuffer = gpuScheduler->commandBuffer(GPUScheduler::Queue::Compute, MTLSTR("Depth Pyramid Commands"));
+    gpuScheduler->wait(computeCommandBuffer, gBufferDoneValue);
+#if !TILE_CLASSIFICATION
+    // Keeps the event values in signal order, computeDoneValue then covers the rays too
+    gpuScheduler->wait(computeCommandBuffer, raytracingDoneValue);
+#else
+    dispatchRaytracing(computeCommandBuffer);
+#endif
+    dispatchMinMaxDepthMipmaps(computeCommandBuffer);
+    computeDoneValue = gpuScheduler->signal(computeCommandBuffer);
+    computeCommandBuffer->commit();
+
+    objectPicker->encodeReadback(commandBuffer, objectIdGBuffer, depthGBuffer, frameNumber);
+
+    // Resolve HDR lighting into the drawable
+    postProcess->encode(commandBuffer, hdrLightingTexture, metalDrawable->texture(), (uint32_t)frameNumber);
+#if REFERENCE_CHECKS
+    // Before the overlay is drawn over the composite
+    if (referenceFrame) {
+        postProcess->encodeReferenceReadback(commandBuffer, hdrLightingTexture, metalDrawable->texture());
+    }
+#endif
 
     // Forward/debug render pass descriptor setup
     forwardDescriptor->colorAttachments()->object(0)->setTexture(metalDrawable->texture());
@@ -887,16 +2177,45 @@ void Engine::draw() {
     forwardDescriptor->stencilAttachment()->setLoadAction(MTL::LoadActionClear);
     forwardDescriptor->stencilAttachment()->setClearStencil(0);
     
-    editor->beginFrame(forwardDescriptor);
+    bool overlayRebuilt;
+    {
+        // The main thread feeds ImGui input while it polls events
+        std::lock_guard<std::mutex> lock(editorMutex);
+        overlayRebuilt = editor->renderOverlay(commandBuffer, (uint32_t)metalDrawable->texture()->width(), (uint32_t)metalDrawable->texture()->height(), *resources);
+    }
 
     MTL::RenderCommandEncoder* debugEncoder = commandBuffer->renderCommandEncoder(forwardDescriptor);
     if (debugEncoder) {
-        debugEncoder->setLabel(NS::String::string("Debug and ImGui Pass", NS::ASCIIStringEncoding));
+        debugEncoder->setLabel(MTLSTR("Debug and ImGui Pass"));
         
         drawDebug(debugEncoder, commandBuffer);
         
         debugEncoder->endEncoding();
     }
 
+    // The frame's slot is only reused once the compute queue is done with it too, the wait
+    // holds back completion and present, not the passes encoded above
+    gpuScheduler->wait(commandBuffer, computeDoneValue);
+    gpuProfiler->endFrame(commandBuffer);
     endFrame(commandBuffer, metalDrawable);
+    gpuScheduler->endFrame();
+#if REFERENCE_CHECKS
+    if (referenceFrame) {
+        runReferenceChecks(commandBuffer);
+    }
+#endif
+
+#if COUNT_FRAME_ALLOCATIONS
+    // Steady state frames must not touch the C++ heap, warmup restarts after a resize
+    uint64_t allocations = AllocationCounter::count() - allocationsAtStart;
+    if (allocationWarmupFrames > 0) {
+        allocationWarmupFrames--;
+    } else if (!overlayRebuilt && allocations > 0) {
+        fprintf(stderr, "Frame %llu made %llu heap allocations\n", frameNumber, allocations);
+        assert(false && "Heap allocation in a steady state frame");
+    }
+#else
+    (void)allocationsAtStart;
+    (void)overlayRebuilt;
+#endif
 }
@@ -0,0 +1,49 @@
+#include "allocationCounter.hpp"
+
+#include <new>
+
+#if COUNT_FRAME_ALLOCATIONS
+
+// Per thread, so allocations on the main thread (event polling, snapshot writes) do not
+// land in the render thread's frame
+static thread_local uint64_t allocationCount = 0;
+
+static void* countedAllocate(size_t size, size_t alignment) {
+    allocationCount++;
+
+    void* pointer = nullptr;
+    if (alignment <= alignof(std::max_align_t)) {
+        pointer = std::malloc(size ? size : 1);
+    } else if (posix_memalign(&pointer, alignment, size ? size : 1) != 0) {
+        pointer = nullptr;
+    }
+    if (!pointer)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void* operator new(size_t size) { return countedAllocate(size, alignof(std::max_align_t)); }
+void* operator new[](size_t size) { return countedAllocate(size, alignof(std::max_align_t)); }
+void* operator new(size_t size, std::align_val_t alignment) { return countedAllocate(size, size_t(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return countedAllocate(size, size_t(alignment)); }
+
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept { std::free(pointer); }
+
+uint64_t AllocationCounter::count() {
+    return allocationCount;
+}
+
+#else
+
+uint64_t AllocationCounter::count() {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include "../../../data/shaders/config.hpp"
+
+// Number of C++ heap allocations the calling thread has made through operator new so
+// far. Always zero unless COUNT_FRAME_ALLOCATIONS is enabled. Allocations on other
+// threads, Objective-C objects and malloc calls are not counted.
+namespace AllocationCounter {
+    uint64_t count();
+}
@@ -0,0 +1,343 @@
+#include "assetReport.hpp"
+
+#include "../Components/mesh.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+
+#include <tinyGLTF/json.hpp>
+
+namespace AssetReport {
+
+static float cornerAngle(simd::float3 corner, simd::float3 next, simd::float3 previous) {
+    simd::float3 a = next - corner;
+    simd::float3 b = previous - corner;
+    float lengths = simd::length(a) * simd::length(b);
+    return lengths > 0.0f ? std::acos(std::clamp(simd::dot(a, b) / lengths, -1.0f, 1.0f)) : 0.0f;
+}
+
+// Number of distinct keys over the vertices, sorted by key
+template<typename Key>
+static uint32_t countUnique(const std::vector<Vertex>& vertices, const Key& key) {
+    if (vertices.empty())
+        return 0;
+    std::vector<uint32_t> order(vertices.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return key(vertices[a], vertices[b]) < 0; });
+    uint32_t unique = 1;
+    for (size_t i = 1; i < order.size(); i++) {
+        if (key(vertices[order[i - 1]], vertices[order[i]]) != 0) {
+            unique++;
+        }
+    }
+    return unique;
+}
+
+// Misses of a FIFO post transform cache that starts empty at every submesh, the draw granularity
+static uint32_t cacheMisses(const Mesh& mesh, uint32_t cacheSize) {
+    std::vector<uint32_t> cachedAt(mesh.vertices.size(), 0);
+    uint32_t misses = 0;
+    for (const Submesh& submesh : mesh.submeshes) {
+        // Vertices entered at or after misses - cacheSize are still cached, older ones were pushed out
+        uint32_t drawStart = misses;
+        for (uint32_t i = submesh.indexOffset; i < submesh.indexOffset + submesh.indexCount; i++) {
+            uint32_t& entry = cachedAt[mesh.vertexIndices[i]];
+            if (entry > drawStart && entry + cacheSize > misses)
+                continue;
+            entry = ++misses;
+        }
+    }
+    return misses;
+}
+
+static Layout layoutOf(const char* name, MTL::Texture* texture, const std::vector<TextureInfo>& infos) {
+    Layout layout;
+    layout.name = name;
+    if (!texture)
+        return layout;
+    // RGBA8, one mip
+    layout.layers = (uint32_t)texture->arrayLength();
+    layout.width = (uint32_t)texture->width();
+    layout.height = (uint32_t)texture->height();
+    layout.bytes = texture->allocatedSize();
+    uint64_t imageBytes = 0;
+    for (const TextureInfo& info : infos) {
+        imageBytes += (uint64_t)info.width * info.height * 4;
+    }
+    uint64_t layerBytes = (uint64_t)layout.width * layout.height * 4 * layout.layers;
+    layout.paddingBytes = layerBytes - std::min(imageBytes, layerBytes);
+    return layout;
+}
+
+MeshEntry analyse(const Mesh& mesh, const std::string& name, const Settings& settings) {
+    MeshEntry entry;
+    entry.name = name;
+    entry.triangles = (uint32_t)(mesh.vertexIndices.size() / 3);
+    entry.corners = (uint32_t)mesh.vertexIndices.size();
+    entry.vertices = (uint32_t)mesh.vertices.size();
+    entry.uniqueVertices = countUnique(mesh.vertices, [](const Vertex& a, const Vertex& b) {
+        return std::memcmp(&a, &b, sizeof(Vertex));
+    });
+    entry.uniquePositions = countUnique(mesh.vertices, [](const Vertex& a, const Vertex& b) {
+        return std::memcmp(&a.position, &b.position, sizeof(float) * 3);
+    });
+
+    std::vector<uint8_t> referenced(mesh.vertices.size(), 0);
+    for (uint32_t index : mesh.vertexIndices) {
+        referenced[index] = 1;
+    }
+    uint32_t referencedVertices = (uint32_t)std::count(referenced.begin(), referenced.end(), 1);
+    entry.unreferencedVertices = entry.vertices - referencedVertices;
+
+    uint32_t misses = cacheMisses(mesh, settings.cacheSize);
+    entry.acmr = entry.triangles ? (float)misses / entry.triangles : 0.0f;
+    entry.atvr = referencedVertices ? (float)misses / referencedVertices : 0.0f;
+
+    // Layer sizes of the diffuse array, by diffuseTextureIndex
+    const std::vector<TextureInfo>* diffuseInfos = mesh.hasTextures ? &mesh.diffuseTexturesArray->diffuseTextureInfos : nullptr;
+    const float requiredDensity = settings.screenHeight /
+                                  (2.0f * settings.nearestViewDistance * std::tan(settings.verticalFov * (float)M_PI / 360.0f));
+    const float sliverRadians = settings.sliverAngle * (float)M_PI / 180.0f;
+
+    // Materials by diffuse layer, -1 untextured in slot 0
+    std::vector<Material> materials(diffuseInfos ? diffuseInfos->size() + 1 : 1);
+    std::vector<double> texelAreas(materials.size(), 0.0);
+    for (uint32_t triangle = 0; triangle < entry.triangles; triangle++) {
+        const Vertex& v0 = mesh.vertices[mesh.vertexIndices[triangle * 3 + 0]];
+        const Vertex& v1 = mesh.vertices[mesh.vertexIndices[triangle * 3 + 1]];
+        const Vertex& v2 = mesh.vertices[mesh.vertexIndices[triangle * 3 + 2]];
+        simd::float3 p0 = v0.position.xyz, p1 = v1.position.xyz, p2 = v2.position.xyz;
+
+        int32_t layer = v0.diffuseTextureIndex;
+        if (!diffuseInfos || layer < 0 || layer >= (int32_t)diffuseInfos->size())
+            layer = -1;
+        Material& material = materials[layer + 1];
+        material.triangles++;
+
+        // Zero area relative to the triangle's own scale, independent of units
+        float longest = std::max({simd::length_squared(p1 - p0), simd::length_squared(p2 - p1), simd::length_squared(p0 - p2)});
+        float area = 0.5f * simd::length(simd::cross(p1 - p0, p2 - p0));
+        if (area * area <= 1e-12f * longest * longest) {
+            entry.degenerateTriangles++;
+            continue;
+        }
+        float smallest = std::min({cornerAngle(p0, p1, p2), cornerAngle(p1, p2, p0), cornerAngle(p2, p0, p1)});
+        if (smallest < sliverRadians) {
+            entry.sliverTriangles++;
+        }
+
+        material.worldArea += area;
+        if (layer >= 0) {
+            simd::float2 e1 = v1.textureCoordinate - v0.textureCoordinate;
+            simd::float2 e2 = v2.textureCoordinate - v0.textureCoordinate;
+            const TextureInfo& info = (*diffuseInfos)[layer];
+            texelAreas[layer + 1] += 0.5 * std::abs(e1.x * e2.y - e1.y * e2.x) * info.width * info.height;
+        }
+    }
+
+    for (size_t i = 0; i < materials.size(); i++) {
+        Material& material = materials[i];
+        if (material.triangles == 0)
+            continue;
+        material.diffuseLayer = (int32_t)i - 1;
+        if (material.diffuseLayer < 0) {
+            material.name = "untextured";
+        } else {
+            const auto& paths = mesh.diffuseTexturesArray->filePaths;
+            material.name = i - 1 < paths.size() ? std::filesystem::path(paths[i - 1]).filename().string() : "layer " + std::to_string(i - 1);
+            MTL::Texture* texture = mesh.diffuseTextures;
+            material.textureBytes = texture->allocatedSize() / texture->arrayLength();
+            if (material.worldArea > 0.0) {
+                material.texelDensity = (float)std::sqrt(texelAreas[i] / material.worldArea);
+                material.densityRatio = material.texelDensity / requiredDensity;
+                // Each level above the need holds three quarters of what is left
+                material.excessMips = material.densityRatio >= 2.0f ? (uint32_t)std::floor(std::log2(material.densityRatio)) : 0;
+                material.excessBytes = material.textureBytes - (uint64_t)(material.textureBytes * std::pow(0.25, material.excessMips));
+            }
+            if (material.densityRatio > settings.budgets.maxTexelDensityRatio) {
+                char text[96];
+                snprintf(text, sizeof(text), "texel density %.1fx the on-screen need (budget %.1fx)",
+                         material.densityRatio, settings.budgets.maxTexelDensityRatio);
+                material.overBudget.push_back(text);
+            }
+        }
+        entry.materials.push_back(material);
+    }
+
+    entry.vertexBytes = mesh.positionStream->length() + mesh.tangentFrameStream->length() +
+                        mesh.texcoordStream->length() + mesh.textureIndexStream->length();
+    entry.indexBytes = mesh.indexBuffer->length();
+    if (mesh.hasTextures) {
+        entry.layouts.push_back(layoutOf("diffuse", mesh.diffuseTextures, mesh.diffuseTexturesArray->diffuseTextureInfos));
+        entry.layouts.push_back(layoutOf("normal", mesh.normalTextures, mesh.normalTexturesArray->normalTextureInfos));
+        for (const Layout& layout : entry.layouts) {
+            entry.textureBytes += layout.bytes;
+        }
+    }
+
+    // Budgets of the mesh, materials carry their own
+    const Budgets& budgets = settings.budgets;
+    auto check = [&](bool over, const char* format, double value, double budget) {
+        if (!over)
+            return;
+        char text[96];
+        snprintf(text, sizeof(text), format, value, budget);
+        entry.overBudget.push_back(text);
+    };
+    float duplicateRatio = entry.uniqueVertices ? (float)entry.vertices / entry.uniqueVertices : 1.0f;
+    check(duplicateRatio > budgets.maxDuplicateRatio, "%.3f stored vertices per unique vertex (budget %.3f)", duplicateRatio, budgets.maxDuplicateRatio);
+    check(entry.acmr > budgets.maxACMR, "ACMR %.3f (budget %.3f)", entry.acmr, budgets.maxACMR);
+    float degenerateFraction = entry.triangles ? (float)entry.degenerateTriangles / entry.triangles : 0.0f;
+    check(degenerateFraction > budgets.maxDegenerateFraction, "%.3f%% degenerate triangles (budget %.3f%%)",
+          degenerateFraction * 100.0, budgets.maxDegenerateFraction * 100.0);
+    float sliverFraction = entry.triangles ? (float)entry.sliverTriangles / entry.triangles : 0.0f;
+    check(sliverFraction > budgets.maxSliverFraction, "%.2f%% sliver triangles (budget %.2f%%)",
+          sliverFraction * 100.0, budgets.maxSliverFraction * 100.0);
+    for (const Layout& layout : entry.layouts) {
+        float paddingFraction = layout.bytes ? (float)layout.paddingBytes / layout.bytes : 0.0f;
+        check(paddingFraction > budgets.maxPaddingFraction,
+              layout.name == "diffuse" ? "%.0f%% of the diffuse array is padding (budget %.0f%%)" : "%.0f%% of the normal array is padding (budget %.0f%%)",
+              paddingFraction * 100.0, budgets.maxPaddingFraction * 100.0);
+    }
+    double megabytes = entry.gpuBytes() / (1024.0 * 1024.0);
+    check(megabytes > budgets.maxMeshMegabytes, "%.1f MB of GPU memory (budget %.1f MB)", megabytes, budgets.maxMeshMegabytes);
+    return entry;
+}
+
+void finish(Report& report) {
+    report.violations = 0;
+    for (MeshEntry& mesh : report.meshes) {
+        std::stable_sort(mesh.materials.begin(), mesh.materials.end(), [](const Material& a, const Material& b) {
+            return a.excessBytes != b.excessBytes ? a.excessBytes > b.excessBytes : a.textureBytes > b.textureBytes;
+        });
+        report.violations += (uint32_t)mesh.overBudget.size();
+        for (const Material& material : mesh.materials) {
+            report.violations += (uint32_t)material.overBudget.size();
+        }
+    }
+    std::stable_sort(report.meshes.begin(), report.meshes.end(), [](const MeshEntry& a, const MeshEntry& b) {
+        return a.gpuBytes() > b.gpuBytes();
+    });
+}
+
+bool loadBudgets(const std::string& path, Budgets& budgets) {
+    std::ifstream file(path);
+    if (!file)
+        return false;
+    nlohmann::json json = nlohmann::json::parse(file, nullptr, false);
+    if (!json.is_object())
+        return false;
+
+    budgets.maxDuplicateRatio = json.value("maxDuplicateRatio", budgets.maxDuplicateRatio);
+    budgets.maxACMR = json.value("maxACMR", budgets.maxACMR);
+    budgets.maxDegenerateFraction = json.value("maxDegenerateFraction", budgets.maxDegenerateFraction);
+    budgets.maxSliverFraction = json.value("maxSliverFraction", budgets.maxSliverFraction);
+    budgets.maxTexelDensityRatio = json.value("maxTexelDensityRatio", budgets.maxTexelDensityRatio);
+    budgets.maxPaddingFraction = json.value("maxPaddingFraction", budgets.maxPaddingFraction);
+    budgets.maxMeshMegabytes = json.value("maxMeshMegabytes", budgets.maxMeshMegabytes);
+    return true;
+}
+
+bool writeJSON(const std::string& path, const Report& report) {
+    const Settings& settings = report.settings;
+    nlohmann::ordered_json json;
+    json["budgets"] = {
+        {"maxDuplicateRatio", settings.budgets.maxDuplicateRatio},
+        {"maxACMR", settings.budgets.maxACMR},
+        {"maxDegenerateFraction", settings.budgets.maxDegenerateFraction},
+        {"maxSliverFraction", settings.budgets.maxSliverFraction},
+        {"maxTexelDensityRatio", settings.budgets.maxTexelDensityRatio},
+        {"maxPaddingFraction", settings.budgets.maxPaddingFraction},
+        {"maxMeshMegabytes", settings.budgets.maxMeshMegabytes}
+    };
+    json["settings"] = {
+        {"cacheSize", settings.cacheSize},
+        {"sliverAngle", settings.sliverAngle},
+        {"screenHeight", settings.screenHeight},
+        {"verticalFov", settings.verticalFov},
+        {"nearestViewDistance", settings.nearestViewDistance}
+    };
+    json["violations"] = report.violations;
+
+    nlohmann::ordered_json meshes = nlohmann::ordered_json::array();
+    for (const MeshEntry& mesh : report.meshes) {
+        nlohmann::ordered_json layouts = nlohmann::ordered_json::array();
+        for (const Layout& layout : mesh.layouts) {
+            layouts.push_back({
+                {"name", layout.name}, {"layers", layout.layers}, {"width", layout.width}, {"height", layout.height},
+                {"bytes", layout.bytes}, {"paddingBytes", layout.paddingBytes}
+            });
+        }
+        nlohmann::ordered_json materials = nlohmann::ordered_json::array();
+        for (const Material& material : mesh.materials) {
+            materials.push_back({
+                {"name", material.name}, {"diffuseLayer", material.diffuseLayer}, {"triangles", material.triangles},
+                {"worldArea", material.worldArea}, {"texelDensity", material.texelDensity},
+                {"densityRatio", material.densityRatio}, {"excessMips", material.excessMips},
+                {"textureBytes", material.textureBytes}, {"excessBytes", material.excessBytes},
+                {"overBudget", material.overBudget}
+            });
+        }
+        meshes.push_back({
+            {"name", mesh.name},
+            {"gpuBytes", mesh.gpuBytes()},
+            {"vertexBytes", mesh.vertexBytes}, {"indexBytes", mesh.indexBytes}, {"textureBytes", mesh.textureBytes},
+            {"triangles", mesh.triangles},
+            {"corners", mesh.corners}, {"vertices", mesh.vertices}, {"uniqueVertices", mesh.uniqueVertices},
+            {"unreferencedVertices", mesh.unreferencedVertices}, {"uniquePositions", mesh.uniquePositions},
+            {"acmr", mesh.acmr}, {"atvr", mesh.atvr},
+            {"degenerateTriangles", mesh.degenerateTriangles}, {"sliverTriangles", mesh.sliverTriangles},
+            {"layouts", layouts},
+            {"materials", materials},
+            {"overBudget", mesh.overBudget}
+        });
+    }
+    json["meshes"] = meshes;
+
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    std::ofstream file(path, std::ios::trunc);
+    if (!file)
+        return false;
+    file << json.dump(2) << "\n";
+    return file.good();
+}
+
+void print(const Report& report) {
+    constexpr double MB = 1024.0 * 1024.0;
+    printf("Asset report: %zu meshes, %u over budget\n", report.meshes.size(), report.violations);
+    for (const MeshEntry& mesh : report.meshes) {
+        printf("  %s: %.1f MB (vertices %.1f, indices %.1f, textures %.1f)\n", mesh.name.c_str(),
+               mesh.gpuBytes() / MB, mesh.vertexBytes / MB, mesh.indexBytes / MB, mesh.textureBytes / MB);
+        printf("    %u triangles, %u corners -> %u vertices, %u unique, %u unreferenced, %u positions\n",
+               mesh.triangles, mesh.corners, mesh.vertices, mesh.uniqueVertices, mesh.unreferencedVertices, mesh.uniquePositions);
+        printf("    ACMR %.3f, ATVR %.3f at %u entries, %u degenerate, %u sliver triangles\n",
+               mesh.acmr, mesh.atvr, report.settings.cacheSize, mesh.degenerateTriangles, mesh.sliverTriangles);
+        for (const Layout& layout : mesh.layouts) {
+            printf("    %s array %u x %ux%u, %.1f MB, %.1f MB padding\n", layout.name.c_str(), layout.layers,
+                   layout.width, layout.height, layout.bytes / MB, layout.paddingBytes / MB);
+        }
+        for (const Material& material : mesh.materials) {
+            if (material.diffuseLayer < 0) {
+                printf("    %-32s %7u triangles\n", material.name.c_str(), material.triangles);
+                continue;
+            }
+            printf("    %-32s %7u triangles, %8.1f texels/unit, %5.2fx need, %u excess mips, %.1f of %.1f MB\n",
+                   material.name.c_str(), material.triangles, material.texelDensity, material.densityRatio,
+                   material.excessMips, material.excessBytes / MB, material.textureBytes / MB);
+        }
+        for (const std::string& violation : mesh.overBudget) {
+            printf("    OVER BUDGET %s\n", violation.c_str());
+        }
+        for (const Material& material : mesh.materials) {
+            for (const std::string& violation : material.overBudget) {
+                printf("    OVER BUDGET %s: %s\n", material.name.c_str(), violation.c_str());
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+
+struct Mesh;
+
+// Content cost analysis over what the import pipeline produced. Every mesh is measured
+// for vertex bloat (stored vertices against exact duplicates, unreferenced vertices and
+// attribute splits per position), post transform cache efficiency of its index order
+// (ACMR over a FIFO cache, reset at every submesh draw), degenerate and sliver
+// triangles, the padding its TextureArray layers waste by being allocated at the size of
+// the largest image, and estimated GPU memory. Every material, a diffuse layer, is
+// measured for texel density against the density the screen can show at the closest
+// expected viewing distance; mips above that are memory no pixel samples. Meshes and
+// materials are ranked by bytes, checked against budgets and written as JSON and text.
+namespace AssetReport {
+    // Loaded from a JSON object with the same keys, missing keys keep these values
+    struct Budgets {
+        float       maxDuplicateRatio = 1.01f;      // Stored vertices over exact unique vertices
+        float       maxACMR = 1.0f;                 // Cache misses per triangle
+        float       maxDegenerateFraction = 0.001f;
+        float       maxSliverFraction = 0.02f;
+        float       maxTexelDensityRatio = 2.0f;    // Texel density over on-screen need, per material
+        float       maxPaddingFraction = 0.25f;     // Of each texture array
+        float       maxMeshMegabytes = 512.0f;      // Estimated GPU memory of one mesh
+    };
+
+    struct Settings {
+        Budgets     budgets;
+        uint32_t    cacheSize = 32;                 // Post transform cache entries
+        float       sliverAngle = 2.0f;             // Degrees, smallest corner angle of a sliver
+        // On-screen need: pixels per world unit at the nearest distance content is seen from
+        float       screenHeight = 1440.0f;
+        float       verticalFov = 45.0f;            // Degrees, the camera's default
+        float       nearestViewDistance = 1.0f;     // World units
+    };
+
+    struct Material {
+        std::string name;                           // Diffuse texture file, or "untextured"
+        int32_t     diffuseLayer = -1;
+        uint32_t    triangles = 0;
+        double      worldArea = 0.0;
+        float       texelDensity = 0.0f;            // Texels per world unit, area weighted
+        float       densityRatio = 0.0f;            // Over the on-screen need
+        uint32_t    excessMips = 0;                 // Levels above the need
+        uint64_t    textureBytes = 0;               // Its layer as allocated, padding included
+        uint64_t    excessBytes = 0;                // Of textureBytes, held by the excess levels
+        std::vector<std::string> overBudget;
+    };
+
+    // One TextureArray, every layer is allocated at width by height
+    struct Layout {
+        std::string name;
+        uint32_t    layers = 0;
+        uint32_t    width = 0;
+        uint32_t    height = 0;
+        uint64_t    bytes = 0;
+        uint64_t    paddingBytes = 0;               // Texels outside every layer's image
+    };
+
+    struct MeshEntry {
+        std::string name;
+        uint32_t    triangles = 0;
+        uint32_t    corners = 0;                    // Vertices before deduplication
+        uint32_t    vertices = 0;                   // Stored
+        uint32_t    uniqueVertices = 0;             // After exact deduplication of the stored ones
+        uint32_t    unreferencedVertices = 0;
+        uint32_t    uniquePositions = 0;
+        float       acmr = 0.0f;
+        float       atvr = 0.0f;                    // Cache misses per referenced vertex
+        uint32_t    degenerateTriangles = 0;
+        uint32_t    sliverTriangles = 0;
+        uint64_t    vertexBytes = 0;
+        uint64_t    indexBytes = 0;
+        uint64_t    textureBytes = 0;
+        std::vector<Layout>     layouts;
+        std::vector<Material>   materials;          // Ranked by excess then texture bytes
+        std::vector<std::string> overBudget;
+
+        uint64_t gpuBytes() const { return vertexBytes + indexBytes + textureBytes; }
+    };
+
+    struct Report {
+        Settings                settings;
+        std::vector<MeshEntry>  meshes;             // Ranked by GPU bytes
+        uint32_t                violations = 0;     // Budgets exceeded, over every mesh and material
+    };
+
+    MeshEntry analyse(const Mesh& mesh, const std::string& name, const Settings& settings);
+    // Ranks the meshes and materials and counts the violations
+    void finish(Report& report);
+
+    bool loadBudgets(const std::string& path, Budgets& budgets);
+    bool writeJSON(const std::string& path, const Report& report);
+    void print(const Report& report);
+}
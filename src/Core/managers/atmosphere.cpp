@@ -0,0 +1,98 @@
+#include "atmosphere.hpp"
+
+#include <cmath>
+
+Atmosphere::Atmosphere(MTL::Device* device, RenderPipeline& pipelines)
+: params(defaultParams()), device(device), pipelines(pipelines) {
+    transmittanceLUT = createLUT(TransmittanceWidth, TransmittanceHeight, "Transmittance LUT");
+    multiScatteringLUT = createLUT(MultiScatteringSize, MultiScatteringSize, "Multiple Scattering LUT");
+    skyViewLUT = createLUT(SkyViewWidth, SkyViewHeight, "Sky View LUT");
+}
+
+Atmosphere::~Atmosphere() {
+    transmittanceLUT->release();
+    multiScatteringLUT->release();
+    skyViewLUT->release();
+}
+
+// Earth-like values from Hillaire, "A Scalable and Production Ready Sky and Atmosphere Rendering Technique"
+AtmosphereParams Atmosphere::defaultParams() {
+    return AtmosphereParams{
+        .rayleighScattering = simd::float4{5.802e-3f, 13.558e-3f, 33.1e-3f, 0.0f},
+        .mieScattering = simd::float4{3.996e-3f, 3.996e-3f, 3.996e-3f, 0.0f},
+        .mieExtinction = simd::float4{4.40e-3f, 4.40e-3f, 4.40e-3f, 0.0f},
+        .ozoneAbsorption = simd::float4{0.650e-3f, 1.881e-3f, 0.085e-3f, 0.0f},
+        .groundAlbedo = simd::float4{0.3f, 0.3f, 0.3f, 0.0f},
+        .sunIlluminance = simd::float4{8.0f, 8.0f, 8.0f, 0.0f},
+        .sunDirection = simd::float4{0.0f, 1.0f, 0.0f, 0.0f},
+        .bottomRadius = 6360.0f,
+        .topRadius = 6460.0f,
+        .cameraRadius = 6360.0f + 0.2f,
+        .miePhaseG = 0.8f,
+        .rayleighScaleHeight = 8.0f,
+        .mieScaleHeight = 1.2f,
+        .ozoneCenterHeight = 25.0f,
+        .ozoneHalfWidth = 15.0f
+    };
+}
+
+MTL::Texture* Atmosphere::createLUT(uint32_t width, uint32_t height, const char* label) {
+    MTL::TextureDescriptor* descriptor = MTL::TextureDescriptor::alloc()->init();
+    descriptor->setTextureType(MTL::TextureType2D);
+    descriptor->setPixelFormat(MTL::PixelFormatRGBA16Float);
+    descriptor->setWidth(width);
+    descriptor->setHeight(height);
+    descriptor->setStorageMode(MTL::StorageModePrivate);
+    descriptor->setUsage(MTL::TextureUsageShaderRead | MTL::TextureUsageShaderWrite);
+
+    MTL::Texture* texture = device->newTexture(descriptor);
+    texture->setLabel(NS::String::string(label, NS::ASCIIStringEncoding));
+    descriptor->release();
+    return texture;
+}
+
+bool Atmosphere::update(MTL::CommandBuffer* commandBuffer, simd::float3 sunDirection, float cameraAltitude) {
+    sunDirection = simd::normalize(sunDirection);
+    float cameraRadius = params.bottomRadius + std::clamp(cameraAltitude, 0.01f, params.topRadius - params.bottomRadius - 0.01f);
+
+    bool sunMoved = simd::dot(sunDirection, skyViewSunDirection) < std::cos(sunAngleThreshold * (float)M_PI / 180.0f);
+    bool cameraMoved = std::abs(cameraRadius - params.cameraRadius) > altitudeThreshold;
+    if (!mediumDirty && skyViewValid && !sunMoved && !cameraMoved)
+        return false;
+
+    params.sunDirection = simd::float4{sunDirection.x, sunDirection.y, sunDirection.z, 0.0f};
+    params.cameraRadius = cameraRadius;
+    skyViewSunDirection = sunDirection;
+
+    MTL::ComputeCommandEncoder* encoder = commandBuffer->computeCommandEncoder();
+    encoder->setLabel(MTLSTR("Atmosphere LUTs"));
+    encoder->setBytes(&params, sizeof(params), BufferIndexAtmosphere);
+
+    MTL::Size threadsPerGroup(8, 8, 1);
+    auto groupsFor = [](MTL::Texture* texture) {
+        return MTL::Size((texture->width() + 7) / 8, (texture->height() + 7) / 8, 1);
+    };
+
+    if (mediumDirty) {
+        encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::TransmittanceLUT));
+        encoder->setTexture(transmittanceLUT, TextureIndexTransmittanceLUT);
+        encoder->dispatchThreadgroups(groupsFor(transmittanceLUT), threadsPerGroup);
+
+        // One threadgroup per texel, one thread per integration direction
+        encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::MultiScatteringLUT));
+        encoder->setTexture(transmittanceLUT, TextureIndexTransmittanceLUT);
+        encoder->setTexture(multiScatteringLUT, TextureIndexMultiScatteringLUT);
+        encoder->dispatchThreadgroups(MTL::Size(MultiScatteringSize, MultiScatteringSize, 1), MTL::Size(MultiScatteringDirections, 1, 1));
+        mediumDirty = false;
+    }
+
+    encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::SkyViewLUT));
+    encoder->setTexture(transmittanceLUT, TextureIndexTransmittanceLUT);
+    encoder->setTexture(multiScatteringLUT, TextureIndexMultiScatteringLUT);
+    encoder->setTexture(skyViewLUT, TextureIndexSkyViewLUT);
+    encoder->dispatchThreadgroups(groupsFor(skyViewLUT), threadsPerGroup);
+    encoder->endEncoding();
+
+    skyViewValid = true;
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+#include <simd/simd.h>
+#include "renderPipeline.hpp"
+#include "../../../data/shaders/shaderTypes.hpp"
+
+// Owns the atmospheric scattering lookup tables and rebuilds them on the GPU only
+// when their inputs change. Transmittance and multiple scattering depend on the
+// medium alone, the sky view table also on the sun direction and camera altitude.
+class Atmosphere {
+public:
+    static constexpr uint32_t TransmittanceWidth        = 256;
+    static constexpr uint32_t TransmittanceHeight       = 64;
+    static constexpr uint32_t MultiScatteringSize       = 32;
+    static constexpr uint32_t MultiScatteringDirections = 64;   // Must match atmosphere.metal
+    static constexpr uint32_t SkyViewWidth              = 192;
+    static constexpr uint32_t SkyViewHeight             = 108;
+
+    Atmosphere(MTL::Device* device, RenderPipeline& pipelines);
+    ~Atmosphere();
+
+    static AtmosphereParams defaultParams();
+
+    // Encodes whichever LUT passes are out of date. The sun direction points towards
+    // the sun in world space, altitude is in km. Returns true if anything was rebuilt.
+    bool update(MTL::CommandBuffer* commandBuffer, simd::float3 sunDirection, float cameraAltitude);
+
+    // Call after editing the medium in params
+    void invalidate() { mediumDirty = true; }
+
+    MTL::Texture* getTransmittanceLUT() const { return transmittanceLUT; }
+    MTL::Texture* getSkyViewLUT() const { return skyViewLUT; }
+
+    AtmosphereParams    params;
+
+    // Sky view is rebuilt once the sun moved further than this, or the camera changed altitude
+    float               sunAngleThreshold = 0.25f;     // Degrees
+    float               altitudeThreshold = 0.01f;     // km
+
+private:
+    MTL::Device*        device;
+    RenderPipeline&     pipelines;
+
+    MTL::Texture*       transmittanceLUT = nullptr;
+    MTL::Texture*       multiScatteringLUT = nullptr;
+    MTL::Texture*       skyViewLUT = nullptr;
+
+    bool                mediumDirty = true;
+    bool                skyViewValid = false;
+    simd::float3        skyViewSunDirection = {0.0f, 1.0f, 0.0f};
+
+    MTL::Texture* createLUT(uint32_t width, uint32_t height, const char* label);
+};
@@ -0,0 +1,126 @@
+#include "constantBlocks.hpp"
+
+ConstantBlocks::ConstantBlocks(MTL::Device* device, uint32_t framesInFlight)
+: allStale((1u << framesInFlight) - 1) {
+    auto align = [](NS::UInteger value) { return (value + BlockAlignment - 1) & ~(BlockAlignment - 1); };
+
+    NS::UInteger size = 0;
+    auto place = [&](uint32_t blockIndex, size_t blockSize) {
+        blocks[blockIndex] = {.offset = size, .size = blockSize, .staleBuffers = 0};
+        size = align(size + blockSize);
+    };
+    place(BlockFrame, sizeof(FrameConstants));
+    place(BlockPass, sizeof(PassConstants));
+    for (uint32_t i = 0; i < MaxViews; i++) {
+        place(BlockViews + i, sizeof(ViewConstants));
+    }
+    for (uint32_t i = 0; i < MaxInstances; i++) {
+        place(BlockInstances + i, sizeof(InstanceConstants));
+    }
+    shadow.resize(size);
+
+    // Identity instances until a mesh is placed
+    InstanceConstants identity{.model_matrix = matrix_identity_float4x4, .normal_matrix = matrix_identity_float3x3};
+    for (uint32_t i = 0; i < MaxInstances; i++) {
+        std::memcpy(shadow.data() + offset(BlockInstances + i), &identity, sizeof(identity));
+    }
+
+    for (uint32_t i = 0; i < framesInFlight; i++) {
+        MTL::Buffer* buffer = device->newBuffer(shadow.data(), size, MTL::ResourceStorageModeShared);
+        buffer->setLabel(NS::String::string("Constant Blocks", NS::ASCIIStringEncoding));
+        buffers.push_back(buffer);
+    }
+}
+
+ConstantBlocks::~ConstantBlocks() {
+    for (MTL::Buffer* buffer : buffers) {
+        buffer->release();
+    }
+}
+
+void ConstantBlocks::set(uint32_t blockIndex, const void* data) {
+    Block& block = blocks[blockIndex];
+    uint8_t* copy = shadow.data() + block.offset;
+    if (std::memcmp(copy, data, block.size) == 0)
+        return;
+
+    std::memcpy(copy, data, block.size);
+    block.staleBuffers = allStale;
+}
+
+void ConstantBlocks::setFrame(const FrameConstants& constants) {
+    set(BlockFrame, &constants);
+}
+
+void ConstantBlocks::setView(uint32_t view, const ViewConstants& constants) {
+    assert(view < MaxViews);
+    set(BlockViews + view, &constants);
+}
+
+void ConstantBlocks::setPass(const PassConstants& constants) {
+    set(BlockPass, &constants);
+}
+
+void ConstantBlocks::setInstance(uint32_t instance, const InstanceConstants& constants) {
+    assert(instance < MaxInstances);
+    set(BlockInstances + instance, &constants);
+}
+
+const FrameConstants& ConstantBlocks::getFrame() const {
+    return *reinterpret_cast<const FrameConstants*>(shadow.data() + offset(BlockFrame));
+}
+
+const ViewConstants& ConstantBlocks::getView(uint32_t view) const {
+    return *reinterpret_cast<const ViewConstants*>(shadow.data() + offset(BlockViews + view));
+}
+
+const PassConstants& ConstantBlocks::getPass() const {
+    return *reinterpret_cast<const PassConstants*>(shadow.data() + offset(BlockPass));
+}
+
+void ConstantBlocks::upload(uint32_t frameIndex) {
+    currentBuffer = frameIndex;
+    uint8_t* contents = static_cast<uint8_t*>(buffers[frameIndex]->contents());
+    uint32_t bufferBit = 1u << frameIndex;
+
+    uploadedBytes = 0;
+    for (Block& block : blocks) {
+        if (block.staleBuffers & bufferBit) {
+            std::memcpy(contents + block.offset, shadow.data() + block.offset, block.size);
+            block.staleBuffers &= ~bufferBit;
+            uploadedBytes += block.size;
+        }
+    }
+}
+
+void ConstantBlocks::bindVertex(MTL::RenderCommandEncoder* encoder, uint32_t view) const {
+    MTL::Buffer* buffer = buffers[currentBuffer];
+    encoder->setVertexBuffer(buffer, offset(BlockFrame), BufferIndexFrameConstants);
+    encoder->setVertexBuffer(buffer, offset(BlockViews + view), BufferIndexViewConstants);
+    encoder->setVertexBuffer(buffer, offset(BlockPass), BufferIndexPassConstants);
+}
+
+void ConstantBlocks::bindFragment(MTL::RenderCommandEncoder* encoder, uint32_t view) const {
+    MTL::Buffer* buffer = buffers[currentBuffer];
+    encoder->setFragmentBuffer(buffer, offset(BlockFrame), BufferIndexFrameConstants);
+    encoder->setFragmentBuffer(buffer, offset(BlockViews + view), BufferIndexViewConstants);
+    encoder->setFragmentBuffer(buffer, offset(BlockPass), BufferIndexPassConstants);
+}
+
+void ConstantBlocks::bindTile(MTL::RenderCommandEncoder* encoder, uint32_t view) const {
+    MTL::Buffer* buffer = buffers[currentBuffer];
+    encoder->setTileBuffer(buffer, offset(BlockFrame), BufferIndexFrameConstants);
+    encoder->setTileBuffer(buffer, offset(BlockViews + view), BufferIndexViewConstants);
+    encoder->setTileBuffer(buffer, offset(BlockPass), BufferIndexPassConstants);
+}
+
+void ConstantBlocks::bind(MTL::ComputeCommandEncoder* encoder, uint32_t view) const {
+    MTL::Buffer* buffer = buffers[currentBuffer];
+    encoder->setBuffer(buffer, offset(BlockFrame), BufferIndexFrameConstants);
+    encoder->setBuffer(buffer, offset(BlockViews + view), BufferIndexViewConstants);
+    encoder->setBuffer(buffer, offset(BlockPass), BufferIndexPassConstants);
+}
+
+void ConstantBlocks::bindInstance(MTL::RenderCommandEncoder* encoder, uint32_t instance) const {
+    encoder->setVertexBuffer(buffers[currentBuffer], offset(BlockInstances + instance), BufferIndexInstanceConstants);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+#include "../../../data/shaders/shaderTypes.hpp"
+
+// Per frame in flight constant buffers holding the FrameConstants, ViewConstants,
+// PassConstants and InstanceConstants blocks at fixed offsets. Setters compare with a
+// CPU copy of the last values; a block that changed is marked stale in every buffer
+// of the ring and copied into each one as it comes round in upload, so unchanged
+// blocks cost nothing per frame.
+class ConstantBlocks {
+public:
+    static constexpr uint32_t MaxViews      = 4;
+    static constexpr uint32_t MaxInstances  = 64;
+    static constexpr uint32_t MainView      = 0;
+
+    ConstantBlocks(MTL::Device* device, uint32_t framesInFlight);
+    ~ConstantBlocks();
+
+    void setFrame(const FrameConstants& constants);
+    void setView(uint32_t view, const ViewConstants& constants);
+    void setPass(const PassConstants& constants);
+    void setInstance(uint32_t instance, const InstanceConstants& constants);
+
+    const FrameConstants&   getFrame() const;
+    const ViewConstants&    getView(uint32_t view) const;
+    const PassConstants&    getPass() const;
+
+    // Brings this frame's buffer up to date, call before encoding the frame
+    void upload(uint32_t frameIndex);
+
+    // Frame, view and pass blocks of the current frame for the stages that read them
+    void bindVertex(MTL::RenderCommandEncoder* encoder, uint32_t view = MainView) const;
+    void bindFragment(MTL::RenderCommandEncoder* encoder, uint32_t view = MainView) const;
+    void bindTile(MTL::RenderCommandEncoder* encoder, uint32_t view = MainView) const;
+    void bind(MTL::ComputeCommandEncoder* encoder, uint32_t view = MainView) const;
+    void bindInstance(MTL::RenderCommandEncoder* encoder, uint32_t instance) const;
+
+    // Bytes copied by the last upload
+    size_t getUploadedBytes() const { return uploadedBytes; }
+
+private:
+    // Blocks start on 256 bytes, the constant buffer offset alignment on macOS
+    static constexpr NS::UInteger BlockAlignment = 256;
+
+    struct Block {
+        NS::UInteger    offset;
+        size_t          size;
+        uint32_t        staleBuffers;   // Bit per buffer of the ring
+    };
+
+    enum BlockIndex : uint32_t {
+        BlockFrame      = 0,
+        BlockPass       = 1,
+        BlockViews      = 2,
+        BlockInstances  = BlockViews + MaxViews,
+        BlockCount      = BlockInstances + MaxInstances
+    };
+
+    void set(uint32_t blockIndex, const void* data);
+    NS::UInteger offset(uint32_t blockIndex) const { return blocks[blockIndex].offset; }
+
+    std::vector<MTL::Buffer*>   buffers;
+    std::vector<uint8_t>        shadow;         // Same layout as the buffers
+    std::array<Block, BlockCount> blocks{};
+    uint32_t                    allStale = 0;
+    uint32_t                    currentBuffer = 0;
+    size_t                      uploadedBytes = 0;
+};
@@ -0,0 +1,253 @@
+#include "deferredMSAA.hpp"
+#if REFERENCE_CHECKS
+#include "msaaClassifierReference.hpp"
+#endif
+
+DeferredMSAA::DeferredMSAA(MTL::Device* device, RenderPipeline& pipelines, GPUProfiler& profiler, const Formats& formats)
+: params(defaultParams()), device(device), pipelines(pipelines), profiler(profiler), formats(formats) {
+    for (auto& buffer : dispatchBuffers) {
+        buffer = device->newBuffer(sizeof(MTL::DispatchThreadgroupsIndirectArguments) * 2, MTL::ResourceStorageModeShared);
+        buffer->setLabel(NS::String::string("MSAA Tile Dispatch", NS::ASCIIStringEncoding));
+    }
+}
+
+DeferredMSAA::~DeferredMSAA() {
+    releaseTargets(nullptr);
+    for (auto& buffer : dispatchBuffers) {
+        buffer->release();
+    }
+}
+
+MSAAClassifyParams DeferredMSAA::defaultParams() {
+    return MSAAClassifyParams{
+        .depthThreshold = 1u << 17,     // Roughly 1.5% of the depth
+        .normalThreshold = 24,          // About 11 degrees between similar normals
+        .albedoThreshold = 16
+    };
+}
+
+void DeferredMSAA::releaseTargets(ResourceRegistry* resources) {
+    auto drop = [resources](auto*& object) {
+        if (object) {
+            resources ? resources->retire(object) : object->release();
+            object = nullptr;
+        }
+    };
+    MTL::Texture** textures[] = {&albedoBits, &normalBits, &albedoTexture, &normalTexture, &depthTexture,
+                                 &objectIdTexture, &depthStencilTexture, &edgeMask};
+    for (MTL::Texture** texture : textures) {
+        drop(*texture);
+    }
+    drop(simpleTiles);
+    drop(complexTiles);
+    if (gbufferPassDescriptor) {
+        gbufferPassDescriptor->release();
+        gbufferPassDescriptor = nullptr;
+    }
+}
+
+void DeferredMSAA::resize(uint32_t width, uint32_t height, ResourceRegistry& resources) {
+    // Frames in flight may still use the old targets
+    releaseTargets(&resources);
+
+    MTL::TextureDescriptor* descriptor = MTL::TextureDescriptor::alloc()->init();
+    descriptor->setTextureType(MTL::TextureType2DMultisample);
+    descriptor->setSampleCount(SampleCount);
+    descriptor->setWidth(width);
+    descriptor->setHeight(height);
+    descriptor->setStorageMode(MTL::StorageModePrivate);
+    descriptor->setUsage(MTL::TextureUsageRenderTarget | MTL::TextureUsageShaderRead | MTL::TextureUsagePixelFormatView);
+
+    descriptor->setPixelFormat(formats.albedo);
+    albedoTexture = device->newTexture(descriptor);
+    albedoTexture->setLabel(NS::String::string("MSAA Albedo GBuffer", NS::ASCIIStringEncoding));
+    descriptor->setPixelFormat(formats.normal);
+    normalTexture = device->newTexture(descriptor);
+    normalTexture->setLabel(NS::String::string("MSAA Normal GBuffer", NS::ASCIIStringEncoding));
+    descriptor->setPixelFormat(formats.depth);
+    depthTexture = device->newTexture(descriptor);
+    depthTexture->setLabel(NS::String::string("MSAA Depth GBuffer", NS::ASCIIStringEncoding));
+#if OBJECT_PICKING
+    descriptor->setPixelFormat(formats.objectId);
+    objectIdTexture = device->newTexture(descriptor);
+    objectIdTexture->setLabel(NS::String::string("MSAA Object ID GBuffer", NS::ASCIIStringEncoding));
+#endif
+
+    // Only needed while the G-buffer is rasterised
+    descriptor->setPixelFormat(MTL::PixelFormatDepth32Float_Stencil8);
+    descriptor->setStorageMode(MTL::StorageModeMemoryless);
+    descriptor->setUsage(MTL::TextureUsageRenderTarget);
+    depthStencilTexture = device->newTexture(descriptor);
+    depthStencilTexture->setLabel(NS::String::string("MSAA Depth-Stencil", NS::ASCIIStringEncoding));
+
+    // Raw bits for classification, sRGB decoding and snorm conversion would not be reproducible on the CPU
+    albedoBits = albedoTexture->newTextureView(MTL::PixelFormatRGBA8Uint);
+    normalBits = normalTexture->newTextureView(MTL::PixelFormatRGBA8Sint);
+
+    descriptor->setTextureType(MTL::TextureType2D);
+    descriptor->setSampleCount(1);
+    descriptor->setPixelFormat(MTL::PixelFormatR8Uint);
+    descriptor->setStorageMode(MTL::StorageModePrivate);
+    descriptor->setUsage(MTL::TextureUsageShaderRead | MTL::TextureUsageShaderWrite);
+    edgeMask = device->newTexture(descriptor);
+    edgeMask->setLabel(NS::String::string("MSAA Edge Mask", NS::ASCIIStringEncoding));
+    descriptor->release();
+
+    tileCountX = (width + TileSize - 1) / TileSize;
+    tileCountY = (height + TileSize - 1) / TileSize;
+    simpleTiles = device->newBuffer(tileCountX * tileCountY * sizeof(uint32_t), MTL::ResourceStorageModePrivate);
+    simpleTiles->setLabel(NS::String::string("MSAA Simple Tiles", NS::ASCIIStringEncoding));
+    complexTiles = device->newBuffer(tileCountX * tileCountY * sizeof(uint32_t), MTL::ResourceStorageModePrivate);
+    complexTiles->setLabel(NS::String::string("MSAA Complex Tiles", NS::ASCIIStringEncoding));
+
+    gbufferPassDescriptor = MTL::RenderPassDescriptor::alloc()->init();
+    auto setupAttachment = [&](int index, MTL::Texture* texture) {
+        MTL::RenderPassColorAttachmentDescriptor* attachment = gbufferPassDescriptor->colorAttachments()->object(index);
+        attachment->setTexture(texture);
+        attachment->setLoadAction(MTL::LoadActionClear);
+        attachment->setStoreAction(MTL::StoreActionStore);
+        // Zero everywhere, normal.w == 0 marks samples without geometry
+        attachment->setClearColor(MTL::ClearColor(0.0, 0.0, 0.0, 0.0));
+    };
+    setupAttachment(RenderTargetAlbedo, albedoTexture);
+    setupAttachment(RenderTargetNormal, normalTexture);
+    setupAttachment(RenderTargetDepth, depthTexture);
+#if OBJECT_PICKING
+    setupAttachment(RenderTargetObjectId, objectIdTexture);
+#endif
+
+    gbufferPassDescriptor->depthAttachment()->setTexture(depthStencilTexture);
+    gbufferPassDescriptor->depthAttachment()->setLoadAction(MTL::LoadActionClear);
+    gbufferPassDescriptor->depthAttachment()->setStoreAction(MTL::StoreActionDontCare);
+    gbufferPassDescriptor->depthAttachment()->setClearDepth(1.0);
+    gbufferPassDescriptor->stencilAttachment()->setTexture(depthStencilTexture);
+    gbufferPassDescriptor->stencilAttachment()->setLoadAction(MTL::LoadActionClear);
+    gbufferPassDescriptor->stencilAttachment()->setStoreAction(MTL::StoreActionDontCare);
+    gbufferPassDescriptor->stencilAttachment()->setClearStencil(0);
+}
+
+void DeferredMSAA::encodeLighting(MTL::CommandBuffer* commandBuffer, const ConstantBlocks& constants, Atmosphere* atmosphere,
+                                  MTL::Texture* output, MTL::Texture* resolvedDepth, MTL::Texture* resolvedObjectId) {
+    MTL::Buffer* dispatchBuffer = dispatchBuffers[ringIndex];
+    ringIndex = (ringIndex + 1) % RingSize;
+
+    // Threadgroup counts are appended to by the classifier
+    auto* arguments = (MTL::DispatchThreadgroupsIndirectArguments*)dispatchBuffer->contents();
+    arguments[0] = {{0, 1, 1}};
+    arguments[1] = {{0, 1, 1}};
+
+    #pragma mark Classification
+    {
+        MTL::ComputeCommandEncoder* encoder = commandBuffer->computeCommandEncoder(profiler.computePassDescriptor("MSAA Classify"));
+        encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::MSAAClassify));
+        encoder->setTexture(albedoBits, TextureIndexMSAAAlbedo);
+        encoder->setTexture(normalBits, TextureIndexMSAANormal);
+        encoder->setTexture(depthTexture, TextureIndexMSAADepth);
+        encoder->setTexture(edgeMask, TextureIndexEdgeMask);
+        encoder->setTexture(resolvedDepth, TextureIndexResolvedDepth);
+    #if OBJECT_PICKING
+        encoder->setTexture(objectIdTexture, TextureIndexMSAAObjectId);
+        encoder->setTexture(resolvedObjectId, TextureIndexResolvedObjectId);
+    #endif
+        encoder->setBytes(&params, sizeof(params), BufferIndexMSAAClassify);
+        encoder->setBuffer(dispatchBuffer, 0, BufferIndexTileDispatch);
+        encoder->setBuffer(simpleTiles, 0, BufferIndexSimpleTiles);
+        encoder->setBuffer(complexTiles, 0, BufferIndexComplexTiles);
+        encoder->dispatchThreadgroups(MTL::Size(tileCountX, tileCountY, 1), MTL::Size(TileSize, TileSize, 1));
+        encoder->endEncoding();
+    }
+
+    #pragma mark Shading
+    {
+        MTL::ComputeCommandEncoder* encoder = commandBuffer->computeCommandEncoder(profiler.computePassDescriptor("MSAA Lighting"));
+        encoder->setTexture(albedoTexture, TextureIndexMSAAAlbedo);
+        encoder->setTexture(normalTexture, TextureIndexMSAANormal);
+        encoder->setTexture(edgeMask, TextureIndexEdgeMask);
+        encoder->setTexture(output, TextureIndexLightingOutput);
+        constants.bind(encoder);
+    #if ATMOSPHERIC_SCATTERING
+        encoder->setTexture(atmosphere->getTransmittanceLUT(), TextureIndexTransmittanceLUT);
+        encoder->setTexture(atmosphere->getSkyViewLUT(), TextureIndexSkyViewLUT);
+        encoder->setBytes(&atmosphere->params, sizeof(AtmosphereParams), BufferIndexAtmosphere);
+    #endif
+        encoder->setBuffer(simpleTiles, 0, BufferIndexSimpleTiles);
+        encoder->setBuffer(complexTiles, 0, BufferIndexComplexTiles);
+
+        encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::MSAAShadeSimple));
+        encoder->dispatchThreadgroups(dispatchBuffer, 0, MTL::Size(TileSize, TileSize, 1));
+
+        encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::MSAAShadeComplex));
+        encoder->dispatchThreadgroups(dispatchBuffer, sizeof(MTL::DispatchThreadgroupsIndirectArguments), MTL::Size(TileSize, TileSize, SampleCount));
+        encoder->endEncoding();
+    }
+}
+
+#if REFERENCE_CHECKS
+void DeferredMSAA::encodeReferenceReadback(MTL::CommandBuffer* commandBuffer) {
+    checkParams = params;
+    uint32_t width = (uint32_t)edgeMask->width();
+    uint32_t height = (uint32_t)edgeMask->height();
+
+    MTL::ComputeCommandEncoder* encoder = commandBuffer->computeCommandEncoder();
+    encoder->setLabel(NS::String::string("MSAA Readback Samples", NS::ASCIIStringEncoding));
+    encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::MSAAReadbackSamples));
+    encoder->setTexture(albedoBits, TextureIndexMSAAAlbedo);
+    encoder->setTexture(normalBits, TextureIndexMSAANormal);
+    encoder->setTexture(depthTexture, TextureIndexMSAADepth);
+    encoder->setBuffer(albedoReadback.target(device, width, height, sizeof(uint32_t) * SampleCount), 0, BufferIndexAlbedoSamples);
+    encoder->setBuffer(normalReadback.target(device, width, height, sizeof(uint32_t) * SampleCount), 0, BufferIndexNormalSamples);
+    encoder->setBuffer(depthReadback.target(device, width, height, sizeof(float) * SampleCount), 0, BufferIndexDepthSamples);
+    encoder->dispatchThreadgroups(MTL::Size((width + TileSize - 1) / TileSize, (height + TileSize - 1) / TileSize, 1),
+                                  MTL::Size(TileSize, TileSize, 1));
+    encoder->endEncoding();
+
+    edgeMaskReadback.copyTexture(commandBuffer, edgeMask, sizeof(uint8_t));
+    simpleTilesReadback.copyBuffer(commandBuffer, simpleTiles, 0, simpleTiles->length());
+    complexTilesReadback.copyBuffer(commandBuffer, complexTiles, 0, complexTiles->length());
+    // encodeLighting has already moved the ring on
+    MTL::Buffer* dispatchBuffer = dispatchBuffers[(ringIndex + RingSize - 1) % RingSize];
+    dispatchReadback.copyBuffer(commandBuffer, dispatchBuffer, 0, dispatchBuffer->length());
+}
+
+bool DeferredMSAA::checkReference() {
+    MSAAClassifierReference::GBufferSamples samples;
+    samples.width = edgeMaskReadback.getWidth();
+    samples.height = edgeMaskReadback.getHeight();
+    samples.sampleCount = SampleCount;
+    size_t sampleTotal = (size_t)samples.width * samples.height * SampleCount;
+    const auto* albedo = albedoReadback.data<std::array<uint8_t, 4>>();
+    const auto* normal = normalReadback.data<std::array<int8_t, 4>>();
+    const float* depth = depthReadback.data<float>();
+    samples.albedo.assign(albedo, albedo + sampleTotal);
+    samples.normal.assign(normal, normal + sampleTotal);
+    samples.depth.assign(depth, depth + sampleTotal);
+
+    MSAAClassifierReference::Result reference = MSAAClassifierReference::classify(samples, checkParams, TileSize);
+
+    uint32_t maskMismatches = 0;
+    const uint8_t* gpuMask = edgeMaskReadback.data<uint8_t>();
+    for (size_t i = 0; i < reference.edgeMask.size(); i++) {
+        if (gpuMask[i] != reference.edgeMask[i])
+            maskMismatches++;
+    }
+
+    // The counts are the threadgroup widths of the two indirect dispatches
+    const auto* arguments = dispatchReadback.data<MTL::DispatchThreadgroupsIndirectArguments>();
+    auto sameTiles = [](const GPUReadback& readback, uint32_t count, std::vector<uint32_t> expected) {
+        if (count != expected.size())
+            return false;
+        std::vector<uint32_t> tiles(readback.data<uint32_t>(), readback.data<uint32_t>() + count);
+        std::sort(tiles.begin(), tiles.end());
+        std::sort(expected.begin(), expected.end());
+        return tiles == expected;
+    };
+    bool simpleMatch = sameTiles(simpleTilesReadback, arguments[0].threadgroupsPerGrid[0], reference.simpleTiles);
+    bool complexMatch = sameTiles(complexTilesReadback, arguments[1].threadgroupsPerGrid[0], reference.complexTiles);
+
+    printf("MSAA classifier reference: %u of %zu edge mask pixels differ, simple tiles %u/%zu %s, complex tiles %u/%zu %s\n",
+           maskMismatches, reference.edgeMask.size(),
+           arguments[0].threadgroupsPerGrid[0], reference.simpleTiles.size(), simpleMatch ? "match" : "differ",
+           arguments[1].threadgroupsPerGrid[0], reference.complexTiles.size(), complexMatch ? "match" : "differ");
+    return maskMismatches == 0 && simpleMatch && complexMatch;
+}
+#endif
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+#include "renderPipeline.hpp"
+#include "gpuProfiler.hpp"
+#include "atmosphere.hpp"
+#include "constantBlocks.hpp"
+#include "resourceRegistry.hpp"
+#if REFERENCE_CHECKS
+#include "gpuReadback.hpp"
+#endif
+#include "../../../data/shaders/shaderTypes.hpp"
+
+// MSAA G-buffer and compute lighting for MSAA_DEFERRED. The G-buffer is rendered
+// with SampleCount samples and stored; msaaClassifyKernel marks edge pixels and
+// builds compacted lists of tiles containing simple and edge pixels, which drive
+// one indirect dispatch each: simple pixels are shaded once, edge pixels per sample.
+class DeferredMSAA {
+public:
+    static constexpr uint32_t SampleCount   = 4;    // Must match MSAASampleCount in msaa_deferred.metal
+    static constexpr uint32_t TileSize      = 8;    // Must match MSAATileSize
+    static constexpr uint32_t RingSize      = 3;
+
+    struct Formats {
+        MTL::PixelFormat albedo;
+        MTL::PixelFormat normal;
+        MTL::PixelFormat depth;
+        MTL::PixelFormat objectId;
+    };
+
+    DeferredMSAA(MTL::Device* device, RenderPipeline& pipelines, GPUProfiler& profiler, const Formats& formats);
+    ~DeferredMSAA();
+
+    static MSAAClassifyParams defaultParams();
+
+    // The old targets and tile lists are retired through resources
+    void resize(uint32_t width, uint32_t height, ResourceRegistry& resources);
+    MTL::RenderPassDescriptor* getGBufferPassDescriptor() const { return gbufferPassDescriptor; }
+
+    // Classifies the stored G-buffer and lights it into output. Sample 0 of depth and
+    // object ID is resolved into the single sample targets used by picking and the
+    // min/max depth pyramid. atmosphere may be null when ATMOSPHERIC_SCATTERING is off.
+    void encodeLighting(MTL::CommandBuffer* commandBuffer, const ConstantBlocks& constants, Atmosphere* atmosphere,
+                        MTL::Texture* output, MTL::Texture* resolvedDepth, MTL::Texture* resolvedObjectId);
+
+    // 1 for pixels shaded per sample, R8Uint
+    MTL::Texture* getEdgeMask() const { return edgeMask; }
+
+#if REFERENCE_CHECKS
+    // Copies the samples, edge mask, tile lists and dispatch counts of the frame whose
+    // lighting was encoded just before
+    void encodeReferenceReadback(MTL::CommandBuffer* commandBuffer);
+    // Once that command buffer has completed, runs MSAAClassifierReference on the copied
+    // samples. The edge mask must match bit for bit and the tile lists as sets, the GPU
+    // appends tiles in any order. Prints the result, returns false on a mismatch.
+    bool checkReference();
+#endif
+
+    MSAAClassifyParams  params;
+
+private:
+    MTL::Device*        device;
+    RenderPipeline&     pipelines;
+    GPUProfiler&        profiler;
+    Formats             formats;
+
+    MTL::RenderPassDescriptor* gbufferPassDescriptor = nullptr;
+
+    MTL::Texture*       albedoTexture = nullptr;
+    MTL::Texture*       normalTexture = nullptr;
+    MTL::Texture*       depthTexture = nullptr;
+    MTL::Texture*       objectIdTexture = nullptr;
+    MTL::Texture*       depthStencilTexture = nullptr;
+
+    // Integer views of the sample data for classification
+    MTL::Texture*       albedoBits = nullptr;
+    MTL::Texture*       normalBits = nullptr;
+
+    MTL::Texture*       edgeMask = nullptr;
+    MTL::Buffer*        simpleTiles = nullptr;
+    MTL::Buffer*        complexTiles = nullptr;
+    uint32_t            tileCountX = 0;
+    uint32_t            tileCountY = 0;
+
+    // Two MTLDispatchThreadgroupsIndirectArguments, reset by the CPU every frame
+    std::array<MTL::Buffer*, RingSize> dispatchBuffers{};
+    uint32_t            ringIndex = 0;
+
+    // Retired through resources, or released at once when null
+    void releaseTargets(ResourceRegistry* resources);
+
+#if REFERENCE_CHECKS
+    MSAAClassifyParams  checkParams;
+    GPUReadback         albedoReadback;
+    GPUReadback         normalReadback;
+    GPUReadback         depthReadback;
+    GPUReadback         edgeMaskReadback;
+    GPUReadback         simpleTilesReadback;
+    GPUReadback         complexTilesReadback;
+    GPUReadback         dispatchReadback;
+#endif
+};
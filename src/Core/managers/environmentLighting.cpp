@@ -0,0 +1,280 @@
+#include "environmentLighting.hpp"
+
+#include <cmath>
+#include "parallel.hpp"
+#include <stb/stb_image.h>
+
+namespace EnvironmentLighting {
+
+namespace {
+
+// Accumulates four samples per call, one per lane, so the nine basis functions
+// are evaluated for four directions at once. Lanes are summed in resolve().
+struct Accumulator {
+    std::array<simd::float4, CoefficientCount> red{};
+    std::array<simd::float4, CoefficientCount> green{};
+    std::array<simd::float4, CoefficientCount> blue{};
+    simd::float4 weightSum = simd::float4{0.0f, 0.0f, 0.0f, 0.0f};
+
+    // Directions must be normalised, lanes with zero weight contribute nothing
+    void add(simd::float4 x, simd::float4 y, simd::float4 z, simd::float4 weight,
+             simd::float4 r, simd::float4 g, simd::float4 b) {
+        simd::float4 basis[CoefficientCount];
+        basis[0] = simd::float4{0.282095f, 0.282095f, 0.282095f, 0.282095f};
+        basis[1] = 0.488603f * y;
+        basis[2] = 0.488603f * z;
+        basis[3] = 0.488603f * x;
+        basis[4] = 1.092548f * x * y;
+        basis[5] = 1.092548f * y * z;
+        basis[6] = 0.315392f * (3.0f * z * z - 1.0f);
+        basis[7] = 1.092548f * x * z;
+        basis[8] = 0.546274f * (x * x - y * y);
+
+        simd::float4 weightedRed = r * weight;
+        simd::float4 weightedGreen = g * weight;
+        simd::float4 weightedBlue = b * weight;
+        for (uint32_t i = 0; i < CoefficientCount; i++) {
+            red[i] += basis[i] * weightedRed;
+            green[i] += basis[i] * weightedGreen;
+            blue[i] += basis[i] * weightedBlue;
+        }
+        weightSum += weight;
+    }
+
+    void merge(const Accumulator& other) {
+        for (uint32_t i = 0; i < CoefficientCount; i++) {
+            red[i] += other.red[i];
+            green[i] += other.green[i];
+            blue[i] += other.blue[i];
+        }
+        weightSum += other.weightSum;
+    }
+
+    // Rescales so the weights integrate to exactly 4pi over the sphere
+    SphericalHarmonicsL2 resolve() const {
+        SphericalHarmonicsL2 result;
+        float totalWeight = simd::reduce_add(weightSum);
+        if (totalWeight <= 0.0f)
+            return result;
+
+        float scale = 4.0f * (float)M_PI / totalWeight;
+        for (uint32_t i = 0; i < CoefficientCount; i++) {
+            result.coefficients[i] = simd::float3{simd::reduce_add(red[i]),
+                                                  simd::reduce_add(green[i]),
+                                                  simd::reduce_add(blue[i])} * scale;
+        }
+        return result;
+    }
+};
+
+// Texel (u, v) in [-1, 1] on a cube face to an unnormalised direction, Metal face orientation
+void faceDirection(uint32_t face, simd::float4 u, simd::float4 v,
+                   simd::float4& x, simd::float4& y, simd::float4& z) {
+    const simd::float4 one = simd::float4{1.0f, 1.0f, 1.0f, 1.0f};
+    switch (face) {
+        case 0: x =  one; y = -v;   z = -u;   break;
+        case 1: x = -one; y = -v;   z =  u;   break;
+        case 2: x =  u;   y =  one; z =  v;   break;
+        case 3: x =  u;   y = -one; z = -v;   break;
+        case 4: x =  u;   y = -v;   z =  one; break;
+        default: x = -u;  y = -v;   z = -one; break;
+    }
+}
+
+Accumulator integrateFace(const CubeMap& cubeMap, uint32_t face) {
+    Accumulator accumulator;
+    const uint32_t size = cubeMap.faceSize;
+    const std::vector<simd::float4>& texels = cubeMap.faces[face];
+    const float texelScale = 2.0f / (float)size;
+
+    for (uint32_t row = 0; row < size; row++) {
+        float v = ((float)row + 0.5f) * texelScale - 1.0f;
+        simd::float4 vv = simd::float4{v, v, v, v};
+
+        for (uint32_t column = 0; column < size; column += 4) {
+            simd::float4 u, r, g, b;
+            simd::float4 valid = simd::float4{0.0f, 0.0f, 0.0f, 0.0f};
+            for (uint32_t lane = 0; lane < 4; lane++) {
+                uint32_t texelColumn = std::min(column + lane, size - 1);
+                const simd::float4& texel = texels[row * size + texelColumn];
+                u[lane] = ((float)texelColumn + 0.5f) * texelScale - 1.0f;
+                r[lane] = texel.x;
+                g[lane] = texel.y;
+                b[lane] = texel.z;
+                valid[lane] = column + lane < size ? 1.0f : 0.0f;
+            }
+
+            simd::float4 x, y, z;
+            faceDirection(face, u, vv, x, y, z);
+
+            // Solid angle of a texel is proportional to (1 + u^2 + v^2)^(-3/2)
+            simd::float4 inverseLength = simd::rsqrt(x * x + y * y + z * z);
+            simd::float4 weight = inverseLength * inverseLength * inverseLength * valid;
+            accumulator.add(x * inverseLength, y * inverseLength, z * inverseLength, weight, r, g, b);
+        }
+    }
+    return accumulator;
+}
+
+simd::float3 skyColor(simd::float3 direction, simd::float3 sunDirection, simd::float3 zenithColor,
+                      simd::float3 horizonColor, simd::float3 groundColor, simd::float3 sunColor) {
+    simd::float3 color;
+    if (direction.y >= 0.0f) {
+        float t = std::sqrt(direction.y);
+        color = horizonColor * (1.0f - t) + zenithColor * t;
+    } else {
+        float t = std::min(-direction.y * 4.0f, 1.0f);
+        color = horizonColor * (1.0f - t) + groundColor * t;
+    }
+    float sunAmount = std::max(simd::dot(direction, sunDirection), 0.0f);
+    return color + sunColor * std::pow(sunAmount, 256.0f);
+}
+
+}
+
+SphericalHarmonicsL2 projectCubeMap(const CubeMap& cubeMap) {
+    std::array<Accumulator, 6> faceResults;
+    parallelFor(6, 0, 1, [&](uint32_t face) {
+        faceResults[face] = integrateFace(cubeMap, face);
+    });
+
+    Accumulator total;
+    for (const auto& result : faceResults) {
+        total.merge(result);
+    }
+    return total.resolve();
+}
+
+SphericalHarmonicsL2 projectEquirectangular(const float* rgba, uint32_t width, uint32_t height) {
+    // Longitude only depends on the column, shared by every row
+    std::vector<float> cosPhi(width), sinPhi(width);
+    for (uint32_t column = 0; column < width; column++) {
+        float phi = 2.0f * (float)M_PI * ((float)column + 0.5f) / (float)width;
+        cosPhi[column] = std::cos(phi);
+        sinPhi[column] = std::sin(phi);
+    }
+
+    // Rows are summed in fixed blocks and the blocks merged in order, so the result does not
+    // depend on how many threads the budget hands out
+    const uint32_t rowsPerBlock = 16;
+    uint32_t blockCount = (height + rowsPerBlock - 1) / rowsPerBlock;
+    std::vector<Accumulator> results(blockCount);
+
+    parallelFor(blockCount, 0, 1, [&](uint32_t block) {
+        Accumulator& accumulator = results[block];
+        uint32_t firstRow = block * rowsPerBlock;
+        uint32_t lastRow = std::min(firstRow + rowsPerBlock, height);
+
+        for (uint32_t row = firstRow; row < lastRow; row++) {
+            // Direction is (sin theta cos phi, cos theta, sin theta sin phi), y up
+            float theta = (float)M_PI * ((float)row + 0.5f) / (float)height;
+            float sinTheta = std::sin(theta);
+            float cosTheta = std::cos(theta);
+            simd::float4 y = simd::float4{cosTheta, cosTheta, cosTheta, cosTheta};
+
+            for (uint32_t column = 0; column < width; column += 4) {
+                simd::float4 x, z, weight, r, g, b;
+                for (uint32_t lane = 0; lane < 4; lane++) {
+                    uint32_t texelColumn = std::min(column + lane, width - 1);
+                    const float* texel = rgba + ((size_t)row * width + texelColumn) * 4;
+                    x[lane] = sinTheta * cosPhi[texelColumn];
+                    z[lane] = sinTheta * sinPhi[texelColumn];
+                    weight[lane] = column + lane < width ? sinTheta : 0.0f;
+                    r[lane] = texel[0];
+                    g[lane] = texel[1];
+                    b[lane] = texel[2];
+                }
+                accumulator.add(x, y, z, weight, r, g, b);
+            }
+        }
+    });
+
+    Accumulator total;
+    for (const auto& result : results) {
+        total.merge(result);
+    }
+    return total.resolve();
+}
+
+bool loadEquirectangular(const std::string& path, SphericalHarmonicsL2& result) {
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load(false);
+    float* image = stbi_loadf(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if (!image) {
+        std::cerr << "Failed to load environment map " << path << ": " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+
+    result = projectEquirectangular(image, (uint32_t)width, (uint32_t)height);
+    stbi_image_free(image);
+    return true;
+}
+
+CubeMap readCubeTexture(MTL::Texture* texture) {
+    assert(texture->textureType() == MTL::TextureTypeCube);
+    assert(texture->pixelFormat() == MTL::PixelFormatRGBA16Float || texture->pixelFormat() == MTL::PixelFormatRGBA32Float);
+
+    CubeMap cubeMap;
+    cubeMap.faceSize = (uint32_t)texture->width();
+    const uint32_t texelCount = cubeMap.faceSize * cubeMap.faceSize;
+    const MTL::Region region = MTL::Region(0, 0, cubeMap.faceSize, cubeMap.faceSize);
+    const bool halfFloat = texture->pixelFormat() == MTL::PixelFormatRGBA16Float;
+
+    std::vector<__fp16> halfTexels(halfFloat ? texelCount * 4 : 0);
+    for (uint32_t face = 0; face < 6; face++) {
+        std::vector<simd::float4>& texels = cubeMap.faces[face];
+        texels.resize(texelCount);
+
+        if (halfFloat) {
+            texture->getBytes(halfTexels.data(), cubeMap.faceSize * 4 * sizeof(__fp16), texelCount * 4 * sizeof(__fp16), region, 0, face);
+            for (uint32_t i = 0; i < texelCount; i++) {
+                texels[i] = simd::float4{halfTexels[i * 4], halfTexels[i * 4 + 1], halfTexels[i * 4 + 2], halfTexels[i * 4 + 3]};
+            }
+        } else {
+            texture->getBytes(texels.data(), cubeMap.faceSize * sizeof(simd::float4), texelCount * sizeof(simd::float4), region, 0, face);
+        }
+    }
+    return cubeMap;
+}
+
+CubeMap proceduralSky(uint32_t faceSize, simd::float3 sunDirection, simd::float3 zenithColor,
+                      simd::float3 horizonColor, simd::float3 groundColor, simd::float3 sunColor) {
+    CubeMap cubeMap;
+    cubeMap.faceSize = faceSize;
+    sunDirection = simd::normalize(sunDirection);
+    const float texelScale = 2.0f / (float)faceSize;
+
+    for (uint32_t face = 0; face < 6; face++) {
+        std::vector<simd::float4>& texels = cubeMap.faces[face];
+        texels.resize(faceSize * faceSize);
+
+        for (uint32_t row = 0; row < faceSize; row++) {
+            float v = ((float)row + 0.5f) * texelScale - 1.0f;
+            for (uint32_t column = 0; column < faceSize; column++) {
+                float u = ((float)column + 0.5f) * texelScale - 1.0f;
+                simd::float4 x, y, z;
+                faceDirection(face, simd::float4{u, u, u, u}, simd::float4{v, v, v, v}, x, y, z);
+
+                simd::float3 direction = simd::normalize(simd::float3{x[0], y[0], z[0]});
+                simd::float3 color = skyColor(direction, sunDirection, zenithColor, horizonColor, groundColor, sunColor);
+                texels[row * faceSize + column] = simd::float4{color.x, color.y, color.z, 1.0f};
+            }
+        }
+    }
+    return cubeMap;
+}
+
+void toIrradiance(const SphericalHarmonicsL2& radiance, simd::float4* output) {
+    // Clamped cosine lobe per band (pi, 2pi/3, pi/4) divided by pi for a Lambertian surface
+    const float bandScale[CoefficientCount] = {
+        1.0f,
+        2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f,
+        0.25f, 0.25f, 0.25f, 0.25f, 0.25f
+    };
+    for (uint32_t i = 0; i < CoefficientCount; i++) {
+        simd::float3 coefficient = radiance.coefficients[i] * bandScale[i];
+        output[i] = simd::float4{coefficient.x, coefficient.y, coefficient.z, 0.0f};
+    }
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+#include <simd/simd.h>
+
+// Diffuse environment lighting through order 2 (L2) spherical harmonics.
+// Environment maps and probe captures are projected on the CPU, the cosine
+// convolved result is uploaded as nine rgb coefficients in FrameConstants and
+// evaluated per pixel in the deferred lighting pass.
+namespace EnvironmentLighting {
+    constexpr uint32_t CoefficientCount = 9;
+
+    // Radiance projection, rgb per coefficient
+    struct SphericalHarmonicsL2 {
+        std::array<simd::float3, CoefficientCount> coefficients{};
+    };
+
+    // Faces in Metal order: +X, -X, +Y, -Y, +Z, -Z, rgba texels row major
+    struct CubeMap {
+        uint32_t                                faceSize = 0;
+        std::array<std::vector<simd::float4>, 6> faces;
+    };
+
+    // Faces are integrated in parallel on threads from the caller's budget
+    SphericalHarmonicsL2 projectCubeMap(const CubeMap& cubeMap);
+    // Blocks of rows are integrated in parallel on threads from the caller's budget
+    SphericalHarmonicsL2 projectEquirectangular(const float* rgba, uint32_t width, uint32_t height);
+
+    // Radiance .hdr file in lat-long layout, returns false if it can't be read
+    bool loadEquirectangular(const std::string& path, SphericalHarmonicsL2& result);
+
+    // Copies a probe capture back to the CPU, the cube texture must be RGBA16Float or
+    // RGBA32Float in shared or managed storage and already synchronised
+    CubeMap readCubeTexture(MTL::Texture* texture);
+
+    // Sky gradient with a sun disc, used when no environment map is available
+    CubeMap proceduralSky(uint32_t faceSize, simd::float3 sunDirection, simd::float3 zenithColor,
+                          simd::float3 horizonColor, simd::float3 groundColor, simd::float3 sunColor);
+
+    // Applies the clamped cosine lobe and the Lambert 1/pi so the shader evaluates
+    // albedo * sum(c_i * Y_i(n)) directly
+    void toIrradiance(const SphericalHarmonicsL2& radiance, simd::float4* output);
+}
@@ -0,0 +1,49 @@
+#include "frameArena.hpp"
+
+static size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+FrameArena::FrameArena(size_t capacity) : capacity(alignUp(capacity, Alignment)) {
+    block = static_cast<uint8_t*>(::operator new(this->capacity, std::align_val_t(Alignment)));
+    overflow.reserve(16);
+}
+
+FrameArena::~FrameArena() {
+    for (void* chunk : overflow) {
+        ::operator delete(chunk, std::align_val_t(Alignment));
+    }
+    ::operator delete(block, std::align_val_t(Alignment));
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment) {
+    size_t start = alignUp(offset, alignment);
+    if (start + size <= capacity) {
+        offset = start + size;
+        highWater = std::max(highWater, offset + overflowBytes);
+        return block + start;
+    }
+
+    // Out of space this frame, the block is grown on the next reset
+    size_t chunkSize = size + alignment;
+    void* chunk = ::operator new(chunkSize, std::align_val_t(Alignment));
+    overflow.push_back(chunk);
+    overflowBytes += alignUp(chunkSize, Alignment);
+    highWater = std::max(highWater, offset + overflowBytes);
+    return reinterpret_cast<void*>(alignUp(reinterpret_cast<uintptr_t>(chunk), alignment));
+}
+
+void FrameArena::reset() {
+    for (void* chunk : overflow) {
+        ::operator delete(chunk, std::align_val_t(Alignment));
+    }
+    overflow.clear();
+
+    if (highWater > capacity) {
+        ::operator delete(block, std::align_val_t(Alignment));
+        capacity = alignUp(highWater + highWater / 2, Alignment);
+        block = static_cast<uint8_t*>(::operator new(capacity, std::align_val_t(Alignment)));
+    }
+    offset = 0;
+    overflowBytes = 0;
+}
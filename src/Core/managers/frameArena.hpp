@@ -0,0 +1,44 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <span>
+#include <type_traits>
+
+// Linear allocator for CPU temporaries that live for one frame. Allocations bump a
+// pointer and are never freed individually; reset() at the start of the frame gives
+// the whole block back. Requests that do not fit go to overflow chunks, and the next
+// reset grows the block to the frame's high water mark, so after warmup a frame does
+// not touch the heap. Only trivially destructible types are handed out.
+class FrameArena {
+public:
+    static constexpr size_t Alignment = 16;
+
+    explicit FrameArena(size_t capacity = 64 * 1024);
+    ~FrameArena();
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void* allocate(size_t size, size_t alignment = Alignment);
+
+    // Uninitialised storage for count elements
+    template<typename T>
+    std::span<T> allocate(size_t count) {
+        static_assert(std::is_trivially_destructible_v<T>, "FrameArena never runs destructors");
+        return {static_cast<T*>(allocate(sizeof(T) * count, std::max(alignof(T), Alignment))), count};
+    }
+
+    void reset();
+
+    size_t getCapacity() const { return capacity; }
+    size_t getHighWater() const { return highWater; }
+
+private:
+    uint8_t*            block = nullptr;
+    size_t              capacity = 0;
+    size_t              offset = 0;
+    size_t              overflowBytes = 0;
+    size_t              highWater = 0;
+    std::vector<void*>  overflow;
+};
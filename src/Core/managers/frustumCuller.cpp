@@ -0,0 +1,155 @@
+#include "frustumCuller.hpp"
+
+#include <thread>
+
+void FrustumCuller::clearInstances() {
+    blocks.clear();
+    instanceCount = 0;
+}
+
+uint32_t FrustumCuller::addInstance(simd::float3 boundsMin, simd::float3 boundsMax, uint32_t flags) {
+    uint32_t lane = instanceCount % 4;
+    if (lane == 0) {
+        // Padding lanes have no flags and an inverted box, they never reach a list
+        InstanceBlock block{};
+        block.extentX = block.extentY = block.extentZ = simd::float4{-1.0f, -1.0f, -1.0f, -1.0f};
+        blocks.push_back(block);
+    }
+
+    simd::float3 center = (boundsMin + boundsMax) * 0.5f;
+    simd::float3 extent = (boundsMax - boundsMin) * 0.5f;
+
+    InstanceBlock& block = blocks.back();
+    block.centerX[lane] = center.x;
+    block.centerY[lane] = center.y;
+    block.centerZ[lane] = center.z;
+    block.extentX[lane] = extent.x;
+    block.extentY[lane] = extent.y;
+    block.extentZ[lane] = extent.z;
+    block.flags[lane] = flags;
+
+    return instanceCount++;
+}
+
+FrustumCuller::ViewPlanes FrustumCuller::extractPlanes(const View& view) {
+    // Rows of the column major matrix
+    simd::float4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = simd::float4{view.viewProjection.columns[0][i], view.viewProjection.columns[1][i],
+                               view.viewProjection.columns[2][i], view.viewProjection.columns[3][i]};
+    }
+
+    ViewPlanes result{};
+    result.flags = view.flags;
+    result.planes[result.planeCount++] = rows[3] + rows[0];    // Left
+    result.planes[result.planeCount++] = rows[3] - rows[0];    // Right
+    result.planes[result.planeCount++] = rows[3] + rows[1];    // Bottom
+    result.planes[result.planeCount++] = rows[3] - rows[1];    // Top
+    result.planes[result.planeCount++] = rows[3] - rows[2];    // Far
+    if (!(view.flags & ViewFlagNoNearPlane)) {
+        result.planes[result.planeCount++] = rows[2];          // Near, z >= 0
+    }
+    return result;
+}
+
+void FrustumCuller::testBlocks(std::span<const ViewPlanes> views, size_t firstBlock, size_t lastBlock) {
+    for (size_t b = firstBlock; b < lastBlock; b++) {
+        const InstanceBlock& block = blocks[b];
+        simd::uint4 blockMasks = simd::uint4{0, 0, 0, 0};
+
+        // Four bits of the candidate set, blocks never straddle a word
+        simd::int4 candidate = simd::int4{-1, -1, -1, -1};
+        if (!candidates.empty()) {
+            uint32_t bits = (uint32_t)(candidates[b / 16] >> ((b % 16) * 4)) & 0xF;
+            candidate = (simd::uint4{bits, bits, bits, bits} & simd::uint4{1, 2, 4, 8}) != 0;
+        }
+
+        for (uint32_t v = 0; v < views.size(); v++) {
+            const ViewPlanes& view = views[v];
+
+            // Padding lanes fail the extent test below, real boxes have extents >= 0
+            simd::int4 inside = block.extentX >= 0.0f;
+            if (view.flags & ViewFlagShadowCasters) {
+                inside &= (block.flags & InstanceFlagCastsShadow) != 0;
+            }
+            if (view.flags & ViewFlagCandidatesOnly) {
+                inside &= candidate;
+                if (!simd::any(inside))
+                    continue;
+            }
+
+            for (uint32_t p = 0; p < view.planeCount; p++) {
+                simd::float4 plane = view.planes[p];
+                simd::float4 distance = plane.x * block.centerX + plane.y * block.centerY + plane.z * block.centerZ + plane.w;
+                simd::float4 radius = std::abs(plane.x) * block.extentX + std::abs(plane.y) * block.extentY + std::abs(plane.z) * block.extentZ;
+                inside &= distance + radius >= 0.0f;
+            }
+            blockMasks |= (simd::uint4)inside & (1u << v);
+        }
+
+        std::memcpy(&masks[b * 4], &blockMasks, sizeof(blockMasks));
+    }
+}
+
+void FrustumCuller::cull(std::span<const View> views, FrameArena& arena) {
+    assert(views.size() <= MaxViews && "Too many views for the visibility mask");
+
+    std::span<ViewPlanes> viewPlanes = arena.allocate<ViewPlanes>(views.size());
+    for (size_t v = 0; v < views.size(); v++) {
+        viewPlanes[v] = extractPlanes(views[v]);
+    }
+
+    masks.resize(blocks.size() * 4);
+    visibleLists.resize(views.size());
+    // Room for every instance, the resize below never allocates once the instances are in
+    for (auto& list : visibleLists) {
+        list.reserve(instanceCount);
+    }
+
+    uint32_t workerCount = std::clamp(instanceCount / MinInstancesPerWorker, 1u, std::max(std::thread::hardware_concurrency(), 1u));
+    size_t blocksPerWorker = (blocks.size() + workerCount - 1) / workerCount;
+    workerCounts.assign(workerCount, {});
+
+    auto blockRange = [&](uint32_t worker) {
+        size_t first = std::min(worker * blocksPerWorker, blocks.size());
+        return std::make_pair(first, std::min(first + blocksPerWorker, blocks.size()));
+    };
+
+    // Masks and per worker counts
+    auto testWork = [&](uint32_t worker) {
+        auto [first, last] = blockRange(worker);
+        testBlocks(viewPlanes, first, last);
+
+        auto& counts = workerCounts[worker];
+        for (size_t i = first * 4; i < std::min<size_t>(last * 4, instanceCount); i++) {
+            for (uint32_t mask = masks[i]; mask; mask &= mask - 1) {
+                counts[__builtin_ctz(mask)]++;
+            }
+        }
+    };
+    workers.run(workerCount, testWork);
+
+    // Exclusive prefix sum over the workers turns counts into write offsets
+    for (uint32_t v = 0; v < views.size(); v++) {
+        uint32_t offset = 0;
+        for (auto& counts : workerCounts) {
+            uint32_t count = counts[v];
+            counts[v] = offset;
+            offset += count;
+        }
+        visibleLists[v].resize(offset);
+    }
+
+    // Compaction, every worker writes its own range of each list
+    auto compactWork = [&](uint32_t worker) {
+        auto [first, last] = blockRange(worker);
+        auto& offsets = workerCounts[worker];
+        for (size_t i = first * 4; i < std::min<size_t>(last * 4, instanceCount); i++) {
+            for (uint32_t mask = masks[i]; mask; mask &= mask - 1) {
+                uint32_t view = __builtin_ctz(mask);
+                visibleLists[view][offsets[view]++] = (uint32_t)i;
+            }
+        }
+    };
+    workers.run(workerCount, compactWork);
+}
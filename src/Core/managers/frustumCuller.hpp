@@ -0,0 +1,81 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+#include <span>
+#include "frameArena.hpp"
+#include "workerPool.hpp"
+
+// Culls every instance against every registered view in one pass. Instance bounds
+// are stored four to a block, structure of arrays, so one plane test covers four
+// instances; each instance gets a bitmask with one bit per visible view. Per view
+// lists are then compacted from the masks in parallel with a prefix sum over the
+// workers' counts, so the lists stay in instance order whatever the thread count. The
+// workers are the culler's own pool, started once and parked between culls.
+class FrustumCuller {
+public:
+    static constexpr uint32_t MaxViews              = 32;   // Bits of a visibility mask
+    static constexpr uint32_t MinInstancesPerWorker = 2048; // Below this one thread does everything
+
+    enum ViewFlags : uint32_t {
+        ViewFlagNone            = 0,
+        ViewFlagNoNearPlane     = 1 << 0,   // Shadow cascades keep casters between the light and the near plane
+        ViewFlagShadowCasters   = 1 << 1,   // Only instances with InstanceFlagCastsShadow
+        ViewFlagCandidatesOnly  = 1 << 2    // Only instances in the candidate set, see setCandidates
+    };
+
+    enum InstanceFlags : uint32_t {
+        InstanceFlagNone        = 0,
+        InstanceFlagCastsShadow = 1 << 0
+    };
+
+    struct View {
+        simd::float4x4  viewProjection;     // Metal clip space, z in [0, w]
+        uint32_t        flags = ViewFlagNone;
+    };
+
+    void clearInstances();
+    // World space AABB, returns the instance index used in the visibility lists
+    uint32_t addInstance(simd::float3 boundsMin, simd::float3 boundsMax, uint32_t flags = InstanceFlagCastsShadow);
+    uint32_t getInstanceCount() const { return instanceCount; }
+
+    // One bit per instance, e.g. the potentially visible set of the camera's cell. The
+    // bits are not copied and must outlive the next cull(). Empty makes every instance
+    // a candidate.
+    void setCandidates(std::span<const uint64_t> bits) { candidates = bits; }
+
+    // Plane sets for the views are taken from arena
+    void cull(std::span<const View> views, FrameArena& arena);
+
+    // Results of the last cull()
+    const std::vector<uint32_t>& getVisibleInstances(uint32_t view) const { return visibleLists[view]; }
+    uint32_t getVisibilityMask(uint32_t instance) const { return masks[instance]; }
+
+private:
+    struct InstanceBlock {
+        simd::float4    centerX, centerY, centerZ;
+        simd::float4    extentX, extentY, extentZ;
+        simd::uint4     flags;
+    };
+
+    struct ViewPlanes {
+        simd::float4    planes[6];          // xyz normal, w distance, inside when positive
+        uint32_t        planeCount;
+        uint32_t        flags;
+    };
+
+    std::vector<InstanceBlock>          blocks;
+    uint32_t                            instanceCount = 0;
+    std::span<const uint64_t>           candidates;
+
+    std::vector<uint32_t>               masks;          // One per instance, padded to the block size
+    std::vector<std::vector<uint32_t>>  visibleLists;
+
+    // Visible count per worker and view, then the worker's write offset into each list
+    std::vector<std::array<uint32_t, MaxViews>> workerCounts;
+    WorkerPool                          workers;
+
+    static ViewPlanes extractPlanes(const View& view);
+    void testBlocks(std::span<const ViewPlanes> views, size_t firstBlock, size_t lastBlock);
+};
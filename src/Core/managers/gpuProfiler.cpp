@@ -0,0 +1,187 @@
+#include "gpuProfiler.hpp"
+
+#include <mach/mach_time.h>
+#include <Block.h>
+
+GPUProfiler::GPUProfiler(MTL::Device* device) : device(device) {
+    plainComputePass = MTL::ComputePassDescriptor::alloc()->init();
+    timings.reserve(MaxScopesPerFrame);
+
+    // Resolves a slot's samples on completion. Copied to the heap once, not per frame.
+    for (auto& slot : slots) {
+        Slot* slotPointer = &slot;
+        slot.completedHandler = Block_copy(^(MTL::CommandBuffer*) {
+            resolveSlot(*slotPointer);
+        });
+    }
+
+    MTL::CounterSet* timestampSet = findTimestampCounterSet();
+    supported = timestampSet && device->supportsCounterSampling(MTL::CounterSamplingPointAtStageBoundary);
+    if (!supported) {
+        printf("GPU profiler: stage boundary timestamps unsupported on %s\n", device->name()->utf8String());
+        return;
+    }
+
+    MTL::CounterSampleBufferDescriptor* descriptor = MTL::CounterSampleBufferDescriptor::alloc()->init();
+    descriptor->setCounterSet(timestampSet);
+    descriptor->setStorageMode(MTL::StorageModeShared);
+    descriptor->setSampleCount(MaxScopesPerFrame * 2);
+
+    for (auto& slot : slots) {
+        NS::Error* error = nullptr;
+        slot.sampleBuffer = device->newCounterSampleBuffer(descriptor, &error);
+        if (!slot.sampleBuffer) {
+            fprintf(stderr, "GPU profiler: failed to create sample buffer: %s\n",
+                    error ? error->localizedDescription()->utf8String() : "unknown error");
+            supported = false;
+            break;
+        }
+
+        // Descriptors are created once, each scope owns a start/end sample pair
+        for (uint32_t i = 0; i < MaxScopesPerFrame; i++) {
+            MTL::ComputePassDescriptor* pass = MTL::ComputePassDescriptor::alloc()->init();
+            MTL::ComputePassSampleBufferAttachmentDescriptor* attachment = pass->sampleBufferAttachments()->object(0);
+            attachment->setSampleBuffer(slot.sampleBuffer);
+            attachment->setStartOfEncoderSampleIndex(i * 2);
+            attachment->setEndOfEncoderSampleIndex(i * 2 + 1);
+            slot.computePasses[i] = pass;
+        }
+    }
+    descriptor->release();
+
+    device->sampleTimestamps(&calibrationCPU, &calibrationGPU);
+}
+
+GPUProfiler::~GPUProfiler() {
+    for (auto& slot : slots) {
+        for (auto* pass : slot.computePasses) {
+            if (pass) pass->release();
+        }
+        if (slot.sampleBuffer) slot.sampleBuffer->release();
+        Block_release(slot.completedHandler);
+    }
+    plainComputePass->release();
+}
+
+MTL::CounterSet* GPUProfiler::findTimestampCounterSet() const {
+    NS::Array* counterSets = device->counterSets();
+    if (!counterSets)
+        return nullptr;
+
+    for (NS::UInteger i = 0; i < counterSets->count(); i++) {
+        MTL::CounterSet* counterSet = counterSets->object<MTL::CounterSet>(i);
+        if (counterSet->name()->isEqualToString(MTL::CommonCounterSetTimestamp)) {
+            return counterSet;
+        }
+    }
+    return nullptr;
+}
+
+void GPUProfiler::calibrate() {
+    MTL::Timestamp cpu, gpu;
+    device->sampleTimestamps(&cpu, &gpu);
+    if (gpu <= calibrationGPU || cpu <= calibrationCPU)
+        return;
+
+    // CPU timestamps are mach absolute time
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    double cpuNanoseconds = double(cpu - calibrationCPU) * timebase.numer / timebase.denom;
+    gpuTicksToNanoseconds = cpuNanoseconds / double(gpu - calibrationGPU);
+}
+
+void GPUProfiler::beginFrame() {
+    recording = false;
+    if (!supported)
+        return;
+
+    slotIndex = (slotIndex + 1) % RingSize;
+    Slot& slot = slots[slotIndex];
+    if (slot.inFlight.load(std::memory_order_acquire))
+        return;
+
+    // Results of the previous use of this slot are dropped if nobody read them
+    slot.resolved.store(false, std::memory_order_relaxed);
+    slot.scopeCount = 0;
+    recording = true;
+}
+
+MTL::ComputePassDescriptor* GPUProfiler::computePassDescriptor(const char* name) {
+    Slot& slot = slots[slotIndex];
+    if (!recording || slot.scopeCount == MaxScopesPerFrame)
+        return plainComputePass;
+
+    uint32_t scope = slot.scopeCount++;
+    slot.names[scope] = name;
+    return slot.computePasses[scope];
+}
+
+void GPUProfiler::attachRenderPass(MTL::RenderPassDescriptor* descriptor, const char* name) {
+    MTL::RenderPassSampleBufferAttachmentDescriptor* attachment = descriptor->sampleBufferAttachments()->object(0);
+
+    Slot& slot = slots[slotIndex];
+    if (!recording || slot.scopeCount == MaxScopesPerFrame) {
+        attachment->setSampleBuffer(nullptr);
+        return;
+    }
+
+    // The scope spans from the start of vertex work to the end of fragment work
+    uint32_t scope = slot.scopeCount++;
+    slot.names[scope] = name;
+    attachment->setSampleBuffer(slot.sampleBuffer);
+    attachment->setStartOfVertexSampleIndex(scope * 2);
+    attachment->setEndOfVertexSampleIndex(MTL::CounterDontSample);
+    attachment->setStartOfFragmentSampleIndex(MTL::CounterDontSample);
+    attachment->setEndOfFragmentSampleIndex(scope * 2 + 1);
+}
+
+void GPUProfiler::endFrame(MTL::CommandBuffer* commandBuffer) {
+    if (!recording)
+        return;
+    recording = false;
+
+    Slot* slot = &slots[slotIndex];
+    if (slot->scopeCount == 0)
+        return;
+
+    slot->inFlight.store(true, std::memory_order_relaxed);
+    commandBuffer->addCompletedHandler(slot->completedHandler);
+}
+
+void GPUProfiler::resolveSlot(Slot& slot) {
+    NS::AutoreleasePool* pool = NS::AutoreleasePool::alloc()->init();
+
+    NS::Data* data = slot.sampleBuffer->resolveCounterRange(NS::Range(0, slot.scopeCount * 2));
+    if (data) {
+        const MTL::CounterResultTimestamp* samples = reinterpret_cast<const MTL::CounterResultTimestamp*>(data->mutableBytes());
+        for (uint32_t i = 0; i < slot.scopeCount * 2; i++) {
+            slot.timestamps[i] = samples[i].timestamp;
+        }
+        slot.resolved.store(true, std::memory_order_release);
+    }
+
+    pool->release();
+    slot.inFlight.store(false, std::memory_order_release);
+}
+
+const std::vector<GPUProfiler::ScopeTiming>& GPUProfiler::getTimings() {
+    // Publish the newest resolved slot and drop any older ones
+    bool published = false;
+    for (uint32_t offset = 0; offset < RingSize; offset++) {
+        Slot& slot = slots[(slotIndex + RingSize - offset) % RingSize];
+        if (!slot.resolved.exchange(false, std::memory_order_acquire) || published)
+            continue;
+
+        published = true;
+        calibrate();
+        timings.clear();
+        for (uint32_t i = 0; i < slot.scopeCount; i++) {
+            uint64_t start = slot.timestamps[i * 2];
+            uint64_t end = slot.timestamps[i * 2 + 1];
+            if (start == MTL::CounterErrorValue || end == MTL::CounterErrorValue || end < start)
+                continue;
+            timings.push_back({slot.names[i], double(end - start) * gpuTicksToNanoseconds * 1e-6});
+        }
+    }
+    return timings;
+}
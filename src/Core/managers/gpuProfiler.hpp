@@ -0,0 +1,65 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+
+// Measures GPU time per encoder with stage boundary timestamp counters. Every scope
+// gets its own pass descriptor carrying the sample buffer attachment, results are
+// resolved in the command buffer completion handler and never stall the CPU.
+class GPUProfiler {
+public:
+    struct ScopeTiming {
+        const char* name;
+        double      milliseconds;
+    };
+
+    static constexpr uint32_t MaxScopesPerFrame = 16;
+    static constexpr uint32_t RingSize          = 3;
+
+    GPUProfiler(MTL::Device* device);
+    ~GPUProfiler();
+
+    bool isSupported() const { return supported; }
+
+    void beginFrame();
+    // Scope names must outlive the frame, string literals are expected
+    MTL::ComputePassDescriptor* computePassDescriptor(const char* name);
+    void attachRenderPass(MTL::RenderPassDescriptor* descriptor, const char* name);
+    void endFrame(MTL::CommandBuffer* commandBuffer);
+
+    // Most recently resolved frame
+    const std::vector<ScopeTiming>& getTimings();
+
+private:
+    struct Slot {
+        MTL::CounterSampleBuffer*                               sampleBuffer = nullptr;
+        std::array<MTL::ComputePassDescriptor*, MaxScopesPerFrame> computePasses{};
+        std::array<const char*, MaxScopesPerFrame>              names{};
+        std::array<uint64_t, MaxScopesPerFrame * 2>             timestamps{};
+        uint32_t                                                scopeCount = 0;
+        std::atomic<bool>                                       inFlight{false};
+        std::atomic<bool>                                       resolved{false};
+        MTL::CommandBufferHandler                               completedHandler = nullptr;
+    };
+
+    MTL::Device*                    device;
+    bool                            supported = false;
+    std::array<Slot, RingSize>      slots;
+    uint32_t                        slotIndex = 0;
+    bool                            recording = false;
+
+    // Used when counters are unsupported or every slot is still in flight
+    MTL::ComputePassDescriptor*     plainComputePass = nullptr;
+
+    // GPU to CPU timestamp calibration
+    MTL::Timestamp                  calibrationCPU = 0;
+    MTL::Timestamp                  calibrationGPU = 0;
+    double                          gpuTicksToNanoseconds = 1.0;
+
+    std::vector<ScopeTiming>        timings;
+
+    MTL::CounterSet* findTimestampCounterSet() const;
+    static void resolveSlot(Slot& slot);
+    void calibrate();
+};
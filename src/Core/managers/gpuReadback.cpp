@@ -0,0 +1,46 @@
+#include "gpuReadback.hpp"
+
+GPUReadback::~GPUReadback() {
+    if (buffer) {
+        buffer->release();
+    }
+}
+
+void GPUReadback::allocate(MTL::Device* device, size_t length) {
+    if (buffer) {
+        buffer->release();
+    }
+    buffer = device->newBuffer(std::max<size_t>(length, 1), MTL::ResourceStorageModeShared);
+    buffer->setLabel(NS::String::string("Reference Check Readback", NS::ASCIIStringEncoding));
+}
+
+void GPUReadback::copyTexture(MTL::CommandBuffer* commandBuffer, MTL::Texture* texture, uint32_t bytesPerPixel, uint32_t level) {
+    width = std::max((uint32_t)texture->width() >> level, 1u);
+    height = std::max((uint32_t)texture->height() >> level, 1u);
+    size_t bytesPerRow = (size_t)width * bytesPerPixel;
+    allocate(texture->device(), bytesPerRow * height);
+
+    MTL::BlitCommandEncoder* blitEncoder = commandBuffer->blitCommandEncoder();
+    blitEncoder->setLabel(NS::String::string("Reference Check Readback", NS::ASCIIStringEncoding));
+    blitEncoder->copyFromTexture(texture, 0, level, MTL::Origin(0, 0, 0), MTL::Size(width, height, 1),
+                                 buffer, 0, bytesPerRow, bytesPerRow * height);
+    blitEncoder->endEncoding();
+}
+
+void GPUReadback::copyBuffer(MTL::CommandBuffer* commandBuffer, MTL::Buffer* source, size_t offset, size_t length) {
+    width = (uint32_t)length;
+    height = 1;
+    allocate(source->device(), length);
+
+    MTL::BlitCommandEncoder* blitEncoder = commandBuffer->blitCommandEncoder();
+    blitEncoder->setLabel(NS::String::string("Reference Check Readback", NS::ASCIIStringEncoding));
+    blitEncoder->copyFromBuffer(source, offset, buffer, 0, length);
+    blitEncoder->endEncoding();
+}
+
+MTL::Buffer* GPUReadback::target(MTL::Device* device, uint32_t width, uint32_t height, size_t elementSize) {
+    this->width = width;
+    this->height = height;
+    allocate(device, (size_t)width * height * elementSize);
+    return buffer;
+}
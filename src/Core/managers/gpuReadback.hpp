@@ -0,0 +1,38 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+
+// Shared buffer copy of one texture level or buffer range, used by the reference checks
+// to compare GPU results with their CPU versions. The copy is encoded into a command
+// buffer and may only be read once that command buffer has completed.
+class GPUReadback {
+public:
+    GPUReadback() = default;
+    ~GPUReadback();
+
+    GPUReadback(const GPUReadback&) = delete;
+    GPUReadback& operator=(const GPUReadback&) = delete;
+
+    // Rows are tightly packed, bytesPerPixel must match the texture's format
+    void copyTexture(MTL::CommandBuffer* commandBuffer, MTL::Texture* texture, uint32_t bytesPerPixel, uint32_t level = 0);
+    void copyBuffer(MTL::CommandBuffer* commandBuffer, MTL::Buffer* source, size_t offset, size_t length);
+    // For data a blit cannot copy, multisample textures or threadgroup memory: returns
+    // the shared buffer for a kernel to write width * height elements of elementSize into
+    MTL::Buffer* target(MTL::Device* device, uint32_t width, uint32_t height, size_t elementSize);
+
+    template<typename T>
+    const T* data() const { return static_cast<const T*>(buffer->contents()); }
+
+    uint32_t getWidth() const { return width; }
+    uint32_t getHeight() const { return height; }
+    bool isEmpty() const { return buffer == nullptr; }
+
+private:
+    MTL::Buffer*    buffer = nullptr;
+    uint32_t        width = 0;
+    uint32_t        height = 0;
+
+    void allocate(MTL::Device* device, size_t length);
+};
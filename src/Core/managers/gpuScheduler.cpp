@@ -0,0 +1,129 @@
+#include "gpuScheduler.hpp"
+
+#include <Block.h>
+
+GPUScheduler::GPUScheduler(MTL::Device* device, MTL::CommandQueue* graphicsQueue, bool asyncCompute) {
+    queues[(uint32_t)Queue::Graphics] = graphicsQueue->retain();
+    if (asyncCompute) {
+        queues[(uint32_t)Queue::Compute] = device->newCommandQueue();
+        queues[(uint32_t)Queue::Compute]->setLabel(NS::String::string("Async Compute Queue", NS::ASCIIStringEncoding));
+    } else {
+        queues[(uint32_t)Queue::Compute] = graphicsQueue->retain();
+    }
+
+    event = device->newSharedEvent();
+    event->setLabel(NS::String::string("Queue Timeline", NS::ASCIIStringEncoding));
+    timeline.reserve(MaxCommandBuffersPerFrame);
+
+    // One handler per command buffer of each slot, copied to the heap once, not per frame
+    for (auto& slot : slots) {
+        Slot* slotPointer = &slot;
+        for (uint32_t i = 0; i < MaxCommandBuffersPerFrame; i++) {
+            slot.completedHandlers[i] = Block_copy(^(MTL::CommandBuffer* commandBuffer) {
+                slotPointer->times[i * 2] = commandBuffer->GPUStartTime();
+                slotPointer->times[i * 2 + 1] = commandBuffer->GPUEndTime();
+                complete(*slotPointer);
+            });
+        }
+    }
+}
+
+GPUScheduler::~GPUScheduler() {
+    for (auto& slot : slots) {
+        for (auto handler : slot.completedHandlers) {
+            Block_release(handler);
+        }
+    }
+    event->release();
+    for (auto* queue : queues) {
+        queue->release();
+    }
+}
+
+void GPUScheduler::complete(Slot& slot) {
+    if (slot.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        slot.resolved.store(true, std::memory_order_release);
+    }
+}
+
+void GPUScheduler::beginFrame() {
+    slotIndex = (slotIndex + 1) % RingSize;
+    Slot& slot = slots[slotIndex];
+    recording = slot.pending.load(std::memory_order_acquire) == 0;
+    if (!recording)
+        return;
+
+    // Results of the previous use of this slot are dropped if nobody read them
+    slot.resolved.store(false, std::memory_order_relaxed);
+    slot.count = 0;
+    slot.pending.store(1, std::memory_order_relaxed);
+}
+
+MTL::CommandBuffer* GPUScheduler::commandBuffer(Queue queue, NS::String* label) {
+    MTL::CommandBuffer* commandBuffer = queues[(uint32_t)queue]->commandBuffer();
+    commandBuffer->setLabel(label);
+
+    Slot& slot = slots[slotIndex];
+    if (recording && slot.count < MaxCommandBuffersPerFrame) {
+        uint32_t index = slot.count++;
+        slot.labels[index] = label;
+        slot.queues[index] = isAsync() ? queue : Queue::Graphics;
+        slot.pending.fetch_add(1, std::memory_order_relaxed);
+        commandBuffer->addCompletedHandler(slot.completedHandlers[index]);
+    }
+    return commandBuffer;
+}
+
+uint64_t GPUScheduler::signal(MTL::CommandBuffer* commandBuffer) {
+    commandBuffer->encodeSignalEvent(event, ++eventValue);
+    return eventValue;
+}
+
+void GPUScheduler::wait(MTL::CommandBuffer* commandBuffer, uint64_t value) {
+    if (value > 0) {
+        commandBuffer->encodeWait(event, value);
+    }
+}
+
+void GPUScheduler::endFrame() {
+    if (!recording)
+        return;
+    recording = false;
+    complete(slots[slotIndex]);
+}
+
+const std::vector<GPUScheduler::Span>& GPUScheduler::getTimeline() {
+    // Publish the newest resolved slot and drop any older ones
+    bool published = false;
+    for (uint32_t offset = 0; offset < RingSize; offset++) {
+        Slot& slot = slots[(slotIndex + RingSize - offset) % RingSize];
+        if (!slot.resolved.exchange(false, std::memory_order_acquire) || published)
+            continue;
+
+        published = true;
+        double frameStart = INFINITY;
+        for (uint32_t i = 0; i < slot.count; i++) {
+            frameStart = std::min(frameStart, slot.times[i * 2]);
+        }
+
+        timeline.clear();
+        for (uint32_t i = 0; i < slot.count; i++) {
+            timeline.push_back({slot.labels[i], slot.queues[i],
+                                (slot.times[i * 2] - frameStart) * 1000.0, (slot.times[i * 2 + 1] - frameStart) * 1000.0});
+        }
+
+        // Command buffers of one queue run one after another, so pairwise intersections add up
+        overlapMilliseconds = 0.0;
+        for (const Span& graphics : timeline) {
+            if (graphics.queue != Queue::Graphics)
+                continue;
+            for (const Span& compute : timeline) {
+                if (compute.queue != Queue::Compute)
+                    continue;
+                overlapMilliseconds += std::max(0.0, std::min(graphics.endMilliseconds, compute.endMilliseconds) -
+                                                     std::max(graphics.startMilliseconds, compute.startMilliseconds));
+            }
+        }
+    }
+    return timeline;
+}
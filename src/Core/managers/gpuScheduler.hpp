@@ -0,0 +1,75 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+
+// Hands out the frame's command buffers by queue affinity. Compute affine passes run on
+// a second command queue when ASYNC_COMPUTE is enabled and on the graphics queue
+// otherwise. Hazard tracking does not span queues, so dependencies between them are
+// expressed with one shared event whose value only grows: signal encodes the next
+// value, wait makes everything encoded after it wait for that value. Every command
+// buffer's GPU start and end time is recorded into a ring of frame timelines, resolved
+// in completion handlers without stalling the CPU.
+class GPUScheduler {
+public:
+    enum class Queue : uint32_t {
+        Graphics,
+        Compute,
+        Count
+    };
+
+    struct Span {
+        NS::String* label;
+        Queue       queue;
+        double      startMilliseconds;  // From the first start of the frame
+        double      endMilliseconds;
+    };
+
+    static constexpr uint32_t MaxCommandBuffersPerFrame = 8;
+    static constexpr uint32_t RingSize                  = 3;
+
+    GPUScheduler(MTL::Device* device, MTL::CommandQueue* graphicsQueue, bool asyncCompute);
+    ~GPUScheduler();
+
+    bool isAsync() const { return queues[(uint32_t)Queue::Compute] != queues[(uint32_t)Queue::Graphics]; }
+
+    void beginFrame();
+    // Labels must outlive the frame, MTLSTR literals are expected
+    MTL::CommandBuffer* commandBuffer(Queue queue, NS::String* label);
+    // Encodes a signal of the next event value, returns the value
+    uint64_t signal(MTL::CommandBuffer* commandBuffer);
+    // Work encoded after this call waits until the event reaches value, zero never waits
+    void wait(MTL::CommandBuffer* commandBuffer, uint64_t value);
+    void endFrame();
+
+    // Most recently resolved frame, in submission order
+    const std::vector<Span>& getTimeline();
+    // Time both queues were busy in that frame
+    double getOverlapMilliseconds() const { return overlapMilliseconds; }
+
+private:
+    struct Slot {
+        std::array<NS::String*, MaxCommandBuffersPerFrame>      labels{};
+        std::array<Queue, MaxCommandBuffersPerFrame>            queues{};
+        std::array<double, MaxCommandBuffersPerFrame * 2>       times{};
+        std::array<MTL::CommandBufferHandler, MaxCommandBuffersPerFrame> completedHandlers{};
+        uint32_t                                                count = 0;
+        // Command buffers still running plus one until endFrame, the last one out resolves
+        std::atomic<uint32_t>                                   pending{0};
+        std::atomic<bool>                                       resolved{false};
+    };
+
+    static void complete(Slot& slot);
+
+    std::array<MTL::CommandQueue*, (uint32_t)Queue::Count> queues{};
+    MTL::SharedEvent*               event = nullptr;
+    uint64_t                        eventValue = 0;
+
+    std::array<Slot, RingSize>      slots;
+    uint32_t                        slotIndex = 0;
+    bool                            recording = false;
+
+    std::vector<Span>               timeline;
+    double                          overlapMilliseconds = 0.0;
+};
@@ -0,0 +1,169 @@
+#include "impostorRasterizer.hpp"
+
+#include "../Components/mesh.hpp"
+
+#include <cmath>
+#include "parallel.hpp"
+
+namespace ImpostorRasterizer {
+
+TextureSource readDiffuseTextures(const Mesh& mesh) {
+    TextureSource source;
+    MTL::Texture* texture = mesh.diffuseTextures;
+    if (!mesh.hasTextures || !texture || !mesh.diffuseTextureInfos || texture->storageMode() == MTL::StorageModePrivate)
+        return source;
+
+    source.width = (uint32_t)texture->width();
+    source.height = (uint32_t)texture->height();
+    uint32_t layerCount = (uint32_t)texture->arrayLength();
+    uint32_t layerTexels = source.width * source.height;
+    source.texels.resize((size_t)layerTexels * layerCount);
+
+    const MTL::Region region = MTL::Region(0, 0, source.width, source.height);
+    for (uint32_t layer = 0; layer < layerCount; layer++) {
+        texture->getBytes(source.texels.data() + (size_t)layer * layerTexels, source.width * sizeof(uint32_t),
+                          layerTexels * sizeof(uint32_t), region, 0, layer);
+    }
+
+    const TextureInfo* infos = static_cast<const TextureInfo*>(mesh.diffuseTextureInfos->contents());
+    source.infos.assign(infos, infos + std::min<size_t>(layerCount, mesh.diffuseTextureInfos->length() / sizeof(TextureInfo)));
+    return source;
+}
+
+static simd::float4 unpackUnorm(uint32_t texel) {
+    return simd::float4{(float)(texel & 0xFF), (float)((texel >> 8) & 0xFF),
+                        (float)((texel >> 16) & 0xFF), (float)(texel >> 24)} / 255.0f;
+}
+
+static float linearToSrgb(float value) {
+    value = std::clamp(value, 0.0f, 1.0f);
+    return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+static uint32_t packSrgb(simd::float4 color) {
+    uint32_t r = (uint32_t)(linearToSrgb(color.x) * 255.0f + 0.5f);
+    uint32_t g = (uint32_t)(linearToSrgb(color.y) * 255.0f + 0.5f);
+    uint32_t b = (uint32_t)(linearToSrgb(color.z) * 255.0f + 0.5f);
+    uint32_t a = (uint32_t)(std::clamp(color.w, 0.0f, 1.0f) * 255.0f + 0.5f);
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+static uint32_t packSnorm(simd::float3 normal) {
+    auto component = [](float value) {
+        return (uint32_t)(uint8_t)(int8_t)std::lround(std::clamp(value, -1.0f, 1.0f) * 127.0f);
+    };
+    return component(normal.x) | (component(normal.y) << 8) | (component(normal.z) << 16) | (component(1.0f) << 24);
+}
+
+// Linear filtered, repeat addressed sample of one layer, the same arithmetic as
+// gbuffer_fragment: uv is scaled to the used part of the padded layer
+static simd::float4 sampleDiffuse(const TextureSource& textures, int32_t layer, simd::float2 uv) {
+    if (layer < 0 || (uint32_t)layer >= textures.infos.size())
+        return simd::float4{0.9608f, 0.9608f, 0.8627f, 1.0f};
+
+    const TextureInfo& info = textures.infos[layer];
+    uv *= simd::float2{(float)info.width / textures.width, (float)info.height / textures.height};
+
+    float x = uv.x * textures.width - 0.5f;
+    float y = uv.y * textures.height - 0.5f;
+    float x0 = std::floor(x), y0 = std::floor(y);
+    float fx = x - x0, fy = y - y0;
+
+    auto wrap = [](int64_t value, uint32_t size) { return (uint32_t)(((value % size) + size) % size); };
+    const uint32_t* texels = textures.texels.data() + (size_t)layer * textures.width * textures.height;
+    auto texel = [&](float px, float py) {
+        return unpackUnorm(texels[wrap((int64_t)py, textures.height) * textures.width + wrap((int64_t)px, textures.width)]);
+    };
+    simd::float4 top = simd::mix(texel(x0, y0), texel(x0 + 1.0f, y0), fx);
+    simd::float4 bottom = simd::mix(texel(x0, y0 + 1.0f), texel(x0 + 1.0f, y0 + 1.0f), fx);
+    return simd::mix(top, bottom, fy);
+}
+
+static float edge(simd::float2 a, simd::float2 b, simd::float2 p) {
+    return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+// One frame into its tile of the atlas
+static void rasterizeFrame(const Mesh& mesh, const ImpostorParams& params, uint32_t frameSize,
+                           const TextureSource& textures, uint32_t frameX, uint32_t frameY, ImpostorImages& images) {
+    simd::float3 direction = Impostors::frameDirection(frameX, frameY, params);
+    simd::float4x4 viewMatrix = Impostors::frameViewMatrix(direction, params);
+    simd::float4x4 projection = Impostors::frameProjectionMatrix(params);
+
+    // Screen position in texels and eye depth per vertex, the projection is orthographic
+    // so attributes interpolate linearly in screen space
+    std::vector<simd::float3> screen(mesh.vertices.size());
+    for (size_t i = 0; i < mesh.vertices.size(); i++) {
+        simd::float4 eye = simd_mul(viewMatrix, simd::float4{mesh.vertices[i].position.x, mesh.vertices[i].position.y, mesh.vertices[i].position.z, 1.0f});
+        simd::float4 clip = simd_mul(projection, eye);
+        screen[i] = simd::float3{(clip.x * 0.5f + 0.5f) * frameSize, (0.5f - clip.y * 0.5f) * frameSize, eye.z};
+    }
+
+    const uint32_t atlasSize = params.framesPerSide * frameSize;
+    const size_t tileOrigin = (size_t)frameY * frameSize * atlasSize + (size_t)frameX * frameSize;
+    std::vector<float> depthBuffer((size_t)frameSize * frameSize, -INFINITY);
+
+    for (size_t triangle = 0; triangle + 2 < mesh.vertexIndices.size(); triangle += 3) {
+        const uint32_t i0 = mesh.vertexIndices[triangle];
+        const uint32_t i1 = mesh.vertexIndices[triangle + 1];
+        const uint32_t i2 = mesh.vertexIndices[triangle + 2];
+        simd::float2 p0 = screen[i0].xy, p1 = screen[i1].xy, p2 = screen[i2].xy;
+        float area = edge(p0, p1, p2);
+        if (std::abs(area) < 1e-12f)
+            continue;
+
+        // Culling is off in the GPU bake too, both windings are drawn
+        int32_t minX = std::max(0, (int32_t)std::floor(std::min({p0.x, p1.x, p2.x})));
+        int32_t minY = std::max(0, (int32_t)std::floor(std::min({p0.y, p1.y, p2.y})));
+        int32_t maxX = std::min((int32_t)frameSize - 1, (int32_t)std::ceil(std::max({p0.x, p1.x, p2.x})));
+        int32_t maxY = std::min((int32_t)frameSize - 1, (int32_t)std::ceil(std::max({p0.y, p1.y, p2.y})));
+
+        const Vertex& v0 = mesh.vertices[i0];
+        const Vertex& v1 = mesh.vertices[i1];
+        const Vertex& v2 = mesh.vertices[i2];
+        for (int32_t y = minY; y <= maxY; y++) {
+            for (int32_t x = minX; x <= maxX; x++) {
+                simd::float2 center = {x + 0.5f, y + 0.5f};
+                float w0 = edge(p1, p2, center) / area;
+                float w1 = edge(p2, p0, center) / area;
+                float w2 = 1.0f - w0 - w1;
+                if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                    continue;
+
+                // Eye z is negative, the nearest surface has the largest value
+                float depth = w0 * screen[i0].z + w1 * screen[i1].z + w2 * screen[i2].z;
+                size_t pixel = (size_t)y * frameSize + x;
+                if (depth <= depthBuffer[pixel])
+                    continue;
+                depthBuffer[pixel] = depth;
+
+                simd::float2 uv = w0 * v0.textureCoordinate + w1 * v1.textureCoordinate + w2 * v2.textureCoordinate;
+                simd::float3 normal = simd::normalize(w0 * v0.normal.xyz + w1 * v1.normal.xyz + w2 * v2.normal.xyz);
+
+                size_t texel = tileOrigin + (size_t)y * atlasSize + x;
+                images.albedo[texel] = packSrgb(sampleDiffuse(textures, v0.diffuseTextureIndex, uv));
+                images.normal[texel] = packSnorm(normal);
+                images.depth[texel] = (__fp16)depth;
+            }
+        }
+    }
+}
+
+ImpostorImages bake(const Mesh& mesh, const ImpostorParams& params, uint32_t frameSize, const TextureSource& textures) {
+    ImpostorImages images;
+    images.params = params;
+    images.frameSize = frameSize;
+    const size_t texelCount = (size_t)images.getAtlasSize() * images.getAtlasSize();
+    images.albedo.assign(texelCount, 0);
+    images.normal.assign(texelCount, 0);
+    // Uncovered texels sit on the far plane of the frame camera, like the GPU clear
+    images.depth.assign(texelCount, (__fp16)(-3.0f * params.center_radius.w));
+
+    const uint32_t frameCount = params.framesPerSide * params.framesPerSide;
+    parallelFor(frameCount, 0, 1, [&](uint32_t frame) {
+        rasterizeFrame(mesh, params, frameSize, textures, frame % params.framesPerSide, frame / params.framesPerSide, images);
+    });
+    return images;
+}
+
+}
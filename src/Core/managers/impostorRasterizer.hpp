@@ -0,0 +1,29 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+
+#include "impostors.hpp"
+#include "../vertexData.hpp"
+
+// Software fallback for the impostor bake, so atlases can be cooked without a GPU
+// queue. Follows the G-buffer shaders: same frame cameras, same texture array
+// addressing, albedo written as an sRGB target would store it. Normal maps are not
+// applied, normals are the interpolated vertex normals. Frames are rasterised in
+// parallel.
+namespace ImpostorRasterizer {
+    // Diffuse texture array read back to the CPU, every layer padded to width x height
+    struct TextureSource {
+        uint32_t                    width = 0;
+        uint32_t                    height = 0;
+        std::vector<uint32_t>       texels;     // RGBA8, layer after layer, row 0 first
+        std::vector<TextureInfo>    infos;      // Used size of each layer
+    };
+
+    // Copies the mesh's diffuse array when its storage mode allows CPU reads, empty otherwise
+    TextureSource readDiffuseTextures(const Mesh& mesh);
+
+    // Frames are rasterized in parallel on threads from the caller's ThreadBudget
+    ImpostorImages bake(const Mesh& mesh, const ImpostorParams& params, uint32_t frameSize, const TextureSource& textures);
+}
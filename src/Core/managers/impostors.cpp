@@ -0,0 +1,391 @@
+#include "impostors.hpp"
+
+#include "impostorRasterizer.hpp"
+#include "../Components/mesh.hpp"
+#include "../../../data/shaders/config.hpp"
+#include "AAPLMathUtilities.h"
+
+#include <cmath>
+#include <filesystem>
+
+Impostors::Impostors(MTL::Device* device, RenderPipeline& pipelines, uint32_t framesInFlight)
+: device(device), pipelines(pipelines) {
+    instances.reserve(MaxInstances);
+    nearInstances.reserve(MaxInstances);
+    for (uint32_t i = 0; i < framesInFlight; i++) {
+        MTL::Buffer* buffer = device->newBuffer(MaxInstances * sizeof(ImpostorInstance), MTL::ResourceStorageModeShared);
+        buffer->setLabel(NS::String::string("Impostor Instances", NS::ASCIIStringEncoding));
+        instanceBuffers.push_back(buffer);
+    }
+}
+
+Impostors::~Impostors() {
+    for (Atlas& atlas : atlases) {
+        atlas.albedo->release();
+        atlas.normal->release();
+        atlas.depth->release();
+    }
+    for (MTL::Buffer* buffer : instanceBuffers) {
+        buffer->release();
+    }
+}
+
+simd::float2 Impostors::octahedralEncode(simd::float3 direction, bool hemisphere) {
+    direction /= std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z);
+    if (hemisphere)
+        return simd::float2{direction.x + direction.z, direction.x - direction.z};
+
+    simd::float2 uv = direction.xz;
+    if (direction.y < 0.0f) {
+        uv = simd::float2{(1.0f - std::abs(uv.y)) * (uv.x >= 0.0f ? 1.0f : -1.0f),
+                          (1.0f - std::abs(uv.x)) * (uv.y >= 0.0f ? 1.0f : -1.0f)};
+    }
+    return uv;
+}
+
+simd::float3 Impostors::octahedralDecode(simd::float2 uv, bool hemisphere) {
+    simd::float3 direction;
+    if (hemisphere) {
+        simd::float2 xz = simd::float2{uv.x + uv.y, uv.x - uv.y} * 0.5f;
+        direction = simd::float3{xz.x, 1.0f - std::abs(xz.x) - std::abs(xz.y), xz.y};
+    } else {
+        direction = simd::float3{uv.x, 1.0f - std::abs(uv.x) - std::abs(uv.y), uv.y};
+        if (direction.y < 0.0f) {
+            float x = direction.x;
+            direction.x = (1.0f - std::abs(direction.z)) * (x >= 0.0f ? 1.0f : -1.0f);
+            direction.z = (1.0f - std::abs(x)) * (direction.z >= 0.0f ? 1.0f : -1.0f);
+        }
+    }
+    return simd::normalize(direction);
+}
+
+simd::float3 Impostors::frameDirection(uint32_t x, uint32_t y, const ImpostorParams& params) {
+    simd::float2 uv = simd::float2{(float)x, (float)y} / (float)(params.framesPerSide - 1) * 2.0f - 1.0f;
+    return octahedralDecode(uv, params.hemisphere != 0);
+}
+
+simd::float4x4 Impostors::frameViewMatrix(simd::float3 direction, const ImpostorParams& params) {
+    simd::float3 center = params.center_radius.xyz;
+    simd::float3 up = std::abs(direction.y) > 0.999f ? simd::float3{0.0f, 0.0f, 1.0f} : simd::float3{0.0f, 1.0f, 0.0f};
+    return matrix_look_at_right_hand(center + direction * (2.0f * params.center_radius.w), center, up);
+}
+
+// The bounding sphere spans eye depths [-radius, -3 * radius]
+simd::float4x4 Impostors::frameProjectionMatrix(const ImpostorParams& params) {
+    float radius = params.center_radius.w;
+    return matrix_ortho_right_hand(-radius, radius, -radius, radius, radius, 3.0f * radius);
+}
+
+ImpostorParams Impostors::fitParams(const Mesh& mesh, const BakeSettings& settings) {
+    simd::float3 boundsMin = simd::float3(INFINITY);
+    simd::float3 boundsMax = simd::float3(-INFINITY);
+    for (const Vertex& vertex : mesh.vertices) {
+        boundsMin = simd::min(boundsMin, vertex.position.xyz);
+        boundsMax = simd::max(boundsMax, vertex.position.xyz);
+    }
+    simd::float3 center = (boundsMin + boundsMax) * 0.5f;
+
+    float radiusSquared = 0.0f;
+    for (const Vertex& vertex : mesh.vertices) {
+        radiusSquared = std::max(radiusSquared, simd::distance_squared(vertex.position.xyz, center));
+    }
+
+    return ImpostorParams{
+        .center_radius = simd::float4{center.x, center.y, center.z, std::max(std::sqrt(radiusSquared), 1e-4f)},
+        .framesPerSide = std::max(settings.framesPerSide, 2u),
+        .hemisphere = settings.hemisphere ? 1u : 0u
+    };
+}
+
+// FNV-1a
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static uint64_t sourceHash(const Mesh& mesh, const ImpostorParams& params, uint32_t frameSize) {
+    constexpr uint32_t Version = 1;
+    uint64_t hash = 14695981039346656037ull;
+    hash = hashBytes(hash, &Version, sizeof(Version));
+    hash = hashBytes(hash, &params, sizeof(params));
+    hash = hashBytes(hash, &frameSize, sizeof(frameSize));
+    for (const Vertex& vertex : mesh.vertices) {
+        hash = hashBytes(hash, &vertex.position, sizeof(float) * 3);
+        hash = hashBytes(hash, &vertex.normal, sizeof(float) * 3);
+        hash = hashBytes(hash, &vertex.textureCoordinate, sizeof(vertex.textureCoordinate));
+        hash = hashBytes(hash, &vertex.diffuseTextureIndex, sizeof(vertex.diffuseTextureIndex));
+    }
+    hash = hashBytes(hash, mesh.vertexIndices.data(), mesh.vertexIndices.size() * sizeof(uint32_t));
+    return hash;
+}
+
+namespace {
+    constexpr uint32_t CacheMagic = 0x504D4931; // "1IMP"
+
+    struct CacheHeader {
+        uint32_t        magic;
+        uint32_t        frameSize;
+        uint64_t        hash;
+        ImpostorParams  params;
+    };
+
+    bool saveImages(const std::string& path, uint64_t hash, const ImpostorImages& images) {
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+
+        CacheHeader header{.magic = CacheMagic, .frameSize = images.frameSize, .hash = hash, .params = images.params};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(images.albedo.data()), images.albedo.size() * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char*>(images.normal.data()), images.normal.size() * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char*>(images.depth.data()), images.depth.size() * sizeof(__fp16));
+        return file.good();
+    }
+
+    bool loadImages(const std::string& path, uint64_t hash, ImpostorImages& images) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+
+        CacheHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != CacheMagic || header.hash != hash)
+            return false;
+
+        images.params = header.params;
+        images.frameSize = header.frameSize;
+        const size_t texelCount = (size_t)images.getAtlasSize() * images.getAtlasSize();
+        images.albedo.resize(texelCount);
+        images.normal.resize(texelCount);
+        images.depth.resize(texelCount);
+        return file.read(reinterpret_cast<char*>(images.albedo.data()), texelCount * sizeof(uint32_t)) &&
+               file.read(reinterpret_cast<char*>(images.normal.data()), texelCount * sizeof(uint32_t)) &&
+               file.read(reinterpret_cast<char*>(images.depth.data()), texelCount * sizeof(__fp16));
+    }
+}
+
+uint32_t Impostors::addMesh(const Mesh& mesh, const std::string& cacheDirectory, MTL::CommandQueue* bakeQueue, const BakeSettings& settings) {
+    ImpostorParams params = fitParams(mesh, settings);
+    uint64_t hash = sourceHash(mesh, params, settings.frameSize);
+    char fileName[40];
+    snprintf(fileName, sizeof(fileName), "/%016llx.impostor", (unsigned long long)hash);
+    std::string path = cacheDirectory + fileName;
+
+    ImpostorImages images;
+    if (!loadImages(path, hash, images)) {
+        auto startTime = std::chrono::steady_clock::now();
+        if (bakeQueue)
+            images = bakeGPU(mesh, bakeQueue, settings);
+        else
+            images = ImpostorRasterizer::bake(mesh, params, settings.frameSize, ImpostorRasterizer::readDiffuseTextures(mesh));
+        printf("Baked %ux%u impostor frames on the %s: %.1f ms\n", params.framesPerSide, params.framesPerSide,
+               bakeQueue ? "GPU" : "CPU", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+
+        if (!saveImages(path, hash, images))
+            std::cerr << "Failed to write impostor cache: " << path << std::endl;
+    }
+
+    Atlas atlas{.params = images.params};
+    upload(atlas, images);
+    atlases.push_back(atlas);
+    return (uint32_t)atlases.size() - 1;
+}
+
+ImpostorImages Impostors::bakeGPU(const Mesh& mesh, MTL::CommandQueue* queue, const BakeSettings& settings) {
+    ImpostorImages images;
+    images.params = fitParams(mesh, settings);
+    images.frameSize = settings.frameSize;
+    const ImpostorParams& params = images.params;
+    const uint32_t atlasSize = images.getAtlasSize();
+    const float radius = params.center_radius.w;
+
+    auto createTarget = [&](MTL::PixelFormat format, const char* label) {
+        MTL::TextureDescriptor* descriptor = MTL::TextureDescriptor::texture2DDescriptor(format, atlasSize, atlasSize, false);
+        descriptor->setStorageMode(MTL::StorageModePrivate);
+        descriptor->setUsage(MTL::TextureUsageRenderTarget);
+        MTL::Texture* texture = device->newTexture(descriptor);
+        texture->setLabel(NS::String::string(label, NS::ASCIIStringEncoding));
+        return texture;
+    };
+    MTL::Texture* albedoTarget = createTarget(MTL::PixelFormatRGBA8Unorm_sRGB, "Impostor Bake Albedo");
+    MTL::Texture* normalTarget = createTarget(MTL::PixelFormatRGBA8Snorm, "Impostor Bake Normal");
+    MTL::Texture* depthTarget = createTarget(MTL::PixelFormatR16Float, "Impostor Bake Depth");
+    MTL::Texture* depthBuffer = createTarget(MTL::PixelFormatDepth32Float, "Impostor Bake Depth Buffer");
+
+    MTL::RenderPassDescriptor* passDescriptor = MTL::RenderPassDescriptor::alloc()->init();
+    auto setTarget = [&](int index, MTL::Texture* texture, MTL::ClearColor clearColor) {
+        MTL::RenderPassColorAttachmentDescriptor* attachment = passDescriptor->colorAttachments()->object(index);
+        attachment->setTexture(texture);
+        attachment->setLoadAction(MTL::LoadActionClear);
+        attachment->setStoreAction(MTL::StoreActionStore);
+        attachment->setClearColor(clearColor);
+    };
+    setTarget(RenderTargetAlbedo, albedoTarget, MTL::ClearColor(0.0, 0.0, 0.0, 0.0));
+    setTarget(RenderTargetNormal, normalTarget, MTL::ClearColor(0.0, 0.0, 0.0, 0.0));
+    // Uncovered texels sit on the far plane of the frame camera
+    setTarget(RenderTargetDepth, depthTarget, MTL::ClearColor(-3.0 * radius, 0.0, 0.0, 0.0));
+    passDescriptor->depthAttachment()->setTexture(depthBuffer);
+    passDescriptor->depthAttachment()->setLoadAction(MTL::LoadActionClear);
+    passDescriptor->depthAttachment()->setStoreAction(MTL::StoreActionDontCare);
+    passDescriptor->depthAttachment()->setClearDepth(1.0);
+
+    MTL::CommandBuffer* commandBuffer = queue->commandBuffer();
+    commandBuffer->setLabel(MTLSTR("Impostor Bake"));
+    MTL::RenderCommandEncoder* encoder = commandBuffer->renderCommandEncoder(passDescriptor);
+    encoder->setLabel(MTLSTR("Impostor Bake"));
+    encoder->setRenderPipelineState(pipelines.getRenderPipeline(RenderPipelineType::ImpostorBake));
+    encoder->setDepthStencilState(pipelines.getDepthStencilState(DepthStencilType::ImpostorBake));
+    encoder->setCullMode(MTL::CullModeNone);
+
+    encoder->setVertexBuffer(mesh.positionStream, 0, BufferIndexPositionStream);
+    encoder->setVertexBuffer(mesh.tangentFrameStream, 0, BufferIndexTangentFrameStream);
+    encoder->setVertexBuffer(mesh.texcoordStream, 0, BufferIndexTexcoordStream);
+    encoder->setVertexBuffer(mesh.textureIndexStream, 0, BufferIndexTextureIndexStream);
+    encoder->setVertexBytes(&mesh.streamLayout, sizeof(VertexStreamLayout), BufferIndexVertexStreamLayout);
+    encoder->setFragmentTexture(mesh.diffuseTextures, TextureIndexBaseColor);
+    encoder->setFragmentTexture(mesh.normalTextures, TextureIndexNormal);
+    encoder->setFragmentBuffer(mesh.diffuseTextureInfos, 0, BufferIndexDiffuseInfo);
+    encoder->setFragmentBuffer(mesh.normalTextureInfos, 0, BufferIndexNormalInfo);
+
+    // Identity model matrix, the G-buffer shaders then write object space normals
+    InstanceConstants instance{.model_matrix = matrix_identity_float4x4, .normal_matrix = matrix_identity_float3x3};
+    encoder->setVertexBytes(&instance, sizeof(instance), BufferIndexInstanceConstants);
+    simd::uint2 objectInfo = {0, 0};
+    encoder->setFragmentBytes(&objectInfo, sizeof(objectInfo), BufferIndexObjectId);
+
+    ViewConstants view{};
+    view.projection_matrix = frameProjectionMatrix(params);
+    view.projection_matrix_inverse = simd_inverse(view.projection_matrix);
+    for (uint32_t y = 0; y < params.framesPerSide; y++) {
+        for (uint32_t x = 0; x < params.framesPerSide; x++) {
+            view.view_matrix = frameViewMatrix(frameDirection(x, y, params), params);
+            encoder->setVertexBytes(&view, sizeof(view), BufferIndexViewConstants);
+            encoder->setViewport(MTL::Viewport{(double)(x * settings.frameSize), (double)(y * settings.frameSize),
+                                               (double)settings.frameSize, (double)settings.frameSize, 0.0, 1.0});
+            encoder->setScissorRect(MTL::ScissorRect{x * settings.frameSize, y * settings.frameSize, settings.frameSize, settings.frameSize});
+            encoder->drawIndexedPrimitives(MTL::PrimitiveTypeTriangle, mesh.indexCount, MTL::IndexTypeUInt32, mesh.indexBuffer, 0);
+        }
+    }
+    encoder->endEncoding();
+
+    // Read back through one shared buffer, the targets are tightly packed one after another
+    const size_t texelCount = (size_t)atlasSize * atlasSize;
+    const size_t albedoOffset = 0;
+    const size_t normalOffset = texelCount * sizeof(uint32_t);
+    const size_t depthOffset = normalOffset + texelCount * sizeof(uint32_t);
+    MTL::Buffer* readback = device->newBuffer(depthOffset + texelCount * sizeof(__fp16), MTL::ResourceStorageModeShared);
+    MTL::BlitCommandEncoder* blit = commandBuffer->blitCommandEncoder();
+    auto copyOut = [&](MTL::Texture* texture, size_t offset, size_t bytesPerTexel) {
+        blit->copyFromTexture(texture, 0, 0, MTL::Origin(0, 0, 0), MTL::Size(atlasSize, atlasSize, 1),
+                              readback, offset, atlasSize * bytesPerTexel, texelCount * bytesPerTexel);
+    };
+    copyOut(albedoTarget, albedoOffset, sizeof(uint32_t));
+    copyOut(normalTarget, normalOffset, sizeof(uint32_t));
+    copyOut(depthTarget, depthOffset, sizeof(__fp16));
+    blit->endEncoding();
+
+    commandBuffer->commit();
+    commandBuffer->waitUntilCompleted();
+
+    const uint8_t* contents = static_cast<const uint8_t*>(readback->contents());
+    images.albedo.assign(reinterpret_cast<const uint32_t*>(contents + albedoOffset), reinterpret_cast<const uint32_t*>(contents + normalOffset));
+    images.normal.assign(reinterpret_cast<const uint32_t*>(contents + normalOffset), reinterpret_cast<const uint32_t*>(contents + depthOffset));
+    images.depth.assign(reinterpret_cast<const __fp16*>(contents + depthOffset), reinterpret_cast<const __fp16*>(contents + depthOffset) + texelCount);
+
+#if !USE_EYE_DEPTH
+    // gbuffer_fragment wrote window depth, the atlas keeps eye depth
+    for (size_t i = 0; i < texelCount; i++) {
+        if (images.albedo[i] >> 24)
+            images.depth[i] = (__fp16)(-(radius + (float)images.depth[i] * 2.0f * radius));
+    }
+#endif
+
+    readback->release();
+    passDescriptor->release();
+    albedoTarget->release();
+    normalTarget->release();
+    depthTarget->release();
+    depthBuffer->release();
+    return images;
+}
+
+void Impostors::upload(Atlas& atlas, const ImpostorImages& images) {
+    const uint32_t atlasSize = images.getAtlasSize();
+    auto createTexture = [&](MTL::PixelFormat format, const void* texels, size_t bytesPerTexel, const char* label) {
+        MTL::TextureDescriptor* descriptor = MTL::TextureDescriptor::texture2DDescriptor(format, atlasSize, atlasSize, false);
+        descriptor->setUsage(MTL::TextureUsageShaderRead);
+        MTL::Texture* texture = device->newTexture(descriptor);
+        texture->setLabel(NS::String::string(label, NS::ASCIIStringEncoding));
+        texture->replaceRegion(MTL::Region(0, 0, atlasSize, atlasSize), 0, texels, atlasSize * bytesPerTexel);
+        return texture;
+    };
+    atlas.albedo = createTexture(MTL::PixelFormatRGBA8Unorm_sRGB, images.albedo.data(), sizeof(uint32_t), "Impostor Albedo Atlas");
+    atlas.normal = createTexture(MTL::PixelFormatRGBA8Snorm, images.normal.data(), sizeof(uint32_t), "Impostor Normal Atlas");
+    atlas.depth = createTexture(MTL::PixelFormatR16Float, images.depth.data(), sizeof(__fp16), "Impostor Depth Atlas");
+}
+
+uint32_t Impostors::addInstance(const Instance& instance) {
+    assert(instance.atlas < atlases.size());
+    assert(instances.size() < MaxInstances);
+    instances.push_back(instance);
+    return (uint32_t)instances.size() - 1;
+}
+
+void Impostors::update(uint32_t frameIndex, simd::float3 cameraPosition) {
+    currentBuffer = frameIndex % (uint32_t)instanceBuffers.size();
+    nearInstances.clear();
+    const float thresholdSquared = distanceThreshold * distanceThreshold;
+
+    // Count the far instances per atlas, then write them bucketed so each atlas is one draw
+    for (Atlas& atlas : atlases) {
+        atlas.farCount = 0;
+    }
+    for (uint32_t i = 0; i < instances.size(); i++) {
+        if (simd::distance_squared(instances[i].position, cameraPosition) > thresholdSquared)
+            atlases[instances[i].atlas].farCount++;
+        else
+            nearInstances.push_back(i);
+    }
+
+    farCount = 0;
+    for (Atlas& atlas : atlases) {
+        atlas.farOffset = farCount;
+        farCount += atlas.farCount;
+        atlas.farCount = 0;
+    }
+
+    ImpostorInstance* farInstances = static_cast<ImpostorInstance*>(instanceBuffers[currentBuffer]->contents());
+    for (const Instance& instance : instances) {
+        if (simd::distance_squared(instance.position, cameraPosition) <= thresholdSquared)
+            continue;
+        Atlas& atlas = atlases[instance.atlas];
+        farInstances[atlas.farOffset + atlas.farCount++].position_scale =
+            simd::float4{instance.position.x, instance.position.y, instance.position.z, instance.scale};
+    }
+}
+
+void Impostors::draw(MTL::RenderCommandEncoder* encoder) const {
+    if (farCount == 0)
+        return;
+
+    encoder->pushDebugGroup(MTLSTR("Draw Impostors"));
+    encoder->setCullMode(MTL::CullModeNone);
+    encoder->setRenderPipelineState(pipelines.getRenderPipeline(RenderPipelineType::Impostor));
+    for (const Atlas& atlas : atlases) {
+        if (atlas.farCount == 0)
+            continue;
+
+        encoder->setVertexBuffer(instanceBuffers[currentBuffer], atlas.farOffset * sizeof(ImpostorInstance), BufferIndexImpostorInstances);
+        encoder->setVertexBytes(&atlas.params, sizeof(ImpostorParams), BufferIndexImpostorParams);
+        encoder->setFragmentBytes(&atlas.params, sizeof(ImpostorParams), BufferIndexImpostorParams);
+        encoder->setFragmentTexture(atlas.albedo, TextureIndexImpostorAlbedo);
+        encoder->setFragmentTexture(atlas.normal, TextureIndexImpostorNormal);
+        encoder->setFragmentTexture(atlas.depth, TextureIndexImpostorDepth);
+        encoder->drawPrimitives(MTL::PrimitiveTypeTriangleStrip, (NS::UInteger)0, (NS::UInteger)4, (NS::UInteger)atlas.farCount);
+    }
+    encoder->popDebugGroup();
+}
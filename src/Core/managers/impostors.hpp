@@ -0,0 +1,98 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+#include <simd/simd.h>
+#include <span>
+
+#include "renderPipeline.hpp"
+#include "../../../data/shaders/shaderTypes.hpp"
+
+struct Mesh;
+
+// CPU copy of a baked impostor atlas, also the cooked form on disk. Frames are
+// frameSize^2 tiles of a (framesPerSide * frameSize)^2 atlas, row major.
+struct ImpostorImages {
+    ImpostorParams          params{};
+    uint32_t                frameSize = 0;
+    std::vector<uint32_t>   albedo;     // RGBA8 sRGB, alpha is coverage
+    std::vector<uint32_t>   normal;     // RGBA8 snorm, object space
+    std::vector<__fp16>     depth;      // Eye depth of the bake camera
+
+    uint32_t getAtlasSize() const { return params.framesPerSide * frameSize; }
+};
+
+// Octahedral impostors for distant instances. Every mesh is rendered from a grid of
+// directions over the hemi- or full octahedron into albedo, normal and depth atlases;
+// the bake runs on the GPU with the G-buffer shaders when a command queue is given,
+// otherwise on the CPU rasterizer (ImpostorRasterizer), and is cooked to disk either
+// way. At runtime instances beyond distanceThreshold are drawn as camera facing
+// quads that blend the three nearest frames into the G-buffer; the rest are handed
+// back to the caller to draw as meshes.
+class Impostors {
+public:
+    static constexpr uint32_t MaxInstances = 4096;
+
+    struct BakeSettings {
+        uint32_t    framesPerSide = 12;
+        uint32_t    frameSize = 128;
+        bool        hemisphere = true;
+    };
+
+    struct Instance {
+        uint32_t        atlas;
+        simd::float3    position;
+        float           scale;
+    };
+
+    Impostors(MTL::Device* device, RenderPipeline& pipelines, uint32_t framesInFlight);
+    ~Impostors();
+
+    // Returns the atlas index. Reads the cooked atlas from cacheDirectory when it is current.
+    uint32_t addMesh(const Mesh& mesh, const std::string& cacheDirectory, MTL::CommandQueue* bakeQueue, const BakeSettings& settings);
+    uint32_t addInstance(const Instance& instance);
+    const Instance& getInstance(uint32_t index) const { return instances[index]; }
+
+    // Splits the instances by distance and writes the far ones for this frame
+    void update(uint32_t frameIndex, simd::float3 cameraPosition);
+    std::span<const uint32_t> getNearInstances() const { return nearInstances; }
+    uint32_t getFarCount() const { return farCount; }
+
+    // Inside the G-buffer pass, with the view constants bound
+    void draw(MTL::RenderCommandEncoder* encoder) const;
+
+    // Frame layout shared by both bakers and impostor.metal
+    static simd::float2 octahedralEncode(simd::float3 direction, bool hemisphere);
+    static simd::float3 octahedralDecode(simd::float2 uv, bool hemisphere);
+    static simd::float3 frameDirection(uint32_t x, uint32_t y, const ImpostorParams& params);
+    // Right handed view of a frame, the camera sits 2 * radius out from the centre
+    static simd::float4x4 frameViewMatrix(simd::float3 direction, const ImpostorParams& params);
+    static simd::float4x4 frameProjectionMatrix(const ImpostorParams& params);
+    static ImpostorParams fitParams(const Mesh& mesh, const BakeSettings& settings);
+
+    float distanceThreshold = 60.0f;
+
+private:
+    struct Atlas {
+        ImpostorParams  params;
+        MTL::Texture*   albedo = nullptr;
+        MTL::Texture*   normal = nullptr;
+        MTL::Texture*   depth = nullptr;
+        uint32_t        farOffset = 0;      // First far instance of this atlas in the frame's buffer
+        uint32_t        farCount = 0;
+    };
+
+    ImpostorImages bakeGPU(const Mesh& mesh, MTL::CommandQueue* queue, const BakeSettings& settings);
+    void upload(Atlas& atlas, const ImpostorImages& images);
+
+    MTL::Device*                device;
+    RenderPipeline&             pipelines;
+
+    std::vector<Atlas>          atlases;
+    std::vector<Instance>       instances;
+    std::vector<uint32_t>       nearInstances;
+    std::vector<MTL::Buffer*>   instanceBuffers;    // One per frame in flight
+    uint32_t                    currentBuffer = 0;
+    uint32_t                    farCount = 0;
+};
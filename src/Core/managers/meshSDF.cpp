@@ -0,0 +1,343 @@
+#include "meshSDF.hpp"
+
+#include "triangleBVH.hpp"
+#include "parallel.hpp"
+#include "../Components/mesh.hpp"
+
+#include <filesystem>
+
+namespace MeshSDF {
+
+// Directions for the parity vote, irrational components keep rays off edges and
+// axis aligned walls. Opposite pairs disagree around open surfaces, a sample is
+// only inside when most of them see an odd number of crossings.
+static const simd::float3 ParityDirections[] = {
+    simd::normalize(simd::float3{ 0.5773f,  0.5774f,  0.5771f}),
+    simd::normalize(simd::float3{-0.5776f, -0.5770f, -0.5775f}),
+    simd::normalize(simd::float3{ 0.8018f, -0.2671f,  0.5345f}),
+    simd::normalize(simd::float3{-0.8019f,  0.2669f, -0.5347f}),
+    simd::normalize(simd::float3{-0.3015f,  0.9045f,  0.3017f}),
+    simd::normalize(simd::float3{ 0.3013f, -0.9046f, -0.3016f}),
+};
+
+static bool isInside(const TriangleBVH& bvh, simd::float3 position) {
+    uint32_t oddCount = 0;
+    for (simd::float3 direction : ParityDirections) {
+        oddCount += bvh.countCrossings(position, direction) & 1;
+    }
+    return oddCount * 2 > std::size(ParityDirections);
+}
+
+static uint32_t quantize(float distance, float bandWidth, Format format) {
+    float normalized = std::clamp(distance / bandWidth, -1.0f, 1.0f) * 0.5f + 0.5f;
+    float maximum = format == Format::Unorm8 ? 255.0f : 65535.0f;
+    return (uint32_t)(normalized * maximum + 0.5f);
+}
+
+static float dequantize(const Volume& volume, uint32_t slot, uint32_t sampleIndex) {
+    float normalized;
+    if (volume.format == Format::Unorm8) {
+        normalized = volume.brickData[slot * BrickSamples + sampleIndex] / 255.0f;
+    } else {
+        uint16_t value;
+        std::memcpy(&value, volume.brickData.data() + (slot * BrickSamples + sampleIndex) * 2, sizeof(value));
+        normalized = value / 65535.0f;
+    }
+    return (normalized * 2.0f - 1.0f) * volume.bandWidth;
+}
+
+std::vector<Volume> bake(const Mesh& mesh, const BakeSettings& settings, BakeStats* stats) {
+    auto startTime = std::chrono::steady_clock::now();
+    const uint32_t threadCount = settings.threadCount;
+    uint32_t volumeCount = (uint32_t)mesh.submeshes.size();
+
+    std::vector<simd::float3> positions(mesh.vertices.size());
+    for (size_t i = 0; i < mesh.vertices.size(); i++) {
+        positions[i] = mesh.vertices[i].position.xyz;
+    }
+
+    // Volume layout and one BVH per submesh
+    std::vector<Volume> volumes(volumeCount);
+    std::vector<TriangleBVH> bvhs(volumeCount);
+    parallelFor(volumeCount, threadCount, 1, [&](uint32_t index) {
+        const Submesh& submesh = mesh.submeshes[index];
+        bvhs[index].build(positions, std::span<const uint32_t>(mesh.vertexIndices).subspan(submesh.indexOffset, submesh.indexCount));
+
+        Volume& volume = volumes[index];
+        simd::float3 extent = submesh.boundsMax - submesh.boundsMin;
+        volume.voxelSize = std::max(simd::reduce_max(extent), 1e-4f) / settings.resolution;
+        volume.bandWidth = settings.bandVoxels * volume.voxelSize;
+        volume.origin = submesh.boundsMin - volume.bandWidth;
+        volume.format = settings.format;
+
+        simd::float3 bricks = simd::ceil((extent + 2.0f * volume.bandWidth) / (volume.voxelSize * BrickStride));
+        volume.brickCounts = simd::max(simd::uint3{(uint32_t)bricks.x, (uint32_t)bricks.y, (uint32_t)bricks.z}, simd::uint3(1));
+    });
+
+    // Cells of all volumes are classified as one flat range
+    std::vector<uint32_t> cellOffsets(volumeCount + 1, 0);
+    for (uint32_t i = 0; i < volumeCount; i++) {
+        const simd::uint3& counts = volumes[i].brickCounts;
+        volumes[i].brickTable.resize(counts.x * counts.y * counts.z);
+        cellOffsets[i + 1] = cellOffsets[i] + (uint32_t)volumes[i].brickTable.size();
+    }
+
+    // A brick is stored when the surface comes within the band of any of its samples,
+    // otherwise every sample would clamp to the same value and only the sign is kept
+    constexpr uint32_t StoreBrick = 0;
+    parallelFor(cellOffsets.back(), threadCount, 64, [&](uint32_t cell) {
+        uint32_t volumeIndex = (uint32_t)(std::upper_bound(cellOffsets.begin(), cellOffsets.end(), cell) - cellOffsets.begin()) - 1;
+        Volume& volume = volumes[volumeIndex];
+        uint32_t local = cell - cellOffsets[volumeIndex];
+        simd::uint3 coordinate = {local % volume.brickCounts.x,
+                                  (local / volume.brickCounts.x) % volume.brickCounts.y,
+                                  local / (volume.brickCounts.x * volume.brickCounts.y)};
+
+        float brickWidth = volume.voxelSize * BrickStride;
+        simd::float3 center = volume.origin + (simd::float3{(float)coordinate.x, (float)coordinate.y, (float)coordinate.z} + 0.5f) * brickWidth;
+        float reach = brickWidth * 0.5f * std::sqrt(3.0f) + volume.bandWidth;
+        if (bvhs[volumeIndex].closestDistanceSquared(center, reach * reach) < reach * reach)
+            volume.brickTable[local] = StoreBrick;
+        else
+            volume.brickTable[local] = isInside(bvhs[volumeIndex], center) ? EmptyInside : EmptyOutside;
+    });
+
+    struct BrickJob {
+        uint32_t    volume;
+        uint32_t    cell;
+    };
+    std::vector<BrickJob> jobs;
+    for (uint32_t volumeIndex = 0; volumeIndex < volumeCount; volumeIndex++) {
+        Volume& volume = volumes[volumeIndex];
+        uint32_t slot = 0;
+        for (uint32_t cell = 0; cell < volume.brickTable.size(); cell++) {
+            if (volume.brickTable[cell] == StoreBrick) {
+                volume.brickTable[cell] = slot++;
+                jobs.push_back({volumeIndex, cell});
+            }
+        }
+        volume.brickData.resize((size_t)slot * BrickSamples * (uint32_t)volume.format);
+    }
+
+    // The bulk of the bake, its thread count is the one reported
+    uint32_t usedThreads = parallelFor((uint32_t)jobs.size(), threadCount, 1, [&](uint32_t jobIndex) {
+        const BrickJob& job = jobs[jobIndex];
+        Volume& volume = volumes[job.volume];
+        const TriangleBVH& bvh = bvhs[job.volume];
+        uint32_t slot = volume.brickTable[job.cell];
+        simd::uint3 coordinate = {job.cell % volume.brickCounts.x,
+                                  (job.cell / volume.brickCounts.x) % volume.brickCounts.y,
+                                  job.cell / (volume.brickCounts.x * volume.brickCounts.y)};
+        simd::float3 brickOrigin = volume.origin + simd::float3{(float)coordinate.x, (float)coordinate.y, (float)coordinate.z} * (volume.voxelSize * BrickStride);
+        float bandSquared = volume.bandWidth * volume.bandWidth;
+
+        for (uint32_t i = 0; i < BrickSamples; i++) {
+            simd::float3 offset = {(float)(i % BrickSize), (float)((i / BrickSize) % BrickSize), (float)(i / (BrickSize * BrickSize))};
+            simd::float3 position = brickOrigin + offset * volume.voxelSize;
+
+            // Beyond the band the magnitude clamps anyway, the query stops there
+            float distance = std::sqrt(bvh.closestDistanceSquared(position, bandSquared));
+            if (isInside(bvh, position))
+                distance = -distance;
+
+            uint32_t value = quantize(distance, volume.bandWidth, volume.format);
+            if (volume.format == Format::Unorm8) {
+                volume.brickData[slot * BrickSamples + i] = (uint8_t)value;
+            } else {
+                uint16_t value16 = (uint16_t)value;
+                std::memcpy(volume.brickData.data() + (slot * BrickSamples + i) * 2, &value16, sizeof(value16));
+            }
+        }
+    });
+
+    if (stats) {
+        stats->volumeCount = volumeCount;
+        stats->brickCells = cellOffsets.back();
+        stats->storedBricks = (uint32_t)jobs.size();
+        stats->samples = (uint64_t)jobs.size() * BrickSamples + cellOffsets.back();
+        stats->threadCount = usedThreads;
+        stats->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    }
+    return volumes;
+}
+
+float sample(const Volume& volume, simd::float3 position) {
+    simd::uint3 sampleCounts = volume.brickCounts * BrickStride;
+    simd::float3 volumeMax = volume.origin + simd::float3{(float)sampleCounts.x, (float)sampleCounts.y, (float)sampleCounts.z} * volume.voxelSize;
+    simd::float3 clamped = simd::clamp(position, volume.origin, volumeMax);
+    float outsideDistance = simd::length(position - clamped);
+
+    simd::float3 grid = (clamped - volume.origin) / volume.voxelSize;
+    simd::float3 brickCoordinate = simd::min(simd::floor(grid / (float)BrickStride),
+                                             simd::float3{(float)volume.brickCounts.x, (float)volume.brickCounts.y, (float)volume.brickCounts.z} - 1.0f);
+    simd::uint3 brick = {(uint32_t)brickCoordinate.x, (uint32_t)brickCoordinate.y, (uint32_t)brickCoordinate.z};
+    uint32_t slot = volume.brickTable[brick.x + volume.brickCounts.x * (brick.y + volume.brickCounts.y * brick.z)];
+    if (slot == EmptyOutside)
+        return volume.bandWidth + outsideDistance;
+    if (slot == EmptyInside)
+        return -volume.bandWidth + outsideDistance;
+
+    simd::float3 local = simd::clamp(grid - brickCoordinate * (float)BrickStride, simd::float3(0.0f), simd::float3((float)BrickStride));
+    simd::float3 base = simd::min(simd::floor(local), simd::float3((float)(BrickStride - 1)));
+    simd::float3 weight = local - base;
+    uint32_t x = (uint32_t)base.x, y = (uint32_t)base.y, z = (uint32_t)base.z;
+
+    auto at = [&](uint32_t dx, uint32_t dy, uint32_t dz) {
+        return dequantize(volume, slot, (x + dx) + BrickSize * ((y + dy) + BrickSize * (z + dz)));
+    };
+    float c00 = at(0, 0, 0) + (at(1, 0, 0) - at(0, 0, 0)) * weight.x;
+    float c10 = at(0, 1, 0) + (at(1, 1, 0) - at(0, 1, 0)) * weight.x;
+    float c01 = at(0, 0, 1) + (at(1, 0, 1) - at(0, 0, 1)) * weight.x;
+    float c11 = at(0, 1, 1) + (at(1, 1, 1) - at(0, 1, 1)) * weight.x;
+    float c0 = c00 + (c10 - c00) * weight.y;
+    float c1 = c01 + (c11 - c01) * weight.y;
+    return c0 + (c1 - c0) * weight.z + outsideDistance;
+}
+
+// FNV-1a
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t sourceHash(const Mesh& mesh, const BakeSettings& settings) {
+    constexpr uint32_t Version = 1;
+    uint64_t hash = 14695981039346656037ull;
+    hash = hashBytes(hash, &Version, sizeof(Version));
+    hash = hashBytes(hash, &settings.resolution, sizeof(settings.resolution));
+    hash = hashBytes(hash, &settings.bandVoxels, sizeof(settings.bandVoxels));
+    hash = hashBytes(hash, &settings.format, sizeof(settings.format));
+    for (const Vertex& vertex : mesh.vertices) {
+        hash = hashBytes(hash, &vertex.position, sizeof(float) * 3);
+    }
+    hash = hashBytes(hash, mesh.vertexIndices.data(), mesh.vertexIndices.size() * sizeof(uint32_t));
+    for (const Submesh& submesh : mesh.submeshes) {
+        hash = hashBytes(hash, &submesh.indexOffset, sizeof(submesh.indexOffset));
+        hash = hashBytes(hash, &submesh.indexCount, sizeof(submesh.indexCount));
+    }
+    return hash;
+}
+
+namespace {
+    constexpr uint32_t CacheMagic = 0x46445353; // "SSDF"
+
+    struct CacheHeader {
+        uint32_t    magic;
+        uint32_t    volumeCount;
+        uint64_t    hash;
+    };
+
+    struct VolumeHeader {
+        float       origin[3];
+        float       voxelSize;
+        float       bandWidth;
+        uint32_t    brickCounts[3];
+        uint32_t    format;
+        uint32_t    storedBricks;
+    };
+}
+
+bool save(const std::string& path, uint64_t hash, const std::vector<Volume>& volumes) {
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+
+    CacheHeader header{.magic = CacheMagic, .volumeCount = (uint32_t)volumes.size(), .hash = hash};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const Volume& volume : volumes) {
+        VolumeHeader volumeHeader{
+            .origin = {volume.origin.x, volume.origin.y, volume.origin.z},
+            .voxelSize = volume.voxelSize,
+            .bandWidth = volume.bandWidth,
+            .brickCounts = {volume.brickCounts.x, volume.brickCounts.y, volume.brickCounts.z},
+            .format = (uint32_t)volume.format,
+            .storedBricks = volume.getBrickCount()
+        };
+        file.write(reinterpret_cast<const char*>(&volumeHeader), sizeof(volumeHeader));
+        file.write(reinterpret_cast<const char*>(volume.brickTable.data()), volume.brickTable.size() * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char*>(volume.brickData.data()), volume.brickData.size());
+    }
+    return file.good();
+}
+
+bool load(const std::string& path, uint64_t hash, std::vector<Volume>& volumes) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    CacheHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != CacheMagic || header.hash != hash)
+        return false;
+
+    std::vector<Volume> loaded(header.volumeCount);
+    for (Volume& volume : loaded) {
+        VolumeHeader volumeHeader;
+        if (!file.read(reinterpret_cast<char*>(&volumeHeader), sizeof(volumeHeader)))
+            return false;
+        if (volumeHeader.format != (uint32_t)Format::Unorm8 && volumeHeader.format != (uint32_t)Format::Unorm16)
+            return false;
+
+        volume.origin = {volumeHeader.origin[0], volumeHeader.origin[1], volumeHeader.origin[2]};
+        volume.voxelSize = volumeHeader.voxelSize;
+        volume.bandWidth = volumeHeader.bandWidth;
+        volume.brickCounts = {volumeHeader.brickCounts[0], volumeHeader.brickCounts[1], volumeHeader.brickCounts[2]};
+        volume.format = (Format)volumeHeader.format;
+        volume.brickTable.resize((size_t)volume.brickCounts.x * volume.brickCounts.y * volume.brickCounts.z);
+        volume.brickData.resize((size_t)volumeHeader.storedBricks * BrickSamples * volumeHeader.format);
+        if (!file.read(reinterpret_cast<char*>(volume.brickTable.data()), volume.brickTable.size() * sizeof(uint32_t)) ||
+            !file.read(reinterpret_cast<char*>(volume.brickData.data()), volume.brickData.size()))
+            return false;
+    }
+    volumes = std::move(loaded);
+    return true;
+}
+
+std::vector<Volume> loadOrBake(const Mesh& mesh, const std::string& directory, const BakeSettings& settings) {
+    uint64_t hash = sourceHash(mesh, settings);
+    char fileName[32];
+    snprintf(fileName, sizeof(fileName), "/%016llx.sdf", (unsigned long long)hash);
+    std::string path = directory + fileName;
+
+    std::vector<Volume> volumes;
+    if (load(path, hash, volumes))
+        return volumes;
+
+    BakeStats stats;
+    volumes = bake(mesh, settings, &stats);
+    printf("Baked %u SDF volumes: %u of %u bricks stored, %.1f ms\n",
+           stats.volumeCount, stats.storedBricks, stats.brickCells, stats.milliseconds);
+    if (!save(path, hash, volumes))
+        std::cerr << "Failed to write SDF cache: " << path << std::endl;
+    return volumes;
+}
+
+void benchmark(const Mesh& mesh, const BakeSettings& settings) {
+    uint32_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    printf("SDF bake benchmark: %zu submeshes, %zu triangles, resolution %u, %u bit\n",
+           mesh.submeshes.size(), mesh.vertexIndices.size() / 3, settings.resolution, 8 * (uint32_t)settings.format);
+
+    for (uint32_t threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+        BakeSettings run = settings;
+        run.threadCount = threads;
+        BakeStats stats;
+        std::vector<Volume> volumes = bake(mesh, run, &stats);
+
+        size_t storedBytes = 0, denseBytes = 0;
+        for (const Volume& volume : volumes) {
+            storedBytes += volume.brickTable.size() * sizeof(uint32_t) + volume.brickData.size();
+            denseBytes += volume.brickTable.size() * BrickSamples * (uint32_t)volume.format;
+        }
+        printf("  %2u threads: %8.1f ms, %7.2f Msamples/s, %u of %u bricks, %.1f MB (%.1f MB dense)\n",
+               threads, stats.milliseconds, stats.samples / (stats.milliseconds * 1000.0),
+               stats.storedBricks, stats.brickCells, storedBytes / 1048576.0, denseBytes / 1048576.0);
+        if (threads == maxThreads)
+            break;
+    }
+}
+
+}
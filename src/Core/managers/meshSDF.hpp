@@ -0,0 +1,73 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+
+struct Mesh;
+
+// Signed distance volumes for soft shadows, AO and collision queries without ray
+// tracing hardware. Each submesh gets its own volume covering its bounds plus the
+// narrow band. The volume is split into bricks of BrickSize^3 samples; only bricks
+// that reach into the band around the surface are stored, quantised to 8 or 16
+// bits, the rest keep a single inside/outside flag in the brick table. Distances
+// are exact within the band (closest point against a BVH), the sign comes from
+// ray parity against the same BVH. Baking runs on every hardware thread.
+namespace MeshSDF {
+    constexpr uint32_t BrickSize        = 8;
+    // Neighbouring bricks share their border samples, trilinear filtering never leaves a brick
+    constexpr uint32_t BrickStride      = BrickSize - 1;
+    constexpr uint32_t BrickSamples     = BrickSize * BrickSize * BrickSize;
+    constexpr uint32_t EmptyOutside     = 0xFFFFFFFF;
+    constexpr uint32_t EmptyInside      = 0xFFFFFFFE;
+
+    enum class Format : uint32_t {
+        Unorm8  = 1,
+        Unorm16 = 2
+    };
+
+    struct BakeSettings {
+        uint32_t    resolution = 64;            // Voxels along the longest axis of a submesh
+        float       bandVoxels = 4.0f;          // Half width of the stored band
+        Format      format = Format::Unorm8;
+        uint32_t    threadCount = 0;            // Zero draws from the caller's ThreadBudget, see parallelFor
+    };
+
+    struct Volume {
+        simd::float3            origin;         // Position of the first sample
+        float                   voxelSize;
+        float                   bandWidth;      // Stored distances cover [-bandWidth, bandWidth]
+        simd::uint3             brickCounts;
+        Format                  format = Format::Unorm8;
+        std::vector<uint32_t>   brickTable;     // Slot per brick cell, x fastest, or EmptyInside/EmptyOutside
+        std::vector<uint8_t>    brickData;      // BrickSamples per slot, x fastest
+
+        uint32_t getBrickCount() const { return (uint32_t)(brickData.size() / (BrickSamples * (uint32_t)format)); }
+    };
+
+    struct BakeStats {
+        uint32_t    volumeCount = 0;
+        uint32_t    brickCells = 0;
+        uint32_t    storedBricks = 0;
+        uint64_t    samples = 0;                // Distance samples evaluated
+        uint32_t    threadCount = 0;
+        double      milliseconds = 0.0;
+    };
+
+    // One volume per submesh, in submesh order
+    std::vector<Volume> bake(const Mesh& mesh, const BakeSettings& settings, BakeStats* stats = nullptr);
+
+    // Trilinear distance at a position in mesh space. Outside the volume the distance to
+    // the volume is added, so the result stays a conservative bound for sphere tracing.
+    float sample(const Volume& volume, simd::float3 position);
+
+    // Cooked cache, keyed by the geometry and the settings
+    uint64_t sourceHash(const Mesh& mesh, const BakeSettings& settings);
+    bool save(const std::string& path, uint64_t hash, const std::vector<Volume>& volumes);
+    bool load(const std::string& path, uint64_t hash, std::vector<Volume>& volumes);
+    // Reads the cached bake from directory if present, otherwise bakes and writes it
+    std::vector<Volume> loadOrBake(const Mesh& mesh, const std::string& directory, const BakeSettings& settings);
+
+    // Bakes with 1, 2, 4 ... hardware threads and prints the throughput of each run
+    void benchmark(const Mesh& mesh, const BakeSettings& settings);
+}
@@ -0,0 +1,72 @@
+#include "msaaClassifierReference.hpp"
+
+namespace MSAAClassifierReference {
+
+static uint32_t depthBits(float depth) {
+    uint32_t bits;
+    std::memcpy(&bits, &depth, sizeof(bits));
+    return bits & 0x7FFFFFFF;
+}
+
+static uint32_t absoluteDifference(uint32_t a, uint32_t b) {
+    return std::max(a, b) - std::min(a, b);
+}
+
+bool isComplexPixel(const GBufferSamples& samples, uint32_t x, uint32_t y, const MSAAClassifyParams& params) {
+    size_t base = ((size_t)y * samples.width + x) * samples.sampleCount;
+    const auto& albedo0 = samples.albedo[base];
+    const auto& normal0 = samples.normal[base];
+    uint32_t depth0 = depthBits(samples.depth[base]);
+
+    for (uint32_t s = 1; s < samples.sampleCount; s++) {
+        const auto& albedo = samples.albedo[base + s];
+        for (int c = 0; c < 4; c++) {
+            if (absoluteDifference(albedo[c], albedo0[c]) > params.albedoThreshold)
+                return true;
+        }
+
+        const auto& normal = samples.normal[base + s];
+        int normalDifference = 0;
+        for (int c = 0; c < 4; c++) {
+            normalDifference += std::abs((int)normal[c] - (int)normal0[c]);
+        }
+        if ((uint32_t)normalDifference > params.normalThreshold)
+            return true;
+
+        if (absoluteDifference(depthBits(samples.depth[base + s]), depth0) > params.depthThreshold)
+            return true;
+    }
+    return false;
+}
+
+Result classify(const GBufferSamples& samples, const MSAAClassifyParams& params, uint32_t tileSize) {
+    Result result;
+    result.edgeMask.resize((size_t)samples.width * samples.height);
+
+    uint32_t tileCountX = (samples.width + tileSize - 1) / tileSize;
+    uint32_t tileCountY = (samples.height + tileSize - 1) / tileSize;
+
+    for (uint32_t tileY = 0; tileY < tileCountY; tileY++) {
+        for (uint32_t tileX = 0; tileX < tileCountX; tileX++) {
+            uint32_t simpleCount = 0;
+            uint32_t complexCount = 0;
+
+            for (uint32_t y = tileY * tileSize; y < std::min((tileY + 1) * tileSize, samples.height); y++) {
+                for (uint32_t x = tileX * tileSize; x < std::min((tileX + 1) * tileSize, samples.width); x++) {
+                    bool complex = isComplexPixel(samples, x, y, params);
+                    result.edgeMask[(size_t)y * samples.width + x] = complex ? 1 : 0;
+                    complex ? complexCount++ : simpleCount++;
+                }
+            }
+
+            uint32_t packedTile = tileX | (tileY << 16);
+            if (simpleCount > 0)
+                result.simpleTiles.push_back(packedTile);
+            if (complexCount > 0)
+                result.complexTiles.push_back(packedTile);
+        }
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+#include "../../../data/shaders/shaderTypes.hpp"
+
+// CPU version of msaaClassifyKernel. It works on the same raw texel bits as the GPU
+// (RGBA8 albedo bytes, RGBA8 snorm normal bytes, R32Float depth), with integer
+// comparisons only, so the edge mask matches the GPU bit for bit. Tile lists are
+// produced in row-major order; the GPU appends them in any order, compare as sets.
+// Run against a readback by DeferredMSAA::checkReference when REFERENCE_CHECKS is on.
+namespace MSAAClassifierReference {
+    struct GBufferSamples {
+        uint32_t                            width = 0;
+        uint32_t                            height = 0;
+        uint32_t                            sampleCount = 4;
+
+        // Indexed by (y * width + x) * sampleCount + sample
+        std::vector<std::array<uint8_t, 4>> albedo;
+        std::vector<std::array<int8_t, 4>>  normal;
+        std::vector<float>                  depth;
+    };
+
+    struct Result {
+        std::vector<uint8_t>    edgeMask;       // 1 for pixels shaded per sample, row major
+        std::vector<uint32_t>   simpleTiles;    // Packed x | (y << 16)
+        std::vector<uint32_t>   complexTiles;
+    };
+
+    bool isComplexPixel(const GBufferSamples& samples, uint32_t x, uint32_t y, const MSAAClassifyParams& params);
+    Result classify(const GBufferSamples& samples, const MSAAClassifyParams& params, uint32_t tileSize = 8);
+}
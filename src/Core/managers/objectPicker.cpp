@@ -0,0 +1,123 @@
+#include "objectPicker.hpp"
+
+ObjectPicker::ObjectPicker(MTL::Device* device) : device(device) {
+    for (auto& slot : slots) {
+        slot.idBuffer = device->newBuffer(RegionSize * RegionSize * sizeof(simd::uint2), MTL::ResourceStorageModeShared);
+        slot.idBuffer->setLabel(NS::String::string("Pick ID Readback", NS::ASCIIStringEncoding));
+        slot.depthBuffer = device->newBuffer(RegionSize * RegionSize * sizeof(float), MTL::ResourceStorageModeShared);
+        slot.depthBuffer->setLabel(NS::String::string("Pick Depth Readback", NS::ASCIIStringEncoding));
+    }
+}
+
+ObjectPicker::~ObjectPicker() {
+    for (auto& slot : slots) {
+        slot.idBuffer->release();
+        slot.depthBuffer->release();
+    }
+}
+
+void ObjectPicker::requestPick(uint32_t x, uint32_t y) {
+    pending = true;
+    pendingX = x;
+    pendingY = y;
+}
+
+void ObjectPicker::encodeReadback(MTL::CommandBuffer* commandBuffer, MTL::Texture* objectIdTexture, MTL::Texture* depthTexture, uint64_t frameNumber) {
+    if (!pending || !objectIdTexture)
+        return;
+
+    Slot& slot = slots[writeIndex];
+    // Every slot is still waiting on the GPU, try again next frame
+    if (slot.inFlight)
+        return;
+
+    uint32_t textureWidth = (uint32_t)objectIdTexture->width();
+    uint32_t textureHeight = (uint32_t)objectIdTexture->height();
+    if (pendingX >= textureWidth || pendingY >= textureHeight) {
+        pending = false;
+        return;
+    }
+
+    // Clamp the region to the texture so picks near the border still work
+    const uint32_t halfSize = RegionSize / 2;
+    uint32_t originX = pendingX > halfSize ? pendingX - halfSize : 0;
+    uint32_t originY = pendingY > halfSize ? pendingY - halfSize : 0;
+    uint32_t width = std::min(RegionSize, textureWidth - originX);
+    uint32_t height = std::min(RegionSize, textureHeight - originY);
+
+    slot.localX = pendingX - originX;
+    slot.localY = pendingY - originY;
+    slot.width = width;
+    slot.height = height;
+    slot.frame = frameNumber;
+    slot.inFlight = true;
+    slot.completed.store(false, std::memory_order_relaxed);
+
+    MTL::BlitCommandEncoder* blitEncoder = commandBuffer->blitCommandEncoder();
+    blitEncoder->setLabel(NS::String::string("Object Pick Readback", NS::ASCIIStringEncoding));
+    blitEncoder->copyFromTexture(objectIdTexture, 0, 0, MTL::Origin(originX, originY, 0), MTL::Size(width, height, 1),
+                                 slot.idBuffer, 0, width * sizeof(simd::uint2), width * height * sizeof(simd::uint2));
+    if (depthTexture) {
+        blitEncoder->copyFromTexture(depthTexture, 0, 0, MTL::Origin(originX, originY, 0), MTL::Size(width, height, 1),
+                                     slot.depthBuffer, 0, width * sizeof(float), width * height * sizeof(float));
+    }
+    blitEncoder->endEncoding();
+
+    std::atomic<bool>* completed = &slot.completed;
+    commandBuffer->addCompletedHandler([completed](MTL::CommandBuffer*) {
+        completed->store(true, std::memory_order_release);
+    });
+
+    pending = false;
+    writeIndex = (writeIndex + 1) % RingSize;
+}
+
+void ObjectPicker::resolve() {
+    for (auto& slot : slots) {
+        if (!slot.inFlight || !slot.completed.load(std::memory_order_acquire))
+            continue;
+
+        slot.inFlight = false;
+        slot.completed.store(false, std::memory_order_relaxed);
+
+        // An older readback can finish after a newer one has been resolved
+        if (slot.frame < resolvedFrame)
+            continue;
+
+        const simd::uint2* ids = reinterpret_cast<const simd::uint2*>(slot.idBuffer->contents());
+        const float* depths = reinterpret_cast<const float*>(slot.depthBuffer->contents());
+
+        // Take the covered pixel closest to the cursor so thin geometry is still selectable
+        int bestIndex = -1;
+        uint32_t bestDistance = std::numeric_limits<uint32_t>::max();
+        for (uint32_t y = 0; y < slot.height; y++) {
+            for (uint32_t x = 0; x < slot.width; x++) {
+                uint32_t index = y * slot.width + x;
+                if (ids[index].x == 0)
+                    continue;
+
+                int dx = (int)x - (int)slot.localX;
+                int dy = (int)y - (int)slot.localY;
+                uint32_t distance = (uint32_t)(dx * dx + dy * dy);
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    bestIndex = (int)index;
+                }
+            }
+        }
+
+        resolvedFrame = std::max<uint64_t>(slot.frame, 1);
+        newResult = true;
+        if (bestIndex < 0) {
+            result.reset();
+            continue;
+        }
+
+        result = PickResult{
+            .instanceId = ids[bestIndex].x - 1,
+            .triangleId = ids[bestIndex].y,
+            .depth = depths[bestIndex],
+            .frame = slot.frame
+        };
+    }
+}
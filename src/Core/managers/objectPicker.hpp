@@ -0,0 +1,69 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+#include <simd/simd.h>
+#include <optional>
+#include <utility>
+
+struct PickResult {
+    uint32_t instanceId;    // Index of the mesh that was hit
+    uint32_t triangleId;    // Triangle index inside that mesh's index buffer
+    float    depth;         // Value stored in the depth G-buffer at that pixel
+    uint64_t frame;         // Frame the pick was captured in
+};
+
+// Copies a small region of the object ID target around the cursor into a ring of
+// shared buffers and resolves it once the GPU is done with it, so selecting an
+// object never blocks the frame on waitUntilCompleted.
+class ObjectPicker {
+public:
+    static constexpr uint32_t RegionSize = 5;   // Odd so the cursor sits in the centre
+    static constexpr uint32_t RingSize   = 3;
+
+    ObjectPicker(MTL::Device* device);
+    ~ObjectPicker();
+
+    // Queue a pick at framebuffer pixel (x, y). Only the most recent request is kept.
+    void requestPick(uint32_t x, uint32_t y);
+
+    // Encode the readback of a pending request. Must be called after the G-buffer pass.
+    void encodeReadback(MTL::CommandBuffer* commandBuffer, MTL::Texture* objectIdTexture, MTL::Texture* depthTexture, uint64_t frameNumber);
+
+    // Consume every slot the GPU has finished with and update the latest result.
+    void resolve();
+
+    // Hit under the cursor from the most recently resolved pick, or nothing if it missed.
+    std::optional<PickResult> getResult() const { return result; }
+
+    // True once for every resolve() that produced a new result, so it is applied a single time
+    bool takeResolvedPick() { return std::exchange(newResult, false); }
+
+private:
+    struct Slot {
+        MTL::Buffer*        idBuffer    = nullptr;
+        MTL::Buffer*        depthBuffer = nullptr;
+        std::atomic<bool>   completed   {false};
+        bool                inFlight    = false;
+
+        // Request position relative to the copied region
+        uint32_t            localX      = 0;
+        uint32_t            localY      = 0;
+        uint32_t            width       = 0;
+        uint32_t            height      = 0;
+        uint64_t            frame       = 0;
+    };
+
+    MTL::Device*                    device;
+    std::array<Slot, RingSize>      slots;
+    uint32_t                        writeIndex = 0;
+
+    bool                            pending = false;
+    uint32_t                        pendingX = 0;
+    uint32_t                        pendingY = 0;
+
+    std::optional<PickResult>       result;
+    uint64_t                        resolvedFrame = 0;
+    bool                            newResult = false;
+};
@@ -0,0 +1,211 @@
+#include "opacityMicromap.hpp"
+
+#include "parallel.hpp"
+#include "../Components/mesh.hpp"
+
+#include <cmath>
+
+namespace OpacityMicromap {
+
+static constexpr uint32_t MicroTrianglesPerEdge = 1u << OpacitySubdivisionLevel;
+
+// First micro triangle of a row, rows shrink by two towards the third vertex
+static uint32_t rowStart(uint32_t row) {
+    return row * (2 * MicroTrianglesPerEdge - row);
+}
+
+uint32_t microTriangleIndex(simd::float2 barycentrics) {
+    const float n = (float)MicroTrianglesPerEdge;
+    float a = std::clamp(barycentrics.x, 0.0f, 1.0f) * n;
+    float b = std::clamp(barycentrics.y, 0.0f, 1.0f) * n;
+    uint32_t row = std::min((uint32_t)b, MicroTrianglesPerEdge - 1);
+    uint32_t column = std::min((uint32_t)a, MicroTrianglesPerEdge - 1 - row);
+    bool inverted = (a - column) + (b - row) > 1.0f && column + row + 1 < MicroTrianglesPerEdge;
+    return rowStart(row) + 2 * column + (inverted ? 1 : 0);
+}
+
+// Barycentric corners of every micro triangle, in index order
+static std::array<std::array<simd::float2, 3>, OpacityMicroTriangleCount> microTriangleCorners() {
+    std::array<std::array<simd::float2, 3>, OpacityMicroTriangleCount> corners;
+    const float step = 1.0f / MicroTrianglesPerEdge;
+    for (uint32_t row = 0; row < MicroTrianglesPerEdge; row++) {
+        for (uint32_t column = 0; column + row < MicroTrianglesPerEdge; column++) {
+            simd::float2 origin = simd::float2{(float)column, (float)row} * step;
+            corners[rowStart(row) + 2 * column] = {origin, origin + simd::float2{step, 0.0f}, origin + simd::float2{0.0f, step}};
+            if (column + row + 1 < MicroTrianglesPerEdge) {
+                corners[rowStart(row) + 2 * column + 1] = {origin + simd::float2{step, 0.0f}, origin + simd::float2{step, step},
+                                                           origin + simd::float2{0.0f, step}};
+            }
+        }
+    }
+    return corners;
+}
+
+OpacityState triangleState(uint32_t states) {
+    if (states == AllOpaque)
+        return OpacityStateOpaque;
+    if (states == AllTransparent)
+        return OpacityStateTransparent;
+    return OpacityStateUnknown;
+}
+
+AlphaMasks buildAlphaMasks(const ImpostorRasterizer::TextureSource& textures, const Settings& settings) {
+    const uint32_t layerCount = (uint32_t)textures.infos.size();
+    AlphaMasks masks;
+    masks.layers.resize(layerCount, AlphaMaskLayer{});
+    masks.layerStates.resize(layerCount, OpacityStateOpaque);
+
+    // Layers are masked in parallel into their own words, then concatenated
+    std::vector<std::vector<uint32_t>> layerWords(layerCount);
+    const uint32_t* source = textures.texels.data();
+    parallelFor(layerCount, settings.threadCount, 1, [&](uint32_t layer) {
+        uint32_t width = std::min((uint32_t)textures.infos[layer].width, textures.width);
+        uint32_t height = std::min((uint32_t)textures.infos[layer].height, textures.height);
+        uint32_t wordsPerRow = (width + 31) / 32;
+        std::vector<uint32_t>& words = layerWords[layer];
+        words.assign((size_t)wordsPerRow * height, 0);
+
+        const uint32_t* texels = source + (size_t)layer * textures.width * textures.height;
+        size_t opaqueTexels = 0;
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                if ((texels[(size_t)y * textures.width + x] >> 24) >= settings.alphaCutoff) {
+                    words[(size_t)y * wordsPerRow + x / 32] |= 1u << (x & 31);
+                    opaqueTexels++;
+                }
+            }
+        }
+
+        if (opaqueTexels == (size_t)width * height) {
+            masks.layerStates[layer] = OpacityStateOpaque;
+            words.clear();
+        } else if (opaqueTexels == 0) {
+            masks.layerStates[layer] = OpacityStateTransparent;
+            words.clear();
+        } else {
+            masks.layerStates[layer] = OpacityStateUnknown;
+            masks.layers[layer] = AlphaMaskLayer{.wordOffset = 0, .width = width, .height = height, .wordsPerRow = wordsPerRow};
+        }
+    });
+
+    for (uint32_t layer = 0; layer < layerCount; layer++) {
+        masks.layers[layer].wordOffset = (uint32_t)masks.words.size();
+        masks.words.insert(masks.words.end(), layerWords[layer].begin(), layerWords[layer].end());
+    }
+    return masks;
+}
+
+// State of the texels a micro triangle can sample. The footprint is the texel box
+// around its UV triangle, which is conservative: extra texels can only turn an
+// opaque or transparent answer into unknown.
+static OpacityState classifyFootprint(const AlphaMasks& masks, uint32_t layer, const simd::float2 uvs[3]) {
+    const AlphaMaskLayer& mask = masks.layers[layer];
+    simd::float2 size = {(float)mask.width, (float)mask.height};
+    simd::float2 p0 = uvs[0] * size, p1 = uvs[1] * size, p2 = uvs[2] * size;
+    simd::float2 low = simd::floor(simd::min(simd::min(p0, p1), p2));
+    simd::float2 high = simd::floor(simd::max(simd::max(p0, p1), p2));
+    if (!simd::all(simd::isfinite(low)) || !simd::all(simd::isfinite(high)))
+        return OpacityStateUnknown;
+
+    // Covering a whole period of the repeat addressed layer samples every texel of it
+    if (high.x - low.x + 1.0f >= size.x && high.y - low.y + 1.0f >= size.y)
+        return OpacityStateUnknown;
+    high = simd::min(high, low + size - 1.0f);
+
+    auto wrap = [](int64_t value, uint32_t size) { return (uint32_t)(((value % size) + size) % size); };
+    const uint32_t* words = masks.words.data() + mask.wordOffset;
+    bool seenOpaque = false, seenTransparent = false;
+    for (int64_t y = (int64_t)low.y; y <= (int64_t)high.y; y++) {
+        const uint32_t* row = words + (size_t)wrap(y, mask.height) * mask.wordsPerRow;
+        for (int64_t x = (int64_t)low.x; x <= (int64_t)high.x; x++) {
+            uint32_t texel = wrap(x, mask.width);
+            if ((row[texel / 32] >> (texel & 31)) & 1) {
+                seenOpaque = true;
+            } else {
+                seenTransparent = true;
+            }
+            if (seenOpaque && seenTransparent)
+                return OpacityStateUnknown;
+        }
+    }
+    return seenOpaque ? OpacityStateOpaque : OpacityStateTransparent;
+}
+
+std::vector<uint32_t> classify(const Mesh& mesh, const AlphaMasks& masks, const Settings& settings, Stats* stats) {
+    auto startTime = std::chrono::steady_clock::now();
+    const uint32_t triangleCount = (uint32_t)(mesh.vertexIndices.size() / 3);
+    std::vector<uint32_t> states(triangleCount, AllOpaque);
+    const auto corners = microTriangleCorners();
+
+    std::atomic<uint32_t> unknownMicroTriangles{0};
+    parallelFor(triangleCount, settings.threadCount, 1024, [&](uint32_t triangle) {
+        const Vertex& v0 = mesh.vertices[mesh.vertexIndices[3 * (size_t)triangle]];
+        const Vertex& v1 = mesh.vertices[mesh.vertexIndices[3 * (size_t)triangle + 1]];
+        const Vertex& v2 = mesh.vertices[mesh.vertexIndices[3 * (size_t)triangle + 2]];
+        int32_t layer = v0.diffuseTextureIndex;
+        if (layer < 0 || (uint32_t)layer >= masks.layerStates.size())
+            return;
+
+        OpacityState layerState = masks.layerStates[layer];
+        if (layerState != OpacityStateUnknown) {
+            states[triangle] = layerState == OpacityStateOpaque ? AllOpaque : AllTransparent;
+            return;
+        }
+
+        uint32_t triangleStates = 0;
+        uint32_t unknown = 0;
+        for (uint32_t micro = 0; micro < OpacityMicroTriangleCount; micro++) {
+            simd::float2 uvs[3];
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                simd::float2 b = corners[micro][corner];
+                uvs[corner] = v0.textureCoordinate * (1.0f - b.x - b.y) + v1.textureCoordinate * b.x + v2.textureCoordinate * b.y;
+            }
+            OpacityState state = classifyFootprint(masks, (uint32_t)layer, uvs);
+            triangleStates |= (uint32_t)state << (2 * micro);
+            unknown += state == OpacityStateUnknown;
+        }
+        states[triangle] = triangleStates;
+        if (triangleState(triangleStates) == OpacityStateUnknown) {
+            unknownMicroTriangles.fetch_add(unknown, std::memory_order_relaxed);
+        }
+    });
+
+    if (stats) {
+        *stats = Stats{};
+        stats->triangles = triangleCount;
+        for (uint32_t triangleStates : states) {
+            switch (triangleState(triangleStates)) {
+                case OpacityStateOpaque:      stats->opaqueTriangles++; break;
+                case OpacityStateTransparent: stats->transparentTriangles++; break;
+                case OpacityStateUnknown:     stats->maskedTriangles++; break;
+            }
+        }
+        stats->unknownMicroTriangles = unknownMicroTriangles.load();
+        stats->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    }
+    return states;
+}
+
+std::vector<uint32_t> pack(std::span<const AlphaMasks> masks, std::vector<uint32_t>& layerBases) {
+    constexpr uint32_t HeaderWords = sizeof(AlphaMaskLayer) / sizeof(uint32_t);
+    uint32_t layerCount = 0;
+    layerBases.clear();
+    for (const AlphaMasks& set : masks) {
+        layerBases.push_back(layerCount);
+        layerCount += (uint32_t)set.layers.size();
+    }
+
+    std::vector<uint32_t> packed((size_t)layerCount * HeaderWords);
+    uint32_t layerIndex = 0;
+    for (const AlphaMasks& set : masks) {
+        uint32_t wordBase = (uint32_t)packed.size();
+        for (AlphaMaskLayer layer : set.layers) {
+            layer.wordOffset += wordBase;
+            memcpy(packed.data() + (size_t)layerIndex++ * HeaderWords, &layer, sizeof(layer));
+        }
+        packed.insert(packed.end(), set.words.begin(), set.words.end());
+    }
+    return packed;
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+#include <span>
+
+#include "impostorRasterizer.hpp"
+#include "../../../data/shaders/shaderTypes.hpp"
+
+struct Mesh;
+
+// Opacity micromaps for alpha masked ray tracing. At import the diffuse array of a
+// mesh is reduced to 1 bit alpha masks, then every triangle on a layer with both
+// opaque and transparent texels is split into OpacityMicroTriangleCount micro
+// triangles whose UV footprints are rasterised against the mask. A micro triangle is
+// opaque or transparent when every texel it can sample agrees, unknown otherwise.
+// The engine drops fully transparent triangles from the acceleration structure,
+// traces fully opaque ones as opaque geometry, and sends the rest through an
+// intersection function that reads the states and only samples the mask when the
+// hit lands in an unknown micro triangle.
+namespace OpacityMicromap {
+    constexpr uint32_t AllTransparent   = 0;
+    constexpr uint32_t AllOpaque        = 0x55555555;   // OpacityStateOpaque in every 2 bit state
+
+    struct Settings {
+        uint8_t     alphaCutoff = 128;      // Texels with at least this alpha are opaque
+        uint32_t    threadCount = 0;        // Zero draws from the caller's ThreadBudget, see parallelFor
+    };
+
+    struct AlphaMasks {
+        std::vector<AlphaMaskLayer>     layers;         // wordOffset is into words
+        std::vector<uint32_t>           words;
+        std::vector<OpacityState>       layerStates;    // Unknown layers are the ones with a mask
+    };
+
+    struct Stats {
+        uint32_t    triangles = 0;
+        uint32_t    opaqueTriangles = 0;
+        uint32_t    transparentTriangles = 0;
+        uint32_t    maskedTriangles = 0;
+        uint32_t    unknownMicroTriangles = 0;  // Of the masked triangles, the rest need no alpha test
+        double      milliseconds = 0.0;
+    };
+
+    AlphaMasks buildAlphaMasks(const ImpostorRasterizer::TextureSource& textures, const Settings& settings);
+    // One word of micro triangle states per triangle of mesh.vertexIndices. The layer
+    // of a triangle is its first vertex's diffuse index, like the G-buffer.
+    std::vector<uint32_t> classify(const Mesh& mesh, const AlphaMasks& masks, const Settings& settings, Stats* stats = nullptr);
+
+    // Micro triangle holding the barycentrics (weights of the second and third vertex),
+    // the same as opacityMicroTriangle in ray_trace.metal
+    uint32_t microTriangleIndex(simd::float2 barycentrics);
+    // Opaque or transparent when every micro triangle is, unknown otherwise
+    OpacityState triangleState(uint32_t states);
+
+    // Headers of every set then their words, with absolute word offsets, ready for the
+    // GPU. layerBases receives the index of each set's first header.
+    std::vector<uint32_t> pack(std::span<const AlphaMasks> masks, std::vector<uint32_t>& layerBases);
+}
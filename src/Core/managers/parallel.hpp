@@ -0,0 +1,73 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <thread>
+
+// Hardware threads shared by the parallel loops of tasks running at the same time.
+// StartupGraph owns one for its run and installs it on the thread of every task, so a
+// task spreads over the threads the other tasks leave idle instead of starting one
+// thread per core on top of them.
+class ThreadBudget {
+public:
+    explicit ThreadBudget(uint32_t threads) : idle((int32_t)threads) {}
+
+    // Takes up to wanted idle threads, possibly none
+    uint32_t acquire(uint32_t wanted) {
+        int32_t available = idle.load(std::memory_order_relaxed);
+        int32_t taken;
+        do {
+            taken = std::clamp(available, 0, (int32_t)wanted);
+        } while (taken > 0 && !idle.compare_exchange_weak(available, available - taken, std::memory_order_relaxed));
+        return (uint32_t)taken;
+    }
+
+    void release(uint32_t count) { idle.fetch_add((int32_t)count, std::memory_order_relaxed); }
+
+    // Budget of the calling thread, null when it has none
+    static ThreadBudget*& current() {
+        static thread_local ThreadBudget* budget = nullptr;
+        return budget;
+    }
+
+private:
+    std::atomic<int32_t> idle;
+};
+
+// Runs work(index) for every index below count, threads pull chunks from a shared counter
+// and the calling thread is one of them. A threadCount of zero takes the extra threads
+// from the calling thread's budget, or every hardware thread when it has none. Returns
+// the number of threads that ran.
+template<typename Work>
+uint32_t parallelFor(uint32_t count, uint32_t threadCount, uint32_t chunkSize, const Work& work) {
+    std::atomic<uint32_t> next{0};
+    auto worker = [&]() {
+        while (true) {
+            uint32_t first = next.fetch_add(chunkSize, std::memory_order_relaxed);
+            if (first >= count)
+                return;
+            uint32_t last = std::min(first + chunkSize, count);
+            for (uint32_t i = first; i < last; i++) {
+                work(i);
+            }
+        }
+    };
+
+    ThreadBudget* budget = threadCount ? nullptr : ThreadBudget::current();
+    uint32_t wanted = threadCount ? threadCount : std::max(std::thread::hardware_concurrency(), 1u);
+    wanted = std::max(1u, std::min(wanted, (count + chunkSize - 1) / chunkSize));
+    uint32_t extra = budget ? budget->acquire(wanted - 1) : wanted - 1;
+
+    std::vector<std::thread> threads;
+    threads.reserve(extra);
+    for (uint32_t i = 0; i < extra; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (budget)
+        budget->release(extra);
+    return extra + 1;
+}
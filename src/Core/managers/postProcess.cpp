@@ -0,0 +1,178 @@
+#include "postProcess.hpp"
+#if REFERENCE_CHECKS
+#include "postProcessReference.hpp"
+#endif
+
+PostProcess::PostProcess(MTL::Device* device, RenderPipeline& pipelines, GPUProfiler& profiler)
+: params(defaultParams()), device(device), pipelines(pipelines), profiler(profiler) {}
+
+PostProcess::~PostProcess() {
+    releaseTextures(nullptr);
+}
+
+PostProcessParams PostProcess::defaultParams() {
+    return PostProcessParams{
+        .exposure = 0.0f,
+        .bloomThreshold = 1.0f,
+        .bloomKnee = 0.5f,
+        .bloomIntensity = 0.05f,
+        .lift = simd::float4{0.0f, 0.0f, 0.0f, 0.0f},
+        .gamma = simd::float4{1.0f, 1.0f, 1.0f, 1.0f},
+        .gain = simd::float4{1.0f, 1.0f, 1.0f, 1.0f},
+        .saturation = 1.0f,
+        .contrast = 1.0f,
+        .ditherStrength = 1.0f,
+        .frameIndex = 0
+    };
+}
+
+void PostProcess::releaseTextures(ResourceRegistry* resources) {
+    for (auto& mip : bloomMips) {
+        if (mip) {
+            resources ? resources->retire(mip) : mip->release();
+            mip = nullptr;
+        }
+    }
+    if (bloomTexture) {
+        resources ? resources->retire(bloomTexture) : bloomTexture->release();
+        bloomTexture = nullptr;
+    }
+}
+
+void PostProcess::resize(uint32_t width, uint32_t height, ResourceRegistry& resources) {
+    // Frames in flight may still read the old chain
+    releaseTextures(&resources);
+
+    uint32_t bloomWidth = std::max(width / 2, 1u);
+    uint32_t bloomHeight = std::max(height / 2, 1u);
+    uint32_t maxLevels = (uint32_t)log2(std::max(bloomWidth, bloomHeight)) + 1;
+    bloomLevelCount = std::min(BloomLevels, maxLevels);
+
+    MTL::TextureDescriptor* descriptor = MTL::TextureDescriptor::alloc()->init();
+    descriptor->setTextureType(MTL::TextureType2D);
+    descriptor->setPixelFormat(MTL::PixelFormatRGBA16Float);
+    descriptor->setWidth(bloomWidth);
+    descriptor->setHeight(bloomHeight);
+    descriptor->setMipmapLevelCount(bloomLevelCount);
+    descriptor->setStorageMode(MTL::StorageModePrivate);
+    descriptor->setUsage(MTL::TextureUsageShaderRead | MTL::TextureUsageShaderWrite | MTL::TextureUsagePixelFormatView);
+    bloomTexture = device->newTexture(descriptor);
+    bloomTexture->setLabel(NS::String::string("Bloom Chain", NS::ASCIIStringEncoding));
+    descriptor->release();
+
+    // Views are created once here instead of per dispatch
+    for (uint32_t level = 0; level < bloomLevelCount; level++) {
+        bloomMips[level] = bloomTexture->newTextureView(MTL::PixelFormatRGBA16Float, MTL::TextureType2D,
+                                                        NS::Range(level, 1), NS::Range(0, 1));
+    }
+}
+
+void PostProcess::encode(MTL::CommandBuffer* commandBuffer, MTL::Texture* hdrTexture, MTL::Texture* outputTexture, uint32_t frameIndex) {
+    params.frameIndex = frameIndex;
+
+    MTL::Size threadsPerGroup(GroupSize, GroupSize, 1);
+    auto groupsFor = [&](MTL::Texture* texture) {
+        return MTL::Size((texture->width() + GroupSize - 1) / GroupSize, (texture->height() + GroupSize - 1) / GroupSize, 1);
+    };
+
+    #pragma mark Bloom downsample
+    {
+        MTL::ComputeCommandEncoder* encoder = commandBuffer->computeCommandEncoder(profiler.computePassDescriptor("Bloom Downsample"));
+        encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::BloomDownsample));
+        encoder->setBytes(&params, sizeof(params), BufferIndexPostProcess);
+
+        for (uint32_t level = 0; level < bloomLevelCount; level++) {
+            // The first level also applies the brightness threshold
+            uint32_t applyThreshold = level == 0 ? 1 : 0;
+            MTL::Texture* source = level == 0 ? hdrTexture : bloomMips[level - 1];
+            encoder->setBytes(&applyThreshold, sizeof(applyThreshold), BufferIndexPostProcessStage);
+            encoder->setTexture(source, TextureIndexPostSource);
+            encoder->setTexture(bloomMips[level], TextureIndexPostDestination);
+            encoder->dispatchThreadgroups(groupsFor(bloomMips[level]), threadsPerGroup);
+        }
+        encoder->endEncoding();
+    }
+
+    #pragma mark Bloom upsample
+    {
+        MTL::ComputeCommandEncoder* encoder = commandBuffer->computeCommandEncoder(profiler.computePassDescriptor("Bloom Upsample"));
+        encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::BloomUpsample));
+
+        // Accumulate from the smallest mip back up to mip 0
+        for (uint32_t level = bloomLevelCount - 1; level > 0; level--) {
+            encoder->setTexture(bloomMips[level], TextureIndexPostSource);
+            encoder->setTexture(bloomMips[level - 1], TextureIndexPostDestination);
+            encoder->dispatchThreadgroups(groupsFor(bloomMips[level - 1]), threadsPerGroup);
+        }
+        encoder->endEncoding();
+    }
+
+    #pragma mark Composite
+    {
+        MTL::ComputeCommandEncoder* encoder = commandBuffer->computeCommandEncoder(profiler.computePassDescriptor("Post Composite"));
+        encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::PostComposite));
+        encoder->setBytes(&params, sizeof(params), BufferIndexPostProcess);
+        encoder->setTexture(hdrTexture, TextureIndexPostSource);
+        encoder->setTexture(outputTexture, TextureIndexPostDestination);
+        encoder->setTexture(bloomMips[0], TextureIndexPostBloom);
+        encoder->dispatchThreadgroups(groupsFor(outputTexture), threadsPerGroup);
+        encoder->endEncoding();
+    }
+}
+
+#if REFERENCE_CHECKS
+void PostProcess::encodeReferenceReadback(MTL::CommandBuffer* commandBuffer, MTL::Texture* hdrTexture, MTL::Texture* outputTexture) {
+    checkParams = params;
+    hdrReadback.copyTexture(commandBuffer, hdrTexture, sizeof(__fp16) * 4);
+    bloomReadback.copyTexture(commandBuffer, bloomTexture, sizeof(__fp16) * 4, 0);
+    outputReadback.copyTexture(commandBuffer, outputTexture, sizeof(uint32_t));
+}
+
+// RGBA16Float readback as the reference's rgb image
+static PostProcessReference::Image halfImage(const GPUReadback& readback) {
+    PostProcessReference::Image image(readback.getWidth(), readback.getHeight());
+    const __fp16* texels = readback.data<__fp16>();
+    for (size_t i = 0; i < image.texels.size(); i++) {
+        image.texels[i] = simd::float3{(float)texels[i * 4], (float)texels[i * 4 + 1], (float)texels[i * 4 + 2]};
+    }
+    return image;
+}
+
+bool PostProcess::checkReference() {
+    PostProcessReference::Image hdr = halfImage(hdrReadback);
+    PostProcessReference::Image gpuBloom = halfImage(bloomReadback);
+
+    // Each stage runs on the GPU result of the stage before it, so errors do not compound
+    PostProcessReference::Image bloom = PostProcessReference::bloom(hdr, bloomLevelCount, checkParams);
+    std::vector<uint32_t> output;
+    PostProcessReference::composite(hdr, gpuBloom, checkParams, output);
+
+    uint32_t bloomFailures = 0;
+    float worstBloom = 0.0f;
+    for (size_t i = 0; i < bloom.texels.size(); i++) {
+        simd::float3 difference = simd::abs(gpuBloom.texels[i] - bloom.texels[i]);
+        simd::float3 tolerance = simd::abs(bloom.texels[i]) * 0.02f + 0.002f;
+        worstBloom = std::max(worstBloom, simd::reduce_max(difference));
+        if (simd::any(difference > tolerance))
+            bloomFailures++;
+    }
+
+    uint32_t outputFailures = 0;
+    int worstOutput = 0;
+    const uint32_t* gpuOutput = outputReadback.data<uint32_t>();
+    for (size_t i = 0; i < output.size(); i++) {
+        for (uint32_t shift = 0; shift < 24; shift += 8) {
+            int difference = std::abs((int)((gpuOutput[i] >> shift) & 0xFF) - (int)((output[i] >> shift) & 0xFF));
+            worstOutput = std::max(worstOutput, difference);
+            if (difference > 2) {
+                outputFailures++;
+                break;
+            }
+        }
+    }
+
+    printf("Post process reference: %u of %zu bloom texels off (worst %.4f), %u of %zu output pixels off (worst %d/255)\n",
+           bloomFailures, bloom.texels.size(), worstBloom, outputFailures, output.size(), worstOutput);
+    return bloomFailures == 0 && outputFailures == 0;
+}
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+#include "renderPipeline.hpp"
+#include "gpuProfiler.hpp"
+#include "resourceRegistry.hpp"
+#if REFERENCE_CHECKS
+#include "gpuReadback.hpp"
+#endif
+#include "../../../data/shaders/shaderTypes.hpp"
+
+// Compute post chain from the HDR lighting target to the drawable:
+// bloom downsample -> bloom upsample -> fused exposure/tonemap/grade/dither
+class PostProcess {
+public:
+    static constexpr uint32_t BloomLevels   = 5;
+    static constexpr uint32_t GroupSize     = 8;    // Must match BloomGroupSize in post_process.metal
+
+    PostProcess(MTL::Device* device, RenderPipeline& pipelines, GPUProfiler& profiler);
+    ~PostProcess();
+
+    static PostProcessParams defaultParams();
+
+    // The old chain is retired through resources, frames in flight may still use it
+    void resize(uint32_t width, uint32_t height, ResourceRegistry& resources);
+    void encode(MTL::CommandBuffer* commandBuffer, MTL::Texture* hdrTexture, MTL::Texture* outputTexture, uint32_t frameIndex);
+
+#if REFERENCE_CHECKS
+    // Copies the input, bloom mip 0 and output of the chain encoded just before
+    void encodeReferenceReadback(MTL::CommandBuffer* commandBuffer, MTL::Texture* hdrTexture, MTL::Texture* outputTexture);
+    // Once that command buffer has completed, runs PostProcessReference on the copied input.
+    // Bloom must be within 2% + 0.002 of the reference per channel, and the composite of
+    // the GPU bloom within 2/255 per channel; the kernels work in half precision and the
+    // dither noise can round across a step. Prints the result, returns false on failure.
+    bool checkReference();
+#endif
+
+    PostProcessParams   params;
+
+private:
+    MTL::Device*        device;
+    RenderPipeline&     pipelines;
+    GPUProfiler&        profiler;
+
+    // Half resolution bloom chain, one cached view per mip
+    MTL::Texture*                           bloomTexture = nullptr;
+    std::array<MTL::Texture*, BloomLevels>  bloomMips{};
+    uint32_t                                bloomLevelCount = 0;
+
+    // Retired through resources, or released at once when null
+    void releaseTextures(ResourceRegistry* resources);
+
+#if REFERENCE_CHECKS
+    PostProcessParams   checkParams;
+    GPUReadback         hdrReadback;
+    GPUReadback         bloomReadback;
+    GPUReadback         outputReadback;
+#endif
+};
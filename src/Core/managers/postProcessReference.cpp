@@ -0,0 +1,140 @@
+#include "postProcessReference.hpp"
+
+#include <cmath>
+
+namespace PostProcessReference {
+
+simd::float3 Image::clampedRead(int x, int y) const {
+    x = std::clamp(x, 0, (int)width - 1);
+    y = std::clamp(y, 0, (int)height - 1);
+    return texels[y * width + x];
+}
+
+simd::float3 bloomPrefilter(simd::float3 color, const PostProcessParams& params) {
+    float brightness = std::max(color.x, std::max(color.y, color.z));
+    float knee = params.bloomThreshold * params.bloomKnee + 1e-4f;
+    float soft = std::clamp(brightness - params.bloomThreshold + knee, 0.0f, 2.0f * knee);
+    soft = soft * soft / (4.0f * knee);
+    float contribution = std::max(soft, brightness - params.bloomThreshold) / std::max(brightness, 1e-4f);
+    return color * contribution;
+}
+
+Image bloomDownsample(const Image& source, bool applyThreshold, const PostProcessParams& params) {
+    Image destination(std::max(source.width / 2, 1u), std::max(source.height / 2, 1u));
+    const float weights[4] = {0.125f, 0.375f, 0.375f, 0.125f};
+
+    for (uint32_t y = 0; y < destination.height; y++) {
+        for (uint32_t x = 0; x < destination.width; x++) {
+            simd::float3 sum = {0.0f, 0.0f, 0.0f};
+            for (int ty = 0; ty < 4; ty++) {
+                for (int tx = 0; tx < 4; tx++) {
+                    simd::float3 color = source.clampedRead((int)x * 2 - 1 + tx, (int)y * 2 - 1 + ty);
+                    if (applyThreshold) {
+                        color = bloomPrefilter(color, params);
+                    }
+                    sum += color * (weights[tx] * weights[ty]);
+                }
+            }
+            destination.at(x, y) = sum;
+        }
+    }
+    return destination;
+}
+
+void bloomUpsample(const Image& source, Image& destination) {
+    for (uint32_t y = 0; y < destination.height; y++) {
+        for (uint32_t x = 0; x < destination.width; x++) {
+            int nearestX = (int)x / 2;
+            int nearestY = (int)y / 2;
+            int neighbourX = nearestX + ((x & 1) ? 1 : -1);
+            int neighbourY = nearestY + ((y & 1) ? 1 : -1);
+
+            simd::float3 upsampled = source.clampedRead(nearestX, nearestY) * (9.0f / 16.0f)
+                                   + source.clampedRead(neighbourX, nearestY) * (3.0f / 16.0f)
+                                   + source.clampedRead(nearestX, neighbourY) * (3.0f / 16.0f)
+                                   + source.clampedRead(neighbourX, neighbourY) * (1.0f / 16.0f);
+            destination.at(x, y) += upsampled;
+        }
+    }
+}
+
+static float tonemapACES(float x) {
+    const float a = 2.51f, b = 0.03f, c = 2.43f, d = 0.59f, e = 0.14f;
+    return std::clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0f, 1.0f);
+}
+
+static float interleavedGradientNoise(float x, float y) {
+    float inner = x * 0.06711056f + y * 0.00583715f;
+    inner -= std::floor(inner);
+    float outer = 52.9829189f * inner;
+    return outer - std::floor(outer);
+}
+
+simd::float3 composite(simd::float3 hdr, simd::float3 bloom, uint32_t x, uint32_t y, const PostProcessParams& params) {
+    simd::float3 color = hdr + bloom * params.bloomIntensity;
+    color *= std::exp2(params.exposure);
+
+    for (int c = 0; c < 3; c++) {
+        float channel = tonemapACES(color[c]);
+        channel = params.gain[c] * (channel + params.lift[c] * (1.0f - channel));
+        channel = std::pow(std::max(channel, 0.0f), 1.0f / params.gamma[c]);
+        color[c] = channel;
+    }
+
+    float luma = simd::dot(color, simd::float3{0.2126f, 0.7152f, 0.0722f});
+    float noise = interleavedGradientNoise((float)x + float(params.frameIndex % 64) * 5.588238f,
+                                           (float)y + float(params.frameIndex % 64) * 5.588238f);
+
+    for (int c = 0; c < 3; c++) {
+        float channel = luma + (color[c] - luma) * params.saturation;
+        channel = (channel - 0.5f) * params.contrast + 0.5f;
+        channel += (noise - 0.5f) * params.ditherStrength / 255.0f;
+        color[c] = std::clamp(channel, 0.0f, 1.0f);
+    }
+    return color;
+}
+
+Image bloom(const Image& hdr, uint32_t bloomLevels, const PostProcessParams& params) {
+    // Stops before the chain degenerates to a single texel, like PostProcess::resize
+    std::vector<Image> mips;
+    mips.reserve(bloomLevels);
+    for (uint32_t level = 0; level < bloomLevels; level++) {
+        const Image& source = level == 0 ? hdr : mips[level - 1];
+        if (level > 0 && source.width == 1 && source.height == 1)
+            break;
+        mips.push_back(bloomDownsample(source, level == 0, params));
+    }
+
+    for (size_t level = mips.size() - 1; level > 0; level--) {
+        bloomUpsample(mips[level], mips[level - 1]);
+    }
+    return mips[0];
+}
+
+void composite(const Image& hdr, const Image& bloom, const PostProcessParams& params, std::vector<uint32_t>& output) {
+    // Bilinear fetch of the half resolution bloom at the pixel centre, like the sampler in the kernel
+    output.resize(hdr.width * hdr.height);
+    for (uint32_t y = 0; y < hdr.height; y++) {
+        for (uint32_t x = 0; x < hdr.width; x++) {
+            float u = ((float)x + 0.5f) / hdr.width * bloom.width - 0.5f;
+            float v = ((float)y + 0.5f) / hdr.height * bloom.height - 0.5f;
+            int x0 = (int)std::floor(u);
+            int y0 = (int)std::floor(v);
+            float fx = u - x0;
+            float fy = v - y0;
+            simd::float3 top = bloom.clampedRead(x0, y0) * (1.0f - fx) + bloom.clampedRead(x0 + 1, y0) * fx;
+            simd::float3 bottom = bloom.clampedRead(x0, y0 + 1) * (1.0f - fx) + bloom.clampedRead(x0 + 1, y0 + 1) * fx;
+            simd::float3 bloomColor = top * (1.0f - fy) + bottom * fy;
+
+            simd::float3 color = composite(hdr.texels[y * hdr.width + x], bloomColor, x, y, params);
+
+            // BGRA8Unorm
+            uint32_t r = (uint32_t)std::lround(color.x * 255.0f);
+            uint32_t g = (uint32_t)std::lround(color.y * 255.0f);
+            uint32_t b = (uint32_t)std::lround(color.z * 255.0f);
+            output[y * hdr.width + x] = b | (g << 8) | (r << 16) | (255u << 24);
+        }
+    }
+}
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+#include "../../../data/shaders/shaderTypes.hpp"
+
+// CPU implementation of the post chain in post_process.metal, texel for texel.
+// PostProcess::checkReference compares it with the GPU kernels when REFERENCE_CHECKS
+// is enabled. Images are tightly packed, row major.
+namespace PostProcessReference {
+    struct Image {
+        uint32_t                    width = 0;
+        uint32_t                    height = 0;
+        std::vector<simd::float3>   texels;
+
+        Image() = default;
+        Image(uint32_t width, uint32_t height) : width(width), height(height), texels(width * height, simd::float3{0.0f, 0.0f, 0.0f}) {}
+
+        simd::float3  clampedRead(int x, int y) const;
+        simd::float3& at(uint32_t x, uint32_t y) { return texels[y * width + x]; }
+    };
+
+    simd::float3 bloomPrefilter(simd::float3 color, const PostProcessParams& params);
+    Image bloomDownsample(const Image& source, bool applyThreshold, const PostProcessParams& params);
+    void bloomUpsample(const Image& source, Image& destination);
+
+    // Exposure, bloom, tonemap, grade and dither for one pixel, returns the 0-1 output colour
+    simd::float3 composite(simd::float3 hdr, simd::float3 bloom, uint32_t x, uint32_t y, const PostProcessParams& params);
+
+    // Downsample and upsample chain, returns the half resolution mip 0 the composite samples
+    Image bloom(const Image& hdr, uint32_t bloomLevels, const PostProcessParams& params);
+    // Composite of every pixel, writes BGRA8 texels like the drawable
+    void composite(const Image& hdr, const Image& bloom, const PostProcessParams& params, std::vector<uint32_t>& output);
+}
@@ -0,0 +1,381 @@
+#include "proxyMesh.hpp"
+
+#include <filesystem>
+#include <queue>
+#include <unordered_map>
+
+namespace ProxyMesh {
+
+namespace {
+    // Symmetric 4x4 of the summed plane equations
+    struct Quadric {
+        double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+        void addPlane(simd::double3 n, double d) {
+            a2 += n.x * n.x; ab += n.x * n.y; ac += n.x * n.z; ad += n.x * d;
+            b2 += n.y * n.y; bc += n.y * n.z; bd += n.y * d;
+            c2 += n.z * n.z; cd += n.z * d;
+            d2 += d * d;
+        }
+
+        Quadric& operator+=(const Quadric& other) {
+            a2 += other.a2; ab += other.ab; ac += other.ac; ad += other.ad;
+            b2 += other.b2; bc += other.bc; bd += other.bd;
+            c2 += other.c2; cd += other.cd;
+            d2 += other.d2;
+            return *this;
+        }
+
+        // Sum of squared distances of p to the planes
+        double evaluate(simd::float3 point) const {
+            double x = point.x, y = point.y, z = point.z;
+            return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+                   b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+                   c2 * z * z + 2 * cd * z + d2;
+        }
+    };
+
+    struct Collapse {
+        double      cost;
+        uint32_t    from;
+        uint32_t    to;
+        uint32_t    fromVersion;
+        uint32_t    toVersion;
+
+        bool operator>(const Collapse& other) const { return cost > other.cost; }
+    };
+
+    struct PositionHash {
+        size_t operator()(simd::float3 position) const {
+            uint32_t bits[3];
+            memcpy(bits, &position, sizeof(bits));
+            return bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u;
+        }
+    };
+
+    struct PositionEqual {
+        bool operator()(simd::float3 a, simd::float3 b) const { return simd::all(a == b); }
+    };
+}
+
+static uint64_t edgeKey(uint32_t a, uint32_t b) {
+    return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+static simd::float3 triangleNormal(simd::float3 p0, simd::float3 p1, simd::float3 p2) {
+    return simd::cross(p1 - p0, p2 - p0);
+}
+
+Proxy simplify(std::span<const simd::float3> sourcePositions, std::span<const uint32_t> sourceIndices,
+               const Settings& settings, Stats* stats) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    // Attribute seams split vertices, the proxy only cares about positions
+    std::vector<simd::float3> positions;
+    std::vector<uint32_t> weld(sourcePositions.size());
+    std::unordered_map<simd::float3, uint32_t, PositionHash, PositionEqual> welded;
+    for (size_t i = 0; i < sourcePositions.size(); i++) {
+        auto [it, inserted] = welded.try_emplace(sourcePositions[i], (uint32_t)positions.size());
+        if (inserted)
+            positions.push_back(sourcePositions[i]);
+        weld[i] = it->second;
+    }
+
+    std::vector<simd::uint3> triangles;
+    triangles.reserve(sourceIndices.size() / 3);
+    for (size_t i = 0; i + 2 < sourceIndices.size(); i += 3) {
+        simd::uint3 triangle = {weld[sourceIndices[i]], weld[sourceIndices[i + 1]], weld[sourceIndices[i + 2]]};
+        if (triangle.x != triangle.y && triangle.y != triangle.z && triangle.x != triangle.z)
+            triangles.push_back(triangle);
+    }
+
+    simd::float3 boundsMin = simd::float3(INFINITY), boundsMax = simd::float3(-INFINITY);
+    for (simd::float3 position : positions) {
+        boundsMin = simd::min(boundsMin, position);
+        boundsMax = simd::max(boundsMax, position);
+    }
+    const float maxError = positions.empty() ? 0.0f : settings.relativeError * simd::length(boundsMax - boundsMin);
+    const double maxErrorSquared = (double)maxError * maxError;
+
+    const uint32_t vertexCount = (uint32_t)positions.size();
+    std::vector<std::vector<uint32_t>> vertexTriangles(vertexCount);
+    std::vector<Quadric> quadrics(vertexCount);
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+    for (uint32_t t = 0; t < triangles.size(); t++) {
+        simd::uint3 triangle = triangles[t];
+        simd::float3 normal = triangleNormal(positions[triangle.x], positions[triangle.y], positions[triangle.z]);
+        float length = simd::length(normal);
+        if (length > 0.0f) {
+            simd::double3 n = simd::double3{normal.x, normal.y, normal.z} / (double)length;
+            double d = -(n.x * positions[triangle.x].x + n.y * positions[triangle.x].y + n.z * positions[triangle.x].z);
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                quadrics[triangle[corner]].addPlane(n, d);
+            }
+        }
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            vertexTriangles[triangle[corner]].push_back(t);
+            edgeUses[edgeKey(triangle[corner], triangle[(corner + 1) % 3])]++;
+        }
+    }
+
+    // Open and non-manifold edges pin their vertices
+    std::vector<uint8_t> locked(vertexCount, 0);
+    if (settings.lockBorders) {
+        for (const auto& [key, uses] : edgeUses) {
+            if (uses != 2) {
+                locked[key >> 32] = 1;
+                locked[key & 0xFFFFFFFF] = 1;
+            }
+        }
+    }
+    edgeUses = {};
+
+    std::vector<uint8_t> removed(vertexCount, 0), deadTriangles(triangles.size(), 0);
+    std::vector<uint32_t> versions(vertexCount, 0);
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+
+    auto pushEdge = [&](uint32_t a, uint32_t b) {
+        Quadric combined = quadrics[a];
+        combined += quadrics[b];
+        Collapse best{.cost = INFINITY};
+        if (!locked[a]) {
+            best = {combined.evaluate(positions[b]), a, b, versions[a], versions[b]};
+        }
+        if (!locked[b]) {
+            double cost = combined.evaluate(positions[a]);
+            if (cost < best.cost)
+                best = {cost, b, a, versions[b], versions[a]};
+        }
+        if (best.cost <= maxErrorSquared)
+            queue.push(best);
+    };
+    for (simd::uint3 triangle : triangles) {
+        pushEdge(triangle.x, triangle.y);
+        pushEdge(triangle.y, triangle.z);
+        pushEdge(triangle.z, triangle.x);
+    }
+
+    const uint32_t targetTriangles = (uint32_t)(triangles.size() * settings.targetRatio);
+    uint32_t aliveTriangles = (uint32_t)triangles.size();
+    uint32_t collapses = 0;
+    double largestCost = 0.0;
+    std::vector<uint32_t> fromNeighbours, toNeighbours;
+
+    auto collectNeighbours = [&](uint32_t vertex, std::vector<uint32_t>& neighbours) {
+        neighbours.clear();
+        for (uint32_t t : vertexTriangles[vertex]) {
+            if (deadTriangles[t])
+                continue;
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                if (triangles[t][corner] != vertex)
+                    neighbours.push_back(triangles[t][corner]);
+            }
+        }
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+    };
+
+    while (aliveTriangles > targetTriangles && !queue.empty()) {
+        Collapse collapse = queue.top();
+        queue.pop();
+        if (removed[collapse.from] || removed[collapse.to] ||
+            versions[collapse.from] != collapse.fromVersion || versions[collapse.to] != collapse.toVersion)
+            continue;
+
+        // Link condition: an interior edge shares exactly its two opposite vertices,
+        // more would pinch the surface into a non-manifold fan
+        collectNeighbours(collapse.from, fromNeighbours);
+        collectNeighbours(collapse.to, toNeighbours);
+        std::vector<uint32_t>& shared = fromNeighbours;
+        shared.erase(std::remove_if(shared.begin(), shared.end(), [&](uint32_t vertex) {
+            return !std::binary_search(toNeighbours.begin(), toNeighbours.end(), vertex);
+        }), shared.end());
+        if (shared.size() > 2)
+            continue;
+
+        // Triangles that keep from must not flip or collapse when it moves
+        bool valid = true;
+        for (uint32_t t : vertexTriangles[collapse.from]) {
+            simd::uint3 triangle = triangles[t];
+            if (deadTriangles[t] || simd::any(triangle == collapse.to))
+                continue;
+            simd::float3 before = triangleNormal(positions[triangle.x], positions[triangle.y], positions[triangle.z]);
+            simd::float3 moved[3];
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                moved[corner] = positions[triangle[corner] == collapse.from ? collapse.to : triangle[corner]];
+            }
+            simd::float3 after = triangleNormal(moved[0], moved[1], moved[2]);
+            if (simd::dot(before, after) <= 0.0f || simd::length_squared(after) <= 1e-12f * simd::length_squared(before)) {
+                valid = false;
+                break;
+            }
+        }
+        if (!valid)
+            continue;
+
+        for (uint32_t t : vertexTriangles[collapse.from]) {
+            if (deadTriangles[t])
+                continue;
+            simd::uint3& triangle = triangles[t];
+            if (simd::any(triangle == collapse.to)) {
+                deadTriangles[t] = 1;
+                aliveTriangles--;
+                continue;
+            }
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                if (triangle[corner] == collapse.from)
+                    triangle[corner] = collapse.to;
+            }
+            vertexTriangles[collapse.to].push_back(t);
+        }
+        std::vector<uint32_t>& toTriangles = vertexTriangles[collapse.to];
+        toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(), [&](uint32_t t) { return deadTriangles[t] != 0; }),
+                          toTriangles.end());
+        vertexTriangles[collapse.from] = {};
+
+        quadrics[collapse.to] += quadrics[collapse.from];
+        removed[collapse.from] = 1;
+        versions[collapse.to]++;
+        largestCost = std::max(largestCost, collapse.cost);
+        collapses++;
+
+        collectNeighbours(collapse.to, toNeighbours);
+        for (uint32_t neighbour : toNeighbours) {
+            pushEdge(collapse.to, neighbour);
+        }
+    }
+
+    // Compact to the surviving triangles and the vertices they use
+    Proxy proxy;
+    proxy.maxError = (float)std::sqrt(largestCost);
+    std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+    for (uint32_t t = 0; t < triangles.size(); t++) {
+        if (deadTriangles[t])
+            continue;
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            uint32_t vertex = triangles[t][corner];
+            if (remap[vertex] == UINT32_MAX) {
+                remap[vertex] = (uint32_t)proxy.positions.size();
+                proxy.positions.push_back(positions[vertex]);
+            }
+            proxy.indices.push_back(remap[vertex]);
+        }
+    }
+
+    if (stats) {
+        stats->sourceTriangles = (uint32_t)(sourceIndices.size() / 3);
+        stats->triangles = proxy.getTriangleCount();
+        stats->collapses = collapses;
+        stats->maxError = proxy.maxError;
+        stats->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    }
+    return proxy;
+}
+
+// FNV-1a
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t sourceHash(std::span<const simd::float3> positions, std::span<const uint32_t> indices, const Settings& settings) {
+    constexpr uint32_t Version = 1;
+    uint64_t hash = 14695981039346656037ull;
+    hash = hashBytes(hash, &Version, sizeof(Version));
+    hash = hashBytes(hash, &settings.targetRatio, sizeof(settings.targetRatio));
+    hash = hashBytes(hash, &settings.relativeError, sizeof(settings.relativeError));
+    hash = hashBytes(hash, &settings.lockBorders, sizeof(settings.lockBorders));
+    for (simd::float3 position : positions) {
+        hash = hashBytes(hash, &position, sizeof(float) * 3);
+    }
+    hash = hashBytes(hash, indices.data(), indices.size() * sizeof(uint32_t));
+    return hash;
+}
+
+namespace {
+    constexpr uint32_t CacheMagic = 0x31585250; // "PRX1"
+
+    struct CacheHeader {
+        uint32_t    magic;
+        uint32_t    vertexCount;
+        uint64_t    hash;
+        uint32_t    indexCount;
+        float       maxError;
+    };
+}
+
+bool save(const std::string& path, uint64_t hash, const Proxy& proxy) {
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+
+    CacheHeader header{
+        .magic = CacheMagic,
+        .vertexCount = (uint32_t)proxy.positions.size(),
+        .hash = hash,
+        .indexCount = (uint32_t)proxy.indices.size(),
+        .maxError = proxy.maxError
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (simd::float3 position : proxy.positions) {
+        file.write(reinterpret_cast<const char*>(&position), sizeof(float) * 3);
+    }
+    file.write(reinterpret_cast<const char*>(proxy.indices.data()), proxy.indices.size() * sizeof(uint32_t));
+    return file.good();
+}
+
+bool load(const std::string& path, uint64_t hash, Proxy& proxy) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    CacheHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != CacheMagic || header.hash != hash)
+        return false;
+
+    Proxy loaded;
+    loaded.maxError = header.maxError;
+    loaded.positions.resize(header.vertexCount);
+    for (simd::float3& position : loaded.positions) {
+        float components[3];
+        if (!file.read(reinterpret_cast<char*>(components), sizeof(components)))
+            return false;
+        position = simd::float3{components[0], components[1], components[2]};
+    }
+    loaded.indices.resize(header.indexCount);
+    if (!file.read(reinterpret_cast<char*>(loaded.indices.data()), loaded.indices.size() * sizeof(uint32_t)))
+        return false;
+    for (uint32_t index : loaded.indices) {
+        if (index >= header.vertexCount)
+            return false;
+    }
+    proxy = std::move(loaded);
+    return true;
+}
+
+Proxy loadOrSimplify(std::span<const simd::float3> positions, std::span<const uint32_t> indices,
+                     const std::string& directory, const Settings& settings) {
+    uint64_t hash = sourceHash(positions, indices, settings);
+    char fileName[32];
+    snprintf(fileName, sizeof(fileName), "/%016llx.proxy", (unsigned long long)hash);
+    std::string path = directory + fileName;
+
+    Proxy proxy;
+    if (load(path, hash, proxy))
+        return proxy;
+
+    Stats stats;
+    proxy = simplify(positions, indices, settings, &stats);
+    printf("Simplified proxy: %u of %u triangles after %u collapses, max error %.4f, %.1f ms\n",
+           stats.triangles, stats.sourceTriangles, stats.collapses, stats.maxError, stats.milliseconds);
+    if (!save(path, hash, proxy))
+        std::cerr << "Failed to write proxy cache: " << path << std::endl;
+    return proxy;
+}
+
+}
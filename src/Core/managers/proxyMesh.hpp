@@ -0,0 +1,49 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+#include <span>
+
+// Simplified stand-ins for secondary rays. Vertices are welded by position, then edges
+// are collapsed onto one of their endpoints in order of quadric error. Quadrics are
+// sums of squared distances to the original planes around a vertex, unweighted, so a
+// collapse whose error stays under maxError² keeps every merged vertex within maxError
+// of each of those planes; collapses past the bound, ones that would flip a triangle,
+// and with lockBorders ones that move a border vertex, are never taken. Kept vertices
+// are original vertices, the proxy never bulges out of the source surface's hull.
+namespace ProxyMesh {
+    struct Settings {
+        float       targetRatio = 0.1f;         // Stops at this fraction of the source triangles
+        float       relativeError = 0.002f;     // maxError as a fraction of the bounds diagonal
+        bool        lockBorders = true;         // Open edges stay where they are, no new gaps
+    };
+
+    struct Proxy {
+        std::vector<simd::float3>   positions;
+        std::vector<uint32_t>       indices;    // Triangle list
+        float                       maxError = 0.0f;
+
+        uint32_t getTriangleCount() const { return (uint32_t)(indices.size() / 3); }
+    };
+
+    struct Stats {
+        uint32_t    sourceTriangles = 0;
+        uint32_t    triangles = 0;
+        uint32_t    collapses = 0;
+        float       maxError = 0.0f;
+        double      milliseconds = 0.0;
+    };
+
+    // indices is a triangle list into positions
+    Proxy simplify(std::span<const simd::float3> positions, std::span<const uint32_t> indices,
+                   const Settings& settings, Stats* stats = nullptr);
+
+    // Cooked cache, keyed by the geometry and the settings
+    uint64_t sourceHash(std::span<const simd::float3> positions, std::span<const uint32_t> indices, const Settings& settings);
+    bool save(const std::string& path, uint64_t hash, const Proxy& proxy);
+    bool load(const std::string& path, uint64_t hash, Proxy& proxy);
+    // Reads the cached proxy from directory if present, otherwise simplifies and writes it
+    Proxy loadOrSimplify(std::span<const simd::float3> positions, std::span<const uint32_t> indices,
+                         const std::string& directory, const Settings& settings);
+}
@@ -0,0 +1,278 @@
+#include "pvs.hpp"
+
+#include "triangleBVH.hpp"
+
+#include <filesystem>
+#include <random>
+#include "parallel.hpp"
+
+namespace PVS {
+
+// A cell centre is solid when most of these see an odd number of crossings
+static const simd::float3 ParityDirections[] = {
+    simd::normalize(simd::float3{ 0.5773f,  0.5774f,  0.5771f}),
+    simd::normalize(simd::float3{-0.8019f,  0.2669f, -0.5347f}),
+    simd::normalize(simd::float3{ 0.3013f, -0.9046f, -0.3016f}),
+};
+
+static bool isWalkable(const TriangleBVH& bvh, simd::float3 center, const BuildSettings& settings) {
+    uint32_t oddCount = 0;
+    for (simd::float3 direction : ParityDirections) {
+        oddCount += bvh.countCrossings(center, direction) & 1;
+    }
+    if (oddCount * 2 > std::size(ParityDirections))
+        return false;
+
+    float maxDistance = settings.maxHeightAboveFloor > 0.0f ? settings.maxHeightAboveFloor : std::numeric_limits<float>::infinity();
+    return bvh.occluded(center, simd::float3{0.0f, -1.0f, 0.0f}, maxDistance);
+}
+
+// Nonzero bytes are copied, a run of zero bytes becomes a zero and the run length
+static void compress(std::span<const uint64_t> bits, uint32_t byteCount, std::vector<uint8_t>& output) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(bits.data());
+    for (uint32_t i = 0; i < byteCount; ) {
+        if (bytes[i] != 0) {
+            output.push_back(bytes[i++]);
+            continue;
+        }
+        uint32_t run = 0;
+        while (i < byteCount && bytes[i] == 0 && run < 255) {
+            i++;
+            run++;
+        }
+        output.push_back(0);
+        output.push_back((uint8_t)run);
+    }
+}
+
+Data build(const Scene& scene, const BuildSettings& settings, BuildStats* stats) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    TriangleBVH bvh;
+    bvh.build(scene.positions, scene.indices);
+
+    Data data;
+    data.objectCount = (uint32_t)scene.objectBoundsMin.size();
+    if (bvh.isEmpty())
+        return data;
+
+    simd::float3 extent = bvh.getBoundsMax() - bvh.getBoundsMin();
+    data.cellSize = std::max(simd::reduce_max(extent), 1e-4f) / std::max(settings.cellsPerAxis, 1u);
+    data.origin = bvh.getBoundsMin();
+    simd::float3 cells = simd::max(simd::ceil(extent / data.cellSize), simd::float3(1.0f));
+    data.cellCounts = simd::uint3{(uint32_t)cells.x, (uint32_t)cells.y, (uint32_t)cells.z};
+    const uint32_t cellCount = data.cellCounts.x * data.cellCounts.y * data.cellCounts.z;
+    const uint32_t wordCount = data.getWordCount();
+    const uint32_t byteCount = (data.objectCount + 7) / 8;
+
+    // Compressed set of every cell, empty for cells outside walkable space
+    std::vector<std::vector<uint8_t>> cellVisibility(cellCount);
+    std::vector<uint8_t> walkable(cellCount, 0);
+    std::vector<uint32_t> visibleCounts(cellCount, 0);
+
+    uint32_t threadCount = parallelFor(cellCount, settings.threadCount, 1, [&](uint32_t cell) {
+        simd::uint3 coordinate = {cell % data.cellCounts.x,
+                                  (cell / data.cellCounts.x) % data.cellCounts.y,
+                                  cell / (data.cellCounts.x * data.cellCounts.y)};
+        simd::float3 cellMin = data.origin + simd::float3{(float)coordinate.x, (float)coordinate.y, (float)coordinate.z} * data.cellSize;
+        simd::float3 cellMax = cellMin + data.cellSize;
+        if (!isWalkable(bvh, (cellMin + cellMax) * 0.5f, settings))
+            return;
+        walkable[cell] = 1;
+        std::vector<uint64_t> bits(wordCount);
+
+        // The camera can be inside anything overlapping the cell
+        for (uint32_t object = 0; object < data.objectCount; object++) {
+            if (simd::all(scene.objectBoundsMin[object] <= cellMax) && simd::all(scene.objectBoundsMax[object] >= cellMin))
+                bits[object / 64] |= 1ull << (object % 64);
+        }
+
+        // Seeded per cell, the result does not depend on the thread count
+        std::mt19937 random(cell);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (uint32_t ray = 0; ray < settings.raysPerCell; ray++) {
+            simd::float3 origin = cellMin + simd::float3{unit(random), unit(random), unit(random)} * data.cellSize;
+            float z = unit(random) * 2.0f - 1.0f;
+            float phi = unit(random) * 2.0f * (float)M_PI;
+            float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+            simd::float3 direction = {r * std::cos(phi), r * std::sin(phi), z};
+
+            TriangleBVH::Hit hit;
+            if (bvh.intersect(origin, direction, std::numeric_limits<float>::infinity(), hit)) {
+                uint32_t object = scene.triangleObjects[hit.triangle];
+                bits[object / 64] |= 1ull << (object % 64);
+            }
+        }
+
+        for (uint64_t word : bits) {
+            visibleCounts[cell] += __builtin_popcountll(word);
+        }
+        compress(bits, byteCount, cellVisibility[cell]);
+    });
+
+    data.cellOffsets.resize(cellCount);
+    uint32_t walkableCells = 0;
+    uint64_t visibleTotal = 0;
+    for (uint32_t cell = 0; cell < cellCount; cell++) {
+        if (!walkable[cell]) {
+            data.cellOffsets[cell] = NoVisibility;
+            continue;
+        }
+        data.cellOffsets[cell] = (uint32_t)data.visibility.size();
+        data.visibility.insert(data.visibility.end(), cellVisibility[cell].begin(), cellVisibility[cell].end());
+        walkableCells++;
+        visibleTotal += visibleCounts[cell];
+    }
+
+    if (stats) {
+        stats->cellCount = cellCount;
+        stats->walkableCells = walkableCells;
+        stats->rays = (uint64_t)walkableCells * settings.raysPerCell;
+        stats->averageVisible = walkableCells ? (double)visibleTotal / walkableCells : 0.0;
+        stats->compressedBytes = (uint32_t)data.visibility.size();
+        stats->threadCount = threadCount;
+        stats->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    }
+    return data;
+}
+
+uint32_t findCell(const Data& data, simd::float3 position) {
+    if (data.isEmpty())
+        return NoCell;
+
+    simd::float3 grid = simd::floor((position - data.origin) / data.cellSize);
+    if (simd::any(grid < 0.0f) ||
+        grid.x >= data.cellCounts.x || grid.y >= data.cellCounts.y || grid.z >= data.cellCounts.z)
+        return NoCell;
+    return (uint32_t)grid.x + data.cellCounts.x * ((uint32_t)grid.y + data.cellCounts.y * (uint32_t)grid.z);
+}
+
+bool decompress(const Data& data, uint32_t cell, std::span<uint64_t> bits) {
+    if (cell == NoCell || data.cellOffsets[cell] == NoVisibility)
+        return false;
+    assert(bits.size() >= data.getWordCount());
+
+    std::fill(bits.begin(), bits.end(), 0);
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(bits.data());
+    const uint32_t byteCount = (data.objectCount + 7) / 8;
+    const uint8_t* input = data.visibility.data() + data.cellOffsets[cell];
+    for (uint32_t i = 0; i < byteCount; ) {
+        if (*input != 0) {
+            bytes[i++] = *input++;
+        } else {
+            i += input[1];
+            input += 2;
+        }
+    }
+    return true;
+}
+
+// FNV-1a
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t sourceHash(const Scene& scene, const BuildSettings& settings) {
+    constexpr uint32_t Version = 1;
+    uint64_t hash = 14695981039346656037ull;
+    hash = hashBytes(hash, &Version, sizeof(Version));
+    hash = hashBytes(hash, &settings.cellsPerAxis, sizeof(settings.cellsPerAxis));
+    hash = hashBytes(hash, &settings.maxHeightAboveFloor, sizeof(settings.maxHeightAboveFloor));
+    hash = hashBytes(hash, &settings.raysPerCell, sizeof(settings.raysPerCell));
+    for (simd::float3 position : scene.positions) {
+        hash = hashBytes(hash, &position, sizeof(float) * 3);
+    }
+    hash = hashBytes(hash, scene.indices.data(), scene.indices.size_bytes());
+    hash = hashBytes(hash, scene.triangleObjects.data(), scene.triangleObjects.size_bytes());
+    for (size_t i = 0; i < scene.objectBoundsMin.size(); i++) {
+        hash = hashBytes(hash, &scene.objectBoundsMin[i], sizeof(float) * 3);
+        hash = hashBytes(hash, &scene.objectBoundsMax[i], sizeof(float) * 3);
+    }
+    return hash;
+}
+
+namespace {
+    constexpr uint32_t CacheMagic = 0x31535650; // "PVS1"
+
+    struct CacheHeader {
+        uint32_t    magic;
+        uint32_t    objectCount;
+        uint64_t    hash;
+        float       origin[3];
+        float       cellSize;
+        uint32_t    cellCounts[3];
+        uint32_t    visibilityBytes;
+    };
+}
+
+bool save(const std::string& path, uint64_t hash, const Data& data) {
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+
+    CacheHeader header{
+        .magic = CacheMagic,
+        .objectCount = data.objectCount,
+        .hash = hash,
+        .origin = {data.origin.x, data.origin.y, data.origin.z},
+        .cellSize = data.cellSize,
+        .cellCounts = {data.cellCounts.x, data.cellCounts.y, data.cellCounts.z},
+        .visibilityBytes = (uint32_t)data.visibility.size()
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(data.cellOffsets.data()), data.cellOffsets.size() * sizeof(uint32_t));
+    file.write(reinterpret_cast<const char*>(data.visibility.data()), data.visibility.size());
+    return file.good();
+}
+
+bool load(const std::string& path, uint64_t hash, Data& data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    CacheHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != CacheMagic || header.hash != hash)
+        return false;
+
+    Data loaded;
+    loaded.origin = {header.origin[0], header.origin[1], header.origin[2]};
+    loaded.cellSize = header.cellSize;
+    loaded.cellCounts = {header.cellCounts[0], header.cellCounts[1], header.cellCounts[2]};
+    loaded.objectCount = header.objectCount;
+    loaded.cellOffsets.resize((size_t)loaded.cellCounts.x * loaded.cellCounts.y * loaded.cellCounts.z);
+    loaded.visibility.resize(header.visibilityBytes);
+    if (!file.read(reinterpret_cast<char*>(loaded.cellOffsets.data()), loaded.cellOffsets.size() * sizeof(uint32_t)) ||
+        !file.read(reinterpret_cast<char*>(loaded.visibility.data()), loaded.visibility.size()))
+        return false;
+
+    data = std::move(loaded);
+    return true;
+}
+
+Data loadOrBuild(const Scene& scene, const std::string& directory, const BuildSettings& settings) {
+    uint64_t hash = sourceHash(scene, settings);
+    char fileName[32];
+    snprintf(fileName, sizeof(fileName), "/%016llx.pvs", (unsigned long long)hash);
+    std::string path = directory + fileName;
+
+    Data data;
+    if (load(path, hash, data))
+        return data;
+
+    BuildStats stats;
+    data = build(scene, settings, &stats);
+    printf("Built PVS: %u of %u cells walkable, %.1f of %u objects visible per cell, %u bytes, %.1f ms on %u threads\n",
+           stats.walkableCells, stats.cellCount, stats.averageVisible, data.objectCount,
+           stats.compressedBytes, stats.milliseconds, stats.threadCount);
+    if (!save(path, hash, data))
+        std::cerr << "Failed to write PVS cache: " << path << std::endl;
+    return data;
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+#include <span>
+
+// Potentially visible sets for static scenes. Walkable space (empty cells with a floor
+// below them) is split into a grid of view cells; for every cell, rays from random
+// points inside it are traced against a BVH of the whole scene and every object they
+// hit, plus every object overlapping the cell, is marked visible. Each cell's bitset
+// is zero run length encoded into one byte stream. At runtime the camera's cell is
+// decompressed once when it changes and handed to the frustum culler as the
+// candidate set. Cells outside walkable space have no set, everything is a candidate.
+namespace PVS {
+    constexpr uint32_t NoCell       = 0xFFFFFFFF;
+    constexpr uint32_t NoVisibility = 0xFFFFFFFF;  // Cell offset of a cell without a set
+
+    struct BuildSettings {
+        uint32_t    cellsPerAxis = 32;          // Along the longest axis of the scene, cells are cubes
+        float       maxHeightAboveFloor = 0.0f; // Cells higher above the floor are not walkable, zero disables
+        uint32_t    raysPerCell = 4096;
+        uint32_t    threadCount = 0;            // Zero draws from the caller's ThreadBudget, see parallelFor
+    };
+
+    // Scene as the builder sees it, world space. Objects are the culler's instances.
+    struct Scene {
+        std::span<const simd::float3>   positions;
+        std::span<const uint32_t>       indices;            // Triangle list
+        std::span<const uint32_t>       triangleObjects;    // Object of every triangle
+        std::span<const simd::float3>   objectBoundsMin;
+        std::span<const simd::float3>   objectBoundsMax;
+    };
+
+    struct Data {
+        simd::float3            origin;
+        float                   cellSize = 0.0f;
+        simd::uint3             cellCounts = {0, 0, 0};
+        uint32_t                objectCount = 0;
+        std::vector<uint32_t>   cellOffsets;    // Start of each cell's run in visibility, or NoVisibility
+        std::vector<uint8_t>    visibility;     // Zero bytes are followed by their run length
+
+        bool isEmpty() const { return cellOffsets.empty(); }
+        // Words of a decompressed set
+        uint32_t getWordCount() const { return (objectCount + 63) / 64; }
+    };
+
+    struct BuildStats {
+        uint32_t    cellCount = 0;
+        uint32_t    walkableCells = 0;
+        uint64_t    rays = 0;
+        double      averageVisible = 0.0;       // Objects per walkable cell
+        uint32_t    compressedBytes = 0;
+        uint32_t    threadCount = 0;
+        double      milliseconds = 0.0;
+    };
+
+    Data build(const Scene& scene, const BuildSettings& settings, BuildStats* stats = nullptr);
+
+    // Grid cell of a position, NoCell outside the grid
+    uint32_t findCell(const Data& data, simd::float3 position);
+    // Expands the cell's set into bits (getWordCount words). False if the cell has no set.
+    bool decompress(const Data& data, uint32_t cell, std::span<uint64_t> bits);
+
+    // Cooked cache, keyed by the scene and the settings
+    uint64_t sourceHash(const Scene& scene, const BuildSettings& settings);
+    bool save(const std::string& path, uint64_t hash, const Data& data);
+    bool load(const std::string& path, uint64_t hash, Data& data);
+    // Reads the cached sets from directory if present, otherwise builds and writes them
+    Data loadOrBuild(const Scene& scene, const std::string& directory, const BuildSettings& settings);
+}
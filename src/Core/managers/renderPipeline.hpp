@@ -3,23 +3,62 @@
 #include <Metal/Metal.hpp>
 #include <string>
 #include <unordered_map>
+#include <vector>
+#include <optional>
 #include <cassert>
 
 enum class RenderPipelineType {
     GBuffer,
     DirectionalLight,
-    ForwardDebug
+    ForwardDebug,
+    EditorComposite,
+    Sky,
+    TileLightCulling,
+    TileLightExport,
+    ImpostorBake,
+    Impostor
 };
 
 enum class ComputePipelineType {
     Raytracing,
     InitMinMaxDepth,
-    MinMaxDepth
+    MinMaxDepth,
+    BloomDownsample,
+    BloomUpsample,
+    PostComposite,
+    TransmittanceLUT,
+    MultiScatteringLUT,
+    SkyViewLUT,
+    MSAAClassify,
+    MSAAShadeSimple,
+    MSAAShadeComplex,
+    MSAAReadbackSamples,
+    TileClassify,
+    RaytracingTiles,
+    RaytracingSimpleTiles,
+    RaytracingEdgeTiles,
+    RaytracingClearTiles,
+    SecondaryRayClear,
+    SecondaryRayQueue,
+    SecondaryRayScan,
+    SecondaryRayScatter,
+    SecondaryRayTrace,
+    InjectFroxels,
+    IntegrateFroxels
 };
 
 enum class DepthStencilType {
     GBuffer,
-    DirectionalLight
+    DirectionalLight,
+    Sky,
+    ImpostorBake
+};
+
+struct BlendConfig {
+    MTL::BlendFactor sourceRGBBlendFactor = MTL::BlendFactorOne;
+    MTL::BlendFactor destinationRGBBlendFactor = MTL::BlendFactorOneMinusSourceAlpha;
+    MTL::BlendFactor sourceAlphaBlendFactor = MTL::BlendFactorOne;
+    MTL::BlendFactor destinationAlphaBlendFactor = MTL::BlendFactorOneMinusSourceAlpha;
 };
 
 struct RenderPipelineConfig {
@@ -29,14 +68,25 @@ struct RenderPipelineConfig {
     MTL::PixelFormat colorPixelFormat = MTL::PixelFormatBGRA8Unorm;
     MTL::PixelFormat depthPixelFormat = MTL::PixelFormatDepth32Float_Stencil8;
     MTL::PixelFormat stencilPixelFormat = MTL::PixelFormatDepth32Float_Stencil8;
-    MTL::VertexDescriptor* vertexDescriptor = nullptr;
+    std::optional<BlendConfig> blend; // Applied to color attachment 0
 
     std::unordered_map<int, MTL::PixelFormat> colorAttachments;
+    NS::UInteger sampleCount = 1;
+};
+
+// Tile shading pipelines run inside a render pass, their attachments must match the pass
+struct TilePipelineConfig {
+    std::string label;
+    std::string tileFunctionName;
+    std::unordered_map<int, MTL::PixelFormat> colorAttachments;
+    NS::UInteger sampleCount = 1;
 };
 
 struct ComputePipelineConfig {
     std::string label;
     std::string computeFunctionName;
+    // Linked into the pipeline and placed in its intersection function table, in order
+    std::vector<std::string> intersectionFunctionNames;
 };
 
 struct StencilConfig {
@@ -69,8 +119,13 @@ public:
     MTL::RenderPipelineState* getRenderPipeline(RenderPipelineType type);
     MTL::ComputePipelineState* getComputePipeline(ComputePipelineType type);
     MTL::DepthStencilState* getDepthStencilState(DepthStencilType type);
+    // Only for compute pipelines created with intersection functions
+    MTL::IntersectionFunctionTable* getIntersectionFunctionTable(ComputePipelineType type);
+    // Binds a buffer for the intersection functions in every table
+    void setIntersectionFunctionBuffer(const MTL::Buffer* buffer, NS::UInteger index);
 
     void createRenderPipeline(RenderPipelineType type, const RenderPipelineConfig& config);
+    void createTilePipeline(RenderPipelineType type, const TilePipelineConfig& config);
     void createComputePipeline(ComputePipelineType type, const ComputePipelineConfig& config);
     void createDepthStencilState(DepthStencilType type, const DepthStencilConfig& config);
     
@@ -81,9 +136,12 @@ private:
     std::unordered_map<RenderPipelineType, MTL::RenderPipelineState*>   renderPipelineStates;
     std::unordered_map<ComputePipelineType, MTL::ComputePipelineState*> computePipelineStates;
     std::unordered_map<DepthStencilType, MTL::DepthStencilState*>       depthStencilStates;
+    std::unordered_map<ComputePipelineType, MTL::IntersectionFunctionTable*> intersectionFunctionTables;
 
     MTL::RenderPipelineState* createRenderPipelineState(const RenderPipelineConfig& config);
+    MTL::RenderPipelineState* createTilePipelineState(const TilePipelineConfig& config);
     MTL::ComputePipelineState* createComputePipelineState(const ComputePipelineConfig& config);
+    MTL::IntersectionFunctionTable* createIntersectionFunctionTable(MTL::ComputePipelineState* pipelineState, const ComputePipelineConfig& config);
     MTL::DepthStencilState* createDepthStencilState(const DepthStencilConfig& config);
     
     void assertValid(MTL::RenderPipelineState* pipelineState, NS::Error* error, const std::string& label);
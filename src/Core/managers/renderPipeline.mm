@@ -20,6 +20,11 @@ void RenderPipeline::cleanup() {
         if (state) state->release();
     }
     depthStencilStates.clear();
+
+    for (auto& [type, table] : intersectionFunctionTables) {
+        if (table) table->release();
+    }
+    intersectionFunctionTables.clear();
 }
 
 MTL::RenderPipelineState* RenderPipeline::getRenderPipeline(RenderPipelineType type) {
@@ -40,6 +45,18 @@ MTL::DepthStencilState* RenderPipeline::getDepthStencilState(DepthStencilType ty
     return it->second;
 }
 
+MTL::IntersectionFunctionTable* RenderPipeline::getIntersectionFunctionTable(ComputePipelineType type) {
+    auto it = intersectionFunctionTables.find(type);
+    assert(it != intersectionFunctionTables.end() && "Intersection function table not found!");
+    return it->second;
+}
+
+void RenderPipeline::setIntersectionFunctionBuffer(const MTL::Buffer* buffer, NS::UInteger index) {
+    for (auto& [type, table] : intersectionFunctionTables) {
+        table->setBuffer(buffer, 0, index);
+    }
+}
+
 void RenderPipeline::createRenderPipeline(RenderPipelineType type, const RenderPipelineConfig& config) {
     auto state = createRenderPipelineState(config);
     
@@ -52,6 +69,18 @@ void RenderPipeline::createRenderPipeline(RenderPipelineType type, const RenderP
     renderPipelineStates[type] = state;
 }
 
+void RenderPipeline::createTilePipeline(RenderPipelineType type, const TilePipelineConfig& config) {
+    auto state = createTilePipelineState(config);
+    
+    // Release existing state if present
+    auto it = renderPipelineStates.find(type);
+    if (it != renderPipelineStates.end() && it->second) {
+        it->second->release();
+    }
+    
+    renderPipelineStates[type] = state;
+}
+
 void RenderPipeline::createComputePipeline(ComputePipelineType type, const ComputePipelineConfig& config) {
     auto state = createComputePipelineState(config);
     
@@ -62,6 +91,14 @@ void RenderPipeline::createComputePipeline(ComputePipelineType type, const Compu
     }
     
     computePipelineStates[type] = state;
+
+    if (!config.intersectionFunctionNames.empty()) {
+        auto tableIt = intersectionFunctionTables.find(type);
+        if (tableIt != intersectionFunctionTables.end() && tableIt->second) {
+            tableIt->second->release();
+        }
+        intersectionFunctionTables[type] = createIntersectionFunctionTable(state, config);
+    }
 }
 
 void RenderPipeline::createDepthStencilState(DepthStencilType type, const DepthStencilConfig& config) {
@@ -94,17 +131,24 @@ MTL::RenderPipelineState* RenderPipeline::createRenderPipelineState(const Render
     descriptor->setVertexFunction(vertexFunction);
     descriptor->setFragmentFunction(fragmentFunction);
     
-    if (config.vertexDescriptor) {
-        descriptor->setVertexDescriptor(config.vertexDescriptor);
-    }
-
     descriptor->colorAttachments()->object(0)->setPixelFormat(config.colorPixelFormat);
+    if (config.blend) {
+        MTL::RenderPipelineColorAttachmentDescriptor* colorAttachment = descriptor->colorAttachments()->object(0);
+        colorAttachment->setBlendingEnabled(true);
+        colorAttachment->setRgbBlendOperation(MTL::BlendOperationAdd);
+        colorAttachment->setAlphaBlendOperation(MTL::BlendOperationAdd);
+        colorAttachment->setSourceRGBBlendFactor(config.blend->sourceRGBBlendFactor);
+        colorAttachment->setDestinationRGBBlendFactor(config.blend->destinationRGBBlendFactor);
+        colorAttachment->setSourceAlphaBlendFactor(config.blend->sourceAlphaBlendFactor);
+        colorAttachment->setDestinationAlphaBlendFactor(config.blend->destinationAlphaBlendFactor);
+    }
     descriptor->setDepthAttachmentPixelFormat(config.depthPixelFormat);
     descriptor->setStencilAttachmentPixelFormat(config.stencilPixelFormat);
 
     for (const auto& [index, format] : config.colorAttachments) {
         descriptor->colorAttachments()->object(index)->setPixelFormat(format);
     }
+    descriptor->setRasterSampleCount(config.sampleCount);
 
     MTL::RenderPipelineState* pipelineState = device->newRenderPipelineState(descriptor, &error);
 
@@ -117,6 +161,33 @@ MTL::RenderPipelineState* RenderPipeline::createRenderPipelineState(const Render
     return pipelineState;
 }
 
+MTL::RenderPipelineState* RenderPipeline::createTilePipelineState(const TilePipelineConfig& config) {
+    assert(device && library && "RenderPipeline not initialized!");
+    NS::Error* error = nullptr;
+
+    MTL::TileRenderPipelineDescriptor* descriptor = MTL::TileRenderPipelineDescriptor::alloc()->init();
+    descriptor->setLabel(NS::String::string(config.label.c_str(), NS::ASCIIStringEncoding));
+
+    MTL::Function* tileFunction = library->newFunction(NS::String::string(config.tileFunctionName.c_str(), NS::ASCIIStringEncoding));
+    assert(tileFunction && "Failed to load tile function!");
+    descriptor->setTileFunction(tileFunction);
+
+    for (const auto& [index, format] : config.colorAttachments) {
+        descriptor->colorAttachments()->object(index)->setPixelFormat(format);
+    }
+    descriptor->setRasterSampleCount(config.sampleCount);
+    descriptor->setThreadgroupSizeMatchesTileSize(true);
+
+    MTL::RenderPipelineState* pipelineState = device->newRenderPipelineState(descriptor, MTL::PipelineOptionNone, nullptr, &error);
+
+    tileFunction->release();
+    descriptor->release();
+
+    assertValid(pipelineState, error, config.label);
+
+    return pipelineState;
+}
+
 MTL::ComputePipelineState* RenderPipeline::createComputePipelineState(const ComputePipelineConfig& config) {
     assert(device && library && "RenderPipeline not initialized!");
     NS::Error* error = nullptr;
@@ -124,7 +195,31 @@ MTL::ComputePipelineState* RenderPipeline::createComputePipelineState(const Comp
     MTL::Function* computeFunction = library->newFunction(NS::String::string(config.computeFunctionName.c_str(), NS::ASCIIStringEncoding));
     assert(computeFunction && "Failed to load compute function!");
 
-    MTL::ComputePipelineState* pipelineState = device->newComputePipelineState(computeFunction, &error);
+    MTL::ComputePipelineState* pipelineState = nullptr;
+    if (config.intersectionFunctionNames.empty()) {
+        pipelineState = device->newComputePipelineState(computeFunction, &error);
+    } else {
+        std::vector<MTL::Function*> functions;
+        for (const std::string& name : config.intersectionFunctionNames) {
+            functions.push_back(library->newFunction(NS::String::string(name.c_str(), NS::ASCIIStringEncoding)));
+            assert(functions.back() && "Failed to load intersection function!");
+        }
+
+        MTL::LinkedFunctions* linkedFunctions = MTL::LinkedFunctions::alloc()->init();
+        linkedFunctions->setFunctions(NS::Array::array((const NS::Object* const*)functions.data(), functions.size()));
+
+        MTL::ComputePipelineDescriptor* descriptor = MTL::ComputePipelineDescriptor::alloc()->init();
+        descriptor->setLabel(NS::String::string(config.label.c_str(), NS::ASCIIStringEncoding));
+        descriptor->setComputeFunction(computeFunction);
+        descriptor->setLinkedFunctions(linkedFunctions);
+        pipelineState = device->newComputePipelineState(descriptor, MTL::PipelineOptionNone, nullptr, &error);
+
+        descriptor->release();
+        linkedFunctions->release();
+        for (MTL::Function* function : functions) {
+            function->release();
+        }
+    }
     
     computeFunction->release();
     
@@ -132,6 +227,20 @@ MTL::ComputePipelineState* RenderPipeline::createComputePipelineState(const Comp
     return pipelineState;
 }
 
+MTL::IntersectionFunctionTable* RenderPipeline::createIntersectionFunctionTable(MTL::ComputePipelineState* pipelineState, const ComputePipelineConfig& config) {
+    MTL::IntersectionFunctionTableDescriptor* descriptor = MTL::IntersectionFunctionTableDescriptor::alloc()->init();
+    descriptor->setFunctionCount(config.intersectionFunctionNames.size());
+    MTL::IntersectionFunctionTable* table = pipelineState->newIntersectionFunctionTable(descriptor);
+    descriptor->release();
+
+    for (size_t i = 0; i < config.intersectionFunctionNames.size(); i++) {
+        MTL::Function* function = library->newFunction(NS::String::string(config.intersectionFunctionNames[i].c_str(), NS::ASCIIStringEncoding));
+        table->setFunction(pipelineState->functionHandle(function), i);
+        function->release();
+    }
+    return table;
+}
+
 MTL::DepthStencilState* RenderPipeline::createDepthStencilState(const DepthStencilConfig& config) {
     assert(device && "RenderPipeline not initialized!");
     
@@ -0,0 +1,39 @@
+#include "renderSnapshot.hpp"
+
+RenderSnapshot& SnapshotQueue::beginWrite() {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return published - released < Count; });
+    return slots[published % Count];
+}
+
+void SnapshotQueue::publish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        published++;
+    }
+    changed.notify_all();
+}
+
+const RenderSnapshot* SnapshotQueue::acquire() {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return acquired < published || closed; });
+    if (acquired == published)
+        return nullptr;
+    return &slots[acquired++ % Count];
+}
+
+void SnapshotQueue::release() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        released++;
+    }
+    changed.notify_all();
+}
+
+void SnapshotQueue::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    changed.notify_all();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <simd/simd.h>
+
+// Everything the simulation changes in a frame, copied by value so the render thread
+// never reads live simulation state. Meshes, instances, point lights and debug geometry
+// do not change after startup and are shared rather than copied.
+struct RenderSnapshot {
+    uint64_t        frameNumber = 0;
+
+    simd::float4x4  viewMatrix;
+    simd::float4x4  projectionMatrix;
+    simd::float3    cameraPosition;
+    simd::float3    cameraUp;
+    simd::float3    cameraRight;
+    simd::float3    cameraFront;
+    simd::float3    sunPosition;                // World space, the sun is animated by frame number
+
+    // Framebuffer size reported by the window, the render thread resizes its targets to it
+    uint32_t        framebufferWidth = 0;
+    uint32_t        framebufferHeight = 0;
+
+    // Object pick requested this frame, in drawable pixels
+    bool            pickRequested = false;
+    uint32_t        pickX = 0;
+    uint32_t        pickY = 0;
+};
+
+// Fixed ring of snapshots between the simulation and the render thread. The producer
+// waits while every slot is published but not yet rendered, so it runs at most
+// Count - 1 frames ahead of the renderer; with two slots frame N + 1 is simulated
+// while frame N is encoded and latency grows by at most one frame. Slots are reused
+// in place, handing a frame over does not allocate.
+class SnapshotQueue {
+public:
+    static constexpr uint32_t Count = 2;
+
+    // Slot for the next frame, waits until the renderer released it
+    RenderSnapshot& beginWrite();
+    void publish();
+
+    // Oldest published snapshot, waits for one. Null once closed and drained.
+    const RenderSnapshot* acquire();
+    void release();
+
+    // Wakes the renderer for shutdown, snapshots already published are still handed out
+    void close();
+
+private:
+    std::array<RenderSnapshot, Count>   slots;
+    std::mutex                          mutex;
+    std::condition_variable             changed;
+    uint64_t                            published = 0;
+    uint64_t                            acquired = 0;
+    uint64_t                            released = 0;
+    bool                                closed = false;
+};
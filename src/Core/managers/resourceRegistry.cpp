@@ -0,0 +1,109 @@
+#include "resourceRegistry.hpp"
+
+#include "../Components/mesh.hpp"
+
+#include <thread>
+
+static void releaseObject(void* object) {
+    static_cast<NS::Object*>(object)->release();
+}
+
+static void deleteMesh(void* object) {
+    delete static_cast<Mesh*>(object);
+}
+
+ResourceRegistry::ResourceRegistry(MTL::Device* device) {
+    frameEvent = device->newSharedEvent();
+    frameEvent->setLabel(NS::String::string("Resource Frame Event", NS::ASCIIStringEncoding));
+    frameEvent->setSignaledValue(0);
+    retired.reserve(64);
+}
+
+ResourceRegistry::~ResourceRegistry() {
+    waitIdle();
+
+    for (Mesh* mesh : meshes.objects()) {
+        delete mesh;
+    }
+    for (MTL::Texture* texture : textures.objects()) {
+        texture->release();
+    }
+    for (MTL::Buffer* buffer : buffers.objects()) {
+        buffer->release();
+    }
+    frameEvent->release();
+}
+
+MeshHandle ResourceRegistry::addMesh(Mesh* mesh) {
+    return meshes.add(mesh);
+}
+
+TextureHandle ResourceRegistry::addTexture(MTL::Texture* texture) {
+    return textures.add(texture);
+}
+
+BufferHandle ResourceRegistry::addBuffer(MTL::Buffer* buffer) {
+    return buffers.add(buffer);
+}
+
+void ResourceRegistry::destroy(MeshHandle handle) {
+    if (Mesh* mesh = meshes.remove(handle))
+        enqueue(mesh, deleteMesh);
+}
+
+void ResourceRegistry::destroy(TextureHandle handle) {
+    if (MTL::Texture* texture = textures.remove(handle))
+        enqueue(texture, releaseObject);
+}
+
+void ResourceRegistry::destroy(BufferHandle handle) {
+    if (MTL::Buffer* buffer = buffers.remove(handle))
+        enqueue(buffer, releaseObject);
+}
+
+void ResourceRegistry::replace(TextureHandle handle, MTL::Texture* texture) {
+    if (MTL::Texture* previous = textures.replace(handle, texture))
+        enqueue(previous, releaseObject);
+}
+
+void ResourceRegistry::replace(BufferHandle handle, MTL::Buffer* buffer) {
+    if (MTL::Buffer* previous = buffers.replace(handle, buffer))
+        enqueue(previous, releaseObject);
+}
+
+void ResourceRegistry::retire(NS::Object* object) {
+    if (object)
+        enqueue(object, releaseObject);
+}
+
+void ResourceRegistry::enqueue(void* object, void (*destroy)(void*)) {
+    // Commands of the current frame may still reference the object
+    retired.push_back({frameSerial, object, destroy});
+}
+
+void ResourceRegistry::collect(uint64_t completedSerial) {
+    size_t count = 0;
+    while (count < retired.size() && retired[count].serial <= completedSerial) {
+        retired[count].destroy(retired[count].object);
+        count++;
+    }
+    retired.erase(retired.begin(), retired.begin() + count);
+}
+
+void ResourceRegistry::beginFrame() {
+    collect(frameEvent->signaledValue());
+    frameSerial++;
+}
+
+void ResourceRegistry::signalFrameEnd(MTL::CommandBuffer* commandBuffer) {
+    commandBuffer->encodeSignalEvent(frameEvent, frameSerial);
+    signalledSerial = frameSerial;
+}
+
+void ResourceRegistry::waitIdle() {
+    while (frameEvent->signaledValue() < signalledSerial) {
+        std::this_thread::yield();
+    }
+    // Nothing that is still queued can be referenced by submitted work
+    collect(UINT64_MAX);
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+#include <span>
+
+struct Mesh;
+
+// 32-bit generational handle: 20 bits of slot index, 12 bits of generation. The
+// generation of a slot is bumped when its resource is destroyed, so stale copies
+// of a handle resolve to null instead of to whatever reuses the slot. Zero is
+// never a live handle.
+template<typename T>
+struct ResourceHandle {
+    static constexpr uint32_t IndexBits      = 20;
+    static constexpr uint32_t GenerationBits = 32 - IndexBits;
+    static constexpr uint32_t MaxIndex       = (1u << IndexBits) - 1;
+    static constexpr uint32_t GenerationMask = (1u << GenerationBits) - 1;
+
+    uint32_t value = 0;
+
+    static ResourceHandle make(uint32_t index, uint32_t generation) {
+        return {(generation << IndexBits) | index};
+    }
+    uint32_t index() const { return value & MaxIndex; }
+    uint32_t generation() const { return value >> IndexBits; }
+    bool isValid() const { return value != 0; }
+
+    bool operator==(const ResourceHandle& other) const { return value == other.value; }
+    bool operator!=(const ResourceHandle& other) const { return value != other.value; }
+};
+
+using MeshHandle    = ResourceHandle<Mesh>;
+using TextureHandle = ResourceHandle<MTL::Texture>;
+using BufferHandle  = ResourceHandle<MTL::Buffer>;
+
+// Objects of one type packed in a dense array for iteration, with a sparse slot
+// table translating handles to dense indices. Removal swaps the last object into
+// the hole, so dense order is not stable. The pool does not own the objects.
+template<typename T>
+class ResourcePool {
+public:
+    using Handle = ResourceHandle<T>;
+
+    Handle add(T* object) {
+        uint32_t index;
+        if (!freeSlots.empty()) {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            assert(slots.size() <= Handle::MaxIndex && "Resource pool is full");
+            index = (uint32_t)slots.size();
+            slots.push_back({0, 1});
+        }
+        slots[index].denseIndex = (uint32_t)dense.size();
+        dense.push_back(object);
+        denseSlots.push_back(index);
+        return Handle::make(index, slots[index].generation);
+    }
+
+    T* get(Handle handle) const {
+        const Slot* slot = find(handle);
+        return slot ? dense[slot->denseIndex] : nullptr;
+    }
+
+    // Swaps the object behind a live handle, returns the previous one
+    T* replace(Handle handle, T* object) {
+        const Slot* slot = find(handle);
+        if (!slot)
+            return nullptr;
+        T* previous = dense[slot->denseIndex];
+        dense[slot->denseIndex] = object;
+        return previous;
+    }
+
+    // Invalidates the handle and every copy of it, returns the object
+    T* remove(Handle handle) {
+        const Slot* slot = find(handle);
+        if (!slot)
+            return nullptr;
+
+        uint32_t denseIndex = slot->denseIndex;
+        T* object = dense[denseIndex];
+
+        dense[denseIndex] = dense.back();
+        denseSlots[denseIndex] = denseSlots.back();
+        slots[denseSlots[denseIndex]].denseIndex = denseIndex;
+        dense.pop_back();
+        denseSlots.pop_back();
+
+        Slot& removed = slots[handle.index()];
+        // Generation zero is skipped so a live handle is never zero
+        removed.generation = (removed.generation + 1) & Handle::GenerationMask;
+        if (removed.generation == 0)
+            removed.generation = 1;
+        freeSlots.push_back(handle.index());
+        return object;
+    }
+
+    size_t size() const { return dense.size(); }
+    std::span<T* const> objects() const { return dense; }
+
+private:
+    struct Slot {
+        uint32_t denseIndex;
+        uint32_t generation;
+    };
+
+    const Slot* find(Handle handle) const {
+        if (!handle.isValid() || handle.index() >= slots.size())
+            return nullptr;
+        const Slot& slot = slots[handle.index()];
+        return slot.generation == handle.generation() ? &slot : nullptr;
+    }
+
+    std::vector<T*>         dense;
+    std::vector<uint32_t>   denseSlots;     // Slot of each dense entry
+    std::vector<Slot>       slots;
+    std::vector<uint32_t>   freeSlots;
+};
+
+// Owns meshes, textures and buffers behind generational handles and defers their
+// destruction until the GPU is done with them. Every frame gets a serial; the last
+// command buffer of the frame signals it on a shared event, and an object retired
+// during frame N is released once the event reaches N. Textures and buffers can be
+// replaced behind a live handle, the old object goes through the same queue.
+class ResourceRegistry {
+public:
+    ResourceRegistry(MTL::Device* device);
+    ~ResourceRegistry();
+
+    MeshHandle      addMesh(Mesh* mesh);
+    TextureHandle   addTexture(MTL::Texture* texture);
+    BufferHandle    addBuffer(MTL::Buffer* buffer);
+
+    // Null for stale handles
+    Mesh*           get(MeshHandle handle) const { return meshes.get(handle); }
+    MTL::Texture*   get(TextureHandle handle) const { return textures.get(handle); }
+    MTL::Buffer*    get(BufferHandle handle) const { return buffers.get(handle); }
+
+    void destroy(MeshHandle handle);
+    void destroy(TextureHandle handle);
+    void destroy(BufferHandle handle);
+
+    void replace(TextureHandle handle, MTL::Texture* texture);
+    void replace(BufferHandle handle, MTL::Buffer* buffer);
+
+    // Deferred release of an object that is not tracked by a handle
+    void retire(NS::Object* object);
+
+    // Starts a new frame serial and frees everything the GPU has finished with
+    void beginFrame();
+    // Encodes the signal for the current serial, call on the frame's last command buffer
+    void signalFrameEnd(MTL::CommandBuffer* commandBuffer);
+    // Waits for every signalled frame and frees the whole queue
+    void waitIdle();
+
+    uint64_t getFrameSerial() const { return frameSerial; }
+    size_t getPendingCount() const { return retired.size(); }
+
+private:
+    struct Retired {
+        uint64_t    serial;
+        void*       object;
+        void        (*destroy)(void* object);
+    };
+
+    void enqueue(void* object, void (*destroy)(void*));
+    void collect(uint64_t completedSerial);
+
+    MTL::SharedEvent*           frameEvent;
+    uint64_t                    frameSerial = 0;
+    uint64_t                    signalledSerial = 0;
+
+    ResourcePool<Mesh>          meshes;
+    ResourcePool<MTL::Texture>  textures;
+    ResourcePool<MTL::Buffer>   buffers;
+
+    std::vector<Retired>        retired;        // In serial order
+};
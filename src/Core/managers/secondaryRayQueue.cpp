@@ -0,0 +1,277 @@
+#include "secondaryRayQueue.hpp"
+
+#include "proxyMesh.hpp"
+#include "triangleBVH.hpp"
+#include "../Components/mesh.hpp"
+
+#include <cmath>
+
+SecondaryRayQueue::SecondaryRayQueue(MTL::Device* device, RenderPipeline& pipelines)
+: device(device), pipelines(pipelines) {
+    // Counts and the ray count, then MTLDispatchThreadgroupsIndirectArguments
+    bins = device->newBuffer((SecondaryRayBinCount + 4) * sizeof(uint32_t), MTL::ResourceStorageModePrivate);
+    bins->setLabel(NS::String::string("Secondary Ray Bins", NS::ASCIIStringEncoding));
+    setSceneBounds(simd::float3{-1.0f, -1.0f, -1.0f}, simd::float3{1.0f, 1.0f, 1.0f});
+}
+
+SecondaryRayQueue::~SecondaryRayQueue() {
+    if (rays) {
+        rays->release();
+    }
+    bins->release();
+}
+
+void SecondaryRayQueue::resize(uint32_t width, uint32_t height, ResourceRegistry& resources) {
+    // Frames in flight may still trace the old queue
+    resources.retire(rays);
+
+    this->width = width;
+    this->height = height;
+    params.capacity = width * height;
+    rays = device->newBuffer(2 * params.capacity * sizeof(SecondaryRay), MTL::ResourceStorageModePrivate);
+    rays->setLabel(NS::String::string("Secondary Rays", NS::ASCIIStringEncoding));
+}
+
+static void fitBounds(SecondaryRayParams& params, simd::float3 boundsMin, simd::float3 boundsMax) {
+    simd::float3 extent = simd::max(boundsMax - boundsMin, simd::float3(1e-4f));
+    params.boundsMin = simd::make_float4(boundsMin, 0.0f);
+    params.boundsInverseExtent = simd::make_float4(1.0f / extent, 0.0f);
+    // A few percent of the scene keeps the occlusion local, like a screen space radius would
+    params.maxDistance = 0.02f * simd::length(extent);
+}
+
+void SecondaryRayQueue::setSceneBounds(simd::float3 boundsMin, simd::float3 boundsMax) {
+    fitBounds(params, boundsMin, boundsMax);
+}
+
+void SecondaryRayQueue::setProxy(MTL::AccelerationStructure* accelerationStructure, float maxError) {
+    proxy = accelerationStructure;
+    params.minDistance = accelerationStructure ? maxError : 0.0f;
+}
+
+void SecondaryRayQueue::encode(MTL::ComputeCommandEncoder* encoder, MTL::Texture* output, uint32_t frameIndex) {
+    assert(rays && "SecondaryRayQueue::resize must run first");
+    params.frameIndex = frameIndex;
+
+    encoder->setBytes(&params, sizeof(params), BufferIndexSecondaryRayParams);
+    encoder->setBuffer(rays, 0, BufferIndexSecondaryRays);
+    encoder->setBuffer(bins, 0, BufferIndexSecondaryRayBins);
+    encoder->setTexture(output, TextureIndexRaytracing);
+
+    // Dispatches of one compute encoder run in order, each pass sees the previous one's writes
+    encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::SecondaryRayClear));
+    encoder->dispatchThreads(MTL::Size(SecondaryRayBinCount + 1, 1, 1), MTL::Size(SecondaryRayScanThreads, 1, 1));
+
+    encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::SecondaryRayQueue));
+#if OPACITY_MICROMAPS
+    encoder->setIntersectionFunctionTable(pipelines.getIntersectionFunctionTable(ComputePipelineType::SecondaryRayQueue),
+                                          BufferIndexIntersectionFunctions);
+#endif
+    encoder->dispatchThreads(MTL::Size(width, height, 1), MTL::Size(8, 8, 1));
+
+    encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::SecondaryRayScan));
+    encoder->dispatchThreadgroups(MTL::Size(1, 1, 1), MTL::Size(SecondaryRayScanThreads, 1, 1));
+
+    const NS::UInteger argumentsOffset = (SecondaryRayBinCount + 1) * sizeof(uint32_t);
+    encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::SecondaryRayScatter));
+    encoder->dispatchThreadgroups(bins, argumentsOffset, MTL::Size(SecondaryRayGroupSize, 1, 1));
+
+    encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::SecondaryRayTrace));
+    if (proxy) {
+        encoder->useResource(proxy, MTL::ResourceUsageRead);
+        encoder->setAccelerationStructure(proxy, BufferIndexAccelerationStructure);
+    }
+#if OPACITY_MICROMAPS
+    encoder->setIntersectionFunctionTable(pipelines.getIntersectionFunctionTable(ComputePipelineType::SecondaryRayTrace),
+                                          BufferIndexIntersectionFunctions);
+#endif
+    encoder->dispatchThreadgroups(bins, argumentsOffset, MTL::Size(SecondaryRayGroupSize, 1, 1));
+}
+
+uint32_t SecondaryRayQueue::sortKey(simd::float3 origin, simd::float3 direction, const SecondaryRayParams& params) {
+    simd::float3 normalized = simd::clamp((origin - params.boundsMin.xyz) * params.boundsInverseExtent.xyz, 0.0f, 1.0f);
+    simd::uint3 cell = simd::uint3{(uint32_t)(normalized.x * 7.999f), (uint32_t)(normalized.y * 7.999f), (uint32_t)(normalized.z * 7.999f)};
+    uint32_t morton = 0;
+    for (uint32_t bit = 0; bit < 3; bit++) {
+        morton |= ((cell.x >> bit) & 1) << (3 * bit) |
+                  ((cell.y >> bit) & 1) << (3 * bit + 1) |
+                  ((cell.z >> bit) & 1) << (3 * bit + 2);
+    }
+
+    direction /= std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z);
+    simd::float2 octahedral = {direction.x, direction.z};
+    if (direction.y < 0.0f) {
+        octahedral = simd::float2{(1.0f - std::abs(direction.z)) * (direction.x >= 0.0f ? 1.0f : -1.0f),
+                                  (1.0f - std::abs(direction.x)) * (direction.z >= 0.0f ? 1.0f : -1.0f)};
+    }
+    simd::float2 uv = simd::clamp(octahedral * 0.5f + 0.5f, 0.0f, 1.0f);
+    uint32_t directionX = (uint32_t)(uv.x * 7.999f);
+    uint32_t directionY = (uint32_t)(uv.y * 7.999f);
+    return (morton << SecondaryRayDirectionBits) | (directionY << 3) | directionX;
+}
+
+void SecondaryRayQueue::sortRays(std::span<const SecondaryRay> rays, std::span<SecondaryRay> sorted) {
+    assert(sorted.size() >= rays.size());
+    std::vector<uint32_t> offsets(SecondaryRayBinCount, 0);
+    for (const SecondaryRay& ray : rays) {
+        offsets[ray.key]++;
+    }
+    uint32_t offset = 0;
+    for (uint32_t& binOffset : offsets) {
+        uint32_t count = binOffset;
+        binOffset = offset;
+        offset += count;
+    }
+    for (const SecondaryRay& ray : rays) {
+        sorted[offsets[ray.key]++] = ray;
+    }
+}
+
+// Same hash as the queue kernel, the CPU rays match the GPU ones of frame zero
+static uint32_t hashUint(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Cosine weighted direction around n
+static simd::float3 sampleHemisphere(simd::float3 n, uint32_t seed) {
+    float u0 = hashUint(seed) * (1.0f / 4294967296.0f);
+    float u1 = hashUint(seed ^ 0x9e3779b9u) * (1.0f / 4294967296.0f);
+    float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+    float a = -1.0f / (sign + n.z);
+    float b = n.x * n.y * a;
+    simd::float3 tangent = {1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x};
+    simd::float3 bitangent = {b, sign + n.y * n.y * a, -n.y};
+    float radius = std::sqrt(u0);
+    float phi = 2.0f * (float)M_PI * u1;
+    return simd::normalize(tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) +
+                           n * std::sqrt(std::max(0.0f, 1.0f - u0)));
+}
+
+namespace {
+    struct TraceStats {
+        double      milliseconds = 0.0;
+        double      nodesPerRay = 0.0;
+        double      simdUtilization = 0.0;  // Mean over groups of sum(nodes) / (width * max(nodes))
+        double      uniqueNodesPerGroup = 0.0;
+        uint32_t    occluded = 0;
+    };
+}
+
+// Group of SIMD width consecutive rays, as one GPU SIMD group would trace them
+static constexpr uint32_t SimdWidth = 32;
+
+// minDistance moves the origins along the rays, as ray.min_distance does on the GPU
+static TraceStats traceRays(const TriangleBVH& bvh, std::span<const SecondaryRay> rays, float minDistance = 0.0f) {
+    TraceStats stats;
+    auto startTime = std::chrono::steady_clock::now();
+    for (const SecondaryRay& ray : rays) {
+        stats.occluded += bvh.occluded(ray.origin_maxDistance.xyz + ray.direction.xyz * minDistance, ray.direction.xyz,
+                                       ray.origin_maxDistance.w - minDistance);
+    }
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+    // Traversal cost per ray and how much of it a SIMD group shares, measured apart from the timing
+    uint64_t totalNodes = 0;
+    double utilization = 0.0, uniqueNodes = 0.0;
+    uint32_t groupCount = 0;
+    std::vector<uint32_t> visited, groupNodes;
+    for (size_t first = 0; first < rays.size(); first += SimdWidth) {
+        size_t last = std::min(first + SimdWidth, rays.size());
+        uint32_t groupSum = 0, groupMax = 0;
+        groupNodes.clear();
+        for (size_t i = first; i < last; i++) {
+            visited.clear();
+            bvh.occluded(rays[i].origin_maxDistance.xyz + rays[i].direction.xyz * minDistance, rays[i].direction.xyz,
+                         rays[i].origin_maxDistance.w - minDistance, visited);
+            groupSum += (uint32_t)visited.size();
+            groupMax = std::max(groupMax, (uint32_t)visited.size());
+            groupNodes.insert(groupNodes.end(), visited.begin(), visited.end());
+        }
+        std::sort(groupNodes.begin(), groupNodes.end());
+        uniqueNodes += std::unique(groupNodes.begin(), groupNodes.end()) - groupNodes.begin();
+        utilization += groupMax ? (double)groupSum / ((double)SimdWidth * groupMax) : 1.0;
+        totalNodes += groupSum;
+        groupCount++;
+    }
+    if (!rays.empty()) {
+        stats.nodesPerRay = (double)totalNodes / rays.size();
+        stats.simdUtilization = utilization / groupCount;
+        stats.uniqueNodesPerGroup = uniqueNodes / groupCount;
+    }
+    return stats;
+}
+
+void SecondaryRayQueue::benchmark(const Mesh& mesh, uint32_t width, uint32_t height) {
+    std::vector<simd::float3> positions(mesh.vertices.size());
+    for (size_t i = 0; i < mesh.vertices.size(); i++) {
+        positions[i] = mesh.vertices[i].position.xyz;
+    }
+    TriangleBVH bvh;
+    bvh.build(positions, mesh.vertexIndices);
+    if (bvh.isEmpty())
+        return;
+
+    SecondaryRayParams params{};
+    fitBounds(params, bvh.getBoundsMin(), bvh.getBoundsMax());
+
+    // Camera in the middle of the scene looking down -z with a 60 degree vertical field of view
+    simd::float3 cameraPosition = (bvh.getBoundsMin() + bvh.getBoundsMax()) * 0.5f;
+    float tanHalfFov = std::tan(30.0f * (float)M_PI / 180.0f);
+    float aspect = (float)width / height;
+
+    // Primary hits, each queues one occlusion ray the way queueSecondaryRaysKernel does
+    std::vector<SecondaryRay> rays;
+    rays.reserve((size_t)width * height);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            simd::float2 ndc = {((x + 0.5f) / width) * 2.0f - 1.0f, 1.0f - ((y + 0.5f) / height) * 2.0f};
+            simd::float3 direction = simd::normalize(simd::float3{ndc.x * tanHalfFov * aspect, ndc.y * tanHalfFov, -1.0f});
+            TriangleBVH::Hit hit;
+            if (!bvh.intersect(cameraPosition, direction, INFINITY, hit))
+                continue;
+
+            const uint32_t* triangle = &mesh.vertexIndices[3 * (size_t)hit.triangle];
+            simd::float3 normal = simd::normalize(mesh.vertices[triangle[0]].normal.xyz * (1.0f - hit.barycentrics.x - hit.barycentrics.y) +
+                                                  mesh.vertices[triangle[1]].normal.xyz * hit.barycentrics.x +
+                                                  mesh.vertices[triangle[2]].normal.xyz * hit.barycentrics.y);
+            uint32_t seed = hashUint(x | (y << 16)) ^ hashUint(0);
+            simd::float3 origin = cameraPosition + direction * hit.distance + normal * (params.maxDistance * 0.01f);
+            simd::float3 secondaryDirection = sampleHemisphere(normal, seed);
+
+            SecondaryRay ray{};
+            ray.origin_maxDistance = simd::make_float4(origin, params.maxDistance);
+            ray.direction = simd::make_float4(secondaryDirection, 0.0f);
+            ray.pixel = x | (y << 16);
+            ray.key = sortKey(origin, secondaryDirection, params);
+            rays.push_back(ray);
+        }
+    }
+
+    std::vector<SecondaryRay> sorted(rays.size());
+    auto sortStart = std::chrono::steady_clock::now();
+    sortRays(rays, sorted);
+    double sortMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sortStart).count();
+
+    printf("Secondary ray benchmark: %ux%u, %zu triangles, %zu rays, sort %.2f ms\n",
+           width, height, mesh.vertexIndices.size() / 3, rays.size(), sortMilliseconds);
+    auto report = [](const char* name, const TraceStats& stats) {
+        printf("  %-6s %8.1f ms, %6.1f nodes/ray, %5.1f%% SIMD utilisation, %7.1f unique nodes/group, %u occluded\n",
+               name, stats.milliseconds, stats.nodesPerRay, 100.0 * stats.simdUtilization, stats.uniqueNodesPerGroup, stats.occluded);
+    };
+    report("pixel", traceRays(bvh, rays));
+    report("sorted", traceRays(bvh, sorted));
+
+    ProxyMesh::Stats proxyStats;
+    ProxyMesh::Proxy proxy = ProxyMesh::simplify(positions, mesh.vertexIndices, ProxyMesh::Settings{}, &proxyStats);
+    TriangleBVH proxyBVH;
+    proxyBVH.build(proxy.positions, proxy.indices);
+    if (proxyBVH.isEmpty())
+        return;
+    printf("  proxy: %u of %u triangles, max error %.4f\n", proxyStats.triangles, proxyStats.sourceTriangles, proxy.maxError);
+    report("proxy", traceRays(proxyBVH, sorted, proxy.maxError));
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+#include <simd/simd.h>
+#include <span>
+#include "renderPipeline.hpp"
+#include "resourceRegistry.hpp"
+#include "../../../data/shaders/shaderTypes.hpp"
+
+struct Mesh;
+
+// Coherence sorted secondary rays for SECONDARY_RAY_QUEUE. The primary pass queues
+// one ray per hit pixel, the queue is counting sorted into SecondaryRayBinCount bins
+// by sortKey, then traced in bin order so the rays of a SIMD group start close together
+// and point the same way. All passes run in the ray tracing encoder; the sorted
+// passes are dispatched indirectly from the ray count the scan writes.
+class SecondaryRayQueue {
+public:
+    SecondaryRayQueue(MTL::Device* device, RenderPipeline& pipelines);
+    ~SecondaryRayQueue();
+
+    // The old queue is retired through resources
+    void resize(uint32_t width, uint32_t height, ResourceRegistry& resources);
+    // Origins are quantised inside the bounds, the occlusion radius follows their size
+    void setSceneBounds(simd::float3 boundsMin, simd::float3 boundsMax);
+    // Simplified scene the sorted rays trace instead of the bound one, not owned.
+    // Rays skip the first maxError so the proxy never occludes the surface it stands in for.
+    void setProxy(MTL::AccelerationStructure* accelerationStructure, float maxError);
+
+    // Inside the ray tracing encoder, with the view and pass constants and the
+    // acceleration structure bound. Writes every pixel of output.
+    void encode(MTL::ComputeCommandEncoder* encoder, MTL::Texture* output, uint32_t frameIndex);
+
+    // Bin of a ray, the same as secondaryRayKey in ray_trace.metal
+    static uint32_t sortKey(simd::float3 origin, simd::float3 direction, const SecondaryRayParams& params);
+    // Stable counting sort by key
+    static void sortRays(std::span<const SecondaryRay> rays, std::span<SecondaryRay> sorted);
+    // Traces the ambient occlusion rays of a camera at the centre of the mesh over its
+    // software BVH in pixel order and in sorted order, then in sorted order over a
+    // ProxyMesh of it, and prints the cost of each
+    static void benchmark(const Mesh& mesh, uint32_t width, uint32_t height);
+
+    SecondaryRayParams  params{};
+
+private:
+    MTL::Device*        device;
+    RenderPipeline&     pipelines;
+
+    MTL::Buffer*        rays = nullptr;     // Unsorted then sorted, params.capacity each
+    MTL::Buffer*        bins = nullptr;     // Counts, ray count, indirect arguments
+    MTL::AccelerationStructure* proxy = nullptr;
+    uint32_t            width = 0;
+    uint32_t            height = 0;
+};
@@ -0,0 +1,206 @@
+#include "smoothNormals.hpp"
+
+#include "parallel.hpp"
+#include "../Components/mesh.hpp"
+
+#include <cmath>
+#include <numeric>
+
+namespace SmoothNormals {
+
+static constexpr uint32_t NoVertex = 0xFFFFFFFF;
+
+static bool hasNormal(const Vertex& vertex) {
+    return simd::length_squared(vertex.normal.xyz) > 0.0f;
+}
+
+static float cornerAngle(simd::float3 corner, simd::float3 next, simd::float3 previous) {
+    simd::float3 a = next - corner;
+    simd::float3 b = previous - corner;
+    float lengths = simd::length(a) * simd::length(b);
+    return lengths > 0.0f ? std::acos(std::clamp(simd::dot(a, b) / lengths, -1.0f, 1.0f)) : 0.0f;
+}
+
+bool generate(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, const Settings& settings, Stats* stats) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<uint32_t> triangles;
+    for (uint32_t triangle = 0; triangle < indices.size() / 3; triangle++) {
+        const uint32_t* corners = &indices[3 * (size_t)triangle];
+        if (!hasNormal(vertices[corners[0]]) && !hasNormal(vertices[corners[1]]) && !hasNormal(vertices[corners[2]])) {
+            triangles.push_back(triangle);
+        }
+    }
+    if (triangles.empty())
+        return false;
+
+    const uint32_t triangleCount = (uint32_t)triangles.size();
+    const uint32_t cornerCount = triangleCount * 3;
+    const uint32_t threadCount = settings.threadCount;
+
+    // Unit face normals and corner angles, each triangle writes only its own entries
+    std::vector<simd::float3> faceNormals(triangleCount);
+    std::vector<float> angles(cornerCount);
+    parallelFor(triangleCount, threadCount, 1024, [&](uint32_t index) {
+        const uint32_t* corners = &indices[3 * (size_t)triangles[index]];
+        simd::float3 p0 = vertices[corners[0]].position.xyz;
+        simd::float3 p1 = vertices[corners[1]].position.xyz;
+        simd::float3 p2 = vertices[corners[2]].position.xyz;
+        simd::float3 normal = simd::cross(p1 - p0, p2 - p0);
+        float length = simd::length(normal);
+        faceNormals[index] = length > 0.0f ? normal / length : simd::float3(0.0f);
+        angles[index * 3 + 0] = cornerAngle(p0, p1, p2);
+        angles[index * 3 + 1] = cornerAngle(p1, p2, p0);
+        angles[index * 3 + 2] = cornerAngle(p2, p0, p1);
+    });
+
+    // Weld by position, vertices sorted by position bits then by index
+    std::vector<uint32_t> order(vertices.size());
+    std::iota(order.begin(), order.end(), 0u);
+    auto positionKey = [&](uint32_t vertex) {
+        simd::float3 position = vertices[vertex].position.xyz;
+        // +0 and -0 weld together
+        position += simd::float3(0.0f);
+        uint32_t x, y, z;
+        std::memcpy(&x, &position.x, 4);
+        std::memcpy(&y, &position.y, 4);
+        std::memcpy(&z, &position.z, 4);
+        return std::make_tuple(x, y, z, vertex);
+    };
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return positionKey(a) < positionKey(b); });
+    std::vector<uint32_t> positionIds(vertices.size());
+    uint32_t positionCount = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        if (i > 0 && simd::any(vertices[order[i]].position.xyz != vertices[order[i - 1]].position.xyz)) {
+            positionCount++;
+        }
+        positionIds[order[i]] = positionCount;
+    }
+    positionCount++;
+
+    // Corners of every welded position, in corner order, which fixes the summation order
+    std::vector<uint32_t> positionOffsets(positionCount + 1, 0);
+    for (uint32_t corner = 0; corner < cornerCount; corner++) {
+        positionOffsets[positionIds[indices[3 * (size_t)triangles[corner / 3] + corner % 3]] + 1]++;
+    }
+    std::partial_sum(positionOffsets.begin(), positionOffsets.end(), positionOffsets.begin());
+    std::vector<uint32_t> positionCorners(cornerCount);
+    {
+        std::vector<uint32_t> cursor(positionOffsets.begin(), positionOffsets.end() - 1);
+        for (uint32_t corner = 0; corner < cornerCount; corner++) {
+            positionCorners[cursor[positionIds[indices[3 * (size_t)triangles[corner / 3] + corner % 3]]]++] = corner;
+        }
+    }
+
+    // Every corner gathers the faces around its position that are within the crease angle
+    const float creaseCosine = std::cos(settings.creaseAngle * (float)M_PI / 180.0f);
+    std::vector<simd::float3> cornerNormals(cornerCount);
+    uint32_t usedThreads = parallelFor(cornerCount, threadCount, 1024, [&](uint32_t corner) {
+        const simd::float3 faceNormal = faceNormals[corner / 3];
+        const uint32_t position = positionIds[indices[3 * (size_t)triangles[corner / 3] + corner % 3]];
+        simd::float3 sum = simd::float3(0.0f);
+        for (uint32_t i = positionOffsets[position]; i < positionOffsets[position + 1]; i++) {
+            uint32_t other = positionCorners[i];
+            if (simd::dot(faceNormal, faceNormals[other / 3]) >= creaseCosine) {
+                sum += faceNormals[other / 3] * angles[other];
+            }
+        }
+        float length = simd::length(sum);
+        cornerNormals[corner] = length > 0.0f ? sum / length : (simd::length_squared(faceNormal) > 0.0f ? faceNormal : simd::float3{0.0f, 1.0f, 0.0f});
+    });
+
+    // Corners of one vertex keep it while they agree, each different normal gets a copy.
+    // Copies of a vertex are chained so later corners can share them.
+    const uint32_t sourceVertexCount = (uint32_t)vertices.size();
+    std::vector<uint8_t> assigned(sourceVertexCount, 0);
+    std::vector<uint32_t> nextCopy(sourceVertexCount, NoVertex);
+    for (uint32_t corner = 0; corner < cornerCount; corner++) {
+        uint32_t& index = indices[3 * (size_t)triangles[corner / 3] + corner % 3];
+        simd::float4 normal = simd::make_float4(cornerNormals[corner], 0.0f);
+        if (!assigned[index]) {
+            assigned[index] = 1;
+            vertices[index].normal = normal;
+            continue;
+        }
+
+        uint32_t vertex = index;
+        while (simd::dot(vertices[vertex].normal.xyz, normal.xyz) < 0.9999f) {
+            if (nextCopy[vertex] == NoVertex) {
+                Vertex copy = vertices[index];
+                copy.normal = normal;
+                nextCopy[vertex] = (uint32_t)vertices.size();
+                nextCopy.push_back(NoVertex);
+                vertices.push_back(copy);
+            }
+            vertex = nextCopy[vertex];
+        }
+        index = vertex;
+    }
+
+    if (stats) {
+        stats->triangles = triangleCount;
+        stats->splitVertices = (uint32_t)vertices.size() - sourceVertexCount;
+        stats->threadCount = usedThreads;
+        stats->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    }
+    return true;
+}
+
+void benchmark(const Mesh& mesh, const Settings& settings) {
+    std::vector<Vertex> stripped = mesh.vertices;
+    for (Vertex& vertex : stripped) {
+        vertex.normal = simd::float4(0.0f);
+    }
+
+    // Best of a few runs, the first touches cold memory
+    auto run = [&](uint32_t threadCount, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+        Settings runSettings = settings;
+        runSettings.threadCount = threadCount;
+        Stats best;
+        best.milliseconds = INFINITY;
+        for (uint32_t repeat = 0; repeat < 3; repeat++) {
+            vertices = stripped;
+            indices = mesh.vertexIndices;
+            Stats stats;
+            generate(vertices, indices, runSettings, &stats);
+            if (stats.milliseconds < best.milliseconds)
+                best = stats;
+        }
+        return best;
+    };
+
+    std::vector<Vertex> serialVertices, parallelVertices;
+    std::vector<uint32_t> serialIndices, parallelIndices;
+    Stats serial = run(1, serialVertices, serialIndices);
+    // Every hardware thread, not what the startup budget has left
+    Stats parallel = run(std::max(std::thread::hardware_concurrency(), 1u), parallelVertices, parallelIndices);
+
+    bool identical = serialIndices == parallelIndices && serialVertices.size() == parallelVertices.size() &&
+                     std::equal(serialVertices.begin(), serialVertices.end(), parallelVertices.begin(), [](const Vertex& a, const Vertex& b) {
+                         return simd::all(a.normal == b.normal);
+                     });
+
+    // Angle between each generated corner normal and the authored one
+    double totalDegrees = 0.0;
+    uint32_t comparedCorners = 0;
+    for (size_t i = 0; i < mesh.vertexIndices.size(); i++) {
+        simd::float3 authored = mesh.vertices[mesh.vertexIndices[i]].normal.xyz;
+        if (simd::length_squared(authored) == 0.0f)
+            continue;
+        float cosine = simd::dot(simd::normalize(authored), parallelVertices[parallelIndices[i]].normal.xyz);
+        totalDegrees += std::acos(std::clamp(cosine, -1.0f, 1.0f)) * 180.0 / M_PI;
+        comparedCorners++;
+    }
+
+    printf("Smooth normal benchmark: %u triangles, crease %.0f degrees, %u split vertices\n",
+           serial.triangles, settings.creaseAngle, parallel.splitVertices);
+    printf("  1 thread  %8.2f ms, %6.2f Mtri/s\n", serial.milliseconds, serial.triangles / (serial.milliseconds * 1000.0));
+    printf("  %-2u threads %7.2f ms, %6.2f Mtri/s, %.1fx, %s\n", parallel.threadCount, parallel.milliseconds,
+           parallel.triangles / (parallel.milliseconds * 1000.0), serial.milliseconds / parallel.milliseconds,
+           identical ? "identical to 1 thread" : "DIFFERS from 1 thread");
+    if (comparedCorners > 0) {
+        printf("  mean deviation from authored normals %.2f degrees\n", totalDegrees / comparedCorners);
+    }
+}
+
+}
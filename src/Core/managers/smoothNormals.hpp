@@ -0,0 +1,40 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+
+#include "../vertexData.hpp"
+
+struct Mesh;
+
+// Import stage for geometry without normals. Every triangle whose three vertices have a
+// zero normal gets smooth normals: each corner averages the face normals around its
+// position, weighted by the corner angle of each face, leaving out faces that meet its
+// own at more than the crease angle. Vertices are welded by position first, so seams in
+// the texture coordinates stay smooth, and split where the corners sharing a vertex end
+// up with different normals, so hard edges stay hard. Face normals and corners run in
+// parallel; each corner gathers its own sum in a fixed order, there are no atomics and
+// the result does not depend on the thread count.
+namespace SmoothNormals {
+    struct Settings {
+        float       creaseAngle = 60.0f;    // Degrees, faces meeting at a sharper angle are not averaged
+        uint32_t    threadCount = 0;        // Zero draws from the caller's ThreadBudget, see parallelFor
+    };
+
+    struct Stats {
+        uint32_t    triangles = 0;          // Triangles that had no normals
+        uint32_t    splitVertices = 0;      // Vertices added at hard edges
+        uint32_t    threadCount = 0;
+        double      milliseconds = 0.0;
+    };
+
+    // Writes normals into vertices and appends split vertices, indices is a triangle list.
+    // Triangles with normals are left alone. Returns false if nothing needed normals.
+    bool generate(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, const Settings& settings, Stats* stats = nullptr);
+
+    // Clears the normals of a copy of the mesh and regenerates them with one thread and
+    // with every thread, then prints the throughput of both and how far the result is
+    // from the authored normals
+    void benchmark(const Mesh& mesh, const Settings& settings);
+}
@@ -0,0 +1,187 @@
+#include "startupGraph.hpp"
+
+#include <Foundation/Foundation.hpp>
+#include <thread>
+
+StartupGraph::TaskId StartupGraph::addTask(const char* name, std::function<void()> work,
+                                           std::initializer_list<TaskId> dependencies, bool mainThread) {
+    TaskId id = (TaskId)tasks.size();
+    Task& task = tasks.emplace_back();
+    task.work = std::move(work);
+    task.mainThread = mainThread;
+    for (TaskId dependency : dependencies) {
+        assert(dependency < id && "Startup task depends on a task added after it");
+        task.dependencies.push_back(dependency);
+        tasks[dependency].dependents.push_back(id);
+    }
+    task.pendingDependencies = (uint32_t)task.dependencies.size();
+
+    timings.push_back({.name = name, .startMilliseconds = 0.0, .endMilliseconds = 0.0, .thread = -1, .criticalPredecessor = -1});
+    return id;
+}
+
+void StartupGraph::execute(TaskId id, int32_t thread) {
+    TaskTiming& timing = timings[id];
+    timing.thread = thread;
+    // Every dependency has finished, the one that finished last is what this task waited on
+    for (TaskId dependency : tasks[id].dependencies) {
+        if (timing.criticalPredecessor < 0 || timings[dependency].endMilliseconds > timings[timing.criticalPredecessor].endMilliseconds)
+            timing.criticalPredecessor = (int32_t)dependency;
+    }
+
+    auto now = [this] {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    };
+    timing.startMilliseconds = now();
+    {
+        // The task's own thread counts against the budget, its loops get what is left
+        uint32_t ownThread = threadBudget.acquire(1);
+        ThreadBudget::current() = &threadBudget;
+
+        // Worker threads have no pool of their own, metal-cpp hands out autoreleased objects
+        NS::AutoreleasePool* pool = NS::AutoreleasePool::alloc()->init();
+        tasks[id].work();
+        pool->release();
+
+        ThreadBudget::current() = nullptr;
+        threadBudget.release(ownThread);
+    }
+    timing.endMilliseconds = now();
+}
+
+void StartupGraph::complete(TaskId id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (TaskId dependent : tasks[id].dependents) {
+        if (--tasks[dependent].pendingDependencies == 0)
+            (tasks[dependent].mainThread ? mainQueue : workerQueue).push_back(dependent);
+    }
+    remainingTasks--;
+    readyCondition.notify_all();
+}
+
+void StartupGraph::run(const std::function<void()>& idle) {
+    startTime = std::chrono::steady_clock::now();
+    remainingTasks = (uint32_t)tasks.size();
+
+    uint32_t workerTasks = 0;
+    for (TaskId id = 0; id < tasks.size(); id++) {
+        if (!tasks[id].mainThread)
+            workerTasks++;
+        if (tasks[id].pendingDependencies == 0)
+            (tasks[id].mainThread ? mainQueue : workerQueue).push_back(id);
+    }
+
+    // The main thread is busy with its own tasks and the event loop
+    uint32_t workerCount = std::min(std::max(std::thread::hardware_concurrency(), 2u) - 1, workerTasks);
+    std::vector<std::thread> workers;
+    workers.reserve(workerCount);
+    for (uint32_t i = 0; i < workerCount; i++) {
+        workers.emplace_back([this, i] {
+            while (true) {
+                TaskId id;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    readyCondition.wait(lock, [this] { return !workerQueue.empty() || remainingTasks == 0; });
+                    if (workerQueue.empty())
+                        return;
+                    id = workerQueue.front();
+                    workerQueue.pop_front();
+                }
+                execute(id, (int32_t)i);
+                complete(id);
+            }
+        });
+    }
+
+    while (true) {
+        TaskId id;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (remainingTasks == 0)
+                break;
+            if (mainQueue.empty()) {
+                if (idle) {
+                    // Short waits so the event loop keeps turning
+                    readyCondition.wait_for(lock, std::chrono::milliseconds(4));
+                    lock.unlock();
+                    idle();
+                } else {
+                    readyCondition.wait(lock);
+                }
+                continue;
+            }
+            id = mainQueue.front();
+            mainQueue.pop_front();
+        }
+        execute(id, -1);
+        complete(id);
+    }
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+std::vector<StartupGraph::TaskId> StartupGraph::criticalPath() const {
+    std::vector<TaskId> path;
+    if (timings.empty())
+        return path;
+
+    // Walk back from the task that finished last along the dependencies it waited on
+    int32_t id = 0;
+    for (TaskId i = 1; i < timings.size(); i++) {
+        if (timings[i].endMilliseconds > timings[id].endMilliseconds)
+            id = (int32_t)i;
+    }
+    for (; id >= 0; id = timings[id].criticalPredecessor) {
+        path.push_back((TaskId)id);
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+void StartupGraph::printReport() const {
+    constexpr int BarWidth = 48;
+
+    double totalMilliseconds = 0.0;
+    double busyMilliseconds = 0.0;
+    for (const TaskTiming& timing : timings) {
+        totalMilliseconds = std::max(totalMilliseconds, timing.endMilliseconds);
+        busyMilliseconds += timing.endMilliseconds - timing.startMilliseconds;
+    }
+    double scale = totalMilliseconds > 0.0 ? BarWidth / totalMilliseconds : 0.0;
+
+    std::vector<TaskId> path = criticalPath();
+    std::vector<bool> critical(timings.size(), false);
+    for (TaskId id : path) {
+        critical[id] = true;
+    }
+
+    printf("Startup timeline (%.1f ms wall, %.1f ms of work)\n", totalMilliseconds, busyMilliseconds);
+    for (TaskId id = 0; id < timings.size(); id++) {
+        const TaskTiming& timing = timings[id];
+        int begin = std::min((int)(timing.startMilliseconds * scale), BarWidth - 1);
+        int end = std::clamp((int)(timing.endMilliseconds * scale + 0.5), begin + 1, BarWidth);
+
+        char bar[BarWidth + 1];
+        for (int i = 0; i < BarWidth; i++) {
+            bar[i] = i < begin || i >= end ? '.' : (critical[id] ? '#' : '=');
+        }
+        bar[BarWidth] = '\0';
+
+        char thread[16];
+        if (timing.thread < 0)
+            snprintf(thread, sizeof(thread), "main");
+        else
+            snprintf(thread, sizeof(thread), "worker %d", timing.thread);
+
+        printf("  %-24s %-9s |%s| %8.1f .. %8.1f ms\n", timing.name, thread, bar, timing.startMilliseconds, timing.endMilliseconds);
+    }
+
+    printf("Critical path:");
+    for (size_t i = 0; i < path.size(); i++) {
+        const TaskTiming& timing = timings[path[i]];
+        printf("%s %s (%.1f ms)", i == 0 ? "" : " ->", timing.name, timing.endMilliseconds - timing.startMilliseconds);
+    }
+    printf("\n");
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include "parallel.hpp"
+
+// Startup work expressed as a dependency graph. Tasks become ready once all of their
+// dependencies have finished and run on a pool of worker threads, except tasks marked
+// as main thread ones (window, layer, anything touching AppKit) which run on the thread
+// calling run(). While the main thread has nothing ready it calls the idle callback,
+// so the window keeps pumping events during a long load. Tasks share one ThreadBudget
+// of hardware threads for their parallel loops. Every task is timed, and the report
+// prints the timeline together with the critical path through the graph.
+class StartupGraph {
+public:
+    using TaskId = uint32_t;
+
+    struct TaskTiming {
+        const char* name;
+        double      startMilliseconds;
+        double      endMilliseconds;
+        int32_t     thread;                 // -1 for the main thread
+        int32_t     criticalPredecessor;    // Dependency that finished last, -1 for none
+    };
+
+    // Dependencies have to be added first, which keeps the graph acyclic. Names must
+    // outlive the graph, string literals are expected.
+    TaskId addTask(const char* name, std::function<void()> work,
+                   std::initializer_list<TaskId> dependencies = {}, bool mainThread = false);
+
+    // Blocks until every task has run
+    void run(const std::function<void()>& idle = {});
+
+    const std::vector<TaskTiming>& getTimings() const { return timings; }
+    std::vector<TaskId> criticalPath() const;
+    void printReport() const;
+
+private:
+    struct Task {
+        std::function<void()>   work;
+        std::vector<TaskId>     dependencies;
+        std::vector<TaskId>     dependents;
+        uint32_t                pendingDependencies = 0;
+        bool                    mainThread = false;
+    };
+
+    void execute(TaskId id, int32_t thread);
+    void complete(TaskId id);
+
+    std::vector<Task>           tasks;
+    std::vector<TaskTiming>     timings;
+
+    std::mutex                  mutex;
+    std::condition_variable     readyCondition;
+    std::deque<TaskId>          workerQueue;
+    std::deque<TaskId>          mainQueue;
+    uint32_t                    remainingTasks = 0;
+
+    ThreadBudget                threadBudget{std::max(std::thread::hardware_concurrency(), 1u)};
+
+    std::chrono::steady_clock::time_point startTime;
+};
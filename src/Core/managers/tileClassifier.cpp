@@ -0,0 +1,134 @@
+#include "tileClassifier.hpp"
+#if REFERENCE_CHECKS
+#include "tileClassifierReference.hpp"
+#endif
+
+TileClassifier::TileClassifier(MTL::Device* device, RenderPipeline& pipelines, GPUProfiler& profiler)
+: params(defaultParams()), device(device), pipelines(pipelines), profiler(profiler) {
+    for (auto& buffer : dispatchBuffers) {
+        buffer = device->newBuffer(sizeof(MTL::DispatchThreadgroupsIndirectArguments) * TileClassCount, MTL::ResourceStorageModeShared);
+        buffer->setLabel(NS::String::string("Tile Class Dispatch", NS::ASCIIStringEncoding));
+    }
+}
+
+TileClassifier::~TileClassifier() {
+    if (tileLists) {
+        tileLists->release();
+    }
+    for (auto& buffer : dispatchBuffers) {
+        buffer->release();
+    }
+}
+
+TileClassifyParams TileClassifier::defaultParams() {
+    return TileClassifyParams{
+        .discontinuityThreshold = 0.05f,    // 5% of the depth between neighbours
+        .creaseThreshold = 0.01f,
+        .tileListCapacity = 0
+    };
+}
+
+void TileClassifier::resize(uint32_t width, uint32_t height, ResourceRegistry& resources) {
+    // Frames in flight may still read the old lists
+    resources.retire(tileLists);
+
+    tileCountX = (width + TileSize - 1) / TileSize;
+    tileCountY = (height + TileSize - 1) / TileSize;
+    params.tileListCapacity = tileCountX * tileCountY;
+
+    // Every list can hold every tile, the classes share one buffer
+    tileLists = device->newBuffer(params.tileListCapacity * TileClassCount * sizeof(uint32_t), MTL::ResourceStorageModePrivate);
+    tileLists->setLabel(NS::String::string("Classified Tile Lists", NS::ASCIIStringEncoding));
+}
+
+void TileClassifier::encode(MTL::CommandBuffer* commandBuffer, MTL::Texture* depth) {
+    currentDispatchBuffer = dispatchBuffers[ringIndex];
+    ringIndex = (ringIndex + 1) % RingSize;
+
+    // Threadgroup counts are appended to by the classifier
+    auto* arguments = (MTL::DispatchThreadgroupsIndirectArguments*)currentDispatchBuffer->contents();
+    for (uint32_t i = 0; i < TileClassCount; i++) {
+        arguments[i] = {{0, 1, 1}};
+    }
+
+    MTL::ComputeCommandEncoder* encoder = commandBuffer->computeCommandEncoder(profiler.computePassDescriptor("Tile Classification"));
+    encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::TileClassify));
+    encoder->setTexture(depth, TextureIndexClassifyDepth);
+    encoder->setBytes(&params, sizeof(params), BufferIndexTileClassify);
+    encoder->setBuffer(currentDispatchBuffer, 0, BufferIndexTileClassDispatch);
+    encoder->setBuffer(tileLists, 0, BufferIndexTileLists);
+    encoder->dispatchThreadgroups(MTL::Size(tileCountX, tileCountY, 1), MTL::Size(TileSize, TileSize, 1));
+    encoder->endEncoding();
+}
+
+void TileClassifier::dispatch(MTL::ComputeCommandEncoder* encoder, TileClass tileClass, NS::UInteger bufferIndex,
+                              uint32_t groupSize) const {
+    assert(currentDispatchBuffer && "TileClassifier::encode must run first");
+
+    encoder->setBuffer(tileLists, tileClass * params.tileListCapacity * sizeof(uint32_t), bufferIndex);
+    encoder->dispatchThreadgroups(currentDispatchBuffer, tileClass * sizeof(MTL::DispatchThreadgroupsIndirectArguments),
+                                  MTL::Size(groupSize, groupSize, 1));
+}
+
+#if REFERENCE_CHECKS
+void TileClassifier::encodeReferenceReadback(MTL::CommandBuffer* commandBuffer, MTL::Texture* depth) {
+    checkParams = params;
+    depthReadback.copyTexture(commandBuffer, depth, sizeof(float));
+    tileListsReadback.copyBuffer(commandBuffer, tileLists, 0, tileLists->length());
+    dispatchReadback.copyBuffer(commandBuffer, currentDispatchBuffer, 0, currentDispatchBuffer->length());
+}
+
+bool TileClassifier::checkReference() {
+    uint32_t width = depthReadback.getWidth();
+    uint32_t height = depthReadback.getHeight();
+    const float* depth = depthReadback.data<float>();
+    std::vector<float> eyeDepth(depth, depth + (size_t)width * height);
+
+    auto scaledParams = [&](float scale) {
+        TileClassifyParams scaled = checkParams;
+        scaled.discontinuityThreshold *= scale;
+        scaled.creaseThreshold *= scale;
+        return scaled;
+    };
+    auto reference = TileClassifierReference::classify(eyeDepth, width, height, checkParams, TileSize);
+    auto lower = TileClassifierReference::classify(eyeDepth, width, height, scaledParams(0.99f), TileSize);
+    auto higher = TileClassifierReference::classify(eyeDepth, width, height, scaledParams(1.01f), TileSize);
+
+    // Class of every tile from the GPU lists, TileClassCount where a tile is missing
+    const auto* arguments = dispatchReadback.data<MTL::DispatchThreadgroupsIndirectArguments>();
+    const uint32_t* lists = tileListsReadback.data<uint32_t>();
+    std::vector<uint32_t> gpuClasses(reference.classes.size(), TileClassCount);
+    uint32_t duplicates = 0;
+    for (uint32_t tileClass = 0; tileClass < TileClassCount; tileClass++) {
+        uint32_t count = std::min(arguments[tileClass].threadgroupsPerGrid[0], checkParams.tileListCapacity);
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t packedTile = lists[tileClass * checkParams.tileListCapacity + i];
+            size_t tile = (size_t)(packedTile >> 16) * reference.tileCountX + (packedTile & 0xFFFF);
+            if (tile >= gpuClasses.size() || gpuClasses[tile] != TileClassCount) {
+                duplicates++;
+                continue;
+            }
+            gpuClasses[tile] = tileClass;
+        }
+    }
+
+    uint32_t mismatches = 0;
+    uint32_t nearThreshold = 0;
+    for (size_t tile = 0; tile < gpuClasses.size(); tile++) {
+        uint32_t gpuClass = gpuClasses[tile];
+        if (gpuClass == (uint32_t)reference.classes[tile])
+            continue;
+        if (gpuClass == (uint32_t)lower.classes[tile] || gpuClass == (uint32_t)higher.classes[tile]) {
+            nearThreshold++;
+            continue;
+        }
+        mismatches++;
+    }
+
+    printf("Tile classifier reference: %zu tiles (%u empty, %u simple, %u complex, %u edge), %u differ, %u within the threshold margin, %u listed twice or out of range\n",
+           gpuClasses.size(), arguments[TileClassEmpty].threadgroupsPerGrid[0], arguments[TileClassSimple].threadgroupsPerGrid[0],
+           arguments[TileClassComplex].threadgroupsPerGrid[0], arguments[TileClassEdge].threadgroupsPerGrid[0],
+           mismatches, nearThreshold, duplicates);
+    return mismatches == 0 && duplicates == 0;
+}
+#endif
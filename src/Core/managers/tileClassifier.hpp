@@ -0,0 +1,73 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+#include "renderPipeline.hpp"
+#include "gpuProfiler.hpp"
+#include "resourceRegistry.hpp"
+#if REFERENCE_CHECKS
+#include "gpuReadback.hpp"
+#endif
+#include "../../../data/shaders/shaderTypes.hpp"
+
+// Screen tile classification for TILE_CLASSIFICATION. classifyTilesKernel sorts the
+// tiles of the stored eye depth into one list per TileClass and counts them into
+// MTLDispatchThreadgroupsIndirectArguments, so later passes dispatch one threadgroup
+// per tile of just the classes they care about.
+class TileClassifier {
+public:
+    static constexpr uint32_t TileSize  = TileClassificationTileSize;
+    static constexpr uint32_t RingSize  = 3;
+
+    TileClassifier(MTL::Device* device, RenderPipeline& pipelines, GPUProfiler& profiler);
+    ~TileClassifier();
+
+    static TileClassifyParams defaultParams();
+
+    // The old tile lists are retired through resources
+    void resize(uint32_t width, uint32_t height, ResourceRegistry& resources);
+
+    // Classifies depth, the eye depth target, sky holds its non-negative clear value.
+    // Moves to the next dispatch buffer of the ring, call once per frame.
+    void encode(MTL::CommandBuffer* commandBuffer, MTL::Texture* depth);
+
+    // Binds the tile list of tileClass at bufferIndex and dispatches one groupSize x groupSize
+    // threadgroup per tile of it, using the counts of the last encode()
+    void dispatch(MTL::ComputeCommandEncoder* encoder, TileClass tileClass, NS::UInteger bufferIndex,
+                  uint32_t groupSize = TileSize) const;
+
+#if REFERENCE_CHECKS
+    // Copies depth and the tile lists and counts of the encode() just before
+    void encodeReferenceReadback(MTL::CommandBuffer* commandBuffer, MTL::Texture* depth);
+    // Once that command buffer has completed, runs TileClassifierReference on the copied
+    // depth. Every tile must be in exactly one list and empty and edge tiles must match.
+    // The GPU tests run in fast math, so a geometry only tile may be simple or complex
+    // when the reference disagrees with itself with both thresholds 1% lower and higher.
+    // Prints the result, returns false on a mismatch.
+    bool checkReference();
+#endif
+
+    TileClassifyParams  params;
+
+private:
+    MTL::Device*        device;
+    RenderPipeline&     pipelines;
+    GPUProfiler&        profiler;
+
+    MTL::Buffer*        tileLists = nullptr;
+    uint32_t            tileCountX = 0;
+    uint32_t            tileCountY = 0;
+
+    // TileClassCount MTLDispatchThreadgroupsIndirectArguments, reset by the CPU every frame
+    std::array<MTL::Buffer*, RingSize> dispatchBuffers{};
+    uint32_t            ringIndex = 0;
+    MTL::Buffer*        currentDispatchBuffer = nullptr;
+
+#if REFERENCE_CHECKS
+    TileClassifyParams  checkParams;
+    GPUReadback         depthReadback;
+    GPUReadback         tileListsReadback;
+    GPUReadback         dispatchReadback;
+#endif
+};
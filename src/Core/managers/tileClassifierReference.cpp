@@ -0,0 +1,66 @@
+#include "tileClassifierReference.hpp"
+
+namespace TileClassifierReference {
+
+static float linearDepth(const std::vector<float>& eyeDepth, uint32_t width, int x, int y) {
+    float depth = eyeDepth[(size_t)y * width + x];
+    return depth < 0.0f ? -depth : 0.0f;
+}
+
+bool isComplexPixel(const std::vector<float>& eyeDepth, uint32_t width, uint32_t height,
+                    uint32_t x, uint32_t y, const TileClassifyParams& params) {
+    float z = linearDepth(eyeDepth, width, x, y);
+    const int axes[2][2] = {{1, 0}, {0, 1}};
+
+    for (const auto& axis : axes) {
+        int nextX = (int)x + axis[0], nextY = (int)y + axis[1];
+        int previousX = (int)x - axis[0], previousY = (int)y - axis[1];
+        float zNext = (nextX < (int)width && nextY < (int)height) ? linearDepth(eyeDepth, width, nextX, nextY) : 0.0f;
+        float zPrevious = (previousX >= 0 && previousY >= 0) ? linearDepth(eyeDepth, width, previousX, previousY) : 0.0f;
+
+        if (zNext > 0.0f && std::abs(zNext - z) > params.discontinuityThreshold * std::min(zNext, z))
+            return true;
+
+        if (zNext > 0.0f && zPrevious > 0.0f) {
+            float w = 1.0f / z;
+            if (std::abs(1.0f / zPrevious - 2.0f * w + 1.0f / zNext) > params.creaseThreshold * w)
+                return true;
+        }
+    }
+    return false;
+}
+
+Result classify(const std::vector<float>& eyeDepth, uint32_t width, uint32_t height,
+                const TileClassifyParams& params, uint32_t tileSize) {
+    Result result;
+    result.tileCountX = (width + tileSize - 1) / tileSize;
+    result.tileCountY = (height + tileSize - 1) / tileSize;
+    result.classes.resize(result.tileCountX * result.tileCountY);
+
+    for (uint32_t tileY = 0; tileY < result.tileCountY; tileY++) {
+        for (uint32_t tileX = 0; tileX < result.tileCountX; tileX++) {
+            bool geometry = false, sky = false, complex = false;
+
+            for (uint32_t y = tileY * tileSize; y < std::min((tileY + 1) * tileSize, height); y++) {
+                for (uint32_t x = tileX * tileSize; x < std::min((tileX + 1) * tileSize, width); x++) {
+                    if (linearDepth(eyeDepth, width, x, y) > 0.0f) {
+                        geometry = true;
+                        complex = complex || isComplexPixel(eyeDepth, width, height, x, y, params);
+                    } else {
+                        sky = true;
+                    }
+                }
+            }
+
+            TileClass tileClass = !geometry ? TileClassEmpty
+                                : sky       ? TileClassEdge
+                                : complex   ? TileClassComplex
+                                            : TileClassSimple;
+            result.classes[tileY * result.tileCountX + tileX] = tileClass;
+            result.lists[tileClass].push_back(tileX | (tileY << 16));
+        }
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+#include "../../../data/shaders/shaderTypes.hpp"
+
+// CPU version of classifyTilesKernel, run by TileClassifier::checkReference when
+// REFERENCE_CHECKS is on. Takes the row major eye depth as stored in the G-buffer
+// (negative in front of the camera, positive for sky) and applies the same per pixel
+// tests. The GPU appends tiles in any order, compare the lists as sets; pixels within
+// float rounding of a threshold may differ.
+namespace TileClassifierReference {
+    struct Result {
+        uint32_t                                        tileCountX = 0;
+        uint32_t                                        tileCountY = 0;
+        std::vector<TileClass>                          classes;    // Row major, one per tile
+        std::array<std::vector<uint32_t>, TileClassCount> lists;    // Packed x | (y << 16), row major order
+    };
+
+    bool isComplexPixel(const std::vector<float>& eyeDepth, uint32_t width, uint32_t height,
+                        uint32_t x, uint32_t y, const TileClassifyParams& params);
+    Result classify(const std::vector<float>& eyeDepth, uint32_t width, uint32_t height,
+                    const TileClassifyParams& params, uint32_t tileSize = TileClassificationTileSize);
+}
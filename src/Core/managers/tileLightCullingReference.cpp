@@ -0,0 +1,78 @@
+#include "tileLightCullingReference.hpp"
+
+namespace TileLightCullingReference {
+
+void tileFrustumPlanes(simd::float2 pixelMin, simd::float2 pixelMax, simd::float2 framebufferSize,
+                       const simd::float4x4& projectionInverse, simd::float3 planes[4]) {
+    simd::float2 ndcMin = pixelMin / framebufferSize * 2.0f - 1.0f;
+    simd::float2 ndcMax = pixelMax / framebufferSize * 2.0f - 1.0f;
+
+    // Pixel rows grow downwards, NDC y upwards
+    simd::float2 cornersNDC[4] = {
+        {ndcMin.x, -ndcMin.y}, {ndcMax.x, -ndcMin.y},
+        {ndcMax.x, -ndcMax.y}, {ndcMin.x, -ndcMax.y}
+    };
+    simd::float3 corners[4];
+    for (int i = 0; i < 4; i++) {
+        simd::float4 corner = simd_mul(projectionInverse, simd::float4{cornersNDC[i].x, cornersNDC[i].y, 1.0f, 1.0f});
+        corners[i] = corner.xyz / corner.w;
+    }
+    simd::float3 centre = corners[0] + corners[1] + corners[2] + corners[3];
+
+    for (int i = 0; i < 4; i++) {
+        simd::float3 normal = simd::normalize(simd::cross(corners[i], corners[(i + 1) % 4]));
+        planes[i] = simd::dot(normal, centre) < 0.0f ? -normal : normal;
+    }
+}
+
+bool pointLightInTile(simd::float4 positionRadius, const simd::float3 planes[4], float minDepth, float maxDepth) {
+    for (int i = 0; i < 4; i++) {
+        if (simd::dot(planes[i], positionRadius.xyz) < -positionRadius.w)
+            return false;
+    }
+    float depth = -positionRadius.z;
+    return depth + positionRadius.w >= minDepth && depth - positionRadius.w <= maxDepth;
+}
+
+Result cull(const std::vector<float>& eyeDepth, uint32_t width, uint32_t height,
+            const std::vector<PointLight>& lights, const simd::float4x4& projectionInverse, uint32_t tileSize) {
+    Result result;
+    result.tileCountX = (width + tileSize - 1) / tileSize;
+    result.tileCountY = (height + tileSize - 1) / tileSize;
+    result.tiles.resize(result.tileCountX * result.tileCountY);
+
+    simd::float2 framebufferSize = {(float)width, (float)height};
+
+    for (uint32_t tileY = 0; tileY < result.tileCountY; tileY++) {
+        for (uint32_t tileX = 0; tileX < result.tileCountX; tileX++) {
+            TileResult& tile = result.tiles[tileY * result.tileCountX + tileX];
+            uint32_t x0 = tileX * tileSize, x1 = std::min(x0 + tileSize, width);
+            uint32_t y0 = tileY * tileSize, y1 = std::min(y0 + tileSize, height);
+
+            // Sky pixels hold the positive clear value
+            for (uint32_t y = y0; y < y1; y++) {
+                for (uint32_t x = x0; x < x1; x++) {
+                    float depth = eyeDepth[(size_t)y * width + x];
+                    if (depth < 0.0f) {
+                        tile.minDepth = std::min(tile.minDepth, -depth);
+                        tile.maxDepth = std::max(tile.maxDepth, -depth);
+                    }
+                }
+            }
+            if (tile.minDepth > tile.maxDepth)
+                continue;
+
+            simd::float3 planes[4];
+            tileFrustumPlanes(simd::float2{(float)x0, (float)y0}, simd::float2{(float)x1, (float)y1},
+                              framebufferSize, projectionInverse, planes);
+
+            for (size_t i = 0; i < lights.size(); i++) {
+                if (pointLightInTile(lights[i].position_radius, planes, tile.minDepth, tile.maxDepth))
+                    tile.lights.push_back((uint16_t)i);
+            }
+        }
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+#include "../../../data/shaders/shaderTypes.hpp"
+
+// CPU version of cullLightsTileKernel, run by Engine::checkTileLightCulling when
+// REFERENCE_CHECKS is on. Reduces the linear depth bounds of every tile from a row
+// major eye depth image (as stored in the G-buffer, negative in front of the camera)
+// and culls eye space point lights with the same plane and depth tests as the GPU.
+// The GPU appends indices in any order and keeps the first MaxLightsPerTile of them,
+// compare as sets when count <= MaxLightsPerTile.
+namespace TileLightCullingReference {
+    struct TileResult {
+        float                   minDepth = INFINITY;    // Linear, min > max for sky only tiles
+        float                   maxDepth = 0.0f;
+        std::vector<uint16_t>   lights;                 // Every light that passed, ascending
+    };
+
+    struct Result {
+        uint32_t                tileCountX = 0;
+        uint32_t                tileCountY = 0;
+        std::vector<TileResult> tiles;                  // Row major
+    };
+
+    void tileFrustumPlanes(simd::float2 pixelMin, simd::float2 pixelMax, simd::float2 framebufferSize,
+                           const simd::float4x4& projectionInverse, simd::float3 planes[4]);
+    bool pointLightInTile(simd::float4 positionRadius, const simd::float3 planes[4], float minDepth, float maxDepth);
+
+    Result cull(const std::vector<float>& eyeDepth, uint32_t width, uint32_t height,
+                const std::vector<PointLight>& lights, const simd::float4x4& projectionInverse,
+                uint32_t tileSize = TileLightingTileSize);
+}
@@ -0,0 +1,362 @@
+#include "triangleBVH.hpp"
+
+void TriangleBVH::build(std::span<const simd::float3> positions, std::span<const uint32_t> indices) {
+    uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+    nodes.clear();
+    triangles.resize(triangleCount);
+    triangleIds.resize(triangleCount);
+    if (triangleCount == 0)
+        return;
+
+    std::vector<simd::float3> centroids(triangleCount);
+    for (uint32_t i = 0; i < triangleCount; i++) {
+        triangles[i] = {positions[indices[i * 3]], positions[indices[i * 3 + 1]], positions[indices[i * 3 + 2]]};
+        triangleIds[i] = i;
+        centroids[i] = (triangles[i].v0 + triangles[i].v1 + triangles[i].v2) / 3.0f;
+    }
+
+    nodes.reserve(triangleCount * 2);
+    nodes.push_back({.leftOrFirst = 0, .count = triangleCount});
+    updateBounds(nodes[0]);
+    subdivide(0, centroids, 0);
+    nodes.shrink_to_fit();
+}
+
+void TriangleBVH::updateBounds(Node& node) const {
+    node.boundsMin = simd::float3(std::numeric_limits<float>::max());
+    node.boundsMax = simd::float3(-std::numeric_limits<float>::max());
+    for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+        const Triangle& triangle = triangles[i];
+        node.boundsMin = simd::min(node.boundsMin, simd::min(triangle.v0, simd::min(triangle.v1, triangle.v2)));
+        node.boundsMax = simd::max(node.boundsMax, simd::max(triangle.v0, simd::max(triangle.v1, triangle.v2)));
+    }
+}
+
+static float surfaceArea(simd::float3 boundsMin, simd::float3 boundsMax) {
+    simd::float3 extent = simd::max(boundsMax - boundsMin, simd::float3(0.0f));
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+void TriangleBVH::subdivide(uint32_t nodeIndex, std::vector<simd::float3>& centroids, uint32_t depth) {
+    Node& node = nodes[nodeIndex];
+    if (node.count <= MaxLeafTriangles || depth + 1 >= MaxDepth)
+        return;
+
+    // Binned SAH over centroid bounds, every axis is tried
+    simd::float3 centroidMin = simd::float3(std::numeric_limits<float>::max());
+    simd::float3 centroidMax = simd::float3(-std::numeric_limits<float>::max());
+    for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+        centroidMin = simd::min(centroidMin, centroids[i]);
+        centroidMax = simd::max(centroidMax, centroids[i]);
+    }
+
+    struct Bin {
+        simd::float3    boundsMin = simd::float3(std::numeric_limits<float>::max());
+        simd::float3    boundsMax = simd::float3(-std::numeric_limits<float>::max());
+        uint32_t        count = 0;
+    };
+
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1;
+    uint32_t bestSplit = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = centroidMax[axis] - centroidMin[axis];
+        if (extent <= 0.0f)
+            continue;
+
+        std::array<Bin, BinCount> bins;
+        float scale = BinCount / extent;
+        for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+            uint32_t bin = std::min(BinCount - 1, (uint32_t)((centroids[i][axis] - centroidMin[axis]) * scale));
+            const Triangle& triangle = triangles[i];
+            bins[bin].count++;
+            bins[bin].boundsMin = simd::min(bins[bin].boundsMin, simd::min(triangle.v0, simd::min(triangle.v1, triangle.v2)));
+            bins[bin].boundsMax = simd::max(bins[bin].boundsMax, simd::max(triangle.v0, simd::max(triangle.v1, triangle.v2)));
+        }
+
+        // Sweep from both ends for the cost of every split plane
+        std::array<float, BinCount - 1> leftArea, rightArea;
+        std::array<uint32_t, BinCount - 1> leftCount, rightCount;
+        Bin left, right;
+        for (uint32_t i = 0; i < BinCount - 1; i++) {
+            left.count += bins[i].count;
+            left.boundsMin = simd::min(left.boundsMin, bins[i].boundsMin);
+            left.boundsMax = simd::max(left.boundsMax, bins[i].boundsMax);
+            leftCount[i] = left.count;
+            leftArea[i] = surfaceArea(left.boundsMin, left.boundsMax);
+
+            const Bin& bin = bins[BinCount - 1 - i];
+            right.count += bin.count;
+            right.boundsMin = simd::min(right.boundsMin, bin.boundsMin);
+            right.boundsMax = simd::max(right.boundsMax, bin.boundsMax);
+            rightCount[BinCount - 2 - i] = right.count;
+            rightArea[BinCount - 2 - i] = surfaceArea(right.boundsMin, right.boundsMax);
+        }
+        for (uint32_t i = 0; i < BinCount - 1; i++) {
+            if (leftCount[i] == 0 || rightCount[i] == 0)
+                continue;
+            float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    // Splitting has to beat intersecting every triangle of the node
+    if (bestAxis < 0 || bestCost >= node.count * surfaceArea(node.boundsMin, node.boundsMax))
+        return;
+
+    float scale = BinCount / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+    uint32_t first = node.leftOrFirst;
+    uint32_t last = node.leftOrFirst + node.count;
+    uint32_t middle = first;
+    for (uint32_t i = first; i < last; i++) {
+        uint32_t bin = std::min(BinCount - 1, (uint32_t)((centroids[i][bestAxis] - centroidMin[bestAxis]) * scale));
+        if (bin <= bestSplit) {
+            std::swap(triangles[i], triangles[middle]);
+            std::swap(triangleIds[i], triangleIds[middle]);
+            std::swap(centroids[i], centroids[middle]);
+            middle++;
+        }
+    }
+
+    uint32_t leftChild = (uint32_t)nodes.size();
+    nodes.push_back({.leftOrFirst = first, .count = middle - first});
+    nodes.push_back({.leftOrFirst = middle, .count = last - middle});
+    // push_back may have moved the node
+    nodes[nodeIndex].leftOrFirst = leftChild;
+    nodes[nodeIndex].count = 0;
+
+    updateBounds(nodes[leftChild]);
+    updateBounds(nodes[leftChild + 1]);
+    subdivide(leftChild, centroids, depth + 1);
+    subdivide(leftChild + 1, centroids, depth + 1);
+}
+
+// Squared distance from a point to an AABB, zero inside
+static float boxDistanceSquared(simd::float3 point, simd::float3 boundsMin, simd::float3 boundsMax) {
+    simd::float3 delta = simd::max(simd::max(boundsMin - point, point - boundsMax), simd::float3(0.0f));
+    return simd::dot(delta, delta);
+}
+
+// Closest point on a triangle by Voronoi region (Ericson, Real-Time Collision Detection 5.1.5)
+static simd::float3 closestPointOnTriangle(simd::float3 p, simd::float3 a, simd::float3 b, simd::float3 c) {
+    simd::float3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = simd::dot(ab, ap), d2 = simd::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return a;
+
+    simd::float3 bp = p - b;
+    float d3 = simd::dot(ab, bp), d4 = simd::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) return b;
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+
+    simd::float3 cp = p - c;
+    float d5 = simd::dot(ab, cp), d6 = simd::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) return c;
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    float denominator = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+float TriangleBVH::closestDistanceSquared(simd::float3 point, float maxDistanceSquared, uint32_t* triangle) const {
+    float best = maxDistanceSquared;
+    if (nodes.empty() || boxDistanceSquared(point, nodes[0].boundsMin, nodes[0].boundsMax) >= best)
+        return best;
+
+    uint32_t stack[MaxDepth * 2];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const Node& node = nodes[stack[--stackSize]];
+        if (boxDistanceSquared(point, node.boundsMin, node.boundsMax) >= best)
+            continue;
+
+        if (node.count > 0) {
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                const Triangle& candidate = triangles[i];
+                simd::float3 delta = point - closestPointOnTriangle(point, candidate.v0, candidate.v1, candidate.v2);
+                float distanceSquared = simd::dot(delta, delta);
+                if (distanceSquared < best) {
+                    best = distanceSquared;
+                    if (triangle)
+                        *triangle = triangleIds[i];
+                }
+            }
+            continue;
+        }
+
+        // Nearer child on top of the stack
+        uint32_t near = node.leftOrFirst, far = node.leftOrFirst + 1;
+        float nearDistance = boxDistanceSquared(point, nodes[near].boundsMin, nodes[near].boundsMax);
+        float farDistance = boxDistanceSquared(point, nodes[far].boundsMin, nodes[far].boundsMax);
+        if (farDistance < nearDistance) {
+            std::swap(near, far);
+            std::swap(nearDistance, farDistance);
+        }
+        if (farDistance < best)
+            stack[stackSize++] = far;
+        if (nearDistance < best)
+            stack[stackSize++] = near;
+    }
+    return best;
+}
+
+// Slab test against all three axes at once, returns the entry distance or infinity on a miss
+static float intersectBox(simd::float3 origin, simd::float3 inverseDirection, simd::float3 boundsMin, simd::float3 boundsMax, float maxDistance) {
+    simd::float3 t0 = (boundsMin - origin) * inverseDirection;
+    simd::float3 t1 = (boundsMax - origin) * inverseDirection;
+    float entry = std::max(simd::reduce_max(simd::min(t0, t1)), 0.0f);
+    float exit = std::min(simd::reduce_min(simd::max(t0, t1)), maxDistance);
+    return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+}
+
+// Möller-Trumbore, two sided, returns the distance or infinity
+static float intersectTriangle(simd::float3 origin, simd::float3 direction, simd::float3 v0, simd::float3 v1, simd::float3 v2, simd::float2& barycentrics) {
+    simd::float3 edge1 = v1 - v0, edge2 = v2 - v0;
+    simd::float3 p = simd::cross(direction, edge2);
+    float determinant = simd::dot(edge1, p);
+    if (std::abs(determinant) < 1e-12f)
+        return std::numeric_limits<float>::infinity();
+
+    float inverseDeterminant = 1.0f / determinant;
+    simd::float3 s = origin - v0;
+    float u = simd::dot(s, p) * inverseDeterminant;
+    if (u < 0.0f || u > 1.0f)
+        return std::numeric_limits<float>::infinity();
+
+    simd::float3 q = simd::cross(s, edge1);
+    float v = simd::dot(direction, q) * inverseDeterminant;
+    if (v < 0.0f || u + v > 1.0f)
+        return std::numeric_limits<float>::infinity();
+
+    float t = simd::dot(edge2, q) * inverseDeterminant;
+    if (t <= 0.0f)
+        return std::numeric_limits<float>::infinity();
+    barycentrics = {u, v};
+    return t;
+}
+
+bool TriangleBVH::intersect(simd::float3 origin, simd::float3 direction, float maxDistance, Hit& hit) const {
+    if (nodes.empty())
+        return false;
+
+    simd::float3 inverseDirection = 1.0f / direction;
+    float closest = maxDistance;
+    bool found = false;
+
+    uint32_t stack[MaxDepth * 2];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const Node& node = nodes[stack[--stackSize]];
+        if (intersectBox(origin, inverseDirection, node.boundsMin, node.boundsMax, closest) == std::numeric_limits<float>::infinity())
+            continue;
+
+        if (node.count > 0) {
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                const Triangle& triangle = triangles[i];
+                simd::float2 barycentrics;
+                float t = intersectTriangle(origin, direction, triangle.v0, triangle.v1, triangle.v2, barycentrics);
+                if (t < closest) {
+                    closest = t;
+                    hit = {.distance = t, .triangle = triangleIds[i], .barycentrics = barycentrics};
+                    found = true;
+                }
+            }
+            continue;
+        }
+
+        // Visit the child the ray enters first
+        uint32_t near = node.leftOrFirst, far = node.leftOrFirst + 1;
+        float nearEntry = intersectBox(origin, inverseDirection, nodes[near].boundsMin, nodes[near].boundsMax, closest);
+        float farEntry = intersectBox(origin, inverseDirection, nodes[far].boundsMin, nodes[far].boundsMax, closest);
+        if (farEntry < nearEntry) {
+            std::swap(near, far);
+            std::swap(nearEntry, farEntry);
+        }
+        if (farEntry != std::numeric_limits<float>::infinity())
+            stack[stackSize++] = far;
+        if (nearEntry != std::numeric_limits<float>::infinity())
+            stack[stackSize++] = near;
+    }
+    return found;
+}
+
+bool TriangleBVH::occluded(simd::float3 origin, simd::float3 direction, float maxDistance) const {
+    return occluded(origin, direction, maxDistance, [](uint32_t) {});
+}
+
+bool TriangleBVH::occluded(simd::float3 origin, simd::float3 direction, float maxDistance, std::vector<uint32_t>& visitedNodes) const {
+    return occluded(origin, direction, maxDistance, [&](uint32_t nodeIndex) { visitedNodes.push_back(nodeIndex); });
+}
+
+template <typename Visit>
+bool TriangleBVH::occluded(simd::float3 origin, simd::float3 direction, float maxDistance, const Visit& visit) const {
+    if (nodes.empty())
+        return false;
+
+    simd::float3 inverseDirection = 1.0f / direction;
+    uint32_t stack[MaxDepth * 2];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        uint32_t nodeIndex = stack[--stackSize];
+        visit(nodeIndex);
+        const Node& node = nodes[nodeIndex];
+        if (intersectBox(origin, inverseDirection, node.boundsMin, node.boundsMax, maxDistance) == std::numeric_limits<float>::infinity())
+            continue;
+
+        if (node.count > 0) {
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                const Triangle& triangle = triangles[i];
+                simd::float2 barycentrics;
+                if (intersectTriangle(origin, direction, triangle.v0, triangle.v1, triangle.v2, barycentrics) < maxDistance)
+                    return true;
+            }
+            continue;
+        }
+        stack[stackSize++] = node.leftOrFirst + 1;
+        stack[stackSize++] = node.leftOrFirst;
+    }
+    return false;
+}
+
+uint32_t TriangleBVH::countCrossings(simd::float3 origin, simd::float3 direction) const {
+    if (nodes.empty())
+        return 0;
+
+    simd::float3 inverseDirection = 1.0f / direction;
+    uint32_t crossings = 0;
+    uint32_t stack[MaxDepth * 2];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const Node& node = nodes[stack[--stackSize]];
+        if (intersectBox(origin, inverseDirection, node.boundsMin, node.boundsMax, std::numeric_limits<float>::max()) == std::numeric_limits<float>::infinity())
+            continue;
+
+        if (node.count > 0) {
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                const Triangle& triangle = triangles[i];
+                simd::float2 barycentrics;
+                if (intersectTriangle(origin, direction, triangle.v0, triangle.v1, triangle.v2, barycentrics) != std::numeric_limits<float>::infinity())
+                    crossings++;
+            }
+            continue;
+        }
+        stack[stackSize++] = node.leftOrFirst + 1;
+        stack[stackSize++] = node.leftOrFirst;
+    }
+    return crossings;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <simd/simd.h>
+#include <span>
+
+// CPU bounding volume hierarchy over a triangle list, built with binned SAH. Triangles
+// are copied into leaf order so a leaf reads its vertices from one contiguous run.
+// Answers closest point, closest hit and crossing count queries; all queries are
+// const and can run from any number of threads at once.
+class TriangleBVH {
+public:
+    static constexpr uint32_t MaxLeafTriangles = 4;
+    static constexpr uint32_t BinCount         = 12;
+    static constexpr uint32_t MaxDepth         = 64;
+
+    struct Hit {
+        float       distance;
+        uint32_t    triangle;       // Index into the source triangle list
+        simd::float2 barycentrics;  // Weights of the second and third vertex
+    };
+
+    // indices is a triangle list into positions
+    void build(std::span<const simd::float3> positions, std::span<const uint32_t> indices);
+
+    bool isEmpty() const { return nodes.empty(); }
+    uint32_t getTriangleCount() const { return (uint32_t)triangleIds.size(); }
+    simd::float3 getBoundsMin() const { return nodes.empty() ? simd::float3(0.0f) : nodes[0].boundsMin; }
+    simd::float3 getBoundsMax() const { return nodes.empty() ? simd::float3(0.0f) : nodes[0].boundsMax; }
+
+    // Squared distance to the closest triangle, or maxDistanceSquared if none is closer
+    float closestDistanceSquared(simd::float3 point, float maxDistanceSquared, uint32_t* triangle = nullptr) const;
+    // Closest intersection in (0, maxDistance), triangles are two sided
+    bool intersect(simd::float3 origin, simd::float3 direction, float maxDistance, Hit& hit) const;
+    // Any intersection in (0, maxDistance)
+    bool occluded(simd::float3 origin, simd::float3 direction, float maxDistance) const;
+    // Same, appends the index of every node whose box is tested, for traversal coherence measurements
+    bool occluded(simd::float3 origin, simd::float3 direction, float maxDistance, std::vector<uint32_t>& visitedNodes) const;
+    // Number of triangles the ray passes through, odd means the origin is inside a closed surface
+    uint32_t countCrossings(simd::float3 origin, simd::float3 direction) const;
+
+private:
+    struct Node {
+        simd::float3    boundsMin;
+        simd::float3    boundsMax;
+        uint32_t        leftOrFirst;    // Left child for inner nodes, first triangle for leaves
+        uint32_t        count;          // Zero for inner nodes, the right child is leftOrFirst + 1
+    };
+
+    struct Triangle {
+        simd::float3    v0, v1, v2;
+    };
+
+    void subdivide(uint32_t nodeIndex, std::vector<simd::float3>& centroids, uint32_t depth);
+    template <typename Visit>
+    bool occluded(simd::float3 origin, simd::float3 direction, float maxDistance, const Visit& visit) const;
+    void updateBounds(Node& node) const;
+
+    std::vector<Node>       nodes;
+    std::vector<Triangle>   triangles;      // Leaf order
+    std::vector<uint32_t>   triangleIds;    // Source index of each leaf ordered triangle
+};
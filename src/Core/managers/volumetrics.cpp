@@ -0,0 +1,110 @@
+#include "volumetrics.hpp"
+
+Volumetrics::Volumetrics(MTL::Device* device, RenderPipeline& pipelines)
+: params(defaultParams()), device(device), pipelines(pipelines) {
+    scatteringVolumes[0] = createVolume("Froxel Scattering A");
+    scatteringVolumes[1] = createVolume("Froxel Scattering B");
+    integratedVolume = createVolume("Integrated Froxel Volume");
+}
+
+Volumetrics::~Volumetrics() {
+    for (auto* volume : scatteringVolumes) {
+        volume->release();
+    }
+    integratedVolume->release();
+}
+
+// Thin haze pooling below the arcade roofs of the scene, in metres
+VolumetricParams Volumetrics::defaultParams() {
+    return VolumetricParams{
+        .scatteringColor = simd::float4{1.0f, 1.0f, 1.0f, 0.0f},
+        .density = 0.02f,
+        .heightFalloff = 0.15f,
+        .baseHeight = 0.0f,
+        .anisotropy = 0.6f,
+        .ambientScale = 0.5f,
+        .historyWeight = 0.1f,
+        .nearDistance = 0.1f,
+        .farDistance = 64.0f
+    };
+}
+
+MTL::Texture* Volumetrics::createVolume(const char* label) {
+    MTL::TextureDescriptor* descriptor = MTL::TextureDescriptor::alloc()->init();
+    descriptor->setTextureType(MTL::TextureType3D);
+    descriptor->setPixelFormat(MTL::PixelFormatRGBA16Float);
+    descriptor->setWidth(GridWidth);
+    descriptor->setHeight(GridHeight);
+    descriptor->setDepth(GridDepth);
+    descriptor->setStorageMode(MTL::StorageModePrivate);
+    descriptor->setUsage(MTL::TextureUsageShaderRead | MTL::TextureUsageShaderWrite);
+
+    MTL::Texture* texture = device->newTexture(descriptor);
+    texture->setLabel(NS::String::string(label, NS::ASCIIStringEncoding));
+    descriptor->release();
+    return texture;
+}
+
+// Radical inverse of index in base, in [0, 1)
+static float halton(uint32_t index, uint32_t base) {
+    float result = 0.0f;
+    float fraction = 1.0f / base;
+    while (index > 0) {
+        result += (index % base) * fraction;
+        index /= base;
+        fraction /= base;
+    }
+    return result;
+}
+
+void Volumetrics::encode(MTL::CommandBuffer* commandBuffer, const ConstantBlocks& constants, const Scene& scene,
+                         Atmosphere* atmosphere, uint64_t frameIndex) {
+    const ViewConstants& view = constants.getView(ConstantBlocks::MainView);
+    params.inverseViewMatrix = simd_inverse(view.view_matrix);
+    params.previousViewProjection = previousViewProjection;
+    params.historyValid = historyValid ? 1 : 0;
+    // Index 0 of the sequence is the froxel corner, start at 1
+    uint32_t sample = (uint32_t)(frameIndex % FroxelJitterPeriod) + 1;
+    params.jitter = simd::float4{halton(sample, 2), halton(sample, 3), halton(sample, 5), 0.0f};
+
+    MTL::Texture* history = scatteringVolumes[currentVolume ^ 1];
+    MTL::Texture* scattering = scatteringVolumes[currentVolume];
+
+    // Not profiled, like the other passes of the compute queue
+    MTL::ComputeCommandEncoder* encoder = commandBuffer->computeCommandEncoder();
+    encoder->setLabel(MTLSTR("Volumetric Lighting"));
+    constants.bind(encoder);
+    encoder->setBytes(&params, sizeof(params), BufferIndexVolumetrics);
+
+    #pragma mark Injection
+    encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::InjectFroxels));
+    encoder->setTexture(history, TextureIndexFroxelHistory);
+    encoder->setTexture(scattering, TextureIndexFroxelScattering);
+    encoder->setAccelerationStructure(scene.accelerationStructure, BufferIndexAccelerationStructure);
+    encoder->useResource(scene.accelerationStructure, MTL::ResourceUsageRead);
+    if (scene.intersectionFunctions) {
+        encoder->setIntersectionFunctionTable(scene.intersectionFunctions, BufferIndexIntersectionFunctions);
+    }
+    if (scene.alphaMasks) {
+        // Read by the intersection functions through their table
+        encoder->useResource(scene.alphaMasks, MTL::ResourceUsageRead);
+    }
+#if ATMOSPHERIC_SCATTERING
+    encoder->setBytes(&atmosphere->params, sizeof(AtmosphereParams), BufferIndexAtmosphere);
+    encoder->setTexture(atmosphere->getTransmittanceLUT(), TextureIndexTransmittanceLUT);
+#else
+    (void)atmosphere;
+#endif
+    encoder->dispatchThreadgroups(MTL::Size((GridWidth + 3) / 4, (GridHeight + 3) / 4, (GridDepth + 3) / 4), MTL::Size(4, 4, 4));
+
+    #pragma mark Integration
+    // Same encoder, the injected volume is a tracked write the integration waits for
+    encoder->setComputePipelineState(pipelines.getComputePipeline(ComputePipelineType::IntegrateFroxels));
+    encoder->setTexture(integratedVolume, TextureIndexFroxelVolume);
+    encoder->dispatchThreadgroups(MTL::Size((GridWidth + 7) / 8, (GridHeight + 7) / 8, 1), MTL::Size(8, 8, 1));
+    encoder->endEncoding();
+
+    previousViewProjection = view.projection_matrix * view.view_matrix;
+    historyValid = true;
+    currentVolume ^= 1;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <Metal/Metal.hpp>
+#include <simd/simd.h>
+#include "renderPipeline.hpp"
+#include "atmosphere.hpp"
+#include "constantBlocks.hpp"
+#include "../../../data/shaders/shaderTypes.hpp"
+
+// Froxel volume of VOLUMETRIC_LIGHTING. injectFroxelsKernel fills a camera aligned grid
+// with fog density and sun light, each froxel tracing one shadow ray from a position
+// jittered by a Halton sequence, and blends it with the previous frame's scattering at
+// the reprojected froxel centre; the two scattering volumes swap every frame.
+// integrateFroxelsKernel then walks every froxel column once and stores the light
+// scattered towards the camera and the transmittance, which the lighting pass applies
+// with one trilinear fetch. The grid does not depend on the framebuffer size.
+class Volumetrics {
+public:
+    static constexpr uint32_t GridWidth     = FroxelGridWidth;
+    static constexpr uint32_t GridHeight    = FroxelGridHeight;
+    static constexpr uint32_t GridDepth     = FroxelGridDepth;
+
+    // What the shadow rays trace against, intersection functions and alpha masks may be null
+    struct Scene {
+        MTL::AccelerationStructure*     accelerationStructure = nullptr;
+        MTL::IntersectionFunctionTable* intersectionFunctions = nullptr;
+        MTL::Buffer*                    alphaMasks = nullptr;
+    };
+
+    Volumetrics(MTL::Device* device, RenderPipeline& pipelines);
+    ~Volumetrics();
+
+    static VolumetricParams defaultParams();
+
+    // Injects and integrates the volume for the main view in constants, whose blocks
+    // must already be uploaded for this frame. atmosphere may be null when
+    // ATMOSPHERIC_SCATTERING is off. The integrated volume is read by this frame's
+    // lighting, the next encode must not start before that lighting has finished.
+    void encode(MTL::CommandBuffer* commandBuffer, const ConstantBlocks& constants, const Scene& scene,
+                Atmosphere* atmosphere, uint64_t frameIndex);
+
+    // The next frame starts from its own samples only, call when the view jumps
+    void invalidateHistory() { historyValid = false; }
+
+    // Light scattered towards the camera in rgb, transmittance in a, RGBA16Float
+    MTL::Texture* getVolume() const { return integratedVolume; }
+
+    // Medium settings are edited directly, the per frame fields are rewritten by encode
+    VolumetricParams    params;
+
+private:
+    MTL::Device*        device;
+    RenderPipeline&     pipelines;
+
+    std::array<MTL::Texture*, 2> scatteringVolumes{};
+    MTL::Texture*       integratedVolume = nullptr;
+    uint32_t            currentVolume = 0;
+
+    bool                historyValid = false;
+    simd::float4x4      previousViewProjection = matrix_identity_float4x4;
+
+    MTL::Texture* createVolume(const char* label);
+};
@@ -0,0 +1,62 @@
+#include "workerPool.hpp"
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    startCondition.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::dispatch(uint32_t workerCount, Function work, void* workContext) {
+    if (workerCount <= 1) {
+        work(workContext, 0);
+        return;
+    }
+
+    // Threads are only added when a job needs more than ever before, i.e. during warmup
+    while (threads.size() < workerCount - 1) {
+        uint32_t worker = (uint32_t)threads.size() + 1;
+        // Only this thread bumps the generation, the new worker starts from the current one
+        threads.emplace_back([this, worker, seenGeneration = generation] { workerLoop(worker, seenGeneration); });
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        function = work;
+        context = workContext;
+        activeWorkers = workerCount;
+        pendingWorkers = workerCount - 1;
+        generation++;
+    }
+    startCondition.notify_all();
+
+    work(workContext, 0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this] { return pendingWorkers == 0; });
+}
+
+void WorkerPool::workerLoop(uint32_t worker, uint64_t seenGeneration) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        startCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+        if (stopping)
+            return;
+        seenGeneration = generation;
+        if (worker >= activeWorkers)
+            continue;
+
+        Function work = function;
+        void* workContext = context;
+        lock.unlock();
+        work(workContext, worker);
+        lock.lock();
+
+        if (--pendingWorkers == 0)
+            doneCondition.notify_one();
+    }
+}
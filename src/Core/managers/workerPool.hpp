@@ -0,0 +1,44 @@
+#pragma once
+
+#include "pch.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Threads for work that fans out inside the frame loop. They are started the first time
+// a job needs them and park on a condition variable between jobs, so a job costs a wake
+// up rather than thread creation, and a steady state job does not touch the heap. The
+// calling thread is worker 0 and run() returns once every worker has finished.
+class WorkerPool {
+public:
+    WorkerPool() = default;
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Runs work(worker) for every worker below workerCount
+    template<typename Work>
+    void run(uint32_t workerCount, Work& work) {
+        dispatch(workerCount, [](void* context, uint32_t worker) { (*static_cast<Work*>(context))(worker); }, &work);
+    }
+
+private:
+    using Function = void (*)(void* context, uint32_t worker);
+
+    void dispatch(uint32_t workerCount, Function function, void* context);
+    void workerLoop(uint32_t worker, uint64_t seenGeneration);
+
+    std::vector<std::thread>    threads;            // Worker i + 1
+    std::mutex                  mutex;
+    std::condition_variable     startCondition;
+    std::condition_variable     doneCondition;
+
+    Function                    function = nullptr;
+    void*                       context = nullptr;
+    uint64_t                    generation = 0;     // Bumped by every job
+    uint32_t                    activeWorkers = 0;  // Of the current job, the caller included
+    uint32_t                    pendingWorkers = 0; // Pool threads still running the current job
+    bool                        stopping = false;
+};
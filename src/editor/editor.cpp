@@ -1,6 +1,11 @@
 #include "editor.hpp"
 #include "../../external/imgui/backends/imgui_impl_metal.h"
 #include "../../external/imgui/backends/imgui_impl_glfw.h"
+#include "../../external/imgui/imgui_internal.h"
+#include "../Core/managers/gpuProfiler.hpp"
+#include "../Core/managers/gpuScheduler.hpp"
+#include "../Core/managers/resourceRegistry.hpp"
+#include "../../data/shaders/shaderTypes.hpp"
 
 Editor::Editor(GLFWwindow* window, MTL::Device* device)
 : window(window), device(device) {
@@ -14,15 +19,117 @@ Editor::Editor(GLFWwindow* window, MTL::Device* device)
     ImGui_ImplGlfw_InitForOther(window, true);
     
     ImGui_ImplMetal_Init(device);
+
+    watchValue(&debug, sizeof(debug));
+    watchValue(&selection, sizeof(selection));
 }
 
 Editor::~Editor() {
     cleanup();
 }
 
+void Editor::watchValue(const void* data, size_t size) {
+    watchedValues.push_back({data, size});
+    forceRebuild = true;
+}
+
+uint64_t Editor::hashWatchedValues() const {
+    // FNV-1a over the raw bytes of every watched value
+    uint64_t hash = 14695981039346656037ull;
+    for (const auto& value : watchedValues) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(value.data);
+        for (size_t i = 0; i < value.size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+void Editor::createOverlayTexture(uint32_t width, uint32_t height, ResourceRegistry& resources) {
+    resources.retire(overlayTexture);
+
+    MTL::TextureDescriptor* descriptor = MTL::TextureDescriptor::alloc()->init();
+    descriptor->setTextureType(MTL::TextureType2D);
+    descriptor->setPixelFormat(MTL::PixelFormatBGRA8Unorm);
+    descriptor->setWidth(width);
+    descriptor->setHeight(height);
+    descriptor->setStorageMode(MTL::StorageModePrivate);
+    descriptor->setUsage(MTL::TextureUsageRenderTarget | MTL::TextureUsageShaderRead);
+    overlayTexture = device->newTexture(descriptor);
+    overlayTexture->setLabel(NS::String::string("Editor Overlay", NS::ASCIIStringEncoding));
+    descriptor->release();
+
+    if (!overlayPassDescriptor) {
+        overlayPassDescriptor = MTL::RenderPassDescriptor::alloc()->init();
+    }
+    overlayPassDescriptor->colorAttachments()->object(0)->setTexture(overlayTexture);
+    overlayPassDescriptor->colorAttachments()->object(0)->setLoadAction(MTL::LoadActionClear);
+    overlayPassDescriptor->colorAttachments()->object(0)->setStoreAction(MTL::StoreActionStore);
+    overlayPassDescriptor->colorAttachments()->object(0)->setClearColor(MTL::ClearColor(0.0, 0.0, 0.0, 0.0));
+}
+
+bool Editor::needsRebuild() {
+    bool rebuild = forceRebuild;
+
+    // Events queued by the GLFW callbacks since the last ImGui::NewFrame
+    if (ImGui::GetCurrentContext()->InputEventsQueue.Size > 0) {
+        rebuild = true;
+    }
+
+    uint64_t hash = hashWatchedValues();
+    if (hash != watchedHash) {
+        watchedHash = hash;
+        rebuild = true;
+    }
+
+    // ImGui needs a couple of frames after an interaction to settle hover and layout state
+    if (rebuild) {
+        settleFrames = 2;
+    } else if (settleFrames > 0) {
+        settleFrames--;
+        rebuild = true;
+    }
+
+    // Timed refreshes only redraw live values, nothing needs to settle after them
+    if (!rebuild && liveContentVisible && glfwGetTime() - lastRebuildTime >= liveRefreshInterval) {
+        rebuild = true;
+    }
+
+    return rebuild;
+}
+
+bool Editor::renderOverlay(MTL::CommandBuffer* commandBuffer, uint32_t width, uint32_t height, ResourceRegistry& resources) {
+    if (!overlayTexture || overlayTexture->width() != width || overlayTexture->height() != height) {
+        createOverlayTexture(width, height, resources);
+        forceRebuild = true;
+    }
+
+    if (!needsRebuild())
+        return false;
+
+    forceRebuild = false;
+    lastRebuildTime = glfwGetTime();
+
+    beginFrame(overlayPassDescriptor);
+
+    MTL::RenderCommandEncoder* encoder = commandBuffer->renderCommandEncoder(overlayPassDescriptor);
+    encoder->setLabel(NS::String::string("ImGui Overlay", NS::ASCIIStringEncoding));
+    endFrame(commandBuffer, encoder);
+    encoder->endEncoding();
+
+    // Values edited through the UI this frame are already reflected in the overlay
+    watchedHash = hashWatchedValues();
+
+    return true;
+}
+
+void Editor::pollPlatform() {
+    ImGui_ImplGlfw_NewFrame();
+}
+
 void Editor::beginFrame(MTL::RenderPassDescriptor* passDescriptor) {
     ImGui_ImplMetal_NewFrame(passDescriptor);
-    ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
 
 //    createDockSpace();
@@ -42,6 +149,14 @@ void Editor::endFrame(MTL::CommandBuffer* commandBuffer, MTL::RenderCommandEncod
     }
 }
 void Editor::cleanup() {
+    if (overlayTexture) {
+        overlayTexture->release();
+        overlayTexture = nullptr;
+    }
+    if (overlayPassDescriptor) {
+        overlayPassDescriptor->release();
+        overlayPassDescriptor = nullptr;
+    }
     ImGui_ImplMetal_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -49,6 +164,7 @@ void Editor::cleanup() {
 
 void Editor::debugWindow() {
     ImGui::Begin("Debug Window", nullptr, ImGuiWindowFlags_None);
+    liveContentVisible = false;
 
     ImGui::Checkbox("Enable Debug Mode", &debug.enableDebugFeature);
 
@@ -56,6 +172,82 @@ void Editor::debugWindow() {
         ImGui::Text("Debug mode is active");
     }
 
+    ImGui::Separator();
+    if (selection.valid) {
+        ImGui::Text("Selected instance: %u", selection.instanceId);
+        ImGui::Text("Triangle: %u", selection.triangleId);
+        ImGui::Text("Depth: %.3f", selection.depth);
+    } else {
+        ImGui::Text("Right click to select an object");
+    }
+
+    if (postProcessParams && ImGui::CollapsingHeader("Post Processing")) {
+        ImGui::SliderFloat("Exposure (EV)", &postProcessParams->exposure, -6.0f, 6.0f);
+        ImGui::SliderFloat("Bloom Threshold", &postProcessParams->bloomThreshold, 0.0f, 8.0f);
+        ImGui::SliderFloat("Bloom Knee", &postProcessParams->bloomKnee, 0.0f, 1.0f);
+        ImGui::SliderFloat("Bloom Intensity", &postProcessParams->bloomIntensity, 0.0f, 1.0f);
+        ImGui::ColorEdit3("Lift", (float*)&postProcessParams->lift);
+        ImGui::SliderFloat3("Gamma", (float*)&postProcessParams->gamma, 0.2f, 3.0f);
+        ImGui::SliderFloat3("Gain", (float*)&postProcessParams->gain, 0.0f, 2.0f);
+        ImGui::SliderFloat("Saturation", &postProcessParams->saturation, 0.0f, 2.0f);
+        ImGui::SliderFloat("Contrast", &postProcessParams->contrast, 0.5f, 2.0f);
+        ImGui::SliderFloat("Dither", &postProcessParams->ditherStrength, 0.0f, 2.0f);
+    }
+
+    if (volumetricParams && ImGui::CollapsingHeader("Volumetric Lighting")) {
+        ImGui::SliderFloat("Density", &volumetricParams->density, 0.0f, 0.2f, "%.4f");
+        ImGui::SliderFloat("Height Falloff", &volumetricParams->heightFalloff, 0.0f, 1.0f);
+        ImGui::SliderFloat("Base Height", &volumetricParams->baseHeight, -5.0f, 20.0f);
+        ImGui::ColorEdit3("Scattering Colour", (float*)&volumetricParams->scatteringColor);
+        ImGui::SliderFloat("Anisotropy", &volumetricParams->anisotropy, -0.9f, 0.9f);
+        ImGui::SliderFloat("Ambient", &volumetricParams->ambientScale, 0.0f, 2.0f);
+        ImGui::SliderFloat("History Weight", &volumetricParams->historyWeight, 0.02f, 1.0f);
+    }
+
+    if (gpuProfiler && ImGui::CollapsingHeader("GPU Timings", ImGuiTreeNodeFlags_DefaultOpen)) {
+        liveContentVisible = true;
+        if (!gpuProfiler->isSupported()) {
+            ImGui::Text("Stage boundary counters are not supported on this device");
+        }
+        double total = 0.0;
+        for (const auto& timing : gpuProfiler->getTimings()) {
+            ImGui::Text("%-20s %6.3f ms", timing.name, timing.milliseconds);
+            total += timing.milliseconds;
+        }
+        ImGui::Text("%-20s %6.3f ms", "Total", total);
+    }
+
+    if (gpuScheduler && ImGui::CollapsingHeader("GPU Timeline", ImGuiTreeNodeFlags_DefaultOpen)) {
+        liveContentVisible = true;
+        const auto& timeline = gpuScheduler->getTimeline();
+        double frameEnd = 0.0;
+        for (const auto& span : timeline) {
+            frameEnd = std::max(frameEnd, span.endMilliseconds);
+        }
+
+        // One lane per queue, command buffers as bars over the frame
+        const float laneHeight = ImGui::GetTextLineHeight();
+        const float width = ImGui::GetContentRegionAvail().x;
+        const ImVec2 origin = ImGui::GetCursorScreenPos();
+        const ImU32 colors[] = {IM_COL32(90, 140, 220, 255), IM_COL32(230, 150, 60, 255)};
+        ImDrawList* drawList = ImGui::GetWindowDrawList();
+        for (const auto& span : timeline) {
+            float lane = (float)span.queue * (laneHeight + 2.0f);
+            float x0 = origin.x + (float)(span.startMilliseconds / std::max(frameEnd, 1e-3)) * width;
+            float x1 = origin.x + (float)(span.endMilliseconds / std::max(frameEnd, 1e-3)) * width;
+            drawList->AddRectFilled(ImVec2(x0, origin.y + lane), ImVec2(std::max(x1, x0 + 1.0f), origin.y + lane + laneHeight),
+                                    colors[(uint32_t)span.queue]);
+        }
+        ImGui::Dummy(ImVec2(width, 2.0f * (laneHeight + 2.0f)));
+
+        for (const auto& span : timeline) {
+            ImGui::Text("%-8s %-28s %6.3f - %6.3f ms", span.queue == GPUScheduler::Queue::Graphics ? "Graphics" : "Compute",
+                        span.label->utf8String(), span.startMilliseconds, span.endMilliseconds);
+        }
+        ImGui::Text("%s, queues overlap %.3f ms", gpuScheduler->isAsync() ? "Async compute" : "Single queue",
+                    gpuScheduler->getOverlapMilliseconds());
+    }
+
     ImGui::End();
 }
 
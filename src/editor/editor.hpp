@@ -6,6 +6,12 @@
 #include <GLFW/glfw3.h>
 #include "../../external/imgui/imgui.h"
 
+class GPUProfiler;
+class GPUScheduler;
+class ResourceRegistry;
+struct PostProcessParams;
+struct VolumetricParams;
+
 class Editor {
 public:
 
@@ -13,17 +19,70 @@ public:
         bool enableDebugFeature = false;
     } debug;
 
+    // Filled by the engine from the object picker, shown in the debug window
+    struct SelectionInfo {
+        bool     valid = false;
+        uint32_t instanceId = 0;
+        uint32_t triangleId = 0;
+        float    depth = 0.0f;
+    } selection;
+
+    // Owned by the engine, edited and displayed in the debug window when set
+    PostProcessParams*  postProcessParams = nullptr;
+    VolumetricParams*   volumetricParams = nullptr;
+    GPUProfiler*        gpuProfiler = nullptr;
+    GPUScheduler*       gpuScheduler = nullptr;
+
     Editor(GLFWwindow* window, MTL::Device* device);
     ~Editor();
 
-    void beginFrame(MTL::RenderPassDescriptor* passDescriptor);
-    void endFrame(MTL::CommandBuffer* commandBuffer, MTL::RenderCommandEncoder* encoder);
+    // Re-renders the UI into the cached overlay texture only when ImGui received input,
+    // a watched value changed, the size changed or, while a live section is open, the
+    // live refresh interval elapsed. A texture replaced on resize is retired through
+    // resources, frames in flight may still composite it. Returns true if the overlay
+    // was rebuilt this frame.
+    bool renderOverlay(MTL::CommandBuffer* commandBuffer, uint32_t width, uint32_t height, ResourceRegistry& resources);
+    // Display size, mouse and cursor shape from the window. GLFW may only be called on the
+    // main thread, so this runs there after polling events even when the overlay is built
+    // on the render thread.
+    void pollPlatform();
+    MTL::Texture* getOverlayTexture() const { return overlayTexture; }
+
+    // Any change in the bytes of a watched value forces a rebuild on the next frame
+    void watchValue(const void* data, size_t size);
+    void requestRebuild() { forceRebuild = true; }
+
+    // Rebuild rate while idle with the GPU timings or timeline open, so they keep updating
+    float liveRefreshInterval = 0.5f;
+
     void cleanup();
     
 private:
     GLFWwindow* window;
     MTL::Device* device;
 
+    // Cached overlay, premultiplied alpha
+    MTL::Texture*               overlayTexture = nullptr;
+    MTL::RenderPassDescriptor*  overlayPassDescriptor = nullptr;
+
+    struct WatchedValue {
+        const void* data;
+        size_t      size;
+    };
+    std::vector<WatchedValue>   watchedValues;
+    uint64_t                    watchedHash = 0;
+    double                      lastRebuildTime = 0.0;
+    uint32_t                    settleFrames = 0;
+    bool                        forceRebuild = true;
+    bool                        liveContentVisible = false; // Set by the last build
+
+    void createOverlayTexture(uint32_t width, uint32_t height, ResourceRegistry& resources);
+    bool needsRebuild();
+    uint64_t hashWatchedValues() const;
+
+    void beginFrame(MTL::RenderPassDescriptor* passDescriptor);
+    void endFrame(MTL::CommandBuffer* commandBuffer, MTL::RenderCommandEncoder* encoder);
+
     void createDockSpace();
     void debugWindow();
 };
@@ -7,5 +7,5 @@ int main() {
     engine.run();
     engine.cleanup();
 
-    return 0;
+    return engine.getExitCode();
 }